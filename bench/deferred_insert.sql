@@ -0,0 +1,13 @@
+-- The same as insert.sql with deferred constraints, so the establishment can
+-- come before its legal unit and everything is checked at commit
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+SELECT nextval('bench_unit_id');
+INSERT INTO establishment (id, legal_unit_id, valid_from, valid_to, name)
+  SELECT currval('bench_unit_id'), currval('bench_unit_id'), DATE '2000-01-11' + 30 * i,
+         least(DATE '2000-01-11' + 30 * (i + 1), DATE '1999-12-22' + 30 * :slices), 'ES'
+  FROM generate_series(0, :slices - 1) AS i;
+INSERT INTO legal_unit (id, valid_from, valid_to, name)
+  SELECT currval('bench_unit_id'), DATE '2000-01-01' + 30 * i, DATE '2000-01-01' + 30 * (i + 1), 'LU'
+  FROM generate_series(0, :slices - 1) AS i;
+END;
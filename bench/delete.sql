@@ -0,0 +1,8 @@
+-- Delete a unit with everything referencing it, which checks the referencing
+-- side of both foreign keys.  Rolled back so that the data stays the same.
+\set id random(1, :units)
+BEGIN;
+DELETE FROM stat_for_unit WHERE establishment_id = :id;
+DELETE FROM establishment WHERE id = :id;
+DELETE FROM legal_unit WHERE id = :id;
+ROLLBACK;
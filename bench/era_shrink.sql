@@ -0,0 +1,7 @@
+-- Shrink the last slice of a legal unit, which checks that its establishment
+-- is still covered.  Rolled back so that the data stays the same.
+\set id random(1, :units)
+BEGIN;
+UPDATE legal_unit SET valid_to = valid_to - 5
+WHERE id = :id AND valid_to = DATE '2000-01-01' + 30 * :slices;
+ROLLBACK;
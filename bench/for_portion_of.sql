@@ -0,0 +1,12 @@
+-- Update a few days in the middle of a slice of statistics through the
+-- FOR PORTION OF view, which splits the row in three.  Rolled back so that
+-- the data stays the same.
+\set id random(1, :units)
+\set slice random(0, :slices - 1)
+BEGIN;
+UPDATE stat_for_unit__for_portion_of_valid
+SET valid_from = DATE '2000-01-17' + 30 * :slice,
+    valid_to = DATE '2000-01-20' + 30 * :slice,
+    employees = employees + 1
+WHERE establishment_id = :id AND valid_from = DATE '2000-01-16' + 30 * :slice;
+ROLLBACK;
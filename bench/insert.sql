@@ -0,0 +1,12 @@
+-- A new legal unit and its establishment, each with all the slices of a key,
+-- checked at the end of each statement
+BEGIN;
+SELECT nextval('bench_unit_id');
+INSERT INTO legal_unit (id, valid_from, valid_to, name)
+  SELECT currval('bench_unit_id'), DATE '2000-01-01' + 30 * i, DATE '2000-01-01' + 30 * (i + 1), 'LU'
+  FROM generate_series(0, :slices - 1) AS i;
+INSERT INTO establishment (id, legal_unit_id, valid_from, valid_to, name)
+  SELECT currval('bench_unit_id'), currval('bench_unit_id'), DATE '2000-01-11' + 30 * i,
+         least(DATE '2000-01-11' + 30 * (i + 1), DATE '1999-12-22' + 30 * :slices), 'ES'
+  FROM generate_series(0, :slices - 1) AS i;
+END;
@@ -0,0 +1,13 @@
+-- The change of temporal_merge.sql made by hand, closing the last slice of
+-- the legal unit and inserting the renamed one with the constraints
+-- deferred.  They are checked before rolling back, so that the data stays
+-- the same.
+\set id random(1, :units)
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+UPDATE legal_unit SET valid_to = DATE '2000-01-01' + 30 * :slices - 15
+WHERE id = :id AND valid_to = DATE '2000-01-01' + 30 * :slices;
+INSERT INTO legal_unit (id, valid_from, valid_to, name)
+  VALUES (:id, DATE '2000-01-01' + 30 * :slices - 15, DATE '2000-01-01' + 30 * :slices, 'LU renamed');
+SET CONSTRAINTS ALL IMMEDIATE;
+ROLLBACK;
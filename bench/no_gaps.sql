@@ -0,0 +1,13 @@
+-- Check that the legal unit of an establishment covers each of its slices
+\set id random(1, :units)
+SELECT es.valid_from,
+       sql_saga.no_gaps(daterange(lu.valid_from, lu.valid_to),
+                        daterange(es.valid_from, es.valid_to)
+                        ORDER BY lu.valid_from)
+FROM establishment AS es
+JOIN legal_unit AS lu
+  ON lu.id = es.legal_unit_id
+ AND lu.valid_from < es.valid_to
+ AND lu.valid_to > es.valid_from
+WHERE es.id = :id
+GROUP BY es.valid_from, es.valid_to;
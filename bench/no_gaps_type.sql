@@ -0,0 +1,5 @@
+-- no_gaps over as many adjacent ranges as there are units, with the element
+-- type of the run, see no_gaps_types in run.sh.  The variable slice is the
+-- range of step i, and target the range of all n steps.
+SELECT sql_saga.no_gaps(:slice, :target ORDER BY i)
+FROM generate_series(0, :units - 1) AS i, (SELECT :units AS n) AS s;
@@ -0,0 +1,6 @@
+-- The pairs of temporal_join.sql found with a join on overlapping ranges
+SELECT count(*)
+FROM legal_unit AS lu
+JOIN establishment AS es
+  ON es.legal_unit_id = lu.id
+ AND daterange(lu.valid_from, lu.valid_to) && daterange(es.valid_from, es.valid_to);
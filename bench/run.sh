@@ -0,0 +1,189 @@
+#!/bin/sh
+#
+# Load the data of setup.sql at the given scale into a fresh database, run the
+# pgbench scripts of this directory against it, and append a line per run to
+# a CSV file, so that the results of different versions can be compared.
+#
+# The settings come from the environment, see the bench target of the
+# Makefile.  The usual PGHOST, PGPORT and PGUSER select the server.
+
+set -e
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+
+rows=${BENCH_ROWS:-10000}
+slices=${BENCH_SLICES:-10}
+clients=${BENCH_CLIENTS:-4}
+duration=${BENCH_DURATION:-10}
+database=${BENCH_DATABASE:-sql_saga_bench}
+output=${BENCH_OUTPUT:-bench_results.csv}
+tests=${BENCH_TESTS:-"insert deferred_insert era_shrink delete for_portion_of temporal_merge manual_merge no_gaps no_gaps_types temporal_join overlap_join timeline_segments timeline_points concurrent_insert concurrent_mixed same_key_row_locks same_key_key_locks btree_insert btree_concurrent_insert"}
+
+if [ "$slices" -lt 1 ] || [ "$rows" -lt "$slices" ]; then
+	echo "BENCH_ROWS ($rows) must be at least BENCH_SLICES ($slices), which must be positive" >&2
+	exit 1
+fi
+units=$((rows / slices))
+
+logs=$(mktemp -d)
+trap 'rm -rf "$logs"' EXIT
+
+echo "Loading $rows rows per table with $slices slices per key into $database"
+dropdb --if-exists "$database"
+createdb "$database"
+psql -X -q -v ON_ERROR_STOP=1 -v rows="$rows" -v slices="$slices" \
+	-d "$database" -f "$bench_dir/setup.sql" > /dev/null
+
+server_version=$(psql -X -A -t -d "$database" -c 'SHOW server_version_num')
+sql_saga_version=$(git -C "$bench_dir" describe --always --dirty 2>/dev/null || echo unknown)
+started=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+if [ ! -s "$output" ]; then
+	echo "started,server_version,sql_saga_version,test,rows,slices,clients,duration,transactions,tps,latency_avg_ms,latency_p50_ms,latency_p95_ms,latency_p99_ms" > "$output"
+fi
+
+# run NAME CLIENTS SCRIPT...
+run() {
+	name=$1
+	nclients=$2
+	shift 2
+
+	echo "Running $name with $nclients client(s) for $duration s"
+	if ! pgbench -n -T "$duration" -c "$nclients" -j "$nclients" \
+			-D units="$units" -D slices="$slices" \
+			--log --log-prefix="$logs/$name" "$@" "$database" > "$logs/$name.out" 2>&1; then
+		cat "$logs/$name.out" >&2
+		exit 1
+	fi
+
+	# The last tps line excludes the connection time in every version
+	tps=$(sed -n 's/^tps = \([0-9.]*\) .*/\1/p' "$logs/$name.out" | tail -n 1)
+
+	# The third field of the transaction log is the latency in microseconds
+	cat "$logs/$name".[0-9]* | awk '{ print $3 }' | sort -n > "$logs/$name.latencies"
+	latencies=$(awk '
+		{ latency[NR] = $1; sum += $1 }
+		function pct(p) { return latency[int((NR - 1) * p / 100) + 1] / 1000 }
+		END {
+			if (NR == 0)
+				printf "0,,,,"
+			else
+				printf "%d,%.3f,%.3f,%.3f,%.3f", NR, sum / NR / 1000, pct(50), pct(95), pct(99)
+		}' "$logs/$name.latencies")
+
+	first=${latencies%%,*}
+	rest=${latencies#*,}
+	echo "$started,$server_version,$sql_saga_version,$name,$rows,$slices,$nclients,$duration,$first,$tps,$rest" >> "$output"
+}
+
+# lock_mode MODE: give the foreign key of the establishments the lock mode
+lock_mode() {
+	psql -X -q -v ON_ERROR_STOP=1 -d "$database" > /dev/null <<-EOF
+		SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+		SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid',
+		                                create_index => true, lock_mode => '$1');
+	EOF
+}
+
+# enforcement MODE: enforce the unique keys of the legal units and the
+# establishments with MODE, which means adding the foreign keys that
+# reference them again, and show the size of the indexes of the legal units
+# with either mode
+enforcement() {
+	index_size=$(psql -X -A -t -d "$database" -c "SELECT pg_size_pretty(pg_indexes_size('legal_unit'))")
+	psql -X -q -v ON_ERROR_STOP=1 -d "$database" > /dev/null <<-EOF
+		SELECT sql_saga.drop_foreign_key('stat_for_unit', 'stat_for_unit_establishment_id_valid');
+		SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+		SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+		SELECT sql_saga.drop_unique_key('establishment', 'establishment_id_valid');
+		SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid', enforcement => '$1');
+		SELECT sql_saga.add_unique_key('establishment', ARRAY['id'], 'valid', enforcement => '$1');
+		SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid',
+		                                create_index => true);
+		SELECT sql_saga.add_foreign_key('stat_for_unit', ARRAY['establishment_id'], 'valid', 'establishment_id_valid',
+		                                create_index => true);
+	EOF
+	echo "Indexes of legal_unit: $index_size before, $(psql -X -A -t -d "$database" -c "SELECT pg_size_pretty(pg_indexes_size('legal_unit'))") with $1 unique keys"
+}
+
+# Fail if the foreign key no longer holds after a run of same_key_*.sql, then
+# remove its establishments so that the next run starts from the same data
+same_key_done() {
+	psql -X -q -v ON_ERROR_STOP=1 -d "$database" > /dev/null <<-EOF
+		SELECT sql_saga.validate_foreign_key('establishment_legal_unit_id_valid');
+		DELETE FROM establishment WHERE legal_unit_id <= 4 AND id > $units;
+	EOF
+}
+
+# no_gaps_type TYPE: run no_gaps_type.sql over ranges of the element type,
+# each a step long
+no_gaps_type() {
+	case $1 in
+		int4|int8)
+			range=$1range zero=0 step=1
+			;;
+		numeric)
+			range=numrange zero=0 step=1
+			;;
+		date)
+			range=daterange zero="DATE '2000-01-01'" step=1
+			;;
+		timestamp)
+			range=tsrange zero="TIMESTAMP 'epoch'" step="INTERVAL '1 hour'"
+			;;
+		timestamptz)
+			range=tstzrange zero="TIMESTAMPTZ 'epoch'" step="INTERVAL '1 hour'"
+			;;
+	esac
+	run "no_gaps_$1" 1 \
+		-D slice="$range($zero + i * $step, $zero + (i + 1) * $step)" \
+		-D target="$range($zero, $zero + n * $step)" \
+		-f "$bench_dir/no_gaps_type.sql"
+}
+
+for test in $tests; do
+	case $test in
+		concurrent_insert)
+			run "$test" "$clients" -f "$bench_dir/insert.sql"
+			;;
+		concurrent_mixed)
+			run "$test" "$clients" \
+				-f "$bench_dir/insert.sql@4" \
+				-f "$bench_dir/deferred_insert.sql@2" \
+				-f "$bench_dir/for_portion_of.sql@2" \
+				-f "$bench_dir/era_shrink.sql@1" \
+				-f "$bench_dir/no_gaps.sql@1"
+			;;
+		same_key_row_locks|same_key_key_locks)
+			if [ "$test" = same_key_key_locks ]; then
+				lock_mode KEY
+			fi
+			run "$test" "$clients" \
+				-f "$bench_dir/same_key_insert.sql@9" \
+				-f "$bench_dir/same_key_shrink.sql@1"
+			same_key_done
+			if [ "$test" = same_key_key_locks ]; then
+				lock_mode ROW
+			fi
+			;;
+		btree_insert|btree_concurrent_insert)
+			enforcement BTREE
+			if [ "$test" = btree_insert ]; then
+				run "$test" 1 -f "$bench_dir/insert.sql"
+			else
+				run "$test" "$clients" -f "$bench_dir/insert.sql"
+			fi
+			enforcement GIST
+			;;
+		no_gaps_types)
+			for type in int4 int8 date timestamp timestamptz numeric; do
+				no_gaps_type "$type"
+			done
+			;;
+		*)
+			run "$test" 1 -f "$bench_dir/$test.sql"
+			;;
+	esac
+done
+
+echo "Results appended to $output"
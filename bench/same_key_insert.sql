@@ -0,0 +1,10 @@
+-- A new establishment of one of the first legal units, so that concurrent
+-- clients keep referencing the same few keys
+\set id random(1, 4)
+BEGIN;
+SELECT nextval('bench_unit_id');
+INSERT INTO establishment (id, legal_unit_id, valid_from, valid_to, name)
+  SELECT currval('bench_unit_id'), :id, DATE '2000-01-11' + 30 * i,
+         least(DATE '2000-01-11' + 30 * (i + 1), DATE '1999-12-22' + 30 * :slices), 'ES'
+  FROM generate_series(0, :slices - 1) AS i;
+END;
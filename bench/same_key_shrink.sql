@@ -0,0 +1,8 @@
+-- Shrink the last slice of one of the legal units of same_key_insert.sql,
+-- which checks all their establishments while they are being inserted.
+-- Rolled back so that the data stays the same.
+\set id random(1, 4)
+BEGIN;
+UPDATE legal_unit SET valid_to = valid_to - 5
+WHERE id = :id AND valid_to = DATE '2000-01-01' + 30 * :slices;
+ROLLBACK;
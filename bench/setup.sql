@@ -0,0 +1,60 @@
+-- The data for the pgbench scripts of this directory.  The psql variables
+-- rows and slices give the number of rows of each table and of slices per
+-- key, so there are rows / slices legal units with one establishment each.
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  legal_unit_id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE stat_for_unit (
+  row_id bigserial PRIMARY KEY,
+  establishment_id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  employees integer NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('stat_for_unit', 'valid_from', 'valid_to');
+
+-- The slices of each table are shifted against each other, so that every
+-- period is covered by two rows of the table it references.  The
+-- establishments end 10 days before their legal unit, which leaves room to
+-- shrink its last slice.  Each slice of a legal unit has a name of its own,
+-- so that temporal_merge.sql finds no neighbours to coalesce.
+INSERT INTO legal_unit
+  SELECT g, DATE '2000-01-01' + 30 * i, DATE '2000-01-01' + 30 * (i + 1), 'LU ' || g || '/' || i
+  FROM generate_series(1, :rows / :slices) AS g, generate_series(0, :slices - 1) AS i;
+INSERT INTO establishment
+  SELECT g, g, DATE '2000-01-11' + 30 * i,
+         least(DATE '2000-01-11' + 30 * (i + 1), DATE '1999-12-22' + 30 * :slices), 'ES ' || g
+  FROM generate_series(1, :rows / :slices) AS g, generate_series(0, :slices - 1) AS i;
+INSERT INTO stat_for_unit (establishment_id, valid_from, valid_to, employees)
+  SELECT g, DATE '2000-01-16' + 30 * i,
+         least(DATE '2000-01-16' + 30 * (i + 1), DATE '1999-12-22' + 30 * :slices), i
+  FROM generate_series(1, :rows / :slices) AS g, generate_series(0, :slices - 1) AS i;
+
+-- The constraints validate the loaded rows with a single query each
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+SELECT sql_saga.add_unique_key('establishment', ARRAY['id'], 'valid');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid',
+                                create_index => true);
+SELECT sql_saga.add_foreign_key('stat_for_unit', ARRAY['establishment_id'], 'valid', 'establishment_id_valid',
+                                create_index => true);
+SELECT sql_saga.add_api('stat_for_unit');
+
+-- The ids of the units inserted by the scripts
+CREATE SEQUENCE bench_unit_id;
+SELECT setval('bench_unit_id', :rows / :slices);
+
+ANALYZE;
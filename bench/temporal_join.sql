@@ -0,0 +1,5 @@
+-- Align every establishment with its legal unit with temporal_join, which
+-- merges both tables in key and start order
+SELECT count(*)
+FROM sql_saga.temporal_join('legal_unit', ARRAY['id'], 'valid', 'establishment', ARRAY['legal_unit_id'], 'valid')
+  AS j (valid_from date, valid_to date, legal_unit legal_unit, establishment establishment);
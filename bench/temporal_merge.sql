@@ -0,0 +1,10 @@
+-- Rename a legal unit for the second half of its last slice with
+-- temporal_merge, which splits the slice and checks that its establishment
+-- is still covered.  Rolled back so that the data stays the same.
+\set id random(1, :units)
+BEGIN;
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], format($$
+  SELECT %s AS id, DATE '2000-01-01' + 30 * %s - 15 AS valid_from,
+         DATE '2000-01-01' + 30 * %s AS valid_to, 'LU renamed' AS name
+$$, :id, :slices, :slices));
+ROLLBACK;
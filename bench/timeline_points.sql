@@ -0,0 +1,16 @@
+-- The segments of timeline_segments.sql from the union of all the starts and
+-- ends of a unit, each paired with the next one
+WITH
+points AS (
+  SELECT id AS legal_unit_id, valid_from AS point FROM legal_unit
+  UNION SELECT id, valid_to FROM legal_unit
+  UNION SELECT legal_unit_id, valid_from FROM establishment
+  UNION SELECT legal_unit_id, valid_to FROM establishment
+  UNION SELECT establishment_id, valid_from FROM stat_for_unit
+  UNION SELECT establishment_id, valid_to FROM stat_for_unit
+),
+windowed AS (
+  SELECT legal_unit_id, point AS valid_from, lead(point) OVER (PARTITION BY legal_unit_id ORDER BY point) AS valid_to
+  FROM points
+)
+SELECT count(*) FROM windowed WHERE valid_to IS NOT NULL;
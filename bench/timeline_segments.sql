@@ -0,0 +1,9 @@
+-- Cut the timeline of every legal unit wherever a row of it, its
+-- establishment or the statistics of that start or end.  An establishment
+-- has the id of its legal unit in the bench data, so the statistics are
+-- keyed by it.
+SELECT count(*)
+FROM sql_saga.timeline_segments(ARRAY['legal_unit', 'establishment', 'stat_for_unit']::regclass[],
+                                ARRAY['id', 'legal_unit_id', 'establishment_id'],
+                                ARRAY['valid', 'valid', 'valid'])
+  AS s (legal_unit_id integer, valid_from date, valid_to date);
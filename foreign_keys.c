@@ -0,0 +1,2251 @@
+/**
+ * foreign_keys.c -
+ * Native implementations of the triggers enforcing temporal foreign keys.
+ *
+ * The PL/pgSQL versions of these triggers serialized every row to jsonb,
+ * looked up the foreign key in our catalogs and planned a fresh query for
+ * each row event.  Here we read the key columns straight from the heap tuple,
+ * keep the catalog lookup in a per-backend cache keyed by the foreign key
+ * name, built on the era and unique key caches of metadata.c, and run a
+ * prepared plan that is kept for the life of the backend.
+ *
+ * The referenced side reads the timeline of the key in the referenced table
+ * once, merges it into the intervals it covers, and sweeps the referencing
+ * rows of the key against them in start order.
+ *
+ * Both sides remember which keys they have already checked so that a key is
+ * only checked once however many row events there are for it.
+ *
+ * The referencing side normally takes FOR KEY SHARE on every referenced row
+ * it relies on.  A foreign key with the KEY lock mode takes one advisory lock
+ * on the referenced key instead, shared by the referencing side and exclusive
+ * on the referenced side, so that concurrent loaders referencing the same
+ * key do not pile up multixacts on its rows.
+ *
+ * The triggers of a partitioned table fire on its partitions, whose columns
+ * need not be in the same place as in the parent, so the key columns are
+ * then found by name.  The unique keys of partitioned tables also have a
+ * trigger of their own here, since their EXCLUDE constraints can only be put
+ * on each partition.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "access/htup_details.h"
+#if (PG_VERSION_NUM >= 120000)
+#include "access/tableam.h"
+#endif
+#include "access/xact.h"
+#include "miscadmin.h"
+#if (PG_VERSION_NUM < 130000)
+#include "access/hash.h"
+#else
+#include "common/hashfn.h"
+#endif
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "nodes/parsenodes.h"
+#include "storage/bufmgr.h"
+#include "storage/lock.h"
+#include "tcop/utility.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/elog.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/jsonb.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+#include "utils/typcache.h"
+#if (PG_VERSION_NUM < 120000)
+#include "utils/tqual.h"
+#endif
+
+#include "foreign_keys.h"
+#include "metadata.h"
+#include "stats.h"
+
+PGDLLEXPORT Datum fk_insert_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum fk_update_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum uk_update_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum uk_delete_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum uk_overlap_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum foreign_key_checks_skipped(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum validate_foreign_key_old_row(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(fk_insert_check);
+PG_FUNCTION_INFO_V1(fk_update_check);
+PG_FUNCTION_INFO_V1(uk_update_check);
+PG_FUNCTION_INFO_V1(uk_delete_check);
+PG_FUNCTION_INFO_V1(uk_overlap_check);
+PG_FUNCTION_INFO_V1(foreign_key_checks_skipped);
+PG_FUNCTION_INFO_V1(validate_foreign_key_old_row);
+
+/*
+ * How the referencing side of a foreign key is checked.
+ *
+ * In row mode every row event checks its key right away, which is what a
+ * deferred constraint trigger does at commit time too.  In batch mode the row
+ * events only queue their key, and the queued keys are checked with a single
+ * set-based query per foreign key at the end of the statement, after SET
+ * CONSTRAINTS, or just before commit, whichever comes first once the
+ * triggers have fired.
+ */
+typedef enum ForeignKeyCheckMode
+{
+	FK_CHECK_MODE_ROW,
+	FK_CHECK_MODE_BATCH
+} ForeignKeyCheckMode;
+
+static const struct config_enum_entry fk_check_mode_options[] = {
+	{"row", FK_CHECK_MODE_ROW, false},
+	{"batch", FK_CHECK_MODE_BATCH, false},
+	{NULL, 0, false}
+};
+
+static int	fk_check_mode = FK_CHECK_MODE_ROW;
+
+/*
+ * The advisory locks of the KEY lock mode, and those serializing the overlap
+ * checks of a unique key, are told apart from those taken by
+ * pg_advisory_lock(), which use 1 and 2, by the last field of their tag.
+ */
+#define FK_KEY_LOCK_SPACE	3
+#define UK_KEY_LOCK_SPACE	4
+
+/*
+ * Everything we need to know about a foreign key to check it.  The entries
+ * are looked up by name, which is what the triggers get as their argument.
+ */
+typedef struct ForeignKeyCacheEntry
+{
+	NameData	key_name;		/* the hash key; must be first */
+	bool		valid;			/* false if the entry must be reloaded */
+	Oid			fk_relid;
+	Oid			uk_relid;
+	char		match_type;		/* FKCONSTR_MATCH_xxx */
+	int			nkeys;
+	AttrNumber	fk_attnums[INDEX_MAX_KEYS];
+	NameData	fk_attnames[INDEX_MAX_KEYS];
+	Oid			fk_atttypes[INDEX_MAX_KEYS];
+	Oid			fk_arraytypes[INDEX_MAX_KEYS];
+	int16		fk_typlen[INDEX_MAX_KEYS];
+	bool		fk_typbyval[INDEX_MAX_KEYS];
+	char		fk_typalign[INDEX_MAX_KEYS];
+	AttrNumber	uk_attnums[INDEX_MAX_KEYS];
+	NameData	uk_attnames[INDEX_MAX_KEYS];
+	Oid			uk_atttypes[INDEX_MAX_KEYS];
+	int16		uk_typlen[INDEX_MAX_KEYS];
+	bool		uk_typbyval[INDEX_MAX_KEYS];
+	FmgrInfo	era_cmp;		/* btree comparator of the era bounds */
+	Oid			era_collation;
+	bool		lock_keys;		/* the KEY lock mode, rather than ROW */
+	FmgrInfo	key_hash[INDEX_MAX_KEYS];	/* hash the key for its lock */
+	Oid			key_collations[INDEX_MAX_KEYS];
+	SPIPlanPtr	qplan;			/* checks the rows having the given key */
+	SPIPlanPtr	batch_qplan;	/* finds a violated key in arrays of keys */
+	SPIPlanPtr	uk_timeline_qplan;	/* the referenced periods of a key */
+	SPIPlanPtr	fk_timeline_qplan;	/* the referencing periods of a key */
+} ForeignKeyCacheEntry;
+
+static HTAB *ForeignKeyCacheHash = NULL;
+
+/*
+ * What uk_overlap_check() needs to know about a unique key on a partitioned
+ * table or enforced with a btree.  The key columns come first in attnames,
+ * then the era bounds.
+ */
+typedef struct OverlapCheckCacheEntry
+{
+	NameData	key_name;		/* the hash key; must be first */
+	bool		valid;			/* false if the entry must be reloaded */
+	Oid			relid;
+	int			ncols;
+	NameData	attnames[INDEX_MAX_KEYS + 2];
+	bool		btree;			/* the BTREE enforcement, rather than GIST */
+	int			nlockkeys;		/* the key columns hashed for its lock */
+	FmgrInfo	key_hash[INDEX_MAX_KEYS];	/* hash the key for its lock */
+	Oid			key_collations[INDEX_MAX_KEYS];
+	SPIPlanPtr	qplan;			/* counts the rows overlapping a period */
+} OverlapCheckCacheEntry;
+
+static HTAB *OverlapCheckCacheHash = NULL;
+
+/*
+ * The keys queued in batch mode, per foreign key.  The values are kept one
+ * array per key column so that they can be passed to unnest() as they are.
+ * Everything lives in PendingChecksContext, along with the set of the keys
+ * that are queued.
+ */
+typedef struct PendingForeignKeyChecks
+{
+	NameData	key_name;		/* the hash key; must be first */
+	int			nkeys;
+	Oid			atttypes[INDEX_MAX_KEYS];
+	int			nrows;
+	int			maxrows;
+	Datum	   *values[INDEX_MAX_KEYS];
+} PendingForeignKeyChecks;
+
+static MemoryContext PendingChecksContext = NULL;
+static HTAB *PendingForeignKeyChecksHash = NULL;
+static HTAB *PendingKeys = NULL;
+static bool flushing_pending_checks = false;
+
+/*
+ * A key, as found in the sets of keys that are already checked or queued.  It
+ * is the name of the foreign key, the side of it the row event was for, and
+ * the binary images of the key values.  Two equal images are always equal
+ * values, which is all we need to skip a check safely.
+ */
+typedef struct ForeignKeyCheckKey
+{
+	uint32		len;
+	char	   *data;
+} ForeignKeyCheckKey;
+
+#define FK_SIDE_REFERENCING	'f'
+#define FK_SIDE_REFERENCED	'u'
+
+/*
+ * The keys that have been checked since the data last changed.  Any
+ * statement that may modify data, and the abort of a subtransaction, forget
+ * them all.
+ */
+static MemoryContext VerifiedChecksContext = NULL;
+static HTAB *VerifiedKeys = NULL;
+
+/* How many row events did not need a check of their own */
+static int64 skipped_checks = 0;
+
+/*
+ * How many executor or utility statements are firing their immediate
+ * triggers.  Deferred triggers fire outside of them, at commit time or from
+ * SET CONSTRAINTS, so a check made while this is zero is a deferred one.
+ */
+static int	immediate_trigger_depth = 0;
+
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+static ProcessUtility_hook_type prev_ProcessUtility = NULL;
+
+/*
+ * Any relcache invalidation on either side of a foreign key could mean that a
+ * column was renamed or that the triggers were dropped and recreated for a
+ * different definition, so just reload the entry the next time it is used.
+ * The same goes for the table of a unique key checked for overlaps.
+ * The plans themselves are released then, since we may not free memory here.
+ * We hear about the invalidations through the metadata cache.
+ */
+static void
+InvalidateForeignKeyCacheCallback(Oid relid)
+{
+	HASH_SEQ_STATUS		status;
+	ForeignKeyCacheEntry *entry;
+	OverlapCheckCacheEntry *overlap_entry;
+
+	if (ForeignKeyCacheHash == NULL)
+		return;
+
+	hash_seq_init(&status, ForeignKeyCacheHash);
+	while ((entry = (ForeignKeyCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (relid == InvalidOid ||
+			entry->fk_relid == relid ||
+			entry->uk_relid == relid)
+			entry->valid = false;
+	}
+
+	hash_seq_init(&status, OverlapCheckCacheHash);
+	while ((overlap_entry = (OverlapCheckCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (relid == InvalidOid || overlap_entry->relid == relid)
+			overlap_entry->valid = false;
+	}
+}
+
+static void
+InitForeignKeyCache(void)
+{
+	HASHCTL	ctl;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = NAMEDATALEN;
+	ctl.entrysize = sizeof(ForeignKeyCacheEntry);
+
+	ForeignKeyCacheHash = hash_create("sql_saga foreign key cache", 64, &ctl,
+									  HASH_ELEM | HASH_BLOBS);
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = NAMEDATALEN;
+	ctl.entrysize = sizeof(OverlapCheckCacheEntry);
+
+	OverlapCheckCacheHash = hash_create("sql_saga overlap check cache", 16, &ctl,
+										HASH_ELEM | HASH_BLOBS);
+}
+
+/*
+ * Find the hash function and the collation of a key column, to lock the key
+ * by its values.  Returns false if the type cannot be hashed.
+ */
+static bool
+LookupKeyHash(Oid relid, AttrNumber attnum, FmgrInfo *key_hash, Oid *key_collation)
+{
+	TypeCacheEntry *typentry;
+	Oid				typid;
+	int32			typmod;
+
+	get_atttypetypmodcoll(relid, attnum, &typid, &typmod, key_collation);
+
+	typentry = lookup_type_cache(typid, TYPECACHE_HASH_PROC_FINFO);
+	if (!OidIsValid(typentry->hash_proc))
+		return false;
+
+	fmgr_info_copy(key_hash, &typentry->hash_proc_finfo, TopMemoryContext);
+
+	return true;
+}
+
+/*
+ * Append the condition that is true when the referencing row "fk" is not
+ * covered by the referenced table.  This is the same test that
+ * validate_foreign_key_new_row() makes, except that the key columns are
+ * compared with plain equality so that indexes on the unique side can be
+ * used.
+ *
+ * From PostgreSQL 14 on, the referenced periods are aggregated into one
+ * multirange that must contain the referencing period.  Before that, the
+ * periods must reach both ends and each must start where the previous ended.
+ *
+ * The referenced rows are locked FOR KEY SHARE unless the key itself is
+ * locked instead.
+ */
+static void
+AppendNotCoveredCondition(StringInfo buf, int ncols,
+						  char **fk_column_names, char **uk_column_names,
+						  const char *uk_table, const char *range_type,
+						  const char *uk_start, const char *uk_end,
+						  const char *fk_start, const char *fk_end,
+						  bool lock_rows)
+{
+	const char *lock_clause = lock_rows ? "FOR KEY SHARE" : "";
+	int		i;
+
+#if (PG_VERSION_NUM >= 140000)
+	appendStringInfo(buf,
+		"NOT EXISTS ( "
+		"    SELECT FROM (SELECT uk.%1$s AS uk_start_value, "
+		"                        uk.%2$s AS uk_end_value "
+		"                 FROM %3$s AS uk "
+		"                 WHERE uk.%1$s <= fk.%5$s "
+		"                   AND uk.%2$s >= fk.%4$s ",
+		uk_start, uk_end, uk_table, fk_start, fk_end);
+	for (i = 0; i < ncols; i++)
+		appendStringInfo(buf, "AND uk.%s = fk.%s ",
+						 quote_identifier(uk_column_names[i]),
+						 quote_identifier(fk_column_names[i]));
+	appendStringInfo(buf,
+		"                 %4$s "
+		"                ) AS uk "
+		"    HAVING range_agg(%1$s(uk.uk_start_value, uk.uk_end_value)) @> %1$s(fk.%2$s, fk.%3$s) "
+		") ",
+		range_type, fk_start, fk_end, lock_clause);
+#else
+	appendStringInfo(buf,
+		"NOT EXISTS ( "
+		"    SELECT FROM (SELECT uk.uk_start_value, "
+		"                        uk.uk_end_value, "
+		"                        nullif(lag(uk.uk_end_value) OVER (ORDER BY uk.uk_start_value), uk.uk_start_value) AS x "
+		"                 FROM (SELECT uk.%1$s AS uk_start_value, "
+		"                              uk.%2$s AS uk_end_value "
+		"                       FROM %3$s AS uk "
+		"                       WHERE uk.%1$s <= fk.%5$s "
+		"                         AND uk.%2$s >= fk.%4$s ",
+		uk_start, uk_end, uk_table, fk_start, fk_end);
+	for (i = 0; i < ncols; i++)
+		appendStringInfo(buf, "AND uk.%s = fk.%s ",
+						 quote_identifier(uk_column_names[i]),
+						 quote_identifier(fk_column_names[i]));
+	appendStringInfo(buf,
+		"                       %3$s "
+		"                      ) AS uk "
+		"                ) AS uk "
+		"    WHERE uk.uk_start_value < fk.%2$s "
+		"      AND uk.uk_end_value >= fk.%1$s "
+		"    HAVING min(uk.uk_start_value) <= fk.%1$s "
+		"       AND max(uk.uk_end_value) >= fk.%2$s "
+		"       AND array_agg(uk.x) FILTER (WHERE uk.x IS NOT NULL) IS NULL "
+		") ",
+		fk_start, fk_end, lock_clause);
+#endif
+}
+
+/*
+ * Fill in a cache entry from our catalogs and prepare the queries checking the
+ * referencing rows for a given key, or for a batch of keys.  Must be called
+ * while connected to SPI.  Returns false if the foreign key does not exist.
+ */
+static bool
+LoadForeignKey(ForeignKeyCacheEntry *entry)
+{
+	int				ret;
+	int				i;
+	Datum			values[1];
+	HeapTuple		tuple;
+	TupleDesc		tupdesc;
+	bool			is_null;
+	bool			batchable = true;
+	Oid				era_type;
+	char		   *match_type;
+	char		   *lock_mode;
+	char		  **fk_column_names;
+	char		  **uk_column_names;
+	int				fk_ncols;
+	char		   *fk_era_name;
+	char		   *unique_key_name;
+	SagaUniqueKey  *uk;
+	SagaEra		   *fk_era;
+	SagaEra		   *uk_era;
+	const char	   *fk_table, *uk_table;
+	const char	   *range_type;
+	const char	   *uk_start, *uk_end;
+	const char	   *fk_start, *fk_end;
+	StringInfoData	buf;
+
+	const char *sql =
+		"SELECT fk.table_name, fk.match_type::text, fk.column_names, "
+		"       fk.era_name, fk.unique_key, fk.lock_mode::text "
+		"FROM sql_saga.foreign_keys AS fk "
+		"WHERE fk.key_name = $1";
+	static SPIPlanPtr qplan = NULL;
+
+	/* Forget the old plans, if any */
+	if (entry->qplan != NULL)
+	{
+		SPI_freeplan(entry->qplan);
+		entry->qplan = NULL;
+	}
+	if (entry->batch_qplan != NULL)
+	{
+		SPI_freeplan(entry->batch_qplan);
+		entry->batch_qplan = NULL;
+	}
+	if (entry->uk_timeline_qplan != NULL)
+	{
+		SPI_freeplan(entry->uk_timeline_qplan);
+		entry->uk_timeline_qplan = NULL;
+	}
+	if (entry->fk_timeline_qplan != NULL)
+	{
+		SPI_freeplan(entry->fk_timeline_qplan);
+		entry->fk_timeline_qplan = NULL;
+	}
+
+	if (qplan == NULL)
+	{
+		Oid	types[1] = {NAMEOID};
+
+		qplan = PrepareKeptPlan(sql, 1, types);
+	}
+
+	values[0] = NameGetDatum(&entry->key_name);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_processed == 0)
+		return false;
+
+	/* key_name is the primary key so there can only be one */
+	Assert(SPI_processed == 1);
+
+	tuple = SPI_tuptable->vals[0];
+	tupdesc = SPI_tuptable->tupdesc;
+
+	entry->fk_relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &is_null));
+
+	match_type = SPI_getvalue(tuple, tupdesc, 2);
+	if (strcmp(match_type, "FULL") == 0)
+		entry->match_type = FKCONSTR_MATCH_FULL;
+	else if (strcmp(match_type, "PARTIAL") == 0)
+		entry->match_type = FKCONSTR_MATCH_PARTIAL;
+	else
+		entry->match_type = FKCONSTR_MATCH_SIMPLE;
+
+	fk_ncols = GetNameArray(SPI_getbinval(tuple, tupdesc, 3, &is_null), &fk_column_names);
+	fk_era_name = SPI_getvalue(tuple, tupdesc, 4);
+	unique_key_name = SPI_getvalue(tuple, tupdesc, 5);
+	lock_mode = SPI_getvalue(tuple, tupdesc, 6);
+	entry->lock_keys = (strcmp(lock_mode, "KEY") == 0);
+
+	/*
+	 * The rest comes from the metadata cache, which queries the catalogs
+	 * through SPI on its own, so we must be done with our tuple by now.
+	 */
+	uk = GetSagaUniqueKey(unique_key_name, false);
+	fk_era = GetSagaEra(entry->fk_relid, fk_era_name, false);
+	uk_era = GetSagaEra(uk->relid, NameStr(uk->era_name), false);
+
+	entry->uk_relid = uk->relid;
+
+	if (fk_ncols != uk->ncols || fk_ncols > INDEX_MAX_KEYS)
+		elog(ERROR, "foreign key \"%s\" has an invalid number of columns",
+			 NameStr(entry->key_name));
+
+	uk_column_names = (char **) palloc(uk->ncols * sizeof(char *));
+
+	entry->nkeys = fk_ncols;
+	for (i = 0; i < fk_ncols; i++)
+	{
+		AttrNumber	attnum = get_attnum(entry->fk_relid, fk_column_names[i]);
+
+		if (attnum == InvalidAttrNumber)
+			elog(ERROR, "column \"%s\" of relation \"%s\" does not exist",
+				 fk_column_names[i], get_rel_name(entry->fk_relid));
+
+		entry->fk_attnums[i] = attnum;
+		namestrcpy(&entry->fk_attnames[i], fk_column_names[i]);
+		entry->fk_atttypes[i] = get_atttype(entry->fk_relid, attnum);
+		entry->fk_arraytypes[i] = get_array_type(entry->fk_atttypes[i]);
+		get_typlenbyvalalign(entry->fk_atttypes[i],
+							 &entry->fk_typlen[i],
+							 &entry->fk_typbyval[i],
+							 &entry->fk_typalign[i]);
+
+		if (!OidIsValid(entry->fk_arraytypes[i]))
+			batchable = false;
+
+		uk_column_names[i] = pstrdup(NameStr(uk->column_names[i]));
+		entry->uk_attnums[i] = uk->attnums[i];
+		namestrcpy(&entry->uk_attnames[i], uk_column_names[i]);
+		entry->uk_atttypes[i] = uk->atttypes[i];
+		get_typlenbyval(entry->uk_atttypes[i],
+						&entry->uk_typlen[i],
+						&entry->uk_typbyval[i]);
+
+		/*
+		 * add_foreign_key() makes sure that both sides have the same type and
+		 * collation, so they hash the same.
+		 */
+		if (entry->lock_keys &&
+			!LookupKeyHash(entry->fk_relid, attnum,
+						   &entry->key_hash[i], &entry->key_collations[i]))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify a hash function for type %s",
+							format_type_be(entry->fk_atttypes[i])),
+					 errhint("Foreign key \"%s\" needs a hashable key for the KEY lock mode.",
+							 NameStr(entry->key_name))));
+	}
+
+	/* Both timelines are compared in the type of the referenced era */
+	era_type = uk_era->bounds_type;
+	fmgr_info_copy(&entry->era_cmp, &uk_era->bounds_cmp, TopMemoryContext);
+	entry->era_collation = uk_era->bounds_collation;
+
+	fk_table = quote_qualified_identifier(
+			get_namespace_name(get_rel_namespace(entry->fk_relid)),
+			get_rel_name(entry->fk_relid));
+	uk_table = quote_qualified_identifier(
+			get_namespace_name(get_rel_namespace(entry->uk_relid)),
+			get_rel_name(entry->uk_relid));
+	range_type = format_type_be_qualified(uk_era->range_type);
+	uk_start = quote_identifier(pstrdup(NameStr(uk_era->start_name)));
+	uk_end = quote_identifier(pstrdup(NameStr(uk_era->end_name)));
+	fk_start = quote_identifier(pstrdup(NameStr(fk_era->start_name)));
+	fk_end = quote_identifier(pstrdup(NameStr(fk_era->end_name)));
+
+	/* Is any row with the given key not covered? */
+	initStringInfo(&buf);
+	appendStringInfo(&buf, "SELECT EXISTS ( SELECT FROM %s AS fk WHERE ", fk_table);
+	for (i = 0; i < fk_ncols; i++)
+		appendStringInfo(&buf, "fk.%s = $%d AND ",
+						 quote_identifier(fk_column_names[i]), i + 1);
+	AppendNotCoveredCondition(&buf, fk_ncols, fk_column_names, uk_column_names,
+							  uk_table, range_type, uk_start, uk_end, fk_start, fk_end,
+							  !entry->lock_keys);
+	appendStringInfoString(&buf, ")");
+
+	entry->qplan = PrepareKeptPlan(buf.data, entry->nkeys, entry->fk_atttypes);
+
+	/*
+	 * Which of the given keys has a row that is not covered?  The keys come in
+	 * as one array per column.
+	 */
+	if (batchable)
+	{
+		resetStringInfo(&buf);
+		appendStringInfoString(&buf, "SELECT k.* FROM (SELECT DISTINCT * FROM unnest(");
+		for (i = 0; i < fk_ncols; i++)
+			appendStringInfo(&buf, "%s$%d", (i > 0 ? ", " : ""), i + 1);
+		appendStringInfoString(&buf, ") AS k (");
+		for (i = 0; i < fk_ncols; i++)
+			appendStringInfo(&buf, "%sk%d", (i > 0 ? ", " : ""), i + 1);
+		appendStringInfo(&buf, ")) AS k WHERE EXISTS ( SELECT FROM %s AS fk WHERE ", fk_table);
+		for (i = 0; i < fk_ncols; i++)
+			appendStringInfo(&buf, "fk.%s = k.k%d AND ",
+							 quote_identifier(fk_column_names[i]), i + 1);
+		AppendNotCoveredCondition(&buf, fk_ncols, fk_column_names, uk_column_names,
+								  uk_table, range_type, uk_start, uk_end, fk_start, fk_end,
+								  !entry->lock_keys);
+		appendStringInfoString(&buf, ") LIMIT 1");
+
+		entry->batch_qplan = PrepareKeptPlan(buf.data, entry->nkeys, entry->fk_arraytypes);
+	}
+
+	/* The periods of a key on either side, in start order */
+	resetStringInfo(&buf);
+	appendStringInfo(&buf, "SELECT uk.%s, uk.%s FROM %s AS uk WHERE ",
+					 uk_start, uk_end, uk_table);
+	for (i = 0; i < fk_ncols; i++)
+		appendStringInfo(&buf, "%suk.%s = $%d", (i > 0 ? " AND " : ""),
+						 quote_identifier(uk_column_names[i]), i + 1);
+	appendStringInfo(&buf, " ORDER BY uk.%s", uk_start);
+
+	entry->uk_timeline_qplan = PrepareKeptPlan(buf.data, entry->nkeys, entry->uk_atttypes);
+
+	resetStringInfo(&buf);
+	appendStringInfo(&buf, "SELECT CAST(fk.%s AS %s), CAST(fk.%s AS %s) FROM %s AS fk WHERE ",
+					 fk_start, format_type_be_qualified(era_type),
+					 fk_end, format_type_be_qualified(era_type),
+					 fk_table);
+	for (i = 0; i < fk_ncols; i++)
+		appendStringInfo(&buf, "%sfk.%s = $%d", (i > 0 ? " AND " : ""),
+						 quote_identifier(fk_column_names[i]), i + 1);
+	appendStringInfoString(&buf, " ORDER BY 1");
+
+	entry->fk_timeline_qplan = PrepareKeptPlan(buf.data, entry->nkeys, entry->uk_atttypes);
+
+	entry->valid = true;
+
+	return true;
+}
+
+/*
+ * Find the cache entry for the named foreign key, (re)loading it if needed.
+ * Must be called while connected to SPI.
+ */
+static ForeignKeyCacheEntry *
+LookupForeignKey(const char *key_name, bool missing_ok)
+{
+	NameData				key;
+	ForeignKeyCacheEntry   *entry;
+	bool					found;
+
+	/* The key is hashed as a blob, so it must be zero-padded */
+	MemSet(&key, 0, sizeof(key));
+	strlcpy(NameStr(key), key_name, NAMEDATALEN);
+
+	entry = (ForeignKeyCacheEntry *) hash_search(ForeignKeyCacheHash,
+												 &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->valid = false;
+		entry->fk_relid = InvalidOid;
+		entry->uk_relid = InvalidOid;
+		entry->qplan = NULL;
+		entry->batch_qplan = NULL;
+		entry->uk_timeline_qplan = NULL;
+		entry->fk_timeline_qplan = NULL;
+	}
+
+	if (!entry->valid && !LoadForeignKey(entry))
+	{
+		if (missing_ok)
+			return NULL;
+
+		ereport(ERROR,
+				(errcode(ERRCODE_RAISE_EXCEPTION),
+				 errmsg("foreign key \"%s\" not found", key_name)));
+	}
+
+	return entry;
+}
+
+/*
+ * Use the same SQLSTATE as the RAISE EXCEPTION in the PL/pgSQL version so
+ * that callers trapping it keep working.
+ */
+static void
+ReportForeignKeyViolation(ForeignKeyCacheEntry *entry, const char *detail)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_RAISE_EXCEPTION),
+			 errmsg("insert or update on table \"%s\" violates foreign key constraint \"%s\"",
+					DatumGetCString(DirectFunctionCall1(regclassout,
+							ObjectIdGetDatum(entry->fk_relid))),
+					NameStr(entry->key_name)),
+			 detail ? errdetail_internal("%s", detail) : 0));
+}
+
+static void
+ReportForeignKeyOldRowViolation(ForeignKeyCacheEntry *entry)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_RAISE_EXCEPTION),
+			 errmsg("update or delete on table \"%s\" violates foreign key constraint \"%s\" on table \"%s\"",
+					DatumGetCString(DirectFunctionCall1(regclassout,
+							ObjectIdGetDatum(entry->uk_relid))),
+					NameStr(entry->key_name),
+					DatumGetCString(DirectFunctionCall1(regclassout,
+							ObjectIdGetDatum(entry->fk_relid))))));
+}
+
+static inline int
+CompareEraBounds(ForeignKeyCacheEntry *entry, Datum a, Datum b)
+{
+	return DatumGetInt32(FunctionCall2Coll(&entry->era_cmp,
+										   entry->era_collation, a, b));
+}
+
+/*
+ * Take the advisory lock of a key of the given table in the given space,
+ * hashing the values of its columns together.  The lock is held until the end
+ * of the transaction.
+ */
+static void
+LockKeyValues(Oid relid, uint16 space, int nkeys, FmgrInfo *key_hash,
+			  Oid *key_collations, Datum *values, LOCKMODE lockmode)
+{
+	LOCKTAG		tag;
+	uint32		hash = 0;
+	int			i;
+
+	for (i = 0; i < nkeys; i++)
+	{
+		uint32	h = DatumGetUInt32(FunctionCall1Coll(&key_hash[i],
+													 key_collations[i],
+													 values[i]));
+
+		hash ^= h + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	}
+
+	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, relid, hash, space);
+	(void) LockAcquire(&tag, lockmode, false, false);
+}
+
+/*
+ * Take the advisory lock of the referenced key with the given values, which
+ * are of the key's type on either side.  All the foreign keys on the same
+ * unique key share it.
+ */
+static void
+LockForeignKeyValues(ForeignKeyCacheEntry *entry, Datum *values, LOCKMODE lockmode)
+{
+	LockKeyValues(entry->uk_relid, FK_KEY_LOCK_SPACE, entry->nkeys,
+				  entry->key_hash, entry->key_collations, values, lockmode);
+}
+
+/*
+ * Without row locks, a transaction snapshot would not show what the
+ * transactions we waited for on the key lock have committed, so the checks
+ * of the KEY lock mode and the overlap checks of unique keys use the latest
+ * snapshot then, like the built-in foreign keys do.  Returns true if a
+ * snapshot was pushed, in which case the queries must be run read-only for
+ * SPI to use it.
+ */
+static bool
+PushKeyCheckSnapshot(bool lock_keys)
+{
+	if (!lock_keys || !IsolationUsesXactSnapshot())
+		return false;
+
+	CommandCounterIncrement();
+	PushActiveSnapshot(GetLatestSnapshot());
+
+	return true;
+}
+
+#define FK_TIMELINE_FETCH_SIZE	1000
+
+/*
+ * Check that every referencing row with the given key (of the referenced
+ * side's types) is still covered by the referenced table.
+ *
+ * The periods of the key in the referenced table are read once in start
+ * order and merged into the disjoint intervals that they cover, adjacent
+ * periods included.  The referencing periods are then streamed in start
+ * order too, so that a single forward pass over the intervals finds the one
+ * that each of them must fit in.  Returns true if one of them does not.
+ * Must be called while connected to SPI.
+ */
+static bool
+ValidateForeignKeyOldRow(ForeignKeyCacheEntry *entry, Datum *values, bool read_only)
+{
+	SPITupleTable  *uk_tuptable;
+	uint64			uk_nrows;
+	Datum		   *covered_start;
+	Datum		   *covered_end;
+	int				ncovered = 0;
+	int				cur = 0;
+	Portal			portal;
+	bool			violation = false;
+	bool			is_null;
+	uint64			r;
+	int				ret;
+
+	ret = SPI_execute_plan(entry->uk_timeline_qplan, values, NULL, read_only, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	/* The tuples stay around until SPI_finish() */
+	uk_tuptable = SPI_tuptable;
+	uk_nrows = SPI_processed;
+
+	covered_start = (Datum *) palloc(Max(uk_nrows, 1) * sizeof(Datum));
+	covered_end = (Datum *) palloc(Max(uk_nrows, 1) * sizeof(Datum));
+
+	for (r = 0; r < uk_nrows; r++)
+	{
+		Datum	start = SPI_getbinval(uk_tuptable->vals[r], uk_tuptable->tupdesc, 1, &is_null);
+		Datum	end;
+
+		if (is_null)
+			continue;
+		end = SPI_getbinval(uk_tuptable->vals[r], uk_tuptable->tupdesc, 2, &is_null);
+		if (is_null)
+			continue;
+
+		if (ncovered > 0 &&
+			CompareEraBounds(entry, start, covered_end[ncovered - 1]) <= 0)
+		{
+			if (CompareEraBounds(entry, end, covered_end[ncovered - 1]) > 0)
+				covered_end[ncovered - 1] = end;
+		}
+		else
+		{
+			covered_start[ncovered] = start;
+			covered_end[ncovered] = end;
+			ncovered++;
+		}
+	}
+
+	portal = SPI_cursor_open(NULL, entry->fk_timeline_qplan, values, NULL, read_only);
+
+	while (!violation)
+	{
+		SPI_cursor_fetch(portal, true, FK_TIMELINE_FETCH_SIZE);
+		if (SPI_processed == 0)
+			break;
+
+		for (r = 0; r < SPI_processed && !violation; r++)
+		{
+			HeapTuple	tuple = SPI_tuptable->vals[r];
+			Datum		start = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 1, &is_null);
+			Datum		end;
+
+			if (is_null)
+				continue;
+			end = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 2, &is_null);
+			if (is_null)
+				continue;
+
+			/* Skip the intervals that end before this period starts */
+			while (cur < ncovered &&
+				   CompareEraBounds(entry, covered_end[cur], start) < 0)
+				cur++;
+
+			violation = (cur >= ncovered ||
+						 CompareEraBounds(entry, covered_start[cur], start) > 0 ||
+						 CompareEraBounds(entry, end, covered_end[cur]) > 0);
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	SPI_cursor_close(portal);
+
+	return violation;
+}
+
+static uint32
+CheckKeyHash(const void *key, Size keysize)
+{
+	const ForeignKeyCheckKey *k = (const ForeignKeyCheckKey *) key;
+
+	return DatumGetUInt32(hash_any((const unsigned char *) k->data, k->len));
+}
+
+static int
+CheckKeyCompare(const void *key1, const void *key2, Size keysize)
+{
+	const ForeignKeyCheckKey *k1 = (const ForeignKeyCheckKey *) key1;
+	const ForeignKeyCheckKey *k2 = (const ForeignKeyCheckKey *) key2;
+
+	if (k1->len != k2->len)
+		return 1;
+	return memcmp(k1->data, k2->data, k1->len);
+}
+
+static HTAB *
+CreateCheckKeySet(const char *name, MemoryContext cxt)
+{
+	HASHCTL		ctl;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(ForeignKeyCheckKey);
+	ctl.entrysize = sizeof(ForeignKeyCheckKey);
+	ctl.hash = CheckKeyHash;
+	ctl.match = CheckKeyCompare;
+	ctl.hcxt = cxt;
+
+	return hash_create(name, 256, &ctl,
+					   HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+}
+
+/*
+ * Build the set key of the given key values, in the current memory context.
+ * None of the values may be null.
+ */
+static void
+BuildCheckKey(ForeignKeyCheckKey *key, ForeignKeyCacheEntry *entry, char side,
+			  Datum *values, int16 *typlen, bool *typbyval)
+{
+	StringInfoData	buf;
+	int				i;
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, NameStr(entry->key_name),
+						   strlen(NameStr(entry->key_name)) + 1);
+	appendStringInfoChar(&buf, side);
+
+	for (i = 0; i < entry->nkeys; i++)
+	{
+		const char *data;
+		uint32		len;
+
+		if (typbyval[i])
+		{
+			data = (const char *) &values[i];
+			len = sizeof(Datum);
+		}
+		else if (typlen[i] == -1)
+		{
+			struct varlena *v = pg_detoast_datum_packed((struct varlena *) DatumGetPointer(values[i]));
+
+			data = VARDATA_ANY(v);
+			len = VARSIZE_ANY_EXHDR(v);
+		}
+		else if (typlen[i] == -2)
+		{
+			data = DatumGetCString(values[i]);
+			len = strlen(data);
+		}
+		else
+		{
+			data = DatumGetPointer(values[i]);
+			len = typlen[i];
+		}
+
+		appendBinaryStringInfo(&buf, (const char *) &len, sizeof(len));
+		appendBinaryStringInfo(&buf, data, len);
+	}
+
+	key->len = buf.len;
+	key->data = buf.data;
+}
+
+/*
+ * Add the key to the set, and return whether it was already there.
+ */
+static bool
+AddCheckKey(HTAB *set, ForeignKeyCheckKey *key, MemoryContext cxt)
+{
+	ForeignKeyCheckKey *member;
+	bool				found;
+
+	member = (ForeignKeyCheckKey *) hash_search(set, key, HASH_ENTER, &found);
+	if (!found)
+	{
+		member->data = MemoryContextAlloc(cxt, key->len);
+		memcpy(member->data, key->data, key->len);
+	}
+
+	return found;
+}
+
+/*
+ * Has the key been checked already, with the data as it is now?
+ */
+static bool
+IsCheckKeyVerified(ForeignKeyCheckKey *key)
+{
+	if (VerifiedKeys == NULL)
+		return false;
+
+	return hash_search(VerifiedKeys, key, HASH_FIND, NULL) != NULL;
+}
+
+static void
+RememberVerifiedCheckKey(ForeignKeyCheckKey *key)
+{
+	if (VerifiedKeys == NULL)
+	{
+		VerifiedChecksContext = AllocSetContextCreate(TopTransactionContext,
+													  "sql_saga verified foreign key checks",
+													  ALLOCSET_DEFAULT_SIZES);
+		VerifiedKeys = CreateCheckKeySet("sql_saga verified foreign key checks",
+										 VerifiedChecksContext);
+	}
+
+	AddCheckKey(VerifiedKeys, key, VerifiedChecksContext);
+}
+
+/*
+ * Forget all the keys that have been checked, because the data they were
+ * checked against may have changed.
+ */
+static void
+ForgetVerifiedCheckKeys(void)
+{
+	if (VerifiedChecksContext != NULL)
+		MemoryContextDelete(VerifiedChecksContext);
+	VerifiedChecksContext = NULL;
+	VerifiedKeys = NULL;
+}
+
+/*
+ * Remember the key of a referencing row so that it is checked with the
+ * others of its batch.  A key that is queued already is only counted.
+ */
+static void
+QueueForeignKeyCheck(ForeignKeyCacheEntry *entry, Datum *values)
+{
+	PendingForeignKeyChecks *pending;
+	ForeignKeyCheckKey	key;
+	MemoryContext	oldcxt;
+	bool			found;
+	int				i;
+
+	if (PendingForeignKeyChecksHash == NULL)
+	{
+		HASHCTL	ctl;
+
+		PendingChecksContext = AllocSetContextCreate(TopTransactionContext,
+													 "sql_saga pending foreign key checks",
+													 ALLOCSET_DEFAULT_SIZES);
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = NAMEDATALEN;
+		ctl.entrysize = sizeof(PendingForeignKeyChecks);
+		ctl.hcxt = PendingChecksContext;
+
+		PendingForeignKeyChecksHash = hash_create("sql_saga pending foreign key checks",
+												  16, &ctl,
+												  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		PendingKeys = CreateCheckKeySet("sql_saga pending foreign key keys",
+										PendingChecksContext);
+	}
+
+	BuildCheckKey(&key, entry, FK_SIDE_REFERENCING, values,
+				  entry->fk_typlen, entry->fk_typbyval);
+	if (AddCheckKey(PendingKeys, &key, PendingChecksContext))
+	{
+		skipped_checks++;
+		return;
+	}
+
+	pending = (PendingForeignKeyChecks *) hash_search(PendingForeignKeyChecksHash,
+													  &entry->key_name,
+													  HASH_ENTER, &found);
+
+	oldcxt = MemoryContextSwitchTo(PendingChecksContext);
+
+	if (!found)
+	{
+		pending->nkeys = entry->nkeys;
+		memcpy(pending->atttypes, entry->fk_atttypes, entry->nkeys * sizeof(Oid));
+		pending->nrows = 0;
+		pending->maxrows = 64;
+		for (i = 0; i < pending->nkeys; i++)
+			pending->values[i] = (Datum *) palloc(pending->maxrows * sizeof(Datum));
+	}
+	else if (pending->nrows >= pending->maxrows)
+	{
+		pending->maxrows *= 2;
+		for (i = 0; i < pending->nkeys; i++)
+			pending->values[i] = (Datum *) repalloc(pending->values[i],
+													pending->maxrows * sizeof(Datum));
+	}
+
+	for (i = 0; i < pending->nkeys; i++)
+		pending->values[i][pending->nrows] = datumCopy(values[i],
+													   entry->fk_typbyval[i],
+													   entry->fk_typlen[i]);
+	pending->nrows++;
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Check all the keys queued for one foreign key in a single query.  Must be
+ * called while connected to SPI.
+ */
+static void
+CheckPendingForeignKeys(PendingForeignKeyChecks *pending, bool deferred)
+{
+	ForeignKeyCacheEntry *entry;
+	Datum		arrays[INDEX_MAX_KEYS];
+	instr_time	start;
+	bool		latest;
+	int			ret;
+	int			i;
+
+	/*
+	 * The foreign key may have been dropped since the keys were queued, or
+	 * even recreated differently, in which case adding it validated the whole
+	 * table already.
+	 */
+	entry = LookupForeignKey(NameStr(pending->key_name), true);
+	if (entry == NULL ||
+		entry->batch_qplan == NULL ||
+		entry->nkeys != pending->nkeys ||
+		memcmp(entry->fk_atttypes, pending->atttypes, entry->nkeys * sizeof(Oid)) != 0)
+		return;
+
+	if (entry->lock_keys)
+	{
+		Datum	values[INDEX_MAX_KEYS];
+		int		r;
+
+		for (r = 0; r < pending->nrows; r++)
+		{
+			for (i = 0; i < entry->nkeys; i++)
+				values[i] = pending->values[i][r];
+			LockForeignKeyValues(entry, values, ShareLock);
+		}
+	}
+
+	StatsCheckStart(&start);
+
+	for (i = 0; i < entry->nkeys; i++)
+		arrays[i] = PointerGetDatum(construct_array(pending->values[i],
+													pending->nrows,
+													entry->fk_atttypes[i],
+													entry->fk_typlen[i],
+													entry->fk_typbyval[i],
+													entry->fk_typalign[i]));
+
+	latest = PushKeyCheckSnapshot(entry->lock_keys);
+
+	ret = SPI_execute_plan(entry->batch_qplan, arrays, NULL, latest, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (latest)
+		PopActiveSnapshot();
+
+	StatsCheckEnd(NameStr(entry->key_name), &start, pending->nrows, deferred,
+				  SPI_processed > 0);
+
+	if (SPI_processed > 0)
+	{
+		StringInfoData	detail;
+
+		initStringInfo(&detail);
+		appendStringInfoString(&detail, "Key (");
+		for (i = 0; i < entry->nkeys; i++)
+			appendStringInfo(&detail, "%s%s", (i > 0 ? ", " : ""),
+							 NameStr(entry->fk_attnames[i]));
+		appendStringInfoString(&detail, ")=(");
+		for (i = 0; i < entry->nkeys; i++)
+			appendStringInfo(&detail, "%s%s", (i > 0 ? ", " : ""),
+							 SPI_getvalue(SPI_tuptable->vals[0],
+										  SPI_tuptable->tupdesc, i + 1));
+		appendStringInfo(&detail, ") is not covered by table \"%s\".",
+						 DatumGetCString(DirectFunctionCall1(regclassout,
+								 ObjectIdGetDatum(entry->uk_relid))));
+
+		ReportForeignKeyViolation(entry, detail.data);
+	}
+}
+
+/*
+ * Check everything that has been queued so far.  The caller tells whether the
+ * keys were queued by deferred triggers, for the statistics.
+ *
+ * The queue is detached before running the checks, so the keys are not
+ * checked again if one of them fails and the error is trapped.  The row
+ * events that queued them have been rolled back along with the
+ * subtransaction in that case anyway.
+ */
+static void
+FlushPendingForeignKeyChecks(bool deferred)
+{
+	HTAB	   *pending_hash = PendingForeignKeyChecksHash;
+	MemoryContext	pending_cxt = PendingChecksContext;
+	HASH_SEQ_STATUS status;
+	PendingForeignKeyChecks *pending;
+
+	if (pending_hash == NULL || flushing_pending_checks || !IsTransactionState())
+		return;
+
+	PendingForeignKeyChecksHash = NULL;
+	PendingKeys = NULL;
+	PendingChecksContext = NULL;
+	flushing_pending_checks = true;
+
+	PG_TRY();
+	{
+		if (SPI_connect() != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect failed");
+
+		hash_seq_init(&status, pending_hash);
+		while ((pending = (PendingForeignKeyChecks *) hash_seq_search(&status)) != NULL)
+			CheckPendingForeignKeys(pending, deferred);
+
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+	}
+	PG_CATCH();
+	{
+		flushing_pending_checks = false;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	flushing_pending_checks = false;
+	MemoryContextDelete(pending_cxt);
+}
+
+/*
+ * Anything that modifies data invalidates the keys that have been checked.
+ * Our own lookups are plain SELECTs, so they keep them.
+ */
+static void
+sql_saga_ExecutorStart(QueryDesc *queryDesc, int eflags)
+{
+	if (queryDesc->operation != CMD_SELECT ||
+		queryDesc->plannedstmt->hasModifyingCTE)
+		ForgetVerifiedCheckKeys();
+
+	if (prev_ExecutorStart)
+		prev_ExecutorStart(queryDesc, eflags);
+	else
+		standard_ExecutorStart(queryDesc, eflags);
+}
+
+/*
+ * Immediate constraint triggers fire at the end of the statement that caused
+ * them, from within ExecutorFinish, so check their keys right after that.
+ * Plain SELECTs cannot fire triggers, and skipping them means that our own
+ * lookups never get here.
+ */
+static void
+sql_saga_ExecutorFinish(QueryDesc *queryDesc)
+{
+	immediate_trigger_depth++;
+	PG_TRY();
+	{
+		if (prev_ExecutorFinish)
+			prev_ExecutorFinish(queryDesc);
+		else
+			standard_ExecutorFinish(queryDesc);
+	}
+	PG_CATCH();
+	{
+		immediate_trigger_depth--;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	immediate_trigger_depth--;
+
+	if (queryDesc->operation != CMD_SELECT ||
+		queryDesc->plannedstmt->hasModifyingCTE)
+		FlushPendingForeignKeyChecks(false);
+}
+
+/*
+ * SET CONSTRAINTS fires the deferred triggers that become immediate, and COPY
+ * fires its own triggers, so check the queued keys after utility commands too.
+ * Utility commands may also change the data without going through the
+ * executor, so forget the checked keys before they run.
+ *
+ * The triggers fired by SET CONSTRAINTS are the deferred ones, and so are the
+ * ones fired by COMMIT, but those of COPY and the like are immediate.
+ *
+ * Only calling the next hook depends on the version, so the hook itself is a
+ * thin wrapper around these.  Returns whether the triggers the command fires
+ * are immediate ones.
+ */
+static bool
+BeginUtility(Node *stmt)
+{
+	bool		immediate = !IsA(stmt, TransactionStmt) &&
+		!IsA(stmt, ConstraintsSetStmt);
+
+	if (!IsA(stmt, TransactionStmt))
+		ForgetVerifiedCheckKeys();
+
+	if (immediate)
+		immediate_trigger_depth++;
+
+	return immediate;
+}
+
+/*
+ * Called once the command is done, or with failed set when it errored out.
+ */
+static void
+EndUtility(Node *stmt, bool immediate, bool failed)
+{
+	if (immediate)
+		immediate_trigger_depth--;
+
+	if (!failed && !IsA(stmt, TransactionStmt))
+		FlushPendingForeignKeyChecks(!immediate);
+}
+
+#if (PG_VERSION_NUM >= 140000)
+static void
+sql_saga_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+						bool readOnlyTree, ProcessUtilityContext context,
+						ParamListInfo params, QueryEnvironment *queryEnv,
+						DestReceiver *dest, QueryCompletion *qc)
+{
+	bool		immediate = BeginUtility(pstmt->utilityStmt);
+
+	PG_TRY();
+	{
+		if (prev_ProcessUtility)
+			prev_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+								params, queryEnv, dest, qc);
+		else
+			standard_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+									params, queryEnv, dest, qc);
+	}
+	PG_CATCH();
+	{
+		EndUtility(pstmt->utilityStmt, immediate, true);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	EndUtility(pstmt->utilityStmt, immediate, false);
+}
+#elif (PG_VERSION_NUM >= 130000)
+static void
+sql_saga_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+						ProcessUtilityContext context,
+						ParamListInfo params, QueryEnvironment *queryEnv,
+						DestReceiver *dest, QueryCompletion *qc)
+{
+	bool		immediate = BeginUtility(pstmt->utilityStmt);
+
+	PG_TRY();
+	{
+		if (prev_ProcessUtility)
+			prev_ProcessUtility(pstmt, queryString, context,
+								params, queryEnv, dest, qc);
+		else
+			standard_ProcessUtility(pstmt, queryString, context,
+									params, queryEnv, dest, qc);
+	}
+	PG_CATCH();
+	{
+		EndUtility(pstmt->utilityStmt, immediate, true);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	EndUtility(pstmt->utilityStmt, immediate, false);
+}
+#else
+static void
+sql_saga_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+						ProcessUtilityContext context,
+						ParamListInfo params, QueryEnvironment *queryEnv,
+						DestReceiver *dest, char *completionTag)
+{
+	bool		immediate = BeginUtility(pstmt->utilityStmt);
+
+	PG_TRY();
+	{
+		if (prev_ProcessUtility)
+			prev_ProcessUtility(pstmt, queryString, context,
+								params, queryEnv, dest, completionTag);
+		else
+			standard_ProcessUtility(pstmt, queryString, context,
+									params, queryEnv, dest, completionTag);
+	}
+	PG_CATCH();
+	{
+		EndUtility(pstmt->utilityStmt, immediate, true);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	EndUtility(pstmt->utilityStmt, immediate, false);
+}
+#endif
+
+/*
+ * Deferred triggers fire at commit time, before the PRE_COMMIT callbacks are
+ * called, so anything they queued is checked here at the latest.
+ */
+static void
+ForeignKeyXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_PRE_COMMIT:
+		case XACT_EVENT_PRE_PREPARE:
+			FlushPendingForeignKeyChecks(true);
+			break;
+
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+			/* The memory went away with TopTransactionContext */
+			PendingForeignKeyChecksHash = NULL;
+			PendingKeys = NULL;
+			PendingChecksContext = NULL;
+			VerifiedKeys = NULL;
+			VerifiedChecksContext = NULL;
+			flushing_pending_checks = false;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*
+ * A rolled back subtransaction takes its changes with it, so what has been
+ * checked since may not hold anymore.
+ */
+static void
+ForeignKeySubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+						  SubTransactionId parentSubid, void *arg)
+{
+	if (event == SUBXACT_EVENT_ABORT_SUB)
+		ForgetVerifiedCheckKeys();
+}
+
+/*
+ * The attribute number of a key column in the relation a trigger fired on.
+ * That is a partition when the table of the key is partitioned, and its
+ * columns can then be in other places than in the parent.
+ */
+static AttrNumber
+GetRowAttnum(Relation rel, Oid key_relid, AttrNumber attnum, Name attname)
+{
+	int		partition_attnum;
+
+	if (RelationGetRelid(rel) == key_relid)
+		return attnum;
+
+	partition_attnum = SPI_fnumber(RelationGetDescr(rel), NameStr(*attname));
+	if (partition_attnum <= 0)
+		elog(ERROR, "column \"%s\" of relation \"%s\" does not exist",
+			 NameStr(*attname), RelationGetRelationName(rel));
+
+	return (AttrNumber) partition_attnum;
+}
+
+/*
+ * Check that the referenced table covers the referencing rows sharing the key
+ * of the given row, and raise the same errors as
+ * validate_foreign_key_new_row() if it doesn't.  In batch mode, the key is
+ * only queued.
+ *
+ * The check covers all the rows with the key, so it is skipped if the key has
+ * been checked already and nothing has changed since.
+ */
+static void
+CheckForeignKeyNewRow(const char *key_name, Relation rel, HeapTuple row)
+{
+	ForeignKeyCacheEntry   *entry;
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	Datum		values[INDEX_MAX_KEYS];
+	bool		has_nulls = false;
+	bool		all_nulls = true;
+	bool		is_null;
+	bool		violation;
+	bool		latest;
+	ForeignKeyCheckKey	key;
+	instr_time	start;
+	int			ret;
+	int			i;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	entry = LookupForeignKey(key_name, false);
+
+	for (i = 0; i < entry->nkeys; i++)
+	{
+		AttrNumber	attnum = GetRowAttnum(rel, entry->fk_relid,
+										  entry->fk_attnums[i],
+										  &entry->fk_attnames[i]);
+
+		values[i] = heap_getattr(row, attnum, tupdesc, &is_null);
+		has_nulls = has_nulls || is_null;
+		all_nulls = all_nulls && is_null;
+	}
+
+	/*
+	 * If there are no values at all, all three types pass.
+	 *
+	 * Period columns are by definition NOT NULL so the FULL MATCH type is
+	 * only concerned with the non-period columns of the constraint.
+	 * SQL:2016 4.23.3.3
+	 */
+	if (all_nulls)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return;
+	}
+
+	if (has_nulls)
+	{
+		switch (entry->match_type)
+		{
+			case FKCONSTR_MATCH_SIMPLE:
+				if (SPI_finish() != SPI_OK_FINISH)
+					elog(ERROR, "SPI_finish failed");
+				return;
+			case FKCONSTR_MATCH_PARTIAL:
+				ereport(ERROR,
+						(errcode(ERRCODE_RAISE_EXCEPTION),
+						 errmsg("partial not implemented")));
+				break;
+			case FKCONSTR_MATCH_FULL:
+				ereport(ERROR,
+						(errcode(ERRCODE_RAISE_EXCEPTION),
+						 errmsg("foreign key violated (nulls in FULL)")));
+				break;
+		}
+	}
+
+	if (fk_check_mode == FK_CHECK_MODE_BATCH && entry->batch_qplan != NULL)
+	{
+		QueueForeignKeyCheck(entry, values);
+
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return;
+	}
+
+	BuildCheckKey(&key, entry, FK_SIDE_REFERENCING, values,
+				  entry->fk_typlen, entry->fk_typbyval);
+	if (IsCheckKeyVerified(&key))
+	{
+		skipped_checks++;
+
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return;
+	}
+
+	if (entry->lock_keys)
+		LockForeignKeyValues(entry, values, ShareLock);
+
+	StatsCheckStart(&start);
+
+	latest = PushKeyCheckSnapshot(entry->lock_keys);
+
+	ret = SPI_execute_plan(entry->qplan, values, NULL, latest, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	violation = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+										   SPI_tuptable->tupdesc, 1, &is_null));
+
+	if (latest)
+		PopActiveSnapshot();
+
+	StatsCheckEnd(key_name, &start, 1, immediate_trigger_depth == 0, violation);
+
+	if (violation)
+		ReportForeignKeyViolation(entry, NULL);
+
+	RememberVerifiedCheckKey(&key);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+}
+
+/*
+ * Check that the referencing rows still find what they need in the referenced
+ * table after the given row is gone.  Only the key of the row matters, so a
+ * key is checked once.
+ */
+static void
+CheckForeignKeyOldRow(const char *key_name, Relation rel, HeapTuple row)
+{
+	ForeignKeyCacheEntry   *entry;
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	Datum		values[INDEX_MAX_KEYS];
+	bool		is_null;
+	bool		violation;
+	bool		latest;
+	ForeignKeyCheckKey	key;
+	instr_time	start;
+	int			i;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	entry = LookupForeignKey(key_name, false);
+
+	/*
+	 * If the old row had nulls in the referenced columns then there was no
+	 * possible referencing row (until we implement PARTIAL) so we can just
+	 * stop here.
+	 */
+	for (i = 0; i < entry->nkeys; i++)
+	{
+		AttrNumber	attnum = GetRowAttnum(rel, entry->uk_relid,
+										  entry->uk_attnums[i],
+										  &entry->uk_attnames[i]);
+
+		values[i] = heap_getattr(row, attnum, tupdesc, &is_null);
+		if (is_null)
+		{
+			if (SPI_finish() != SPI_OK_FINISH)
+				elog(ERROR, "SPI_finish failed");
+			return;
+		}
+	}
+
+	BuildCheckKey(&key, entry, FK_SIDE_REFERENCED, values,
+				  entry->uk_typlen, entry->uk_typbyval);
+	if (IsCheckKeyVerified(&key))
+	{
+		skipped_checks++;
+
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return;
+	}
+
+	/* Wait for the transactions relying on the key, and keep new ones out */
+	if (entry->lock_keys)
+		LockForeignKeyValues(entry, values, ExclusiveLock);
+
+	StatsCheckStart(&start);
+
+	latest = PushKeyCheckSnapshot(entry->lock_keys);
+
+	violation = ValidateForeignKeyOldRow(entry, values, latest);
+
+	if (latest)
+		PopActiveSnapshot();
+
+	StatsCheckEnd(key_name, &start, 1, immediate_trigger_depth == 0, violation);
+
+	if (violation)
+		ReportForeignKeyOldRowViolation(entry);
+
+	RememberVerifiedCheckKey(&key);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+}
+
+/*
+ * Common checks for the trigger functions.  Note: translatable error strings
+ * are shared with ri_triggers.c, so resist the temptation to fold the
+ * function name into them.
+ */
+static void
+CheckTriggerCall(FunctionCallInfo fcinfo, const char *funcname, int tgkind)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						funcname)));
+
+	if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired AFTER ROW",
+						funcname)));
+
+	switch (tgkind)
+	{
+		case TRIGGER_EVENT_INSERT:
+			if (!TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+				ereport(ERROR,
+						(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+						 errmsg("function \"%s\" must be fired for INSERT",
+								funcname)));
+			break;
+		case TRIGGER_EVENT_UPDATE:
+			if (!TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+				ereport(ERROR,
+						(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+						 errmsg("function \"%s\" must be fired for UPDATE",
+								funcname)));
+			break;
+		case TRIGGER_EVENT_DELETE:
+			if (!TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
+				ereport(ERROR,
+						(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+						 errmsg("function \"%s\" must be fired for DELETE",
+								funcname)));
+			break;
+	}
+
+	if (trigdata->tg_trigger->tgnargs != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("function \"%s\" must be called with the foreign key name as its only argument",
+						funcname)));
+}
+
+/*
+ * fk_insert_check -
+ *
+ * This function is called when a new row is inserted into a table containing
+ * foreign keys with sql_saga.  It checks to verify that the referenced table
+ * contains the proper data to satisfy the foreign key constraint.
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ */
+Datum
+fk_insert_check(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	CheckTriggerCall(fcinfo, "fk_insert_check", TRIGGER_EVENT_INSERT);
+
+	CheckForeignKeyNewRow(trigdata->tg_trigger->tgargs[0],
+						  trigdata->tg_relation,
+						  trigdata->tg_trigtuple);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * fk_update_check -
+ *
+ * This function is called when a table containing foreign keys with periods
+ * is updated.  It checks to verify that the referenced table contains the
+ * proper data to satisfy the foreign key constraint.
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ */
+Datum
+fk_update_check(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	CheckTriggerCall(fcinfo, "fk_update_check", TRIGGER_EVENT_UPDATE);
+
+	CheckForeignKeyNewRow(trigdata->tg_trigger->tgargs[0],
+						  trigdata->tg_relation,
+						  trigdata->tg_newtuple);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * uk_update_check -
+ *
+ * This function is called when a table referenced by foreign keys with
+ * periods is updated.  It checks to verify that the referenced table still
+ * contains the proper data to satisfy the foreign key constraint.
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ */
+Datum
+uk_update_check(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	CheckTriggerCall(fcinfo, "uk_update_check", TRIGGER_EVENT_UPDATE);
+
+	CheckForeignKeyOldRow(trigdata->tg_trigger->tgargs[0],
+						  trigdata->tg_relation,
+						  trigdata->tg_trigtuple);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * uk_delete_check -
+ *
+ * This function is called when a table referenced by foreign keys with
+ * periods is deleted from.  It checks to verify that the referenced table
+ * still contains the proper data to satisfy the foreign key constraint.
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ */
+Datum
+uk_delete_check(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	CheckTriggerCall(fcinfo, "uk_delete_check", TRIGGER_EVENT_DELETE);
+
+	CheckForeignKeyOldRow(trigdata->tg_trigger->tgargs[0],
+						  trigdata->tg_relation,
+						  trigdata->tg_trigtuple);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * Prepare the query counting the rows of a unique key's table that have the
+ * key and period of a row.  The period conditions let the planner skip the
+ * partitions that cannot overlap it.
+ *
+ * With the BTREE enforcement there is no EXCLUDE constraint to rely on, and
+ * the unique constraint's btree on (key, start, end) cannot search by
+ * overlap.  As the periods of a key checked before do not overlap, their ends
+ * grow with their starts, so only two slices of the index can hold a
+ * conflict: the rows starting within the period, and the last row starting
+ * before it.  Must be called while connected to SPI.
+ */
+static void
+LoadOverlapCheck(OverlapCheckCacheEntry *entry)
+{
+	SagaUniqueKey  *uk;
+	SagaEra		   *era;
+	Oid				argtypes[INDEX_MAX_KEYS + 2];
+	const char	   *table_name;
+	const char	   *start_name;
+	const char	   *end_name;
+	StringInfoData	key_buf;
+	StringInfoData	buf;
+	int				i;
+
+	/* Forget the old plan, if any */
+	if (entry->qplan != NULL)
+	{
+		SPI_freeplan(entry->qplan);
+		entry->qplan = NULL;
+	}
+
+	uk = GetSagaUniqueKey(NameStr(entry->key_name), false);
+	era = GetSagaEra(uk->relid, NameStr(uk->era_name), false);
+
+	entry->relid = uk->relid;
+	entry->ncols = uk->ncols + 2;
+	entry->btree = uk->btree;
+	entry->nlockkeys = uk->ncols;
+
+	table_name = quote_qualified_identifier(
+			get_namespace_name(get_rel_namespace(uk->relid)),
+			get_rel_name(uk->relid));
+
+	start_name = quote_identifier(NameStr(era->start_name));
+	end_name = quote_identifier(NameStr(era->end_name));
+
+	initStringInfo(&key_buf);
+	for (i = 0; i < uk->ncols; i++)
+	{
+		namestrcpy(&entry->attnames[i], NameStr(uk->column_names[i]));
+		argtypes[i] = uk->atttypes[i];
+		appendStringInfo(&key_buf, "uk.%s = $%d AND ",
+						 quote_identifier(NameStr(uk->column_names[i])), i + 1);
+
+		if (entry->nlockkeys > 0 &&
+			!LookupKeyHash(uk->relid, uk->attnums[i],
+						   &entry->key_hash[i], &entry->key_collations[i]))
+		{
+			if (entry->btree)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNDEFINED_FUNCTION),
+						 errmsg("could not identify a hash function for type %s",
+								format_type_be(uk->atttypes[i])),
+						 errhint("Unique key \"%s\" needs a hashable key for the BTREE enforcement.",
+								 NameStr(entry->key_name))));
+
+			/* Without a hash, lock every key of the table at once */
+			entry->nlockkeys = 0;
+		}
+	}
+
+	namestrcpy(&entry->attnames[uk->ncols], NameStr(era->start_name));
+	namestrcpy(&entry->attnames[uk->ncols + 1], NameStr(era->end_name));
+	argtypes[uk->ncols] = era->bounds_type;
+	argtypes[uk->ncols + 1] = era->bounds_type;
+
+	initStringInfo(&buf);
+	if (entry->btree)
+	{
+		appendStringInfo(&buf,
+						 "SELECT (SELECT count(*) FROM (SELECT FROM %s AS uk WHERE %s"
+						 "uk.%s >= $%d AND uk.%s < $%d LIMIT 2) AS uk) + ",
+						 table_name, key_buf.data,
+						 start_name, uk->ncols + 1, start_name, uk->ncols + 2);
+		appendStringInfo(&buf,
+						 "(SELECT count(*) FROM (SELECT uk.%s FROM %s AS uk WHERE %s"
+						 "uk.%s < $%d ORDER BY uk.%s DESC, uk.%s DESC LIMIT 1) AS uk "
+						 "WHERE uk.%s > $%d)",
+						 end_name, table_name, key_buf.data,
+						 start_name, uk->ncols + 1, start_name, end_name,
+						 end_name, uk->ncols + 1);
+	}
+	else
+		appendStringInfo(&buf,
+						 "SELECT count(*) FROM (SELECT FROM %s AS uk WHERE %s"
+						 "uk.%s < $%d AND uk.%s > $%d LIMIT 2) AS uk",
+						 table_name, key_buf.data,
+						 start_name, uk->ncols + 2, end_name, uk->ncols + 1);
+
+	entry->qplan = PrepareKeptPlan(buf.data, entry->ncols, argtypes);
+	entry->valid = true;
+}
+
+/*
+ * Find the cache entry for the named unique key, (re)loading it if needed.
+ * Must be called while connected to SPI.
+ */
+static OverlapCheckCacheEntry *
+LookupOverlapCheck(const char *key_name)
+{
+	NameData				key;
+	OverlapCheckCacheEntry *entry;
+	bool					found;
+
+	/* The key is hashed as a blob, so it must be zero-padded */
+	MemSet(&key, 0, sizeof(key));
+	strlcpy(NameStr(key), key_name, NAMEDATALEN);
+
+	entry = (OverlapCheckCacheEntry *) hash_search(OverlapCheckCacheHash,
+												   &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->valid = false;
+		entry->relid = InvalidOid;
+		entry->qplan = NULL;
+	}
+
+	if (!entry->valid)
+		LoadOverlapCheck(entry);
+
+	return entry;
+}
+
+/*
+ * Is the row a trigger fired for still there?  A deferred check can come
+ * after the same transaction updated or deleted the row again, and the values
+ * it had then say nothing about the table anymore.  ri_triggers.c makes the
+ * same test.
+ */
+static bool
+TriggerRowIsLive(TriggerData *trigdata)
+{
+	bool		is_update = TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event);
+#if (PG_VERSION_NUM >= 120000)
+	TupleTableSlot *slot = is_update ? trigdata->tg_newslot : trigdata->tg_trigslot;
+
+	return table_tuple_satisfies_snapshot(trigdata->tg_relation, slot, SnapshotSelf);
+#else
+	HeapTuple	row = is_update ? trigdata->tg_newtuple : trigdata->tg_trigtuple;
+	Buffer		buf = is_update ? trigdata->tg_newtuplebuf : trigdata->tg_trigtuplebuf;
+	bool		is_live;
+
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	is_live = HeapTupleSatisfiesVisibility(row, SnapshotSelf, buf);
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+	return is_live;
+#endif
+}
+
+/*
+ * uk_overlap_check -
+ *
+ * This function is called when a row is inserted into or updated in a
+ * partitioned table with unique keys.  The EXCLUDE constraint of each
+ * partition only sees its own rows, so this checks that no row in any other
+ * partition has the same key and an overlapping period.
+ *
+ * It is also called for the unique keys enforced with a btree, which have no
+ * EXCLUDE constraint at all.
+ *
+ * The check first takes an exclusive lock on the key, so that the
+ * transactions writing the same key are checked one after the other and each
+ * sees the rows of those before it.
+ *
+ * The first argument is the name of the unique key in our custom catalogs.
+ */
+Datum
+uk_overlap_check(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+	OverlapCheckCacheEntry *entry;
+	TupleDesc		tupdesc;
+	HeapTuple		row;
+	Datum			values[INDEX_MAX_KEYS + 2];
+	char			nulls[INDEX_MAX_KEYS + 2];
+	bool			is_null;
+	int64			overlapping;
+	bool			latest;
+	instr_time		start;
+	int				ret;
+	int				i;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						"uk_overlap_check")));
+
+	if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event) ||
+		TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired AFTER INSERT or UPDATE FOR EACH ROW",
+						"uk_overlap_check")));
+
+	if (trigdata->tg_trigger->tgnargs != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("function \"%s\" must be called with the unique key name as its only argument",
+						"uk_overlap_check")));
+
+	if (!TriggerRowIsLive(trigdata))
+		return PointerGetDatum(NULL);
+
+	row = TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event) ?
+		trigdata->tg_newtuple : trigdata->tg_trigtuple;
+	tupdesc = RelationGetDescr(trigdata->tg_relation);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	entry = LookupOverlapCheck(trigdata->tg_trigger->tgargs[0]);
+
+	for (i = 0; i < entry->ncols; i++)
+	{
+		int		attnum = SPI_fnumber(tupdesc, NameStr(entry->attnames[i]));
+
+		if (attnum <= 0)
+			elog(ERROR, "column \"%s\" of relation \"%s\" does not exist",
+				 NameStr(entry->attnames[i]),
+				 RelationGetRelationName(trigdata->tg_relation));
+
+		values[i] = heap_getattr(row, attnum, tupdesc, &is_null);
+		nulls[i] = is_null ? 'n' : ' ';
+	}
+
+	/* A key with a null is never equal to another, as with EXCLUDE */
+	for (i = 0; i < entry->ncols - 2; i++)
+	{
+		if (nulls[i] == 'n')
+		{
+			if (SPI_finish() != SPI_OK_FINISH)
+				elog(ERROR, "SPI_finish failed");
+			return PointerGetDatum(NULL);
+		}
+	}
+
+	LockKeyValues(entry->relid, UK_KEY_LOCK_SPACE, entry->nlockkeys,
+				  entry->key_hash, entry->key_collations, values,
+				  ExclusiveLock);
+
+	StatsCheckStart(&start);
+
+	latest = PushKeyCheckSnapshot(true);
+
+	/* The row itself is one of them */
+	ret = SPI_execute_plan(entry->qplan, values, nulls, latest, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	overlapping = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+											  SPI_tuptable->tupdesc, 1, &is_null));
+
+	if (latest)
+		PopActiveSnapshot();
+
+	StatsCheckEnd(NameStr(entry->key_name), &start, 1,
+				  immediate_trigger_depth == 0, overlapping > 1);
+
+	if (overlapping > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_EXCLUSION_VIOLATION),
+				 errmsg("conflicting key value violates unique key \"%s\"",
+						NameStr(entry->key_name)),
+				 errdetail("Another row of table \"%s\" has the same key and an overlapping period.",
+						   get_rel_name(entry->relid))));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * foreign_key_checks_skipped -
+ *
+ * The number of row events of this backend that did not need a foreign key
+ * check of their own, because their key was checked or queued already.
+ */
+Datum
+foreign_key_checks_skipped(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(skipped_checks);
+}
+
+/*
+ * The value of a field of a jsonb object as text, like the ->> operator, or
+ * NULL if it is missing or null.
+ */
+static char *
+GetJsonbFieldText(Jsonb *jb, const char *field)
+{
+	JsonbValue	k;
+	JsonbValue *v;
+
+	if (!JB_ROOT_IS_OBJECT(jb))
+		return NULL;
+
+	k.type = jbvString;
+	k.val.string.val = (char *) field;
+	k.val.string.len = strlen(field);
+
+	v = findJsonbValueFromContainer(&jb->root, JB_FOBJECT, &k);
+	if (v == NULL)
+		return NULL;
+
+	switch (v->type)
+	{
+		case jbvNull:
+			return NULL;
+		case jbvString:
+			return pnstrdup(v->val.string.val, v->val.string.len);
+		case jbvNumeric:
+			return DatumGetCString(DirectFunctionCall1(numeric_out,
+													   NumericGetDatum(v->val.numeric)));
+		case jbvBool:
+			return pstrdup(v->val.boolean ? "true" : "false");
+		case jbvBinary:
+			return JsonbToCString(NULL, v->val.binary.data, v->val.binary.len);
+		default:
+			elog(ERROR, "unrecognized jsonb type: %d", (int) v->type);
+	}
+
+	return NULL;				/* keep compiler quiet */
+}
+
+/*
+ * validate_foreign_key_old_row -
+ *
+ * Check that the referencing rows of the key of the given row, an old row of
+ * the referenced table as jsonb, are still covered by the referenced table.
+ * This is what uk_update_check() and uk_delete_check() do, for callers that
+ * only have the row as jsonb.
+ *
+ * This function either returns true or raises an exception.
+ */
+Datum
+validate_foreign_key_old_row(PG_FUNCTION_ARGS)
+{
+	ForeignKeyCacheEntry   *entry;
+	Jsonb	   *row_data;
+	Datum		values[INDEX_MAX_KEYS];
+	bool		violation;
+	bool		latest;
+	int			i;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_RAISE_EXCEPTION),
+				 errmsg("foreign key \"%s\" not found", "<NULL>")));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	entry = LookupForeignKey(NameStr(*PG_GETARG_NAME(0)), false);
+
+	/*
+	 * If the row had nulls in the referenced columns then there was no
+	 * possible referencing row (until we implement PARTIAL) so we can just
+	 * stop here.
+	 */
+	if (PG_ARGISNULL(1))
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		PG_RETURN_BOOL(true);
+	}
+
+	row_data = PG_GETARG_JSONB_P(1);
+	for (i = 0; i < entry->nkeys; i++)
+	{
+		AttrNumber	attnum = entry->uk_attnums[i];
+		char	   *text = GetJsonbFieldText(row_data,
+											 get_attname(entry->uk_relid, attnum, false));
+		Oid			typinput;
+		Oid			typioparam;
+
+		if (text == NULL)
+		{
+			if (SPI_finish() != SPI_OK_FINISH)
+				elog(ERROR, "SPI_finish failed");
+			PG_RETURN_BOOL(true);
+		}
+
+		getTypeInputInfo(entry->uk_atttypes[i], &typinput, &typioparam);
+		values[i] = OidInputFunctionCall(typinput, text, typioparam, -1);
+	}
+
+	if (entry->lock_keys)
+		LockForeignKeyValues(entry, values, ExclusiveLock);
+
+	latest = PushKeyCheckSnapshot(entry->lock_keys);
+
+	violation = ValidateForeignKeyOldRow(entry, values, latest);
+
+	if (latest)
+		PopActiveSnapshot();
+
+	if (violation)
+		ReportForeignKeyOldRowViolation(entry);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	PG_RETURN_BOOL(true);
+}
+
+void
+foreign_keys_init(void)
+{
+	DefineCustomEnumVariable("sql_saga.foreign_key_check_mode",
+							 "Sets how the referencing side of foreign keys is checked.",
+							 "\"row\" checks every inserted or updated row on its own, "
+							 "\"batch\" checks all the keys touched by a statement, "
+							 "or by a transaction for deferred constraints, in a single query.",
+							 &fk_check_mode,
+							 FK_CHECK_MODE_ROW,
+							 fk_check_mode_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	prev_ExecutorStart = ExecutorStart_hook;
+	ExecutorStart_hook = sql_saga_ExecutorStart;
+	prev_ExecutorFinish = ExecutorFinish_hook;
+	ExecutorFinish_hook = sql_saga_ExecutorFinish;
+	prev_ProcessUtility = ProcessUtility_hook;
+	ProcessUtility_hook = sql_saga_ProcessUtility;
+
+	InitForeignKeyCache();
+	RegisterSagaInvalidationCallback(InvalidateForeignKeyCacheCallback);
+
+	RegisterXactCallback(ForeignKeyXactCallback, NULL);
+	RegisterSubXactCallback(ForeignKeySubXactCallback, NULL);
+}
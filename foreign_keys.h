@@ -0,0 +1,10 @@
+/**
+ * foreign_keys.h -
+ * Native implementations of the triggers enforcing temporal foreign keys.
+ */
+#ifndef SQL_SAGA_FOREIGN_KEYS_H
+#define SQL_SAGA_FOREIGN_KEYS_H
+
+extern void foreign_keys_init(void);
+
+#endif							/* SQL_SAGA_FOREIGN_KEYS_H */
@@ -0,0 +1,442 @@
+/**
+ * metadata.c -
+ * A backend-local cache of what our catalogs say about eras and unique keys.
+ *
+ * Every trigger function needs to know which columns bound an era and which
+ * columns make up a unique key.  Rather than have each of them query our
+ * catalogs for every row event, they look the definitions up here.  The
+ * entries are marked stale by relcache invalidations of the table they
+ * describe, which our catalogs also send when they are written to (see
+ * invalidate_cached_metadata()), so that a change made by another session is
+ * seen once it commits.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/spi.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/elog.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
+
+#include "metadata.h"
+
+PGDLLEXPORT Datum invalidate_cached_metadata(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(invalidate_cached_metadata);
+
+#define MAX_INVALIDATION_CALLBACKS	8
+
+static HTAB *EraCacheHash = NULL;
+static HTAB *UniqueKeyCacheHash = NULL;
+
+static SagaInvalidationCallback invalidation_callbacks[MAX_INVALIDATION_CALLBACKS];
+static int	num_invalidation_callbacks = 0;
+
+/*
+ * Any relcache invalidation of a table could mean that one of its columns was
+ * renamed or that our catalogs changed for it, so reload its entries the next
+ * time they are used.  The caches built on top of this one are told too.
+ */
+static void
+InvalidateMetadataCallback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS	status;
+	int				i;
+
+	if (EraCacheHash != NULL)
+	{
+		SagaEra	   *era;
+
+		hash_seq_init(&status, EraCacheHash);
+		while ((era = (SagaEra *) hash_seq_search(&status)) != NULL)
+		{
+			if (relid == InvalidOid || era->key.relid == relid)
+				era->valid = false;
+		}
+	}
+
+	if (UniqueKeyCacheHash != NULL)
+	{
+		SagaUniqueKey *uk;
+
+		hash_seq_init(&status, UniqueKeyCacheHash);
+		while ((uk = (SagaUniqueKey *) hash_seq_search(&status)) != NULL)
+		{
+			if (relid == InvalidOid || uk->relid == relid)
+				uk->valid = false;
+		}
+	}
+
+	for (i = 0; i < num_invalidation_callbacks; i++)
+		invalidation_callbacks[i] (relid);
+}
+
+void
+metadata_init(void)
+{
+	HASHCTL	ctl;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(SagaEraKey);
+	ctl.entrysize = sizeof(SagaEra);
+	EraCacheHash = hash_create("sql_saga era cache", 64, &ctl,
+							   HASH_ELEM | HASH_BLOBS);
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = NAMEDATALEN;
+	ctl.entrysize = sizeof(SagaUniqueKey);
+	UniqueKeyCacheHash = hash_create("sql_saga unique key cache", 64, &ctl,
+									 HASH_ELEM | HASH_BLOBS);
+
+	CacheRegisterRelcacheCallback(InvalidateMetadataCallback, (Datum) 0);
+}
+
+/*
+ * Let another cache hear about the invalidations we get, so that it does not
+ * need a relcache callback of its own.  Only called from _PG_init().
+ */
+void
+RegisterSagaInvalidationCallback(SagaInvalidationCallback callback)
+{
+	if (num_invalidation_callbacks >= MAX_INVALIDATION_CALLBACKS)
+		elog(ERROR, "out of sql_saga invalidation callback slots");
+
+	invalidation_callbacks[num_invalidation_callbacks++] = callback;
+}
+
+SPIPlanPtr
+PrepareKeptPlan(const char *sql, int nargs, Oid *argtypes)
+{
+	SPIPlanPtr	plan;
+	int			ret;
+
+	plan = SPI_prepare(sql, nargs, argtypes);
+	if (plan == NULL)
+		elog(ERROR, "SPI_prepare returned %s for %s",
+			 SPI_result_code_string(SPI_result), sql);
+
+	ret = SPI_keepplan(plan);
+	if (ret != 0)
+		elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+
+	return plan;
+}
+
+/*
+ * Deconstruct a name[] from our catalogs into its C strings.
+ */
+int
+GetNameArray(Datum array_datum, char ***names)
+{
+	ArrayType  *arr = DatumGetArrayTypeP(array_datum);
+	Datum	   *elems;
+	int			nelems;
+	int			i;
+
+	deconstruct_array(arr, NAMEOID, NAMEDATALEN, false, 'c',
+					  &elems, NULL, &nelems);
+
+	*names = (char **) palloc(nelems * sizeof(char *));
+	for (i = 0; i < nelems; i++)
+		(*names)[i] = NameStr(*DatumGetName(elems[i]));
+
+	return nelems;
+}
+
+static AttrNumber
+GetAttnumOrError(Oid relid, const char *column_name)
+{
+	AttrNumber	attnum = get_attnum(relid, column_name);
+
+	if (attnum == InvalidAttrNumber)
+		elog(ERROR, "column \"%s\" of relation \"%s\" does not exist",
+			 column_name, get_rel_name(relid));
+
+	return attnum;
+}
+
+/*
+ * Fill in an era from sql_saga.era.  Returns false if there is no such era.
+ */
+static bool
+LoadEra(SagaEra *era)
+{
+	int				ret;
+	Datum			values[2];
+	bool			found;
+	char		   *start_name = NULL;
+	char		   *end_name = NULL;
+	Oid				range_type = InvalidOid;
+	int32			bounds_typmod;
+	TypeCacheEntry *typentry;
+
+	const char *sql =
+		"SELECT e.start_column_name, e.end_column_name, e.range_type "
+		"FROM sql_saga.era AS e "
+		"WHERE (e.table_name, e.era_name) = ($1, $2)";
+	static SPIPlanPtr qplan = NULL;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (qplan == NULL)
+	{
+		Oid	types[2] = {OIDOID, NAMEOID};
+
+		qplan = PrepareKeptPlan(sql, 2, types);
+	}
+
+	values[0] = ObjectIdGetDatum(era->key.relid);
+	values[1] = NameGetDatum(&era->key.era_name);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	/* (table_name, era_name) is the primary key so there can only be one */
+	found = (SPI_processed > 0);
+	if (found)
+	{
+		HeapTuple	tuple = SPI_tuptable->vals[0];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		bool		is_null;
+
+		start_name = SPI_getvalue(tuple, tupdesc, 1);
+		end_name = SPI_getvalue(tuple, tupdesc, 2);
+		range_type = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 3, &is_null));
+
+		namestrcpy(&era->start_name, start_name);
+		namestrcpy(&era->end_name, end_name);
+	}
+
+	SPI_finish();
+
+	if (!found)
+		return false;
+
+	era->start_attnum = GetAttnumOrError(era->key.relid, NameStr(era->start_name));
+	era->end_attnum = GetAttnumOrError(era->key.relid, NameStr(era->end_name));
+	era->range_type = range_type;
+	/* Compare the bounds with the collation of their column, not their type */
+	get_atttypetypmodcoll(era->key.relid, era->start_attnum,
+						  &era->bounds_type, &bounds_typmod, &era->bounds_collation);
+	get_typlenbyval(era->bounds_type, &era->bounds_typlen, &era->bounds_typbyval);
+
+	typentry = lookup_type_cache(era->bounds_type, TYPECACHE_CMP_PROC);
+	if (!OidIsValid(typentry->cmp_proc))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a comparison function for type %s",
+						format_type_be(era->bounds_type))));
+	fmgr_info_cxt(typentry->cmp_proc, &era->bounds_cmp, TopMemoryContext);
+
+	era->valid = true;
+
+	return true;
+}
+
+/*
+ * Find the named era of a table, (re)loading it if needed.  The result points
+ * into the cache, so it stays valid for the life of the backend, but its
+ * contents may be reloaded by the next lookup after an invalidation.
+ */
+SagaEra *
+GetSagaEra(Oid relid, const char *era_name, bool missing_ok)
+{
+	SagaEraKey	key;
+	SagaEra	   *era;
+	bool		found;
+
+	/* The key is hashed as a blob, so it must be zero-padded */
+	MemSet(&key, 0, sizeof(key));
+	key.relid = relid;
+	strlcpy(NameStr(key.era_name), era_name, NAMEDATALEN);
+
+	era = (SagaEra *) hash_search(EraCacheHash, &key, HASH_ENTER, &found);
+	if (!found)
+		era->valid = false;
+
+	if (!era->valid && !LoadEra(era))
+	{
+		if (missing_ok)
+			return NULL;
+
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("era \"%s\" not found on table \"%s\"",
+						era_name, get_rel_name(relid))));
+	}
+
+	return era;
+}
+
+/*
+ * Fill in a unique key from sql_saga.unique_keys.  Returns false if there is
+ * no such key.
+ */
+static bool
+LoadUniqueKey(SagaUniqueKey *uk)
+{
+	int			ret;
+	int			i;
+	Datum		values[1];
+	bool		found;
+
+	const char *sql =
+		"SELECT uk.table_name, uk.era_name, uk.column_names, uk.enforcement::text "
+		"FROM sql_saga.unique_keys AS uk "
+		"WHERE uk.key_name = $1";
+	static SPIPlanPtr qplan = NULL;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (qplan == NULL)
+	{
+		Oid	types[1] = {NAMEOID};
+
+		qplan = PrepareKeptPlan(sql, 1, types);
+	}
+
+	values[0] = NameGetDatum(&uk->key_name);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	/* key_name is the primary key so there can only be one */
+	found = (SPI_processed > 0);
+	if (found)
+	{
+		HeapTuple	tuple = SPI_tuptable->vals[0];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		bool		is_null;
+		char	  **column_names;
+		int			ncols;
+
+		uk->relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &is_null));
+		namestrcpy(&uk->era_name, SPI_getvalue(tuple, tupdesc, 2));
+
+		ncols = GetNameArray(SPI_getbinval(tuple, tupdesc, 3, &is_null), &column_names);
+		if (ncols > INDEX_MAX_KEYS)
+			elog(ERROR, "unique key \"%s\" has too many columns",
+				 NameStr(uk->key_name));
+
+		uk->ncols = ncols;
+		for (i = 0; i < ncols; i++)
+			namestrcpy(&uk->column_names[i], column_names[i]);
+
+		uk->btree = (strcmp(SPI_getvalue(tuple, tupdesc, 4), "BTREE") == 0);
+	}
+
+	SPI_finish();
+
+	if (!found)
+		return false;
+
+	for (i = 0; i < uk->ncols; i++)
+	{
+		uk->attnums[i] = GetAttnumOrError(uk->relid, NameStr(uk->column_names[i]));
+		uk->atttypes[i] = get_atttype(uk->relid, uk->attnums[i]);
+	}
+
+	uk->valid = true;
+
+	return true;
+}
+
+/*
+ * Find the named unique key, (re)loading it if needed.  See GetSagaEra().
+ */
+SagaUniqueKey *
+GetSagaUniqueKey(const char *key_name, bool missing_ok)
+{
+	NameData		key;
+	SagaUniqueKey  *uk;
+	bool			found;
+
+	MemSet(&key, 0, sizeof(key));
+	strlcpy(NameStr(key), key_name, NAMEDATALEN);
+
+	uk = (SagaUniqueKey *) hash_search(UniqueKeyCacheHash, &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		uk->valid = false;
+		uk->relid = InvalidOid;
+	}
+
+	if (!uk->valid && !LoadUniqueKey(uk))
+	{
+		if (missing_ok)
+			return NULL;
+
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("unique key \"%s\" not found", key_name)));
+	}
+
+	return uk;
+}
+
+/*
+ * A row trigger on our catalogs.  The cached entries are only invalidated by
+ * relcache invalidations, so send one for the table the row is about, which
+ * other sessions will see when we commit.  The table may already be gone when
+ * the row is deleted by our drop handler, but then its invalidation was sent
+ * by the drop itself.
+ */
+Datum
+invalidate_cached_metadata(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+	TupleDesc	tupdesc;
+	int			attnum;
+	HeapTuple	rows[2];
+	int			i;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						"invalidate_cached_metadata")));
+
+	if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired AFTER ROW",
+						"invalidate_cached_metadata")));
+
+	tupdesc = RelationGetDescr(trigdata->tg_relation);
+	attnum = SPI_fnumber(tupdesc, "table_name");
+	if (attnum <= 0)
+		elog(ERROR, "relation \"%s\" has no column \"table_name\"",
+			 RelationGetRelationName(trigdata->tg_relation));
+
+	rows[0] = trigdata->tg_trigtuple;
+	rows[1] = TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event) ? trigdata->tg_newtuple : NULL;
+
+	for (i = 0; i < 2; i++)
+	{
+		Datum	relid;
+		bool	is_null;
+
+		if (rows[i] == NULL)
+			continue;
+
+		relid = heap_getattr(rows[i], attnum, tupdesc, &is_null);
+		if (!is_null && SearchSysCacheExists1(RELOID, relid))
+			CacheInvalidateRelcacheByRelid(DatumGetObjectId(relid));
+	}
+
+	return PointerGetDatum(NULL);
+}
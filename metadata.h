@@ -0,0 +1,61 @@
+/**
+ * metadata.h -
+ * A backend-local cache of what our catalogs say about eras and unique keys,
+ * shared by all the trigger functions so that they don't query the catalogs
+ * for every row.
+ */
+#ifndef SQL_SAGA_METADATA_H
+#define SQL_SAGA_METADATA_H
+
+#include "access/attnum.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+
+typedef struct SagaEraKey
+{
+	Oid			relid;
+	NameData	era_name;
+} SagaEraKey;
+
+typedef struct SagaEra
+{
+	SagaEraKey	key;			/* the hash key; must be first */
+	bool		valid;			/* false if the entry must be reloaded */
+	NameData	start_name;
+	NameData	end_name;
+	AttrNumber	start_attnum;
+	AttrNumber	end_attnum;
+	Oid			range_type;
+	Oid			bounds_type;	/* the type of both bound columns */
+	Oid			bounds_collation;	/* of the start column */
+	int16		bounds_typlen;
+	bool		bounds_typbyval;
+	FmgrInfo	bounds_cmp;		/* btree comparator of bounds_type */
+} SagaEra;
+
+typedef struct SagaUniqueKey
+{
+	NameData	key_name;		/* the hash key; must be first */
+	bool		valid;			/* false if the entry must be reloaded */
+	Oid			relid;
+	NameData	era_name;
+	int			ncols;
+	NameData	column_names[INDEX_MAX_KEYS];
+	AttrNumber	attnums[INDEX_MAX_KEYS];
+	Oid			atttypes[INDEX_MAX_KEYS];
+	bool		btree;			/* the BTREE enforcement, rather than GIST */
+} SagaUniqueKey;
+
+/* Called with the relation whose metadata may have changed, or InvalidOid */
+typedef void (*SagaInvalidationCallback) (Oid relid);
+
+extern void metadata_init(void);
+
+extern SagaEra *GetSagaEra(Oid relid, const char *era_name, bool missing_ok);
+extern SagaUniqueKey *GetSagaUniqueKey(const char *key_name, bool missing_ok);
+extern void RegisterSagaInvalidationCallback(SagaInvalidationCallback callback);
+
+extern SPIPlanPtr PrepareKeptPlan(const char *sql, int nargs, Oid *argtypes);
+extern int	GetNameArray(Datum array_datum, char ***names);
+
+#endif							/* SQL_SAGA_METADATA_H */
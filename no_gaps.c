@@ -18,6 +18,7 @@
 #include <fmgr.h>
 #include <pg_config.h>
 #include <miscadmin.h>
+#include <libpq/pqformat.h>
 #include <utils/array.h>
 #include <utils/datum.h>
 #include <utils/guc.h>
@@ -25,6 +26,9 @@
 #include <utils/lsyscache.h>
 #include <utils/builtins.h>
 #include <utils/rangetypes.h>
+#if (PG_VERSION_NUM >= 140000)
+#include <utils/multirangetypes.h>
+#endif
 #include <utils/float.h>
 #include <utils/numeric.h>
 #include <utils/date.h>
@@ -37,16 +41,59 @@
 #include "no_gaps.h"
 
 // Declarations/Prototypes
-char *DatumGetString(Oid elem_oid, RangeBound bound);
-Datum DatumNegativeInfinity(Oid elem_oid);
-
 Datum no_gaps_transfn(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(no_gaps_transfn);
 Datum no_gaps_finalfn(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(no_gaps_finalfn);
+Datum no_gaps_unordered_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_unordered_transfn);
+Datum no_gaps_unordered_combinefn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_unordered_combinefn);
+Datum no_gaps_unordered_serialfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_unordered_serialfn);
+Datum no_gaps_unordered_deserialfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_unordered_deserialfn);
+Datum no_gaps_unordered_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_unordered_finalfn);
+Datum gaps_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gaps_transfn);
+Datum gaps_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gaps_finalfn);
+Datum gaps_unordered_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(gaps_unordered_finalfn);
+Datum covered_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(covered_transfn);
+Datum covered_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(covered_finalfn);
+Datum no_gaps_multirange_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_multirange_transfn);
+Datum covered_multirange_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(covered_multirange_transfn);
+
+#if (PG_VERSION_NUM < 160000)
+#define make_range_noerror(typcache, lower, upper) make_range(typcache, lower, upper, false)
+#else
+#define make_range_noerror(typcache, lower, upper) make_range(typcache, lower, upper, false, NULL)
+#endif
 
 
 // Types
+
+// How the bound values are compared, picked once per group.  The common
+// element types compare as plain integers, anything else goes through the
+// btree comparison function of the range type.
+typedef enum no_gaps_compare_kind {
+  NO_GAPS_COMPARE_INT32,  // int4, date
+  NO_GAPS_COMPARE_INT64,  // int8, timestamp, timestamptz
+  NO_GAPS_COMPARE_GENERIC
+} no_gaps_compare_kind;
+
+// The ranges that make up the result of gaps and covered, in order.
+typedef struct no_gaps_range_list {
+  int nranges, maxranges;
+  RangeType **ranges;
+} no_gaps_range_list;
+
 typedef struct no_gaps_state {
   RangeBound covered_to;
   RangeType *target;  // Assuming that the target range does not need to be modified and is not large
@@ -55,19 +102,177 @@ typedef struct no_gaps_state {
   bool answer_is_null;
   bool finished;    // Used to avoid further processing if we have already succeeded/failed.
   bool no_gaps;
+  TypeCacheEntry *typcache;  // Looked up on the first row only
+  no_gaps_compare_kind compare_kind;
+  bool elem_byval;
+  int16 elem_len;
+  void *covered_to_buf;  // Holds covered_to.val when it is passed by reference
+  Size covered_to_bufsize;
+  // Used by gaps instead of covered_to: the lower bound of the next gap,
+  // unless the rows so far reach positive infinity.
+  RangeBound gap_from;
+  bool covered_to_infinity;
+  void *gap_from_buf;
+  Size gap_from_bufsize;
+  no_gaps_range_list gaps;
+  // The start of the previous row, to check that gaps gets them sorted.
+  RangeBound prev_start;
+  bool has_prev_start;
+  void *prev_start_buf;
+  Size prev_start_bufsize;
 } no_gaps_state;
 
+// The order-insensitive variant remembers which parts of the target are covered
+// as a list of intervals clipped to the target.  The list is sorted and merged
+// whenever it fills up, and before it is used, so it stays about as long as the
+// number of gaps.  Partial states can be combined in any order, which is what
+// parallel aggregation needs.
+typedef struct no_gaps_interval {
+  RangeBound lower, upper;
+  RangeType *range;  // Holds the bound values when they are passed by reference
+} no_gaps_interval;
+
+typedef struct no_gaps_set_state {
+  MemoryContext context;  // Where the intervals live
+  TypeCacheEntry *typcache;
+  bool answer_is_null;
+  RangeType *target;
+  RangeBound target_start, target_end;
+  int nitems, maxitems;
+  no_gaps_interval *items;
+} no_gaps_set_state;
+
 
 // Implementations
+
+// The same as range_cmp_bounds(), without a function call per comparison for
+// the element types we know.
+static inline int no_gaps_cmp_bounds(no_gaps_state *state, const RangeBound *b1, const RangeBound *b2)
+{
+  int result;
+
+  if (state->compare_kind == NO_GAPS_COMPARE_GENERIC) {
+    return range_cmp_bounds(state->typcache, b1, b2);
+  }
+
+  if (b1->infinite && b2->infinite) {
+    if (b1->lower == b2->lower) return 0;
+    return b1->lower ? -1 : 1;
+  } else if (b1->infinite) {
+    return b1->lower ? -1 : 1;
+  } else if (b2->infinite) {
+    return b2->lower ? 1 : -1;
+  }
+
+  if (state->compare_kind == NO_GAPS_COMPARE_INT32) {
+    int32 v1 = DatumGetInt32(b1->val), v2 = DatumGetInt32(b2->val);
+    result = (v1 > v2) - (v1 < v2);
+  } else {
+    int64 v1 = DatumGetInt64(b1->val), v2 = DatumGetInt64(b2->val);
+    result = (v1 > v2) - (v1 < v2);
+  }
+
+  // Equal values still differ by their inclusiveness, like in range_cmp_bounds().
+  if (result == 0) {
+    if (!b1->inclusive && !b2->inclusive) {
+      if (b1->lower == b2->lower) return 0;
+      return b1->lower ? 1 : -1;
+    } else if (!b1->inclusive) {
+      return b1->lower ? 1 : -1;
+    } else if (!b2->inclusive) {
+      return b2->lower ? -1 : 1;
+    }
+  }
+  return result;
+}
+
+// The target must be the same for all the rows, which it usually is byte for byte.
+static inline bool no_gaps_same_target(no_gaps_state *state, RangeType *target)
+{
+  if (target == state->target) return true;
+  if (VARSIZE(target) == VARSIZE(state->target) &&
+      memcmp(target, state->target, VARSIZE(target)) == 0) return true;
+  return !range_ne_internal(state->typcache, state->target, target);
+}
+
+// Keep a copy of a bound value passed by reference in a buffer of the state,
+// which only grows when a longer value comes, so that memory stays constant.
+static void no_gaps_copy_bound(no_gaps_state *state, RangeBound *bound, void **buf, Size *bufsize, MemoryContext aggContext)
+{
+  Size size;
+
+  if (state->elem_byval || bound->infinite) return;
+
+  size = state->elem_len > 0 ? (Size)state->elem_len : VARSIZE_ANY(DatumGetPointer(bound->val));
+  if (size > *bufsize) {
+    if (*buf != NULL) pfree(*buf);
+    *buf = MemoryContextAlloc(aggContext, size);
+    *bufsize = size;
+  }
+  memcpy(*buf, DatumGetPointer(bound->val), size);
+  bound->val = PointerGetDatum(*buf);
+}
+
+static void no_gaps_copy_covered_to(no_gaps_state *state, MemoryContext aggContext)
+{
+  no_gaps_copy_bound(state, &state->covered_to, &state->covered_to_buf, &state->covered_to_bufsize, aggContext);
+}
+
+// Create the state on the first row of a group, analysing the target.
+static no_gaps_state *no_gaps_state_create(FunctionCallInfo fcinfo, MemoryContext aggContext)
+{
+  no_gaps_state *state;
+  RangeType *target_range;
+
+  // Need to use MemoryContextAlloc with aggContext, not just palloc0,
+  // or the state will get cleared in between invocations:
+  state = (no_gaps_state *)MemoryContextAllocZero(aggContext, sizeof(no_gaps_state));
+  state->finished = false;
+  state->no_gaps = false;
+
+  // Technically this will fail to detect an inconsistent target
+  // if only the first row is NULL or has an empty range, however,
+  // any target problem will be detected when the data is present.
+  if (PG_ARGISNULL(2) || RangeIsEmpty(target_range = PG_GETARG_RANGE_P(2))) {
+    // return NULL from the whole thing
+    state->answer_is_null = true;
+    state->finished = true;
+    return state;
+  }
+  state->answer_is_null = false;
+
+  state->target = (RangeType *)MemoryContextAlloc(aggContext, VARSIZE(target_range));
+  memcpy(state->target, target_range, VARSIZE(target_range));
+  state->typcache = range_get_typcache(fcinfo, RangeTypeGetOid(state->target));
+  range_deserialize(state->typcache, state->target, &state->target_start, &state->target_end, &state->target_empty);
+
+  state->elem_byval = state->typcache->rngelemtype->typbyval;
+  state->elem_len = state->typcache->rngelemtype->typlen;
+  switch (state->typcache->rngelemtype->type_id) {
+    case INT4OID:
+    case DATEOID:
+      state->compare_kind = NO_GAPS_COMPARE_INT32;
+      break;
+    case INT8OID:
+    case TIMESTAMPOID:
+    case TIMESTAMPTZOID:
+      // These are only passed by value on 64-bit platforms.
+      state->compare_kind = state->elem_byval ? NO_GAPS_COMPARE_INT64 : NO_GAPS_COMPARE_GENERIC;
+      break;
+    default:
+      state->compare_kind = NO_GAPS_COMPARE_GENERIC;
+      break;
+  }
+
+  return state;
+}
+
 Datum no_gaps_transfn(PG_FUNCTION_ARGS)
 {
-  MemoryContext aggContext, oldContext;
+  MemoryContext aggContext;
   no_gaps_state *state;
-  RangeType *current_range,
-            *target_range;
+  RangeType *current_range;
   RangeBound current_start, current_end;
-  TypeCacheEntry *typcache, *elem_typcache;
-  Oid elem_oid;
   bool current_empty;
   bool first_time;
 
@@ -78,49 +283,16 @@ Datum no_gaps_transfn(PG_FUNCTION_ARGS)
   // First run of the aggregate function.
   // Create the state and analyse the input arguments.
   if (PG_ARGISNULL(0)) {
-    // Need to use MemoryContextAlloc with aggContext, not just palloc0,
-    // or the state will get cleared in between invocations:
-    state = (no_gaps_state *)MemoryContextAlloc(aggContext, sizeof(no_gaps_state));
-    state->finished = false;
-    state->no_gaps = false;
+    state = no_gaps_state_create(fcinfo, aggContext);
     first_time = true;
+    if (state->answer_is_null) PG_RETURN_POINTER(state);
 
-    // Technically this will fail to detect an inconsistent target
-    // if only the first row is NULL or has an empty range, however,
-    // any target problem will be detected when the data is present.
-    if (PG_ARGISNULL(2) || RangeIsEmpty(target_range = PG_GETARG_RANGE_P(2))) {
-      // return NULL from the whole thing
-      state->answer_is_null = true;
-      state->finished = true;
-      PG_RETURN_POINTER(state);
-    }
-    state->answer_is_null = false;
-
-    state->target = (RangeType *)MemoryContextAlloc(aggContext, VARSIZE(PG_GETARG_RANGE_P(2)));
-    memcpy(state->target, target_range, VARSIZE(target_range));
-    typcache = range_get_typcache(fcinfo, RangeTypeGetOid(state->target));
-    range_deserialize(typcache, state->target, &state->target_start, &state->target_end, &state->target_empty);
-    elem_oid = typcache->rngelemtype->type_id;
-    elem_typcache = lookup_type_cache(elem_oid, 0);
-
-    //ereport(DEBUG1, (errmsg("target is [%s, %s)", DatumGetString(elem_oid, state->target_start), DatumGetString(elem_oid, state->target_end))));
-
-    // Initialize covered_to to negative infinity bound, and make sure it is allocated for regular free.
-    //if (!elem_typcache->typbyval && elem_typcache->typlen == -1) {
-    //  ereport(DEBUG1, (errmsg("Performing memory copy.")));  
-    //  oldContext = MemoryContextSwitchTo(aggContext);
-    //  state->covered_to.val = datumCopy(DatumNegativeInfinity(elem_oid), /*pass by reference when false*/ false, /*dynamic length when -1*/ -1);
-    //  MemoryContextSwitchTo(oldContext);
-    //} else {
-    //    ereport(DEBUG1, (errmsg("Skipping memory copy.")));
-        state->covered_to.val = DatumNegativeInfinity(elem_oid);
-    //}
+    // Start from negative infinity, so the value itself does not matter.
+    state->covered_to.val = (Datum) 0;
     state->covered_to.infinite = true;
     state->covered_to.inclusive = true;
     state->covered_to.lower = true;
-    //ereport(DEBUG1, (errmsg("initial covered_to is %s", DatumGetString(elem_oid, state->covered_to))));
   } else {
-    // ereport(NOTICE, (errmsg("looking up state....")));
     state = (no_gaps_state *)PG_GETARG_POINTER(0);
 
     // TODO: Is there any better way to exit an aggregation early?
@@ -130,11 +302,7 @@ Datum no_gaps_transfn(PG_FUNCTION_ARGS)
     first_time = false;
 
     // Make sure the second arg is always the same:
-    typcache = range_get_typcache(fcinfo, RangeTypeGetOid(state->target));
-    elem_oid = typcache->rngelemtype->type_id;
-    elem_typcache = lookup_type_cache(elem_oid, 0);
-
-    if (PG_ARGISNULL(2) || range_ne_internal(typcache, state->target, PG_GETARG_RANGE_P(2))) {
+    if (PG_ARGISNULL(2) || !no_gaps_same_target(state, PG_GETARG_RANGE_P(2))) {
       ereport(ERROR, (errmsg("no_gaps second argument must be constant across the group")));
     }
   }
@@ -149,12 +317,7 @@ Datum no_gaps_transfn(PG_FUNCTION_ARGS)
     }
   }
 
-  range_deserialize(typcache, current_range, &current_start, &current_end, &current_empty);
-
-  oldContext = MemoryContextSwitchTo(aggContext);
-  //ereport(DEBUG1, (errmsg("current is [%s, %s)", DatumGetString(elem_oid, current_start), DatumGetString(elem_oid, current_end))));
-  //ereport(DEBUG1, (errmsg("pre state->covered_to is %s", DatumGetString(elem_oid, state->covered_to))));
-  MemoryContextSwitchTo(oldContext);
+  range_deserialize(state->typcache, current_range, &current_start, &current_end, &current_empty);
 
   if (first_time) {
     // If the target range start is unbounded, but the current range start is not, then we cannot have full coverage
@@ -164,62 +327,42 @@ Datum no_gaps_transfn(PG_FUNCTION_ARGS)
       PG_RETURN_POINTER(state);
     }
     // If the current range starts after the target range starts, then we have a gap
-    if (range_cmp_bounds(typcache, &current_start, &state->target_start) > 0) {
+    if (no_gaps_cmp_bounds(state, &current_start, &state->target_start) > 0) {
       state->finished = true;
       state->no_gaps = false;
       PG_RETURN_POINTER(state);
     }
   } else {
     // For subsequent ranges, check if there is a gap between the end of the covered range and the start of the current range
-    if (range_cmp_bounds(typcache, &state->covered_to, &current_start) < 0) {
+    if (no_gaps_cmp_bounds(state, &state->covered_to, &current_start) < 0) {
       state->finished = true;
       state->no_gaps = false;
       PG_RETURN_POINTER(state);
     }
   }
-  
+
   // If the current range starts after the last covered range, it means the ranges are not sorted
-  if (range_cmp_bounds(typcache, &current_start, &state->covered_to) < 0) {
-    //ereport(ERROR, (errmsg(
-    //    "no_gaps first argument should be sorted but got %s after covering up to %s",
-    //    DatumGetString(elem_oid, current_start),
-    //    DatumGetString(elem_oid, state->covered_to)
-    //)));
+  if (no_gaps_cmp_bounds(state, &current_start, &state->covered_to) < 0) {
     ereport(ERROR, (errmsg(
       "no_gaps first argument should be sorted but got a range ending before the last covered_to"
     )));
   }
-  
+
   // Update the covered range if the current range extends beyond it
-  if (range_cmp_bounds(typcache, &current_end, &state->covered_to) > 0) {
+  if (no_gaps_cmp_bounds(state, &current_end, &state->covered_to) > 0) {
     state->covered_to = current_end;
-    if (!elem_typcache->typbyval && elem_typcache->typlen == -1) {
-        //ereport(DEBUG1, (errmsg("Performing memory copy.")));
-        //ereport(DEBUG1, (errmsg("Before pfree(state->covered_to.val)")));
-        oldContext = MemoryContextSwitchTo(aggContext);
-        // The first covered_to is not allocated on the stack, so it can not be freed...
-        //pfree(state->covered_to.val);
-        //ereport(DEBUG1, (errmsg("Before datumCopy.")));
-        state->covered_to.val = datumCopy(current_end.val, /*pass by reference when false*/ false, /*dynamic length when -1*/ -1);
-        //ereport(DEBUG1, (errmsg("After datumCopy.")));
-        MemoryContextSwitchTo(oldContext);
-    } else {
-        //ereport(DEBUG1, (errmsg("Skipping memory copy.")));
-    }
-    
+    no_gaps_copy_covered_to(state, aggContext);
+
     // Notice that the previous non-inclusive end is included in the next start.
     state->covered_to.inclusive = true;
   }
-  
+
   // If the covered range now extends to or beyond the target end, we have full coverage
-  if (!state->target_end.infinite && range_cmp_bounds(typcache, &state->covered_to, &state->target_end) >= 0) {
+  if (!state->target_end.infinite && no_gaps_cmp_bounds(state, &state->covered_to, &state->target_end) >= 0) {
     state->no_gaps = true;
     state->finished = true;
   }
-  //oldContext = MemoryContextSwitchTo(aggContext);
-  //ereport(DEBUG1, (errmsg("post state->covered_to is %s", DatumGetString(elem_oid, state->covered_to))));
-  //MemoryContextSwitchTo(oldContext);
-  
+
   PG_RETURN_POINTER(state);
 }
 
@@ -238,70 +381,649 @@ Datum no_gaps_finalfn(PG_FUNCTION_ARGS)
 }
 
 
-Datum DatumNegativeInfinity(Oid elem_oid)
-{
-    switch (elem_oid)
-    {
-        case INT4OID:
-            return Int32GetDatum(INT32_MIN);
-        case INT8OID:
-            return Int64GetDatum(INT64_MIN);
-        case DATEOID:
-            return DateADTGetDatum(DATEVAL_NOBEGIN);
-        case NUMERICOID:
-        {
-            text* negativeInfinityText = cstring_to_text("-Infinity");
-            Datum negativeInfinityDatum = DirectFunctionCall1(numeric_in, PointerGetDatum(negativeInfinityText));
-            pfree(negativeInfinityText);
-            return negativeInfinityDatum;
-        }
-        case TIMESTAMPOID:
-        case TIMESTAMPTZOID:
-            return DatumGetTimestampTz(DT_NOBEGIN);
-        default:
-            elog(ERROR, "Unsupported range type: %u", elem_oid);
-            return (Datum) 0;  // This line will not be reached due to the elog(ERROR) above
+static no_gaps_set_state *no_gaps_set_create(MemoryContext context, TypeCacheEntry *typcache, RangeType *target)
+{
+  no_gaps_set_state *state;
+  bool target_empty;
+
+  state = (no_gaps_set_state *)MemoryContextAllocZero(context, sizeof(no_gaps_set_state));
+  state->context = context;
+  state->typcache = typcache;
+
+  // Like no_gaps, a missing or empty target makes the answer NULL.
+  if (target == NULL || RangeIsEmpty(target)) {
+    state->answer_is_null = true;
+    return state;
+  }
+
+  state->target = (RangeType *)MemoryContextAlloc(context, VARSIZE(target));
+  memcpy(state->target, target, VARSIZE(target));
+  range_deserialize(typcache, state->target, &state->target_start, &state->target_end, &target_empty);
+
+  state->maxitems = 64;
+  state->items = (no_gaps_interval *)MemoryContextAlloc(context, state->maxitems * sizeof(no_gaps_interval));
+  return state;
+}
+
+// Set the bounds of an interval, copying their values into the state if need be.
+static void no_gaps_set_assign(no_gaps_set_state *state, no_gaps_interval *item, RangeBound lower, RangeBound upper, bool is_new)
+{
+  RangeType *old_range = is_new ? NULL : item->range;
+  bool empty;
+
+  if (state->typcache->rngelemtype->typbyval) {
+    item->lower = lower;
+    item->upper = upper;
+    item->range = NULL;
+    return;
+  }
+
+  // The bounds may point into the old range, so free it last.
+  item->range = make_range_noerror(state->typcache, &lower, &upper);
+  range_deserialize(state->typcache, item->range, &item->lower, &item->upper, &empty);
+  if (old_range != NULL) pfree(old_range);
+}
+
+static int no_gaps_interval_cmp(const void *a, const void *b, void *arg)
+{
+  return range_cmp_bounds((TypeCacheEntry *)arg,
+                          &((const no_gaps_interval *)a)->lower,
+                          &((const no_gaps_interval *)b)->lower);
+}
+
+// Sort the intervals and merge those that overlap or touch.
+static void no_gaps_set_normalize(no_gaps_set_state *state)
+{
+  TypeCacheEntry *typcache = state->typcache;
+  MemoryContext oldContext;
+  int i, n = 0;
+
+  if (state->nitems < 2) return;
+
+  oldContext = MemoryContextSwitchTo(state->context);
+  qsort_arg(state->items, state->nitems, sizeof(no_gaps_interval), no_gaps_interval_cmp, typcache);
+
+  for (i = 0; i < state->nitems; i++) {
+    no_gaps_interval *item = &state->items[i];
+    no_gaps_interval *last = n > 0 ? &state->items[n - 1] : NULL;
+
+    if (last != NULL &&
+        (range_cmp_bounds(typcache, &last->upper, &item->lower) >= 0 ||
+         bounds_adjacent(typcache, last->upper, item->lower))) {
+      if (range_cmp_bounds(typcache, &item->upper, &last->upper) > 0) {
+        no_gaps_set_assign(state, last, last->lower, item->upper, false);
+      }
+      if (item->range != NULL) pfree(item->range);
+    } else {
+      state->items[n++] = *item;
+    }
+  }
+  state->nitems = n;
+
+  MemoryContextSwitchTo(oldContext);
+}
+
+// Add the part of [lower, upper) within the target.
+static void no_gaps_set_add(no_gaps_set_state *state, RangeBound lower, RangeBound upper)
+{
+  TypeCacheEntry *typcache = state->typcache;
+  MemoryContext oldContext;
+
+  if (range_cmp_bounds(typcache, &lower, &state->target_start) < 0) lower = state->target_start;
+  if (range_cmp_bounds(typcache, &upper, &state->target_end) > 0) upper = state->target_end;
+  if (range_cmp_bounds(typcache, &lower, &upper) > 0) return;
+
+  if (state->nitems == state->maxitems) {
+    no_gaps_set_normalize(state);
+    // Make room for more if merging did not free enough.
+    if (state->nitems > state->maxitems / 2) {
+      state->maxitems *= 2;
+      state->items = (no_gaps_interval *)repalloc(state->items, state->maxitems * sizeof(no_gaps_interval));
+    }
+  }
+
+  oldContext = MemoryContextSwitchTo(state->context);
+  no_gaps_set_assign(state, &state->items[state->nitems++], lower, upper, true);
+  MemoryContextSwitchTo(oldContext);
+}
+
+// Get the state of a group, creating it on its first row, and check that the
+// target stays the same.
+static no_gaps_set_state *no_gaps_set_get_state(FunctionCallInfo fcinfo, MemoryContext aggContext)
+{
+  no_gaps_set_state *state;
+
+  if (PG_ARGISNULL(0)) {
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, get_fn_expr_argtype(fcinfo->flinfo, 2));
+
+    state = no_gaps_set_create(aggContext, typcache, PG_ARGISNULL(2) ? NULL : PG_GETARG_RANGE_P(2));
+  } else {
+    state = (no_gaps_set_state *)PG_GETARG_POINTER(0);
+
+    if (!state->answer_is_null &&
+        (PG_ARGISNULL(2) || range_ne_internal(state->typcache, state->target, PG_GETARG_RANGE_P(2)))) {
+      ereport(ERROR, (errmsg("no_gaps_unordered second argument must be constant across the group")));
+    }
+  }
+  return state;
+}
+
+Datum no_gaps_unordered_transfn(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggContext;
+  no_gaps_set_state *state;
+  RangeType *current_range;
+  RangeBound current_start, current_end;
+  bool current_empty;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "no_gaps_unordered called in non-aggregate context");
+  }
+
+  state = no_gaps_set_get_state(fcinfo, aggContext);
+  if (state->answer_is_null || PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
+
+  current_range = PG_GETARG_RANGE_P(1);
+  if (RangeTypeGetOid(current_range) != RangeTypeGetOid(state->target)) {
+    elog(ERROR, "range types do not match");
+  }
+
+  if (!range_overlaps_internal(state->typcache, current_range, state->target)) PG_RETURN_POINTER(state);
+
+  range_deserialize(state->typcache, current_range, &current_start, &current_end, &current_empty);
+  no_gaps_set_add(state, current_start, current_end);
+
+  PG_RETURN_POINTER(state);
+}
+
+Datum no_gaps_unordered_combinefn(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggContext;
+  no_gaps_set_state *state1, *state2;
+  int i;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "no_gaps_unordered_combinefn called in non-aggregate context");
+  }
+
+  state1 = PG_ARGISNULL(0) ? NULL : (no_gaps_set_state *)PG_GETARG_POINTER(0);
+  state2 = PG_ARGISNULL(1) ? NULL : (no_gaps_set_state *)PG_GETARG_POINTER(1);
+
+  if (state2 == NULL) {
+    if (state1 == NULL) PG_RETURN_NULL();
+    PG_RETURN_POINTER(state1);
+  }
+
+  // The second state may not live in the aggregate context, so copy it over.
+  if (state1 == NULL) {
+    state1 = no_gaps_set_create(aggContext, state2->typcache, state2->answer_is_null ? NULL : state2->target);
+  } else if (!state1->answer_is_null && !state2->answer_is_null &&
+             range_ne_internal(state1->typcache, state1->target, state2->target)) {
+    ereport(ERROR, (errmsg("no_gaps_unordered second argument must be constant across the group")));
+  }
+
+  if (state2->answer_is_null) state1->answer_is_null = true;
+  if (state1->answer_is_null) PG_RETURN_POINTER(state1);
+
+  for (i = 0; i < state2->nitems; i++) {
+    no_gaps_set_add(state1, state2->items[i].lower, state2->items[i].upper);
+  }
+
+  PG_RETURN_POINTER(state1);
+}
+
+Datum no_gaps_unordered_serialfn(PG_FUNCTION_ARGS)
+{
+  no_gaps_set_state *state;
+  StringInfoData buf;
+  int i;
+
+  if (!AggCheckCallContext(fcinfo, NULL)) {
+    elog(ERROR, "no_gaps_unordered_serialfn called in non-aggregate context");
+  }
+
+  state = (no_gaps_set_state *)PG_GETARG_POINTER(0);
+  no_gaps_set_normalize(state);
+
+  // The ranges are sent as they are in memory, as they only go to other
+  // backends of the same server.
+  pq_begintypsend(&buf);
+  pq_sendint32(&buf, state->typcache->type_id);
+  pq_sendbyte(&buf, state->answer_is_null);
+  if (!state->answer_is_null) {
+    pq_sendint32(&buf, VARSIZE(state->target));
+    pq_sendbytes(&buf, (char *)state->target, VARSIZE(state->target));
+    pq_sendint32(&buf, state->nitems);
+    for (i = 0; i < state->nitems; i++) {
+      RangeType *range = make_range_noerror(state->typcache, &state->items[i].lower, &state->items[i].upper);
+
+      pq_sendint32(&buf, VARSIZE(range));
+      pq_sendbytes(&buf, (char *)range, VARSIZE(range));
+      pfree(range);
     }
+  }
+
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+// Copy a range out of the message, as the message data is not aligned.
+static RangeType *no_gaps_getmsgrange(StringInfo buf)
+{
+  int len = pq_getmsgint(buf, 4);
+  RangeType *range = (RangeType *)palloc(len);
+
+  memcpy(range, pq_getmsgbytes(buf, len), len);
+  return range;
 }
 
+Datum no_gaps_unordered_deserialfn(PG_FUNCTION_ARGS)
+{
+  bytea *sstate;
+  no_gaps_set_state *state;
+  TypeCacheEntry *typcache;
+  StringInfoData buf;
+  RangeType *range;
+  RangeBound lower, upper;
+  bool empty;
+  int nitems, i;
+
+  if (!AggCheckCallContext(fcinfo, NULL)) {
+    elog(ERROR, "no_gaps_unordered_deserialfn called in non-aggregate context");
+  }
+
+  sstate = PG_GETARG_BYTEA_PP(0);
+  buf.data = VARDATA_ANY(sstate);
+  buf.len = VARSIZE_ANY_EXHDR(sstate);
+  buf.maxlen = 0;
+  buf.cursor = 0;
+
+  // The combine function copies the state into its own context if it needs to.
+  typcache = range_get_typcache(fcinfo, pq_getmsgint(&buf, 4));
+  if (pq_getmsgbyte(&buf)) {
+    state = no_gaps_set_create(CurrentMemoryContext, typcache, NULL);
+  } else {
+    range = no_gaps_getmsgrange(&buf);
+    state = no_gaps_set_create(CurrentMemoryContext, typcache, range);
+    pfree(range);
 
-char *DatumGetString(Oid elem_oid, RangeBound bound) {
-    char *result;
-
-    switch (elem_oid) {
-        case INT4OID:
-            result = psprintf("%d", DatumGetInt32(bound.val));
-            break;
-        case INT8OID:
-            result = psprintf("%ld", DatumGetInt64(bound.val));
-            break;
-        case DATEOID: {
-            char *dateStr = DatumGetCString(DirectFunctionCall1(date_out, bound.val));
-            result = psprintf("%s", dateStr);
-            //pfree(dateStr);
-            break;
-        }
-        case NUMERICOID: {
-            char *numericStr = DatumGetCString(DirectFunctionCall1(numeric_out, bound.val));
-            result = psprintf("%s", numericStr);
-            //pfree(numericStr);
-            break;
-        }
-        case TIMESTAMPOID: {
-            char *timestampStr = DatumGetCString(DirectFunctionCall1(timestamp_out, bound.val));
-            result = psprintf("%s", timestampStr);
-            //pfree(timestampStr);
-            break;
-        }
-        case TIMESTAMPTZOID: {
-            char *timestamptzStr = DatumGetCString(DirectFunctionCall1(timestamptz_out, bound.val));
-            result = psprintf("%s", timestamptzStr);
-            //pfree(timestamptzStr);
-            break;
-        }
-        default:
-            elog(ERROR, "Unsupported element type id: %u", elem_oid);
-            return NULL; // This line will not be reached due to the elog(ERROR) above
+    nitems = pq_getmsgint(&buf, 4);
+    for (i = 0; i < nitems; i++) {
+      range = no_gaps_getmsgrange(&buf);
+      range_deserialize(typcache, range, &lower, &upper, &empty);
+      no_gaps_set_add(state, lower, upper);
+      pfree(range);
     }
-    return result;
+  }
+  pq_getmsgend(&buf);
+
+  PG_RETURN_POINTER(state);
+}
+
+Datum no_gaps_unordered_finalfn(PG_FUNCTION_ARGS)
+{
+  no_gaps_set_state *state;
+
+  if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+
+  state = (no_gaps_set_state *)PG_GETARG_POINTER(0);
+  if (state->answer_is_null) PG_RETURN_NULL();
+
+  // Once merged, the target is covered if a single interval spans all of it.
+  no_gaps_set_normalize(state);
+  PG_RETURN_BOOL(state->nitems == 1 &&
+                 range_cmp_bounds(state->typcache, &state->items[0].lower, &state->target_start) == 0 &&
+                 range_cmp_bounds(state->typcache, &state->items[0].upper, &state->target_end) == 0);
+}
+
+
+// gaps and covered return what they find as a multirange.  Their states are
+// those of no_gaps and no_gaps_unordered, so they only keep as many ranges as
+// there are gaps.  Multiranges are new in PostgreSQL 14, and the extension
+// script only creates these aggregates from there on.
+
+// The lower bound of whatever comes right after a finite upper bound.
+static inline RangeBound no_gaps_bound_after(RangeBound upper)
+{
+  upper.lower = true;
+  upper.inclusive = !upper.inclusive;
+  return upper;
+}
+
+// The upper bound of whatever comes right before a finite lower bound.
+static inline RangeBound no_gaps_bound_before(RangeBound lower)
+{
+  lower.lower = false;
+  lower.inclusive = !lower.inclusive;
+  return lower;
+}
+
+// Append the range between two bounds to the list, unless it is empty.
+static void no_gaps_list_add(TypeCacheEntry *typcache, no_gaps_range_list *list, MemoryContext context,
+                             RangeBound lower, RangeBound upper)
+{
+  MemoryContext oldContext;
+  RangeType *range;
+
+  if (range_cmp_bounds(typcache, &lower, &upper) > 0) return;
+
+  oldContext = MemoryContextSwitchTo(context);
+  range = make_range_noerror(typcache, &lower, &upper);
+  // A discrete range like (5,6) is empty once canonicalized.
+  if (RangeIsEmpty(range)) {
+    pfree(range);
+  } else {
+    if (list->nranges == list->maxranges) {
+      list->maxranges = list->maxranges == 0 ? 8 : list->maxranges * 2;
+      if (list->ranges == NULL) {
+        list->ranges = (RangeType **)palloc(list->maxranges * sizeof(RangeType *));
+      } else {
+        list->ranges = (RangeType **)repalloc(list->ranges, list->maxranges * sizeof(RangeType *));
+      }
+    }
+    list->ranges[list->nranges++] = range;
+  }
+  MemoryContextSwitchTo(oldContext);
+}
+
+// Append the gap from a lower bound up to a later start, but not past the end of the target.
+static void no_gaps_add_gap(TypeCacheEntry *typcache, no_gaps_range_list *list, MemoryContext context,
+                            RangeBound from, RangeBound next_start, RangeBound target_end)
+{
+  RangeBound upper;
+
+  if (range_cmp_bounds(typcache, &from, &next_start) >= 0) return;
+
+  upper = no_gaps_bound_before(next_start);
+  if (range_cmp_bounds(typcache, &upper, &target_end) > 0) upper = target_end;
+  no_gaps_list_add(typcache, list, context, from, upper);
+}
+
+#if (PG_VERSION_NUM >= 140000)
+static Datum no_gaps_list_result(TypeCacheEntry *typcache, no_gaps_range_list *list)
+{
+  MultirangeType *result;
+
+  result = make_multirange(get_range_multirange(typcache->type_id), typcache, list->nranges, list->ranges);
+  PG_RETURN_MULTIRANGE_P(result);
+}
+#endif
+
+Datum gaps_transfn(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggContext;
+  no_gaps_state *state;
+  RangeType *current_range;
+  RangeBound current_start, current_end, after;
+  bool current_empty;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "gaps called in non-aggregate context");
+  }
+
+  if (PG_ARGISNULL(0)) {
+    state = no_gaps_state_create(fcinfo, aggContext);
+    if (state->answer_is_null) PG_RETURN_POINTER(state);
+
+    // Nothing is covered yet, so the first gap would start with the target.
+    state->gap_from = state->target_start;
+  } else {
+    state = (no_gaps_state *)PG_GETARG_POINTER(0);
+    if (state->finished) PG_RETURN_POINTER(state);
+
+    if (PG_ARGISNULL(2) || !no_gaps_same_target(state, PG_GETARG_RANGE_P(2))) {
+      ereport(ERROR, (errmsg("gaps second argument must be constant across the group")));
+    }
+  }
+
+  if (PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
+
+  current_range = PG_GETARG_RANGE_P(1);
+  if (RangeTypeGetOid(current_range) != RangeTypeGetOid(state->target)) {
+    elog(ERROR, "range types do not match");
+  }
+
+  range_deserialize(state->typcache, current_range, &current_start, &current_end, &current_empty);
+  if (current_empty) PG_RETURN_POINTER(state);
+
+  // A row starting before the previous one could fill a gap already reported.
+  if (state->has_prev_start && no_gaps_cmp_bounds(state, &current_start, &state->prev_start) < 0) {
+    ereport(ERROR, (errmsg(
+      "gaps first argument should be sorted but got a range starting before the previous one"
+    )));
+  }
+  state->prev_start = current_start;
+  state->has_prev_start = true;
+  no_gaps_copy_bound(state, &state->prev_start, &state->prev_start_buf, &state->prev_start_bufsize, aggContext);
+
+  // The rows come sorted, so a row starting after the covered part leaves a
+  // gap that no later row can fill.
+  if (no_gaps_cmp_bounds(state, &state->gap_from, &current_start) < 0) {
+    no_gaps_add_gap(state->typcache, &state->gaps, aggContext, state->gap_from, current_start, state->target_end);
+  }
+
+  if (current_end.infinite) {
+    state->covered_to_infinity = true;
+    state->finished = true;
+    PG_RETURN_POINTER(state);
+  }
+
+  after = no_gaps_bound_after(current_end);
+  if (no_gaps_cmp_bounds(state, &after, &state->gap_from) > 0) {
+    state->gap_from = after;
+    no_gaps_copy_bound(state, &state->gap_from, &state->gap_from_buf, &state->gap_from_bufsize, aggContext);
+  }
+
+  // Once past the end of the target, the remaining rows cannot change the result.
+  if (no_gaps_cmp_bounds(state, &state->gap_from, &state->target_end) > 0) {
+    state->finished = true;
+  }
+
+  PG_RETURN_POINTER(state);
+}
+
+Datum gaps_finalfn(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 140000)
+  no_gaps_state *state;
+  no_gaps_range_list result;
+
+  if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+
+  state = (no_gaps_state *)PG_GETARG_POINTER(0);
+  if (state->answer_is_null) PG_RETURN_NULL();
+
+  // The final function may run more than once on the same state,
+  // so the gap after the last row goes into a copy of the list.
+  result.nranges = state->gaps.nranges;
+  result.maxranges = state->gaps.nranges + 1;
+  result.ranges = (RangeType **)palloc(result.maxranges * sizeof(RangeType *));
+  if (state->gaps.nranges > 0) {
+    memcpy(result.ranges, state->gaps.ranges, state->gaps.nranges * sizeof(RangeType *));
+  }
+  if (!state->covered_to_infinity) {
+    no_gaps_list_add(state->typcache, &result, CurrentMemoryContext, state->gap_from, state->target_end);
+  }
+
+  return no_gaps_list_result(state->typcache, &result);
+#else
+  ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("gaps needs PostgreSQL 14 or later")));
+  PG_RETURN_NULL();
+#endif
+}
+
+Datum gaps_unordered_finalfn(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 140000)
+  no_gaps_set_state *state;
+  no_gaps_range_list result;
+  RangeBound from;
+  int i;
+
+  if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+
+  state = (no_gaps_set_state *)PG_GETARG_POINTER(0);
+  if (state->answer_is_null) PG_RETURN_NULL();
+
+  // The gaps are what lies between the merged intervals within the target.
+  no_gaps_set_normalize(state);
+  memset(&result, 0, sizeof(result));
+  from = state->target_start;
+  for (i = 0; i < state->nitems; i++) {
+    no_gaps_add_gap(state->typcache, &result, CurrentMemoryContext, from, state->items[i].lower, state->target_end);
+    if (state->items[i].upper.infinite) break;
+    from = no_gaps_bound_after(state->items[i].upper);
+  }
+  if (i == state->nitems) {
+    no_gaps_list_add(state->typcache, &result, CurrentMemoryContext, from, state->target_end);
+  }
+
+  return no_gaps_list_result(state->typcache, &result);
+#else
+  ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("gaps_unordered needs PostgreSQL 14 or later")));
+  PG_RETURN_NULL();
+#endif
+}
+
+// The state of covered keeps the intervals within (,), so that nothing gets
+// cut off and the rest of the no_gaps_unordered state works unchanged.
+static no_gaps_set_state *no_gaps_set_create_unbounded(MemoryContext context, TypeCacheEntry *typcache)
+{
+  no_gaps_set_state *state;
+  RangeBound lower, upper;
+  RangeType *everything;
+
+  lower.val = upper.val = (Datum) 0;
+  lower.infinite = upper.infinite = true;
+  lower.inclusive = upper.inclusive = false;
+  lower.lower = true;
+  upper.lower = false;
+  everything = make_range_noerror(typcache, &lower, &upper);
+  state = no_gaps_set_create(context, typcache, everything);
+  pfree(everything);
+  return state;
+}
+
+Datum covered_transfn(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggContext;
+  no_gaps_set_state *state;
+  RangeType *current_range;
+  RangeBound current_start, current_end;
+  bool current_empty;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "covered called in non-aggregate context");
+  }
+
+  if (PG_ARGISNULL(0)) {
+    state = no_gaps_set_create_unbounded(aggContext, range_get_typcache(fcinfo, get_fn_expr_argtype(fcinfo->flinfo, 1)));
+  } else {
+    state = (no_gaps_set_state *)PG_GETARG_POINTER(0);
+  }
+
+  if (PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
+
+  current_range = PG_GETARG_RANGE_P(1);
+  range_deserialize(state->typcache, current_range, &current_start, &current_end, &current_empty);
+  if (!current_empty) no_gaps_set_add(state, current_start, current_end);
+
+  PG_RETURN_POINTER(state);
+}
+
+Datum covered_finalfn(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 140000)
+  no_gaps_set_state *state;
+  no_gaps_range_list result;
+  int i;
+
+  if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+
+  state = (no_gaps_set_state *)PG_GETARG_POINTER(0);
+  no_gaps_set_normalize(state);
+  memset(&result, 0, sizeof(result));
+  for (i = 0; i < state->nitems; i++) {
+    no_gaps_list_add(state->typcache, &result, CurrentMemoryContext, state->items[i].lower, state->items[i].upper);
+  }
+
+  return no_gaps_list_result(state->typcache, &result);
+#else
+  ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("covered needs PostgreSQL 14 or later")));
+  PG_RETURN_NULL();
+#endif
+}
+
+
+// no_gaps, gaps and covered also take multiranges.  Their ranges go into the
+// interval set of no_gaps_unordered one by one, so the rows can come in any
+// order, and the final functions are the same.
+
+#if (PG_VERSION_NUM >= 140000)
+static void no_gaps_set_add_multirange(no_gaps_set_state *state, MultirangeType *multirange)
+{
+  TypeCacheEntry *rangetyp = state->typcache;
+  RangeBound lower, upper;
+  int32 i;
+
+  if (MultirangeTypeGetOid(multirange) != get_range_multirange(rangetyp->type_id)) {
+    elog(ERROR, "range types do not match");
+  }
+
+  // No need to check for overlaps, as the bounds are clipped to the target.
+  for (i = 0; i < multirange->rangeCount; i++) {
+    multirange_get_bounds(rangetyp, multirange, i, &lower, &upper);
+    no_gaps_set_add(state, lower, upper);
+  }
+}
+#endif
+
+Datum no_gaps_multirange_transfn(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 140000)
+  MemoryContext aggContext;
+  no_gaps_set_state *state;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "no_gaps called in non-aggregate context");
+  }
+
+  state = no_gaps_set_get_state(fcinfo, aggContext);
+  if (state->answer_is_null || PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
+
+  no_gaps_set_add_multirange(state, PG_GETARG_MULTIRANGE_P(1));
+
+  PG_RETURN_POINTER(state);
+#else
+  ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("multiranges need PostgreSQL 14 or later")));
+  PG_RETURN_NULL();
+#endif
+}
+
+Datum covered_multirange_transfn(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 140000)
+  MemoryContext aggContext;
+  no_gaps_set_state *state;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "covered called in non-aggregate context");
+  }
+
+  if (PG_ARGISNULL(0)) {
+    TypeCacheEntry *mltrngtypcache = multirange_get_typcache(fcinfo, get_fn_expr_argtype(fcinfo->flinfo, 1));
+
+    state = no_gaps_set_create_unbounded(aggContext, mltrngtypcache->rngtype);
+  } else {
+    state = (no_gaps_set_state *)PG_GETARG_POINTER(0);
+  }
+
+  if (PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
+
+  no_gaps_set_add_multirange(state, PG_GETARG_MULTIRANGE_P(1));
+
+  PG_RETURN_POINTER(state);
+#else
+  ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("multiranges need PostgreSQL 14 or later")));
+  PG_RETURN_NULL();
+#endif
 }
@@ -11,13 +11,19 @@
 #endif
 #include "access/tupconvert.h"
 #include "access/xact.h"
+#include "catalog/pg_trigger.h"
 #include "catalog/pg_type.h"
 #include "commands/trigger.h"
 #include "datatype/timestamp.h"
+#include "executor/executor.h"
 #include "executor/spi.h"
 #include "funcapi.h"
 #include "lib/stringinfo.h"
+#include "miscadmin.h"
 #include "nodes/bitmapset.h"
+#include "nodes/parsenodes.h"
+#include "nodes/pg_list.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/date.h"
 #include "utils/datum.h"
@@ -26,17 +32,23 @@
 #else
 #include "utils/fmgrprotos.h"
 #endif
+#include "utils/guc.h"
 #include "utils/hsearch.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/timestamp.h"
 
+#include "metadata.h"
+#include "periods.h"
+
 PGDLLEXPORT Datum generated_always_as_row_start_end(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum write_history(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum update_portion_of(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(generated_always_as_row_start_end);
 PG_FUNCTION_INFO_V1(write_history);
+PG_FUNCTION_INFO_V1(update_portion_of);
 
 /* Define some SQLSTATEs that might not exist */
 #if (PG_VERSION_NUM < 100000)
@@ -75,181 +87,197 @@ CreateInsertHistoryPlanHash(void)
 {
 	HASHCTL	ctl;
 
+	MemSet(&ctl, 0, sizeof(ctl));
 	ctl.keysize = sizeof(Oid);
 	ctl.entrysize = sizeof(InsertHistoryPlanEntry);
 
 	return hash_create("Insert History Hash", 16, &ctl, HASH_ELEM | HASH_BLOBS);
 }
 
-static void
-GetPeriodColumnNames(Relation rel, char *period_name, char **start_name, char **end_name)
-{
-	int				ret;
-	Datum			values[2];
-	SPITupleTable  *tuptable;
-	bool			is_null;
-	Datum			dat;
-	MemoryContext	mcxt = CurrentMemoryContext; /* The context outside of SPI */
-
-	const char *sql =
-		"SELECT p.start_column_name, p.end_column_name "
-		"FROM periods.periods AS p "
-		"WHERE (p.table_name, p.period_name) = ($1, $2)";
-	static SPIPlanPtr qplan = NULL;
-
-	if (SPI_connect() != SPI_OK_CONNECT)
-		elog(ERROR, "SPI_connect failed");
-
-	/*
-	 * Query the periods table to get the start and end columns.
-	 * Cache the plan if we haven't already.
-	 */
-	if (qplan == NULL)
-	{
-		Oid	types[2] = {OIDOID, NAMEOID};
+/*
+ * What our catalogs say about the SYSTEM_TIME era of each table, so that the
+ * triggers do not query them for every row.
+ */
+static HTAB *SystemTimeHash = NULL;
 
-		qplan = SPI_prepare(sql, 2, types);
-		if (qplan == NULL)
-			elog(ERROR, "SPI_prepare returned %s for %s",
-				 SPI_result_code_string(SPI_result), sql);
+typedef struct SystemTimeEntry
+{
+	Oid			relid;			/* the hash key; must be first */
+	bool		valid;			/* false if the entry must be reloaded */
+	Oid			history_relid;	/* InvalidOid without SYSTEM VERSIONING */
+	Bitmapset  *excluded_attnums;	/* in CacheMemoryContext */
+} SystemTimeEntry;
 
-		ret = SPI_keepplan(qplan);
-		if (ret != 0)
-			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
-	}
+/*
+ * The rows write_history() has yet to insert into the history tables.
+ *
+ * Inserting them one by one costs an executor startup per row, so they are
+ * queued per table and inserted with a single statement per table once the
+ * outermost statement has finished firing its triggers, or at commit at the
+ * latest.  Each row remembers the subtransaction that queued it so that the
+ * rows of a rolled back subtransaction are dropped with it.  Everything lives
+ * in a child of TopTransactionContext.
+ */
+typedef struct PendingHistoryRows
+{
+	Oid			relid;			/* the hash key; must be first */
+	Oid			history_relid;
+	Oid			userid;			/* write_history() ran as, see below */
+	TupleDesc	tupdesc;		/* copies, as the map points to them */
+	TupleDesc	history_tupdesc;
+	TupleConversionMap *map;	/* NULL if the rows fit the history table */
+	int16		history_end_num;
+	bool		immediate;		/* insert each row as soon as it is queued */
+	int			nrows;
+	int			maxrows;
+	Datum	   *rows;			/* of the row type of the history table */
+	SubTransactionId *subids;
+} PendingHistoryRows;
+
+static HTAB *PendingHistoryHash = NULL;
+static MemoryContext PendingHistoryContext = NULL;
+static bool flushing_pending_history = false;
+
+/* How deep we are in nested ExecutorFinish calls */
+static int	executor_finish_depth = 0;
+
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
 
-	values[0] = ObjectIdGetDatum(rel->rd_id);
-	values[1] = CStringGetDatum(period_name);
-	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
-	if (ret != SPI_OK_SELECT)
-		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+/*
+ * Get the columns bounding a period, which is an era in our catalogs, from the
+ * metadata cache.
+ */
+static void
+GetPeriodColumnNames(Relation rel, char *period_name, char **start_name, char **end_name)
+{
+	SagaEra	   *era;
 
-	/* Make sure we got one */
-	if (SPI_processed == 0)
+	era = GetSagaEra(RelationGetRelid(rel), period_name, true);
+	if (era == NULL)
 		ereport(ERROR,
 				(errmsg("period \"%s\" not found on table \"%s\"",
 						period_name,
 						RelationGetRelationName(rel))));
 
-	/* There is a unique constraint so there shouldn't be more than 1 row */
-	Assert(SPI_processed == 1);
-
-	/*
-	 * Get the names from the result tuple.  We copy them into the original
-	 * context so they don't get wiped out by SPI_finish().
-	 */
-	tuptable = SPI_tuptable;
-
-	dat = SPI_getbinval(tuptable->vals[0], tuptable->tupdesc, 1, &is_null);
-	*start_name = MemoryContextStrdup(mcxt, NameStr(*(DatumGetName(dat))));
-
-	dat = SPI_getbinval(tuptable->vals[0], tuptable->tupdesc, 2, &is_null);
-	*end_name = MemoryContextStrdup(mcxt, NameStr(*(DatumGetName(dat))));
-
-	/* All done with SPI */
-	if (SPI_finish() != SPI_OK_FINISH)
-		elog(ERROR, "SPI_finish failed");
+	*start_name = pstrdup(NameStr(era->start_name));
+	*end_name = pstrdup(NameStr(era->end_name));
 }
 
 /*
- * Check if the only columns changed in an UPDATE are columns that the user is
- * excluding from SYSTEM VERSIONING. One possible use case for this is a
- * "last_login timestamptz" column on a user table.  Arguably, this column
- * should be in another table, but users have requested the feature so let's do
- * it.
+ * Get what our catalogs say about the SYSTEM_TIME era of a table.  The entry
+ * is cached until the metadata of the table is invalidated.
  */
-static bool
-OnlyExcludedColumnsChanged(Relation rel, HeapTuple old_row, HeapTuple new_row)
+static SystemTimeEntry *
+GetSystemTimeEntry(Relation rel)
 {
-	int				ret;
-	int				i;
-	Datum			values[1];
-	TupleDesc		tupdesc = RelationGetDescr(rel);
-	Bitmapset	   *excluded_attnums = NULL;
-	MemoryContext	mcxt = CurrentMemoryContext; /* The context outside of SPI */
+	SystemTimeEntry *entry;
+	Oid			relid = RelationGetRelid(rel);
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	bool		found;
+	int			ret;
+	Datum		values[1];
+	Oid			history_relid = InvalidOid;
+	Bitmapset  *excluded_attnums = NULL;
 
 	const char *sql =
-		"SELECT u.name "
-		"FROM periods.system_time_periods AS stp "
-		"CROSS JOIN unnest(stp.excluded_column_names) AS u (name) "
-		"WHERE stp.table_name = $1";
+		"SELECT sv.history_table_name::oid, ste.excluded_column_names "
+		"FROM sql_saga.system_time_era AS ste "
+		"LEFT JOIN sql_saga.system_versioning AS sv ON sv.table_name = ste.table_name "
+		"WHERE ste.table_name = $1";
 	static SPIPlanPtr qplan = NULL;
 
+	entry = (SystemTimeEntry *) hash_search(SystemTimeHash, &relid, HASH_ENTER, &found);
+	if (found && entry->valid)
+		return entry;
+
+	if (!found)
+		entry->excluded_attnums = NULL;
+	entry->valid = false;
+
 	if (SPI_connect() != SPI_OK_CONNECT)
 		elog(ERROR, "SPI_connect failed");
 
-	/*
-	 * Get the excluded column names.
-	 * Cache the plan if we haven't already.
-	 */
 	if (qplan == NULL)
 	{
 		Oid	types[1] = {OIDOID};
 
-		qplan = SPI_prepare(sql, 1, types);
-		if (qplan == NULL)
-			elog(ERROR, "SPI_prepare returned %s for %s",
-				 SPI_result_code_string(SPI_result), sql);
-
-		ret = SPI_keepplan(qplan);
-		if (ret != 0)
-			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+		qplan = PrepareKeptPlan(sql, 1, types);
 	}
 
-	values[0] = ObjectIdGetDatum(rel->rd_id);
+	values[0] = ObjectIdGetDatum(relid);
 	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
 	if (ret != SPI_OK_SELECT)
 		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
 
-	/* Construct a bitmap of excluded attnums */
-	if (SPI_processed > 0 && SPI_tuptable != NULL)
+	/* There is a primary key so there shouldn't be more than 1 row */
+	if (SPI_processed > 0)
 	{
+		HeapTuple	tuple = SPI_tuptable->vals[0];
 		TupleDesc	spitupdesc = SPI_tuptable->tupdesc;
-		bool		isnull;
+		bool		is_null;
+		Datum		datum;
+		char	  **names;
+		int			nnames;
 		int			i;
 
-		for (i = 0; i < SPI_processed; i++)
-		{
-			HeapTuple	tuple = SPI_tuptable->vals[i];
-			Datum		attdatum;
-			char	   *attname;
-			int16		attnum;
+		datum = SPI_getbinval(tuple, spitupdesc, 1, &is_null);
+		if (!is_null)
+			history_relid = DatumGetObjectId(datum);
 
-			/* Get the attnum from the column name */
-			attdatum = SPI_getbinval(tuple, spitupdesc, 1, &isnull);
-			attname = NameStr(*(DatumGetName(attdatum)));
-			attnum = SPI_fnumber(tupdesc, attname);
+		/* Construct a bitmap of excluded attnums */
+		nnames = GetNameArray(SPI_getbinval(tuple, spitupdesc, 2, &is_null), &names);
+		for (i = 0; i < nnames; i++)
+		{
+			int		attnum = SPI_fnumber(tupdesc, names[i]);
 
 			/* Make sure it's valid (should always be) */
 			if (attnum == SPI_ERROR_NOATTRIBUTE)
 				ereport(ERROR,
 						(errcode(ERRCODE_UNDEFINED_COLUMN),
-						 errmsg("column \"%s\" does not exist", attname)));
+						 errmsg("column \"%s\" does not exist", names[i])));
 
 			/* Just ignore system columns (should never happen) */
 			if (attnum < 0)
 				continue;
 
-			/* Add it to the bitmap set */
 			excluded_attnums = bms_add_member(excluded_attnums, attnum);
 		}
+	}
 
-		/*
-		 * If we have excluded columns, move the bitmapset out of the SPI
-		 * context.
-		 */
-		if (excluded_attnums != NULL)
-		{
-			MemoryContext spicontext = MemoryContextSwitchTo(mcxt);
-			excluded_attnums = bms_copy(excluded_attnums);
-			MemoryContextSwitchTo(spicontext);
-		}
+	/* Move the bitmapset out of the SPI context before it goes away */
+	bms_free(entry->excluded_attnums);
+	entry->excluded_attnums = NULL;
+	if (excluded_attnums != NULL)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(CacheMemoryContext);
+
+		entry->excluded_attnums = bms_copy(excluded_attnums);
+		MemoryContextSwitchTo(oldcxt);
 	}
 
-	/* Don't need SPI anymore */
 	if (SPI_finish() != SPI_OK_FINISH)
 		elog(ERROR, "SPI_finish failed");
 
+	entry->history_relid = history_relid;
+	entry->valid = true;
+
+	return entry;
+}
+
+/*
+ * Check if the only columns changed in an UPDATE are columns that the user is
+ * excluding from SYSTEM VERSIONING. One possible use case for this is a
+ * "last_login timestamptz" column on a user table.  Arguably, this column
+ * should be in another table, but users have requested the feature so let's do
+ * it.
+ */
+static bool
+OnlyExcludedColumnsChanged(Relation rel, HeapTuple old_row, HeapTuple new_row)
+{
+	int				i;
+	TupleDesc		tupdesc = RelationGetDescr(rel);
+	Bitmapset	   *excluded_attnums = GetSystemTimeEntry(rel)->excluded_attnums;
+
 	/* If there are no excluded columns, then we're done */
 	if (excluded_attnums == NULL)
 		return false;
@@ -294,70 +322,13 @@ OnlyExcludedColumnsChanged(Relation rel, HeapTuple old_row, HeapTuple new_row)
 }
 
 /*
- * Get the oid of the history table.  If this table does not have a system_time
- * period an error is raised.  If it doesn't have SYSTEM VERSIONING, then
- * InvalidOid is returned.
+ * Get the oid of the history table.  If this table doesn't have SYSTEM
+ * VERSIONING, then InvalidOid is returned.
  */
 static Oid
 GetHistoryTable(Relation rel)
 {
-	int		ret;
-	Datum	values[1];
-	Oid		result;
-	SPITupleTable  *tuptable;
-	bool			is_null;
-
-	const char *sql =
-		"SELECT history_table_name::oid "
-		"FROM periods.system_versioning AS sv "
-		"WHERE sv.table_name = $1";
-	static SPIPlanPtr qplan = NULL;
-
-	if (SPI_connect() != SPI_OK_CONNECT)
-		elog(ERROR, "SPI_connect failed");
-
-	/*
-	 * Check existence in system_versioning table.
-	 * Cache the plan if we haven't already.
-	 */
-	if (qplan == NULL)
-	{
-		Oid	types[1] = {OIDOID};
-
-		qplan = SPI_prepare(sql, 1, types);
-		if (qplan == NULL)
-			elog(ERROR, "SPI_prepare returned %s for %s",
-				 SPI_result_code_string(SPI_result), sql);
-
-		ret = SPI_keepplan(qplan);
-		if (ret != 0)
-			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
-	}
-
-	values[0] = ObjectIdGetDatum(rel->rd_id);
-	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
-	if (ret != SPI_OK_SELECT)
-		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
-
-	/* Did we get one? */
-	if (SPI_processed == 0)
-	{
-		if (SPI_finish() != SPI_OK_FINISH)
-			elog(ERROR, "SPI_finish failed");
-		return InvalidOid;
-	}
-
-	/* There is a unique constraint so there shouldn't be more than 1 row */
-	Assert(SPI_processed == 1);
-
-	/* Get oid from results */
-	tuptable = SPI_tuptable;
-	result = DatumGetObjectId(SPI_getbinval(tuptable->vals[0], tuptable->tupdesc, 1, &is_null));
-
-	if (SPI_finish() != SPI_OK_FINISH)
-		elog(ERROR, "SPI_finish failed");
-
-	return result;
+	return GetSystemTimeEntry(rel)->history_relid;
 }
 
 static Datum
@@ -516,19 +487,193 @@ generated_always_as_row_start_end(PG_FUNCTION_ARGS)
 	return PointerGetDatum(new_row);
 }
 
+/*
+ * Does the table have enabled AFTER triggers besides those of sql_saga?  They
+ * fire before the statement ends and may look at the history table.
+ */
+static bool
+HasOtherAfterTriggers(Relation rel, Trigger *self)
+{
+	TriggerDesc *trigdesc = rel->trigdesc;
+	Oid			saga_namespace = get_func_namespace(self->tgfoid);
+	int			i;
+
+	if (trigdesc == NULL)
+		return false;
+
+	for (i = 0; i < trigdesc->numtriggers; i++)
+	{
+		Trigger    *trigger = &trigdesc->triggers[i];
+
+		if (trigger->tgisinternal ||
+			trigger->tgenabled == TRIGGER_DISABLED ||
+			!TRIGGER_FOR_AFTER(trigger->tgtype))
+			continue;
+
+		if (get_func_namespace(trigger->tgfoid) != saga_namespace)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Queue a row for the history table, with its ROW END set to the given value.
+ */
+static PendingHistoryRows *
+QueueHistoryRow(Relation rel, Trigger *trigger, Oid history_relid,
+				HeapTuple old_row, const char *end_name, Datum row_end)
+{
+	PendingHistoryRows *pending;
+	Oid			relid = RelationGetRelid(rel);
+	TupleDesc	history_tupledesc;
+	HeapTuple	history_tuple;
+	Datum	   *values;
+	bool	   *nulls;
+	Datum		row;
+	MemoryContext oldcxt;
+	bool		found;
+
+	if (PendingHistoryHash == NULL)
+	{
+		HASHCTL	ctl;
+
+		PendingHistoryContext = AllocSetContextCreate(TopTransactionContext,
+													  "sql_saga pending history rows",
+													  ALLOCSET_DEFAULT_SIZES);
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(PendingHistoryRows);
+		ctl.hcxt = PendingHistoryContext;
+
+		PendingHistoryHash = hash_create("sql_saga pending history rows", 16, &ctl,
+										 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	pending = (PendingHistoryRows *) hash_search(PendingHistoryHash, &relid, HASH_ENTER, &found);
+	if (!found)
+	{
+		Relation	history_rel;
+
+		/* Open the history table to lock it and look at its columns */
+		history_rel = table_open(history_relid, RowExclusiveLock);
+
+		oldcxt = MemoryContextSwitchTo(PendingHistoryContext);
+
+		/*
+		 * Copy the constraints too so that missing attributes are filled in.
+		 * This corrects for bug #16242 which was found by this very problem.
+		 */
+		pending->history_relid = history_relid;
+		pending->userid = GetUserId();
+		pending->tupdesc = CreateTupleDescCopyConstr(RelationGetDescr(rel));
+		pending->history_tupdesc = CreateTupleDescCopyConstr(RelationGetDescr(history_rel));
+		pending->history_end_num = SPI_fnumber(pending->history_tupdesc, end_name);
+		pending->immediate = HasOtherAfterTriggers(rel, trigger);
+
+		/*
+		 * We may have to convert the tuple structure between the table and the
+		 * history table.
+		 *
+		 * See https://github.com/xocolatl/periods/issues/5
+		 */
+#if (PG_VERSION_NUM < 130000)
+		pending->map = convert_tuples_by_name(pending->tupdesc, pending->history_tupdesc,
+											  gettext_noop("could not convert row type"));
+#else
+		pending->map = convert_tuples_by_name(pending->tupdesc, pending->history_tupdesc);
+#endif
+
+		pending->nrows = 0;
+		pending->maxrows = 64;
+		pending->rows = (Datum *) palloc(pending->maxrows * sizeof(Datum));
+		pending->subids = (SubTransactionId *) palloc(pending->maxrows * sizeof(SubTransactionId));
+
+		MemoryContextSwitchTo(oldcxt);
+
+		/* Keep the lock until end of transaction */
+		table_close(history_rel, NoLock);
+	}
+
+	if (pending->map != NULL)
+	{
+#if (PG_VERSION_NUM < 120000)
+		history_tuple = do_convert_tuple(old_row, pending->map);
+#else
+		history_tuple = execute_attr_map_tuple(old_row, pending->map);
+#endif
+		history_tupledesc = pending->history_tupdesc;
+	}
+	else
+	{
+		/* Use the main table's tupledesc so that missing attributes are filled in */
+		history_tuple = old_row;
+		history_tupledesc = pending->tupdesc;
+	}
+
+	/* Build the new tuple for the history table */
+	values = (Datum *) palloc(history_tupledesc->natts * sizeof(Datum));
+	nulls = (bool *) palloc(history_tupledesc->natts * sizeof(bool));
+
+	/* Modify the historical ROW END on the fly */
+	heap_deform_tuple(history_tuple, history_tupledesc, values, nulls);
+	values[pending->history_end_num-1] = row_end;
+	nulls[pending->history_end_num-1] = false;
+	history_tuple = heap_form_tuple(history_tupledesc, values, nulls);
+
+	pfree(values);
+	pfree(nulls);
+
+	/* Keep it as a value of the row type of the history table */
+	oldcxt = MemoryContextSwitchTo(PendingHistoryContext);
+
+	row = heap_copy_tuple_as_datum(history_tuple, pending->history_tupdesc);
+
+	if (pending->nrows == pending->maxrows)
+	{
+		pending->maxrows *= 2;
+		pending->rows = (Datum *) repalloc(pending->rows, pending->maxrows * sizeof(Datum));
+		pending->subids = (SubTransactionId *) repalloc(pending->subids, pending->maxrows * sizeof(SubTransactionId));
+	}
+	pending->rows[pending->nrows] = row;
+	pending->subids[pending->nrows] = GetCurrentSubTransactionId();
+	pending->nrows++;
+
+	MemoryContextSwitchTo(oldcxt);
+
+	return pending;
+}
+
+/*
+ * Insert the queued rows of a table into its history table, all at once.
+ * Must be called while connected to SPI.
+ */
 static void
-insert_into_history(Relation history_rel, HeapTuple history_tuple)
+insert_into_history(PendingHistoryRows *pending)
 {
 	InsertHistoryPlanEntry   *hentry;
 	bool		found;
-	char	   *schemaname = SPI_getnspname(history_rel);
-	char	   *tablename = SPI_getrelname(history_rel);
-	Oid			history_relid = history_rel->rd_id;
+	Oid			history_relid = pending->history_relid;
+	char	   *schemaname = get_namespace_name(get_rel_namespace(history_relid));
+	char	   *tablename = get_rel_name(history_relid);
+	Oid			rowtype = pending->history_tupdesc->tdtypeid;
+	Oid			arraytype;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
 	Datum		value;
+	Oid			save_userid;
+	int			save_sec_context;
 	int			ret;
 
-	if (SPI_connect() != SPI_OK_CONNECT)
-		elog(ERROR, "SPI_connect failed");
+	if (schemaname == NULL || tablename == NULL)
+		elog(ERROR, "cache lookup failed for relation %u", history_relid);
+
+	arraytype = get_array_type(rowtype);
+	if (!OidIsValid(arraytype))
+		elog(ERROR, "could not find array type for data type %s",
+			 format_type_be(rowtype));
 
 	if (!InsertHistoryPlanHash)
 		InsertHistoryPlanHash = CreateInsertHistoryPlanHash();
@@ -542,19 +687,22 @@ insert_into_history(Relation history_rel, HeapTuple history_tuple)
 
 	/* If we didn't find it or the name changed, re-plan it */
 	if (!found ||
-		!strcmp(hentry->schemaname, schemaname) ||
-		!strcmp(hentry->tablename, tablename))
+		strcmp(hentry->schemaname, schemaname) != 0 ||
+		strcmp(hentry->tablename, tablename) != 0)
 	{
 		StringInfo	buf = makeStringInfo();
-		Oid			type = HeapTupleHeaderGetTypeId(history_tuple->t_data);
 
-		appendStringInfo(buf, "INSERT INTO %s VALUES (($1).*)",
+		if (found && hentry->qplan != NULL)
+			SPI_freeplan(hentry->qplan);
+		hentry->qplan = NULL;
+
+		appendStringInfo(buf, "INSERT INTO %s SELECT * FROM unnest($1)",
 				quote_qualified_identifier(schemaname, tablename));
 
 		hentry->history_relid = history_relid;
 		strlcpy(hentry->schemaname, schemaname, sizeof(hentry->schemaname));
 		strlcpy(hentry->tablename, tablename, sizeof(hentry->tablename));
-		hentry->qplan = SPI_prepare(buf->data, 1, &type);
+		hentry->qplan = SPI_prepare(buf->data, 1, &arraytype);
 		if (hentry->qplan == NULL)
 			elog(ERROR, "SPI_prepare returned %s for %s",
 				 SPI_result_code_string(SPI_result), buf->data);
@@ -565,51 +713,214 @@ insert_into_history(Relation history_rel, HeapTuple history_tuple)
 	}
 
 	/* Do the INSERT */
-	value = HeapTupleGetDatum(history_tuple);
+	get_typlenbyvalalign(rowtype, &typlen, &typbyval, &typalign);
+	value = PointerGetDatum(construct_array(pending->rows, pending->nrows,
+											rowtype, typlen, typbyval, typalign));
+
+	/*
+	 * Insert as the user write_history() ran as.  It is SECURITY DEFINER so
+	 * that writers of the table need no privileges on the history table, but
+	 * the queued rows are inserted once it has returned, at the end of the
+	 * statement or at commit.  The current user is then whoever runs at that
+	 * point: the caller of a SECURITY DEFINER function that made the change,
+	 * or a role set just before COMMIT.  That user could lack the privilege
+	 * or, worse, have privileges and row security policies the trigger did
+	 * not run with.  Local user id changes keep SET ROLE out of the insert,
+	 * and an error resets the user with the transaction.
+	 */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(pending->userid, save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
 	ret = SPI_execute_plan(hentry->qplan, &value, NULL, false, 0);
 	if (ret != SPI_OK_INSERT)
 		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
 
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+}
+
+/*
+ * Insert the rows queued so far for a table whose other AFTER triggers must
+ * see them, rather than waiting for the end of the statement.
+ */
+static void
+InsertQueuedHistoryRows(PendingHistoryRows *pending)
+{
+	int			i;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	insert_into_history(pending);
+
 	if (SPI_finish() != SPI_OK_FINISH)
 		elog(ERROR, "SPI_finish failed");
+
+	for (i = 0; i < pending->nrows; i++)
+		pfree(DatumGetPointer(pending->rows[i]));
+	pending->nrows = 0;
 }
 
-Datum
-write_history(PG_FUNCTION_ARGS)
+/*
+ * Insert all the queued rows into their history tables.  The inserts run
+ * statements of their own, so the queue is detached first.
+ */
+static void
+FlushPendingHistory(void)
 {
-	TriggerData	   *trigdata = castNode(TriggerData, fcinfo->context);
-	const char	   *funcname = "write_history";
-	Relation		rel;
-	HeapTuple		old_row, new_row;
-	TupleDesc		tupledesc;
-	char		   *start_name, *end_name;
-	int16			start_num, end_num;
-	Oid				typeid;
-	bool			is_null;
-	Oid				history_id;
-	int				cmp;
-	bool			only_excluded_changed = false;
+	HTAB	   *pending_hash = PendingHistoryHash;
+	MemoryContext pending_cxt = PendingHistoryContext;
+	HASH_SEQ_STATUS status;
+	PendingHistoryRows *pending;
 
-	/*
-	 * Make sure this is being called as an AFTER ROW trigger.  Note:
-	 * translatable error strings are shared with ri_triggers.c, so resist the
-	 * temptation to fold the function name into them.
-	 */
-	if (!CALLED_AS_TRIGGER(fcinfo))
-		ereport(ERROR,
-				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
-				 errmsg("function \"%s\" was not called by trigger manager",
-						funcname)));
+	if (pending_hash == NULL || flushing_pending_history || !IsTransactionState())
+		return;
 
-	if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
-		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
-		ereport(ERROR,
-				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
-				 errmsg("function \"%s\" must be fired AFTER ROW",
-						funcname)));
+	PendingHistoryHash = NULL;
+	PendingHistoryContext = NULL;
+	flushing_pending_history = true;
 
-	/* Get Relation information */
-	rel = trigdata->tg_relation;
+	PG_TRY();
+	{
+		if (SPI_connect() != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect failed");
+
+		hash_seq_init(&status, pending_hash);
+		while ((pending = (PendingHistoryRows *) hash_seq_search(&status)) != NULL)
+		{
+			if (pending->nrows > 0)
+				insert_into_history(pending);
+		}
+
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+	}
+	PG_CATCH();
+	{
+		flushing_pending_history = false;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	flushing_pending_history = false;
+	MemoryContextDelete(pending_cxt);
+}
+
+/*
+ * Flush the history rows once the outermost statement is done, which includes
+ * its AFTER triggers, so that a bulk UPDATE or DELETE inserts them with one
+ * statement per history table.  The statements run by the triggers themselves
+ * finish first and leave their rows to it.
+ */
+static void
+periods_ExecutorFinish(QueryDesc *queryDesc)
+{
+	executor_finish_depth++;
+	PG_TRY();
+	{
+		if (prev_ExecutorFinish)
+			prev_ExecutorFinish(queryDesc);
+		else
+			standard_ExecutorFinish(queryDesc);
+	}
+	PG_CATCH();
+	{
+		executor_finish_depth--;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	executor_finish_depth--;
+
+	if (executor_finish_depth == 0)
+		FlushPendingHistory();
+}
+
+/*
+ * Statements that do not go through the executor, like COPY, can fire the
+ * triggers too, so whatever is left is flushed before commit.
+ */
+static void
+HistoryXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_PRE_COMMIT:
+		case XACT_EVENT_PRE_PREPARE:
+			FlushPendingHistory();
+			break;
+
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+			/* The memory went away with TopTransactionContext */
+			PendingHistoryHash = NULL;
+			PendingHistoryContext = NULL;
+			flushing_pending_history = false;
+			executor_finish_depth = 0;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*
+ * The rows queued by a rolled back subtransaction, and by the subtransactions
+ * it started, are the last ones of each table, so drop them.
+ */
+static void
+HistorySubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+					   SubTransactionId parentSubid, void *arg)
+{
+	HASH_SEQ_STATUS		status;
+	PendingHistoryRows *pending;
+
+	if (event != SUBXACT_EVENT_ABORT_SUB || PendingHistoryHash == NULL)
+		return;
+
+	hash_seq_init(&status, PendingHistoryHash);
+	while ((pending = (PendingHistoryRows *) hash_seq_search(&status)) != NULL)
+	{
+		while (pending->nrows > 0 && pending->subids[pending->nrows - 1] >= mySubid)
+			pending->nrows--;
+	}
+}
+
+Datum
+write_history(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = castNode(TriggerData, fcinfo->context);
+	const char	   *funcname = "write_history";
+	Relation		rel;
+	HeapTuple		old_row, new_row;
+	TupleDesc		tupledesc;
+	char		   *start_name, *end_name;
+	int16			start_num, end_num;
+	Oid				typeid;
+	bool			is_null;
+	Oid				history_id;
+	int				cmp;
+	bool			only_excluded_changed = false;
+
+	/*
+	 * Make sure this is being called as an AFTER ROW trigger.  Note:
+	 * translatable error strings are shared with ri_triggers.c, so resist the
+	 * temptation to fold the function name into them.
+	 */
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						funcname)));
+
+	if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired AFTER ROW",
+						funcname)));
+
+	/* Get Relation information */
+	rel = trigdata->tg_relation;
 	tupledesc = RelationGetDescr(rel);
 
 	/* Get the old data that was updated/deleted */
@@ -719,70 +1030,789 @@ write_history(PG_FUNCTION_ARGS)
 	history_id = GetHistoryTable(rel);
 	if (OidIsValid(history_id))
 	{
-		Relation	history_rel;
-		TupleDesc	history_tupledesc;
-		HeapTuple	history_tuple;
-		int16		history_end_num;
-		TupleConversionMap   *map;
-		Datum	   *values;
-		bool	   *nulls;
-
-		/* Open the history table for inserting */
-		history_rel = table_open(history_id, RowExclusiveLock);
-		history_tupledesc = RelationGetDescr(history_rel);
-		history_end_num = SPI_fnumber(history_tupledesc, end_name);
+		PendingHistoryRows *pending;
 
-		/*
-		 * We may have to convert the tuple structure between the table and the
-		 * history table.
-		 *
-		 * See https://github.com/xocolatl/periods/issues/5
-		 */
-#if (PG_VERSION_NUM < 130000)
-		map = convert_tuples_by_name(tupledesc, history_tupledesc, gettext_noop("could not convert row type"));
-#else
-		map = convert_tuples_by_name(tupledesc, history_tupledesc);
-#endif
-		if (map != NULL)
-		{
+		pending = QueueHistoryRow(rel, trigdata->tg_trigger, history_id,
+								  old_row, end_name, GetRowStart(typeid));
+
+		/* The other AFTER triggers of the table may want to see it */
+		if (pending->immediate)
+			InsertQueuedHistoryRows(pending);
+	}
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * The FOR PORTION OF views.
+ *
+ * Everything update_portion_of() needs to know about a view is kept here,
+ * along with the plans it runs against the table.  The INSERT plan is the
+ * same for every row, but the UPDATE only assigns the columns that were
+ * changed, like the PL/pgSQL version used to do, so there is one plan per set
+ * of changed columns.  A bulk UPDATE through the view usually only needs one.
+ */
+typedef struct PortionOfUpdatePlan
+{
+	Bitmapset  *changed;		/* the view columns assigned */
+	SPIPlanPtr	qplan;
+} PortionOfUpdatePlan;
+
+typedef struct PortionOfViewEntry
+{
+	Oid			view_relid;		/* the hash key; must be first */
+	bool		valid;			/* false if the entry must be reloaded */
+	Oid			table_relid;
+	MemoryContext mcxt;			/* holds everything below */
+	char	   *table_name;		/* qualified and quoted */
+	int16		start_num;		/* the era columns in the view */
+	int16		end_num;
+	FmgrInfo	bounds_cmp;
+	Oid			bounds_collation;
+	int			ninsert;
+	int16	   *insert_nums;	/* the view columns a new row gets */
+	int			nkey;
+	int16	   *key_nums;		/* the view columns identifying a row */
+	SPIPlanPtr	insert_qplan;
+	List	   *update_plans;	/* of PortionOfUpdatePlan */
+	char	   *era_name;
+	int			ncoalesce;
+	int16	   *coalesce_nums;	/* the view columns the coalescing is limited to */
+	SPIPlanPtr	coalesce_qplan;	/* prepared on first use */
+} PortionOfViewEntry;
+
+static HTAB *PortionOfViewHash = NULL;
+
+/* Merge the rows changed through the views with their identical neighbours */
+static bool coalesce_on_write = false;
+
+/*
+ * Generated columns must not be copied into the new rows.  SQL:2016 15.13 GR
+ * 10)b)i)
+ *
+ * We also leave out columns that own a sequence as those are a form of
+ * generated column.  We do not, however, leave out columns that default to
+ * nextval() without owning the underlying sequence.
+ *
+ * Columns belonging to a SYSTEM_TIME period are also left out.
+ *
+ * In addition to what the standard calls for, we also leave out any columns
+ * belonging to primary keys.
+ */
 #if (PG_VERSION_NUM < 120000)
-			history_tuple = do_convert_tuple(old_row, map);
+#define GENERATED_COLUMN_CONDITION "OR a.attidentity <> '' "
 #else
-			history_tuple = execute_attr_map_tuple(old_row, map);
+#define GENERATED_COLUMN_CONDITION "OR a.attidentity <> '' OR a.attgenerated <> '' "
 #endif
-			free_conversion_map(map);
+
+static void
+InvalidatePortionOfViewCallback(Oid relid)
+{
+	HASH_SEQ_STATUS		status;
+	PortionOfViewEntry *entry;
+
+	hash_seq_init(&status, PortionOfViewHash);
+	while ((entry = (PortionOfViewEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (relid == InvalidOid ||
+			entry->view_relid == relid ||
+			entry->table_relid == relid)
+			entry->valid = false;
+	}
+}
+
+static void
+InvalidateSystemTimeCallback(Oid relid)
+{
+	HASH_SEQ_STATUS		status;
+	SystemTimeEntry	   *entry;
+
+	hash_seq_init(&status, SystemTimeHash);
+	while ((entry = (SystemTimeEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (relid == InvalidOid ||
+			entry->relid == relid ||
+			entry->history_relid == relid)
+			entry->valid = false;
+	}
+}
+
+void
+periods_init(void)
+{
+	HASHCTL	ctl;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(PortionOfViewEntry);
+
+	PortionOfViewHash = hash_create("sql_saga FOR PORTION OF view cache", 16, &ctl,
+									HASH_ELEM | HASH_BLOBS);
+
+	RegisterSagaInvalidationCallback(InvalidatePortionOfViewCallback);
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(SystemTimeEntry);
+
+	SystemTimeHash = hash_create("sql_saga SYSTEM_TIME cache", 16, &ctl,
+								 HASH_ELEM | HASH_BLOBS);
+
+	RegisterSagaInvalidationCallback(InvalidateSystemTimeCallback);
+
+	prev_ExecutorFinish = ExecutorFinish_hook;
+	ExecutorFinish_hook = periods_ExecutorFinish;
+
+	RegisterXactCallback(HistoryXactCallback, NULL);
+	RegisterSubXactCallback(HistorySubXactCallback, NULL);
+
+	DefineCustomBoolVariable("sql_saga.coalesce_on_write",
+							 "Coalesces the rows changed through the FOR PORTION OF views.",
+							 "The rows of the same key that end up adjacent and identical "
+							 "to a row updated through the view are merged with it.",
+							 &coalesce_on_write,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
+
+/*
+ * Run a query returning column names of the table and return the matching
+ * columns of the view.  Must be called while connected to SPI.
+ */
+static Bitmapset *
+GetViewColumnsFromQuery(const char *sql, SPIPlanPtr *qplan, Oid table_relid,
+						TupleDesc view_tupdesc)
+{
+	Bitmapset  *result = NULL;
+	Datum		values[1];
+	int			ret;
+	uint64		i;
+
+	if (*qplan == NULL)
+	{
+		Oid	types[1] = {OIDOID};
+
+		*qplan = PrepareKeptPlan(sql, 1, types);
+	}
+
+	values[0] = ObjectIdGetDatum(table_relid);
+	ret = SPI_execute_plan(*qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		char   *attname = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+		int		attnum = SPI_fnumber(view_tupdesc, attname);
+
+		if (attnum > 0)
+			result = bms_add_member(result, attnum);
+	}
+
+	return result;
+}
+
+/*
+ * Fill in a view entry from our catalogs and prepare the INSERT plan.  Must be
+ * called while connected to SPI.
+ */
+static void
+LoadPortionOfView(PortionOfViewEntry *entry, Relation view)
+{
+	TupleDesc		tupdesc = RelationGetDescr(view);
+	Datum			values[1];
+	int				ret;
+	int				i;
+	bool			is_null;
+	char		   *era_name;
+	SagaEra		   *era;
+	Bitmapset	   *generated;
+	Bitmapset	   *key;
+	Oid			   *argtypes;
+	StringInfoData	buf;
+	ListCell	   *lc;
+
+	const char *sql =
+		"SELECT fpv.table_name, fpv.era_name "
+		"FROM sql_saga.api_view AS fpv "
+		"WHERE fpv.view_name = $1";
+	static SPIPlanPtr qplan = NULL;
+
+	const char *generated_sql =
+		"SELECT a.attname "
+		"FROM pg_catalog.pg_attribute AS a "
+		"WHERE a.attrelid = $1 "
+		"  AND a.attnum > 0 "
+		"  AND NOT a.attisdropped "
+		"  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL "
+		"    " GENERATED_COLUMN_CONDITION
+		"    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c "
+		"               WHERE _c.conrelid = a.attrelid "
+		"                 AND _c.contype = 'p' "
+		"                 AND _c.conkey @> ARRAY[a.attnum]) "
+		"    OR EXISTS (SELECT FROM sql_saga.era AS _p "
+		"               WHERE (_p.table_name, _p.era_name) = (a.attrelid, 'system_time') "
+		"                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))";
+	static SPIPlanPtr generated_qplan = NULL;
+
+	/* The rows are found by all the columns that are part of a constraint */
+	const char *key_sql =
+		"SELECT a.attname "
+		"FROM pg_catalog.pg_attribute AS a "
+		"WHERE a.attrelid = $1 "
+		"  AND a.attnum > 0 "
+		"  AND NOT a.attisdropped "
+		"  AND EXISTS (SELECT FROM pg_catalog.pg_constraint AS c "
+		"              WHERE c.conrelid = a.attrelid "
+		"                AND c.conkey @> ARRAY[a.attnum])";
+	static SPIPlanPtr key_qplan = NULL;
+
+	/* Forget the old plans, if any */
+	if (entry->insert_qplan != NULL)
+	{
+		SPI_freeplan(entry->insert_qplan);
+		entry->insert_qplan = NULL;
+	}
+	foreach(lc, entry->update_plans)
+		SPI_freeplan(((PortionOfUpdatePlan *) lfirst(lc))->qplan);
+	entry->update_plans = NIL;
+	if (entry->coalesce_qplan != NULL)
+	{
+		SPI_freeplan(entry->coalesce_qplan);
+		entry->coalesce_qplan = NULL;
+	}
+
+	if (entry->mcxt == NULL)
+		entry->mcxt = AllocSetContextCreate(CacheMemoryContext,
+											"sql_saga FOR PORTION OF view",
+											ALLOCSET_SMALL_SIZES);
+	else
+		MemoryContextReset(entry->mcxt);
+
+	/* Get the table information from this view */
+	if (qplan == NULL)
+	{
+		Oid	types[1] = {OIDOID};
+
+		qplan = PrepareKeptPlan(sql, 1, types);
+	}
+
+	values[0] = ObjectIdGetDatum(entry->view_relid);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_processed == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_RAISE_EXCEPTION),
+				 errmsg("table and era information not found for view \"%s\"",
+						DatumGetCString(DirectFunctionCall1(regclassout,
+								ObjectIdGetDatum(entry->view_relid))))));
+
+	entry->table_relid = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+														SPI_tuptable->tupdesc,
+														1, &is_null));
+	era_name = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2);
+	entry->era_name = MemoryContextStrdup(entry->mcxt, era_name);
+
+	era = GetSagaEra(entry->table_relid, era_name, false);
+
+	entry->start_num = SPI_fnumber(tupdesc, NameStr(era->start_name));
+	entry->end_num = SPI_fnumber(tupdesc, NameStr(era->end_name));
+	if (entry->start_num <= 0 || entry->end_num <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("view \"%s\" does not have the columns of era \"%s\"",
+						RelationGetRelationName(view), era_name)));
+
+	fmgr_info_copy(&entry->bounds_cmp, &era->bounds_cmp, entry->mcxt);
+	entry->bounds_collation = era->bounds_collation;
+
+	generated = GetViewColumnsFromQuery(generated_sql, &generated_qplan,
+										entry->table_relid, tupdesc);
+	key = GetViewColumnsFromQuery(key_sql, &key_qplan,
+								  entry->table_relid, tupdesc);
+
+	entry->table_name = MemoryContextStrdup(entry->mcxt,
+			quote_qualified_identifier(
+				get_namespace_name(get_rel_namespace(entry->table_relid)),
+				get_rel_name(entry->table_relid)));
+
+	entry->insert_nums = (int16 *) MemoryContextAlloc(entry->mcxt,
+			tupdesc->natts * sizeof(int16));
+	entry->key_nums = (int16 *) MemoryContextAlloc(entry->mcxt,
+			tupdesc->natts * sizeof(int16));
+	entry->ninsert = 0;
+	entry->nkey = 0;
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		if (TupleDescAttr(tupdesc, i-1)->attisdropped)
+			continue;
+
+		if (!bms_is_member(i, generated))
+			entry->insert_nums[entry->ninsert++] = i;
+		if (bms_is_member(i, key))
+			entry->key_nums[entry->nkey++] = i;
+	}
+
+	/* Every table with a FOR PORTION OF view has a primary key */
+	if (entry->nkey == 0)
+		elog(ERROR, "table \"%s\" has no constraints to identify its rows",
+			 entry->table_name);
+
+	/* The new rows before and after the portion */
+	initStringInfo(&buf);
+	argtypes = (Oid *) palloc(Max(entry->ninsert, 1) * sizeof(Oid));
+	if (entry->ninsert == 0)
+		appendStringInfo(&buf, "INSERT INTO %s DEFAULT VALUES", entry->table_name);
+	else
+	{
+		appendStringInfo(&buf, "INSERT INTO %s (", entry->table_name);
+		for (i = 0; i < entry->ninsert; i++)
+		{
+			appendStringInfo(&buf, "%s%s", (i > 0 ? ", " : ""),
+							 quote_identifier(SPI_fname(tupdesc, entry->insert_nums[i])));
+			argtypes[i] = SPI_gettypeid(tupdesc, entry->insert_nums[i]);
 		}
-		else
+		appendStringInfoString(&buf, ") VALUES (");
+		for (i = 0; i < entry->ninsert; i++)
+			appendStringInfo(&buf, "%s$%d", (i > 0 ? ", " : ""), i + 1);
+		appendStringInfoString(&buf, ")");
+	}
+
+	entry->insert_qplan = PrepareKeptPlan(buf.data, entry->ninsert, argtypes);
+
+	entry->valid = true;
+}
+
+static PortionOfViewEntry *
+LookupPortionOfView(Relation view)
+{
+	Oid					view_relid = RelationGetRelid(view);
+	PortionOfViewEntry *entry;
+	bool				found;
+
+	entry = (PortionOfViewEntry *) hash_search(PortionOfViewHash, &view_relid,
+											   HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->valid = false;
+		entry->table_relid = InvalidOid;
+		entry->mcxt = NULL;
+		entry->insert_qplan = NULL;
+		entry->update_plans = NIL;
+		entry->coalesce_qplan = NULL;
+	}
+
+	if (!entry->valid)
+		LoadPortionOfView(entry, view);
+
+	return entry;
+}
+
+/*
+ * Find the UPDATE assigning the given columns, or prepare it.  The parameters
+ * are the new values of the changed columns, then the old values of the key
+ * columns, then the bounds of the portion.
+ */
+static SPIPlanPtr
+GetPortionOfUpdatePlan(PortionOfViewEntry *entry, TupleDesc tupdesc,
+					   Bitmapset *changed)
+{
+	PortionOfUpdatePlan *plan;
+	ListCell	   *lc;
+	StringInfoData	buf;
+	Oid			   *argtypes;
+	int				nargs = 0;
+	int				attnum;
+	int				i;
+	MemoryContext	oldcxt;
+
+	foreach(lc, entry->update_plans)
+	{
+		plan = (PortionOfUpdatePlan *) lfirst(lc);
+		if (bms_equal(plan->changed, changed))
+			return plan->qplan;
+	}
+
+	argtypes = (Oid *) palloc((bms_num_members(changed) + entry->nkey + 2) * sizeof(Oid));
+
+	initStringInfo(&buf);
+	appendStringInfo(&buf, "UPDATE %s SET ", entry->table_name);
+	attnum = -1;
+	while ((attnum = bms_next_member(changed, attnum)) >= 0)
+	{
+		appendStringInfo(&buf, "%s%s = $%d", (nargs > 0 ? ", " : ""),
+						 quote_identifier(SPI_fname(tupdesc, attnum)), nargs + 1);
+		argtypes[nargs++] = SPI_gettypeid(tupdesc, attnum);
+	}
+
+	appendStringInfoString(&buf, " WHERE ");
+	for (i = 0; i < entry->nkey; i++)
+	{
+		appendStringInfo(&buf, "%s = $%d AND ",
+						 quote_identifier(SPI_fname(tupdesc, entry->key_nums[i])), nargs + 1);
+		argtypes[nargs++] = SPI_gettypeid(tupdesc, entry->key_nums[i]);
+	}
+
+	appendStringInfo(&buf, "%s > $%d AND %s < $%d",
+					 quote_identifier(SPI_fname(tupdesc, entry->end_num)), nargs + 1,
+					 quote_identifier(SPI_fname(tupdesc, entry->start_num)), nargs + 2);
+	argtypes[nargs++] = SPI_gettypeid(tupdesc, entry->start_num);
+	argtypes[nargs++] = SPI_gettypeid(tupdesc, entry->end_num);
+
+	oldcxt = MemoryContextSwitchTo(entry->mcxt);
+	plan = (PortionOfUpdatePlan *) palloc(sizeof(PortionOfUpdatePlan));
+	plan->changed = bms_copy(changed);
+	plan->qplan = PrepareKeptPlan(buf.data, nargs, argtypes);
+	entry->update_plans = lappend(entry->update_plans, plan);
+	MemoryContextSwitchTo(oldcxt);
+
+	return plan->qplan;
+}
+
+/*
+ * Is the value in the bounds, excluding them?  Any null makes it false, like
+ * it does in SQL.
+ */
+static bool
+IsStrictlyBetween(PortionOfViewEntry *entry, Datum lower, bool lower_isnull,
+				  Datum value, bool value_isnull, Datum upper, bool upper_isnull)
+{
+	if (lower_isnull || value_isnull || upper_isnull)
+		return false;
+
+	return DatumGetInt32(FunctionCall2Coll(&entry->bounds_cmp, entry->bounds_collation,
+										   lower, value)) < 0 &&
+		   DatumGetInt32(FunctionCall2Coll(&entry->bounds_cmp, entry->bounds_collation,
+										   value, upper)) < 0;
+}
+
+static void
+InsertPortionOfRow(PortionOfViewEntry *entry, TupleDesc tupdesc, HeapTuple row)
+{
+	Datum  *values = (Datum *) palloc(Max(entry->ninsert, 1) * sizeof(Datum));
+	char   *nulls = (char *) palloc(Max(entry->ninsert, 1) * sizeof(char));
+	bool	is_null;
+	int		ret;
+	int		i;
+
+	for (i = 0; i < entry->ninsert; i++)
+	{
+		values[i] = SPI_getbinval(row, tupdesc, entry->insert_nums[i], &is_null);
+		nulls[i] = is_null ? 'n' : ' ';
+	}
+
+	ret = SPI_execute_plan(entry->insert_qplan, values, nulls, false, 0);
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+}
+
+/*
+ * Prepare the statement coalescing the rows around an updated row.  It is
+ * limited to the rows with the same values in the columns of the first unique
+ * key of the era, or in all the columns copied to new rows if there is none,
+ * and the coalescing itself is done by the statement sql_saga.coalesce_era()
+ * runs.  Must be called while connected to SPI.
+ */
+static void
+PrepareCoalescePlan(PortionOfViewEntry *entry, TupleDesc tupdesc)
+{
+	Datum			values[3];
+	Oid			   *argtypes;
+	char		  **column_names = NULL;
+	int				ncolumns = 0;
+	int				ret;
+	int				i;
+	bool			is_null;
+	char		   *sql;
+	StringInfoData	buf;
+
+	const char *uk_sql =
+		"SELECT uk.column_names "
+		"FROM sql_saga.unique_keys AS uk "
+		"WHERE (uk.table_name, uk.era_name) = ($1, $2) "
+		"ORDER BY uk.key_name "
+		"LIMIT 1";
+	static SPIPlanPtr uk_qplan = NULL;
+
+	const char *coalesce_sql = "SELECT sql_saga._coalesce_era_sql($1, $2, $3)";
+	static SPIPlanPtr coalesce_qplan = NULL;
+
+	if (uk_qplan == NULL)
+	{
+		Oid	types[2] = {OIDOID, NAMEOID};
+
+		uk_qplan = PrepareKeptPlan(uk_sql, 2, types);
+	}
+
+	values[0] = ObjectIdGetDatum(entry->table_relid);
+	values[1] = DirectFunctionCall1(namein, CStringGetDatum(entry->era_name));
+	ret = SPI_execute_plan(uk_qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_processed > 0)
+		ncolumns = GetNameArray(SPI_getbinval(SPI_tuptable->vals[0],
+											  SPI_tuptable->tupdesc, 1, &is_null),
+								&column_names);
+
+	entry->coalesce_nums = (int16 *) MemoryContextAlloc(entry->mcxt,
+			tupdesc->natts * sizeof(int16));
+	entry->ncoalesce = 0;
+	if (ncolumns > 0)
+	{
+		for (i = 0; i < ncolumns; i++)
 		{
-			history_tuple = old_row;
-
-			/*
-			 * Use the main table's tupledesc if there is no map so that
-			 * missing attributes are filled in.  This corrects for bug #16242
-			 * which was found by this very problem.
-			 */
-			history_tupledesc = tupledesc;
+			int		attnum = SPI_fnumber(tupdesc, column_names[i]);
+
+			if (attnum > 0)
+				entry->coalesce_nums[entry->ncoalesce++] = attnum;
 		}
+	}
+	else
+	{
+		for (i = 0; i < entry->ninsert; i++)
+		{
+			if (entry->insert_nums[i] != entry->start_num &&
+				entry->insert_nums[i] != entry->end_num)
+				entry->coalesce_nums[entry->ncoalesce++] = entry->insert_nums[i];
+		}
+	}
 
-		/* Build the new tuple for the history table */
-		values = (Datum *) palloc(history_tupledesc->natts * sizeof(Datum));
-		nulls = (bool *) palloc(history_tupledesc->natts * sizeof(bool));
+	initStringInfo(&buf);
+	argtypes = (Oid *) palloc(Max(entry->ncoalesce, 1) * sizeof(Oid));
+	for (i = 0; i < entry->ncoalesce; i++)
+	{
+		appendStringInfo(&buf, "%st.%s %s $%d", (i > 0 ? " AND " : ""),
+						 quote_identifier(SPI_fname(tupdesc, entry->coalesce_nums[i])),
+						 (ncolumns > 0 ? "=" : "IS NOT DISTINCT FROM"), i + 1);
+		argtypes[i] = SPI_gettypeid(tupdesc, entry->coalesce_nums[i]);
+	}
 
-		/* Modify the historical ROW END on the fly */
-		heap_deform_tuple(history_tuple, history_tupledesc, values, nulls);
-		values[history_end_num-1] = GetRowStart(typeid);
-		nulls[history_end_num-1] = false;
-		history_tuple = heap_form_tuple(history_tupledesc, values, nulls);
+	if (coalesce_qplan == NULL)
+	{
+		Oid	types[3] = {OIDOID, NAMEOID, TEXTOID};
 
-		pfree(values);
-		pfree(nulls);
+		coalesce_qplan = PrepareKeptPlan(coalesce_sql, 3, types);
+	}
 
-		/* INSERT the row */
-		insert_into_history(history_rel, history_tuple);
+	values[2] = CStringGetTextDatum(entry->ncoalesce > 0 ? buf.data : "true");
+	ret = SPI_execute_plan(coalesce_qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
 
-		/* Keep the lock until end of transaction */
-		table_close(history_rel, NoLock);
+	sql = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+	entry->coalesce_qplan = PrepareKeptPlan(sql, entry->ncoalesce, argtypes);
+}
+
+static void
+CoalescePortionOfRow(PortionOfViewEntry *entry, TupleDesc tupdesc, HeapTuple row)
+{
+	Datum  *values = (Datum *) palloc(Max(entry->ncoalesce, 1) * sizeof(Datum));
+	char   *nulls = (char *) palloc(Max(entry->ncoalesce, 1) * sizeof(char));
+	bool	is_null;
+	int		ret;
+	int		i;
+
+	if (entry->coalesce_qplan == NULL)
+		PrepareCoalescePlan(entry, tupdesc);
+
+	for (i = 0; i < entry->ncoalesce; i++)
+	{
+		values[i] = SPI_getbinval(row, tupdesc, entry->coalesce_nums[i], &is_null);
+		nulls[i] = is_null ? 'n' : ' ';
 	}
 
-	return PointerGetDatum(NULL);
+	ret = SPI_execute_plan(entry->coalesce_qplan, values, nulls, false, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+}
+
+/*
+ * The INSTEAD OF UPDATE trigger on the FOR PORTION OF views.  The new bounds
+ * of the era given in the UPDATE are the portion of the row's period to
+ * change, and the parts of the old row before and after that portion are
+ * inserted back as they were.
+ *
+ * REFERENCES:
+ *     SQL:2016 15.13 GR 10
+ */
+Datum
+update_portion_of(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = castNode(TriggerData, fcinfo->context);
+	const char	   *funcname = "update_portion_of";
+	Relation		view;
+	TupleDesc		tupdesc;
+	PortionOfViewEntry *entry;
+	HeapTuple		old_row, new_row;
+	Datum			fromval, toval, bstartval, bendval;
+	bool			from_isnull, to_isnull, bstart_isnull, bend_isnull;
+	bool			pre_assigned, post_assigned;
+	Bitmapset	   *changed = NULL;
+	SPIPlanPtr		qplan;
+	Datum		   *values;
+	char		   *nulls;
+	int				columns[2];
+	Datum			bounds[2];
+	bool			bounds_nulls[2];
+	int				nargs;
+	int				attnum;
+	int				ret;
+	int				i;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						funcname)));
+
+	if (!TRIGGER_FIRED_INSTEAD(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event) ||
+		!TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired INSTEAD OF UPDATE FOR EACH ROW",
+						funcname)));
+
+	view = trigdata->tg_relation;
+	tupdesc = RelationGetDescr(view);
+	old_row = trigdata->tg_trigtuple;
+	new_row = trigdata->tg_newtuple;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	entry = LookupPortionOfView(view);
+
+	fromval = SPI_getbinval(new_row, tupdesc, entry->start_num, &from_isnull);
+	toval = SPI_getbinval(new_row, tupdesc, entry->end_num, &to_isnull);
+	bstartval = SPI_getbinval(old_row, tupdesc, entry->start_num, &bstart_isnull);
+	bendval = SPI_getbinval(old_row, tupdesc, entry->end_num, &bend_isnull);
+
+	/* Which columns other than the period did the UPDATE change? */
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, i-1);
+		Datum	old_datum, new_datum;
+		bool	old_isnull, new_isnull;
+
+		if (attr->attisdropped || i == entry->start_num || i == entry->end_num)
+			continue;
+
+		old_datum = SPI_getbinval(old_row, tupdesc, i, &old_isnull);
+		new_datum = SPI_getbinval(new_row, tupdesc, i, &new_isnull);
+
+		if (old_isnull != new_isnull ||
+			(!old_isnull && !datumIsEqual(old_datum, new_datum, attr->attbyval, attr->attlen)))
+			changed = bms_add_member(changed, i);
+	}
+
+	/* If the period is the only thing changed, do nothing */
+	if (changed == NULL)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return PointerGetDatum(NULL);
+	}
+
+	pre_assigned = IsStrictlyBetween(entry, bstartval, bstart_isnull,
+									 fromval, from_isnull, bendval, bend_isnull);
+	post_assigned = IsStrictlyBetween(entry, bstartval, bstart_isnull,
+									  toval, to_isnull, bendval, bend_isnull);
+
+	/*
+	 * The updated row keeps its old period, except for the parts that go to
+	 * the rows inserted before and after it.
+	 */
+	columns[0] = entry->start_num;
+	bounds[0] = pre_assigned ? fromval : bstartval;
+	bounds_nulls[0] = pre_assigned ? false : bstart_isnull;
+	columns[1] = entry->end_num;
+	bounds[1] = post_assigned ? toval : bendval;
+	bounds_nulls[1] = post_assigned ? false : bend_isnull;
+	new_row = heap_modify_tuple_by_cols(new_row, tupdesc, 2, columns, bounds, bounds_nulls);
+
+	if (pre_assigned)
+		changed = bms_add_member(changed, entry->start_num);
+	if (post_assigned)
+		changed = bms_add_member(changed, entry->end_num);
+
+	if (pre_assigned || post_assigned)
+	{
+		/* Don't validate foreign keys until all this is done */
+		ConstraintsSetStmt *stmt = makeNode(ConstraintsSetStmt);
+
+		stmt->constraints = NIL;
+		stmt->deferred = true;
+		AfterTriggerSetState(stmt);
+	}
+
+	if (pre_assigned)
+	{
+		HeapTuple	pre_row;
+
+		columns[0] = entry->end_num;
+		bounds[0] = fromval;
+		bounds_nulls[0] = false;
+		pre_row = heap_modify_tuple_by_cols(old_row, tupdesc, 1, columns, bounds, bounds_nulls);
+
+		InsertPortionOfRow(entry, tupdesc, pre_row);
+	}
+
+	qplan = GetPortionOfUpdatePlan(entry, tupdesc, changed);
+
+	nargs = bms_num_members(changed) + entry->nkey + 2;
+	values = (Datum *) palloc(nargs * sizeof(Datum));
+	nulls = (char *) palloc(nargs * sizeof(char));
+	nargs = 0;
+
+	attnum = -1;
+	while ((attnum = bms_next_member(changed, attnum)) >= 0)
+	{
+		bool	is_null;
+
+		values[nargs] = SPI_getbinval(new_row, tupdesc, attnum, &is_null);
+		nulls[nargs++] = is_null ? 'n' : ' ';
+	}
+	for (i = 0; i < entry->nkey; i++)
+	{
+		bool	is_null;
+
+		values[nargs] = SPI_getbinval(old_row, tupdesc, entry->key_nums[i], &is_null);
+		nulls[nargs++] = is_null ? 'n' : ' ';
+	}
+	values[nargs] = fromval;
+	nulls[nargs++] = from_isnull ? 'n' : ' ';
+	values[nargs] = toval;
+	nulls[nargs++] = to_isnull ? 'n' : ' ';
+
+	ret = SPI_execute_plan(qplan, values, nulls, false, 0);
+	if (ret != SPI_OK_UPDATE)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (post_assigned)
+	{
+		HeapTuple	post_row;
+
+		columns[0] = entry->start_num;
+		bounds[0] = toval;
+		bounds_nulls[0] = false;
+		post_row = heap_modify_tuple_by_cols(old_row, tupdesc, 1, columns, bounds, bounds_nulls);
+
+		InsertPortionOfRow(entry, tupdesc, post_row);
+	}
+
+	if (coalesce_on_write)
+		CoalescePortionOfRow(entry, tupdesc, new_row);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	return PointerGetDatum(trigdata->tg_newtuple);
 }
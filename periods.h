@@ -0,0 +1,10 @@
+/**
+ * periods.h -
+ * Triggers inherited from the periods extension, and the FOR PORTION OF views.
+ */
+#ifndef SQL_SAGA_PERIODS_H
+#define SQL_SAGA_PERIODS_H
+
+extern void periods_init(void);
+
+#endif							/* SQL_SAGA_PERIODS_H */
@@ -0,0 +1,562 @@
+/**
+ * predicates.c -
+ * A planner support function for the Allen-relation predicates, so that
+ * filtering a table by the period of one of its eras can use the GiST index
+ * that add_unique_key builds on range_type(start, end, '[)').
+ *
+ * The predicates are SQL functions, which the planner inlines into
+ * comparisons of the bounds, and those can use btree indexes on the start or
+ * end column but not the range index.  The support function is called before
+ * the inlining.  When the first two arguments are the start and end columns
+ * of a table with such an index, and the arguments the predicate compares
+ * them to do not depend on the row, it turns the call into the matching range
+ * operator on the indexed expression, whose selectivity is estimated from the
+ * statistics of that expression.  Otherwise the call is left to be inlined.
+ *
+ * The range operators only agree with the comparisons when neither range is
+ * empty and no bound is null.  The columns of an era are NOT NULL and have a
+ * CHECK (start < end) constraint, so we look for those.  Constants are only
+ * used when they make a non-empty range.  Other arguments, such as the
+ * parameters of a generic plan, are only known when the query runs, so the
+ * range made of them is guarded by a CASE: a missing bound makes it null, and
+ * when the bounds would not make a range, one that lets every row through is
+ * used and the comparisons of the predicate decide.
+ *
+ * Planner support functions are new in PostgreSQL 12, and the extension
+ * script only attaches this one from there on.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#if (PG_VERSION_NUM >= 120000)
+#include "access/genam.h"
+#include "access/table.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_inherits.h"
+#include "catalog/pg_type.h"
+#include "nodes/bitmapset.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#include "parser/parsetree.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/rangetypes.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+#include "utils/typcache.h"
+#endif
+
+PGDLLEXPORT Datum predicate_support(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(predicate_support);
+
+#if (PG_VERSION_NUM >= 120000)
+
+/*
+ * How a predicate maps onto a range operator: the strategy of the operator in
+ * the range opfamily, and which arguments make up the constant side.  For
+ * contains(sv, ev, ve) that is the element itself; otherwise it is a range,
+ * left unbounded on the side the predicate doesn't look at.
+ */
+typedef struct PredicateOperator
+{
+	const char *name;
+	int			nargs;
+	StrategyNumber strategy;
+	bool		element;
+	bool		uses_start;
+	bool		uses_end;
+} PredicateOperator;
+
+static const PredicateOperator predicate_operators[] = {
+	{"contains", 3, RANGESTRAT_CONTAINS_ELEM, true, false, false},
+	{"contains", 4, RANGESTRAT_CONTAINS, false, true, true},
+	{"equals", 4, RANGESTRAT_EQ, false, true, true},
+	{"overlaps", 4, RANGESTRAT_OVERLAPS, false, true, true},
+	{"precedes", 4, RANGESTRAT_BEFORE, false, true, false},
+	{"succeeds", 4, RANGESTRAT_AFTER, false, false, true},
+	{"immediately_precedes", 4, RANGESTRAT_ADJACENT, false, true, false},
+	{"immediately_succeeds", 4, RANGESTRAT_ADJACENT, false, false, true},
+};
+
+static const PredicateOperator *
+GetPredicateOperator(Oid funcid, int nargs)
+{
+	char	   *name = get_func_name(funcid);
+	int			i;
+
+	if (name == NULL)
+		return NULL;
+
+	for (i = 0; i < lengthof(predicate_operators); i++)
+	{
+		if (predicate_operators[i].nargs == nargs &&
+			strcmp(predicate_operators[i].name, name) == 0)
+			return &predicate_operators[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Is there a valid CHECK (start < end) constraint on the relation?
+ */
+static bool
+HasBoundsCheck(Relation rel, AttrNumber start_attnum, AttrNumber end_attnum, Oid lt_opr)
+{
+	TupleConstr *constr = rel->rd_att->constr;
+	int			i;
+
+	if (constr == NULL)
+		return false;
+
+	for (i = 0; i < constr->num_check; i++)
+	{
+		Node	   *check;
+		OpExpr	   *op;
+		Var		   *left;
+		Var		   *right;
+
+		if (!constr->check[i].ccvalid)
+			continue;
+
+		check = stringToNode(constr->check[i].ccbin);
+		if (!IsA(check, OpExpr))
+			continue;
+
+		op = (OpExpr *) check;
+		if (op->opno != lt_opr || list_length(op->args) != 2)
+			continue;
+
+		left = (Var *) linitial(op->args);
+		right = (Var *) lsecond(op->args);
+		if (IsA(left, Var) && IsA(right, Var) &&
+			left->varattno == start_attnum && right->varattno == end_attnum)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Find a GiST index of the relation with a key that is a range constructor
+ * called on (start, end, '[)').  Returns the expression, with the Vars of the
+ * index, and sets the opfamily of that key.
+ */
+static FuncExpr *
+FindRangeIndexKey(Relation rel, AttrNumber start_attnum, AttrNumber end_attnum,
+				  Oid *opfamily)
+{
+	List	   *indexoids = RelationGetIndexList(rel);
+	FuncExpr   *result = NULL;
+	ListCell   *lc;
+
+	foreach(lc, indexoids)
+	{
+		Relation	index = index_open(lfirst_oid(lc), AccessShareLock);
+		List	   *exprs;
+		ListCell   *expr_cell;
+		int			i;
+
+		if (index->rd_rel->relam != GIST_AM_OID || !index->rd_index->indisvalid)
+		{
+			index_close(index, NoLock);
+			continue;
+		}
+
+		exprs = RelationGetIndexExpressions(index);
+		expr_cell = list_head(exprs);
+
+		for (i = 0; i < index->rd_index->indnkeyatts && result == NULL; i++)
+		{
+			FuncExpr   *func;
+			Var		   *start;
+			Var		   *end;
+			Const	   *bounds;
+
+			if (index->rd_index->indkey.values[i] != 0)
+				continue;
+
+			func = (FuncExpr *) lfirst(expr_cell);
+#if (PG_VERSION_NUM >= 130000)
+			expr_cell = lnext(exprs, expr_cell);
+#else
+			expr_cell = lnext(expr_cell);
+#endif
+
+			if (!IsA(func, FuncExpr) || !type_is_range(func->funcresulttype) ||
+				list_length(func->args) != 3)
+				continue;
+
+			start = (Var *) linitial(func->args);
+			end = (Var *) lsecond(func->args);
+			bounds = (Const *) lthird(func->args);
+			if (!IsA(start, Var) || start->varattno != start_attnum ||
+				!IsA(end, Var) || end->varattno != end_attnum ||
+				!IsA(bounds, Const) || bounds->constisnull ||
+				bounds->consttype != TEXTOID ||
+				strcmp(TextDatumGetCString(bounds->constvalue), "[)") != 0)
+				continue;
+
+			result = func;
+			*opfamily = index->rd_opfamily[i];
+		}
+
+		/* Keep the lock until the end of the transaction, like the planner */
+		index_close(index, NoLock);
+
+		if (result != NULL)
+			break;
+	}
+
+	list_free(indexoids);
+
+	return result;
+}
+
+/*
+ * Can this argument be compared to the index?  It must not depend on the row
+ * being scanned, nor change during the scan.
+ */
+static bool
+IsUsableArgument(PlannerInfo *root, Node *arg, Index varno)
+{
+	Bitmapset  *varnos;
+
+#if (PG_VERSION_NUM >= 140000)
+	varnos = pull_varnos(root, arg);
+#else
+	varnos = pull_varnos(arg);
+#endif
+
+	return !bms_is_member(varno, varnos) && !contain_volatile_functions(arg);
+}
+
+static bool
+IsNonNullConst(Node *arg)
+{
+	return IsA(arg, Const) && !((Const *) arg)->constisnull;
+}
+
+/*
+ * Build range_type(lower, upper, '[)') from the index key, with a null bound
+ * where the predicate doesn't look at it.
+ */
+static Expr *
+MakeRange(FuncExpr *key, Oid element_type, Oid collation, Node *lower, Node *upper)
+{
+	FuncExpr   *range = copyObject(key);
+
+	range->args = list_make3(lower != NULL ? lower : (Node *) makeNullConst(element_type, -1, collation),
+							 upper != NULL ? upper : (Node *) makeNullConst(element_type, -1, collation),
+							 lthird(key->args));
+
+	return (Expr *) range;
+}
+
+static Expr *
+MakeCase(Oid type, Expr *test, Expr *result, Expr *defresult)
+{
+	CaseExpr   *expr = makeNode(CaseExpr);
+	CaseWhen   *when = makeNode(CaseWhen);
+
+	when->expr = test;
+	when->result = result;
+	when->location = -1;
+
+	expr->casetype = type;
+	expr->casecollid = InvalidOid;
+	expr->arg = NULL;
+	expr->args = list_make1(when);
+	expr->defresult = defresult;
+	expr->location = -1;
+
+	return (Expr *) expr;
+}
+
+static Expr *
+MakeComparison(Oid opfamily, Oid type, StrategyNumber strategy, Oid collation,
+			   Node *left, Node *right)
+{
+	Oid			opno = get_opfamily_member(opfamily, type, type, strategy);
+	Expr	   *result;
+
+	if (!OidIsValid(opno))
+		return NULL;
+
+	result = make_opclause(opno, BOOLOID, false, (Expr *) copyObject(left),
+						   (Expr *) copyObject(right), InvalidOid, collation);
+	set_opfuncid((OpExpr *) result);
+
+	return result;
+}
+
+/*
+ * The comparisons a two-period predicate is inlined into, for the rows whose
+ * bounds do not make a range.
+ */
+static Expr *
+MakeBoundsComparisons(const PredicateOperator *pred, Oid opfamily, Oid type, Oid collation,
+					  Var *start, Var *end, Node *lower, Node *upper)
+{
+	Expr	   *first;
+	Expr	   *second;
+
+	switch (pred->strategy)
+	{
+		case RANGESTRAT_CONTAINS:
+			/* sv1 <= sv2 AND ev1 >= ev2 */
+			first = MakeComparison(opfamily, type, BTLessEqualStrategyNumber, collation,
+								   (Node *) start, lower);
+			second = MakeComparison(opfamily, type, BTGreaterEqualStrategyNumber, collation,
+									(Node *) end, upper);
+			break;
+		case RANGESTRAT_EQ:
+			/* sv1 = sv2 AND ev1 = ev2 */
+			first = MakeComparison(opfamily, type, BTEqualStrategyNumber, collation,
+								   (Node *) start, lower);
+			second = MakeComparison(opfamily, type, BTEqualStrategyNumber, collation,
+									(Node *) end, upper);
+			break;
+		case RANGESTRAT_OVERLAPS:
+			/* sv1 < ev2 AND ev1 > sv2 */
+			first = MakeComparison(opfamily, type, BTLessStrategyNumber, collation,
+								   (Node *) start, upper);
+			second = MakeComparison(opfamily, type, BTGreaterStrategyNumber, collation,
+									(Node *) end, lower);
+			break;
+		default:
+			return NULL;
+	}
+
+	if (first == NULL || second == NULL)
+		return NULL;
+
+	return make_andclause(list_make2(first, second));
+}
+
+static Node *
+SimplifyPredicate(SupportRequestSimplify *req)
+{
+	FuncExpr   *fcall = req->fcall;
+	const PredicateOperator *pred;
+	Node	   *start_arg;
+	Node	   *end_arg;
+	Var		   *start;
+	Var		   *end;
+	RangeTblEntry *rte;
+	Relation	rel;
+	TypeCacheEntry *typcache;
+	TypeCacheEntry *elemcache;
+	Oid			opfamily = InvalidOid;
+	FuncExpr   *key = NULL;
+	FuncExpr   *range_expr;
+	Node	   *lower;
+	Node	   *upper;
+	bool		constant;
+	StrategyNumber strategy;
+	Node	   *right;
+	Expr	   *recheck = NULL;
+	Oid			opno;
+	Expr	   *result;
+
+	/* The range expression of the index can only be found in a query */
+	if (req->root == NULL)
+		return NULL;
+
+	pred = GetPredicateOperator(fcall->funcid, list_length(fcall->args));
+	if (pred == NULL)
+		return NULL;
+
+	start_arg = linitial(fcall->args);
+	end_arg = lsecond(fcall->args);
+	if (!IsA(start_arg, Var) || !IsA(end_arg, Var))
+		return NULL;
+
+	start = (Var *) start_arg;
+	end = (Var *) end_arg;
+	if (start->varno != end->varno || start->varlevelsup != 0 || end->varlevelsup != 0 ||
+		start->varattno <= 0 || end->varattno <= 0)
+		return NULL;
+
+	/* The arguments the era is compared to, NULL where it isn't */
+	if (pred->element)
+	{
+		lower = lthird(fcall->args);
+		upper = NULL;
+	}
+	else
+	{
+		lower = pred->uses_start ? lthird(fcall->args) : NULL;
+		upper = pred->uses_end ? lfourth(fcall->args) : NULL;
+	}
+
+	if ((lower != NULL && !IsUsableArgument(req->root, lower, start->varno)) ||
+		(upper != NULL && !IsUsableArgument(req->root, upper, start->varno)))
+		return NULL;
+
+	constant = (lower == NULL || IsNonNullConst(lower)) &&
+		(upper == NULL || IsNonNullConst(upper));
+
+	if (IS_SPECIAL_VARNO(start->varno) ||
+		start->varno > list_length(req->root->parse->rtable))
+		return NULL;
+
+	/* Inheritance children need not have the index or the constraints */
+	rte = rt_fetch(start->varno, req->root->parse->rtable);
+	if (rte->rtekind != RTE_RELATION || rte->relkind != RELKIND_RELATION ||
+		has_subclass(rte->relid))
+		return NULL;
+
+	elemcache = lookup_type_cache(start->vartype, TYPECACHE_BTREE_OPFAMILY | TYPECACHE_LT_OPR);
+	if (!OidIsValid(elemcache->lt_opr))
+		return NULL;
+
+	/* The parser holds a lock on the relation already */
+	rel = table_open(rte->relid, NoLock);
+
+	if (TupleDescAttr(rel->rd_att, start->varattno - 1)->attnotnull &&
+		TupleDescAttr(rel->rd_att, end->varattno - 1)->attnotnull &&
+		HasBoundsCheck(rel, start->varattno, end->varattno, elemcache->lt_opr))
+		key = FindRangeIndexKey(rel, start->varattno, end->varattno, &opfamily);
+
+	table_close(rel, NoLock);
+
+	if (key == NULL)
+		return NULL;
+
+	/* The range type must order the bounds like the comparisons do */
+	typcache = lookup_type_cache(key->funcresulttype, TYPECACHE_RANGE_INFO);
+	if (typcache->rng_opfamily != elemcache->btree_opf ||
+		typcache->rng_collation != fcall->inputcollid)
+		return NULL;
+
+	/* The constant range must not be empty */
+	if (constant && lower != NULL && upper != NULL && !pred->element)
+	{
+		if (DatumGetInt32(FunctionCall2Coll(&typcache->rng_cmp_proc_finfo,
+											typcache->rng_collation,
+											((Const *) lower)->constvalue,
+											((Const *) upper)->constvalue)) >= 0)
+			return NULL;
+	}
+
+	/*
+	 * Equal ranges contain each other, and every range contains the empty
+	 * one, which the CASE below needs.  The comparisons then tell them apart.
+	 */
+	strategy = pred->strategy;
+	if (!constant && !pred->element && lower != NULL && upper != NULL &&
+		strategy == RANGESTRAT_EQ)
+		strategy = RANGESTRAT_CONTAINS;
+
+	opno = get_opfamily_member(opfamily, ANYRANGEOID,
+							   pred->element ? ANYELEMENTOID : ANYRANGEOID,
+							   strategy);
+	if (!OidIsValid(opno))
+		return NULL;
+
+	/* Use the Vars of the query so that the expression matches the index */
+	range_expr = copyObject(key);
+	range_expr->args = list_make3(copyObject(start), copyObject(end), lthird(key->args));
+
+	if (pred->element)
+		right = lower;
+	else if (constant)
+	{
+		Expr	   *range = MakeRange(key, start->vartype, start->varcollid, lower, upper);
+
+		right = eval_const_expressions(req->root, (Node *) range);
+	}
+	else if (lower == NULL || upper == NULL)
+	{
+		NullTest   *known = makeNode(NullTest);
+		Expr	   *range;
+
+		/* CASE WHEN bound IS NOT NULL THEN range END */
+		known->arg = (Expr *) copyObject(lower != NULL ? lower : upper);
+		known->nulltesttype = IS_NOT_NULL;
+		known->argisrow = false;
+		known->location = -1;
+
+		range = MakeCase(key->funcresulttype, (Expr *) known,
+						 MakeRange(key, start->vartype, start->varcollid, lower, upper),
+						 (Expr *) makeNullConst(key->funcresulttype, -1, InvalidOid));
+		right = eval_const_expressions(req->root, (Node *) range);
+	}
+	else
+	{
+		Expr	   *ordered;
+		Expr	   *any;
+		Expr	   *range;
+		BooleanTest *is_true = makeNode(BooleanTest);
+		Expr	   *comparisons;
+
+		/*
+		 * CASE WHEN lower < upper THEN range ELSE any END, where any range
+		 * overlaps the unbounded one and contains the empty one.  The rows
+		 * let through that way are checked with the comparisons.
+		 */
+		ordered = make_opclause(elemcache->lt_opr, BOOLOID, false,
+								(Expr *) copyObject(lower), (Expr *) copyObject(upper),
+								InvalidOid, fcall->inputcollid);
+		set_opfuncid((OpExpr *) ordered);
+
+		if (strategy == RANGESTRAT_OVERLAPS)
+			any = MakeRange(key, start->vartype, start->varcollid, NULL, NULL);
+		else
+			any = (Expr *) makeConst(key->funcresulttype, -1, InvalidOid, -1,
+									 RangeTypePGetDatum(make_empty_range(typcache)),
+									 false, false);
+
+		range = MakeCase(key->funcresulttype, ordered,
+						 MakeRange(key, start->vartype, start->varcollid, lower, upper),
+						 any);
+		right = eval_const_expressions(req->root, (Node *) range);
+
+		comparisons = MakeBoundsComparisons(pred, elemcache->btree_opf, start->vartype,
+											fcall->inputcollid, start, end, lower, upper);
+		if (comparisons == NULL)
+			return NULL;
+
+		/* (lower < upper) IS TRUE OR comparisons */
+		is_true->arg = (Expr *) copyObject(ordered);
+		is_true->booltesttype = IS_TRUE;
+		is_true->location = -1;
+		recheck = make_orclause(list_make2(is_true, comparisons));
+	}
+
+	result = make_opclause(opno, BOOLOID, false,
+						   (Expr *) range_expr, (Expr *) right,
+						   InvalidOid, pred->element ? exprCollation(right) : InvalidOid);
+	set_opfuncid((OpExpr *) result);
+
+	if (recheck != NULL)
+		result = make_andclause(list_make2(result, recheck));
+
+	return (Node *) result;
+}
+
+#endif							/* PG_VERSION_NUM >= 120000 */
+
+/*
+ * predicate_support -
+ * The planner support function of contains, equals, overlaps, precedes,
+ * succeeds, immediately_precedes and immediately_succeeds.
+ */
+Datum
+predicate_support(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 120000)
+	Node	   *rawreq = (Node *) PG_GETARG_POINTER(0);
+
+	if (IsA(rawreq, SupportRequestSimplify))
+		PG_RETURN_POINTER(SimplifyPredicate((SupportRequestSimplify *) rawreq));
+#endif
+
+	PG_RETURN_POINTER(NULL);
+}
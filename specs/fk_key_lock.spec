@@ -0,0 +1,66 @@
+# Foreign keys with the KEY lock mode lock the referenced key rather than its
+# rows.  Loaders referencing the same key do not block each other, while a
+# change to the referenced key waits for them, and they wait for it.
+
+setup
+{
+  CREATE EXTENSION btree_gist;
+  CREATE EXTENSION sql_saga;
+
+  CREATE TABLE legal_unit (id integer, valid_from integer, valid_to integer);
+  SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+  SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id']);
+
+  CREATE TABLE establishment (id integer, legal_unit_id integer, valid_from integer, valid_to integer);
+  SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+  SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid',
+                                  lock_mode => 'KEY');
+
+  INSERT INTO legal_unit VALUES (1, 0, 10), (1, 10, 20), (2, 0, 20);
+}
+
+teardown
+{
+  SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+  SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+  SELECT sql_saga.drop_era('establishment');
+  SELECT sql_saga.drop_era('legal_unit');
+  DROP TABLE establishment;
+  DROP TABLE legal_unit;
+  DROP EXTENSION sql_saga;
+  DROP EXTENSION btree_gist;
+}
+
+session s1
+step s1_insert	{ BEGIN; INSERT INTO establishment VALUES (1, 1, 5, 15); }
+step s1_commit	{ COMMIT; }
+
+session s2
+step s2_insert	{ BEGIN; INSERT INTO establishment VALUES (2, 1, 0, 20); }
+step s2_insert_other	{ BEGIN; INSERT INTO establishment VALUES (3, 2, 0, 20); }
+step s2_commit	{ COMMIT; }
+
+session s3
+step s3_delete	{ BEGIN; DELETE FROM legal_unit WHERE id = 1 AND valid_from = 10; }
+step s3_delete_other	{ BEGIN; DELETE FROM legal_unit WHERE id = 2; }
+step s3_commit	{ COMMIT; }
+
+session s4
+step s4_insert	{ BEGIN ISOLATION LEVEL REPEATABLE READ; INSERT INTO establishment VALUES (4, 1, 5, 15); }
+step s4_commit	{ COMMIT; }
+
+# Loaders of the same key go ahead together
+permutation s1_insert s2_insert s1_commit s2_commit
+
+# Deleting from the key waits for a loader, then sees its row
+permutation s1_insert s3_delete s1_commit s3_commit
+
+# A loader waits for the deletion, then sees it
+permutation s3_delete s1_insert s3_commit s1_commit
+
+# Even when its snapshot is older than the deletion
+permutation s3_delete s4_insert s3_commit s4_commit
+
+# Other keys are not blocked
+permutation s1_insert s3_delete_other s1_commit s3_commit
+permutation s3_delete s2_insert_other s2_commit s3_commit
@@ -0,0 +1,55 @@
+# Unique keys with the BTREE enforcement have no EXCLUDE constraint to stop
+# concurrent transactions from writing overlapping rows, so their check locks
+# the key first.  A writer of the same key waits for the others, then sees
+# their rows.
+
+setup
+{
+  CREATE EXTENSION btree_gist;
+  CREATE EXTENSION sql_saga;
+
+  CREATE TABLE legal_unit (id integer, valid_from integer, valid_to integer);
+  SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+  SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], enforcement => 'BTREE');
+
+  INSERT INTO legal_unit VALUES (1, 0, 10), (2, 0, 10);
+}
+
+teardown
+{
+  SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+  SELECT sql_saga.drop_era('legal_unit');
+  DROP TABLE legal_unit;
+  DROP EXTENSION sql_saga;
+  DROP EXTENSION btree_gist;
+}
+
+session s1
+step s1_insert	{ BEGIN; INSERT INTO legal_unit VALUES (1, 10, 20); }
+step s1_commit	{ COMMIT; }
+step s1_rollback	{ ROLLBACK; }
+
+session s2
+step s2_insert_overlap	{ BEGIN; INSERT INTO legal_unit VALUES (1, 15, 25); }
+step s2_insert_after	{ BEGIN; INSERT INTO legal_unit VALUES (1, 20, 30); }
+step s2_insert_other	{ BEGIN; INSERT INTO legal_unit VALUES (2, 10, 20); }
+step s2_commit	{ COMMIT; }
+
+session s3
+step s3_insert_overlap	{ BEGIN ISOLATION LEVEL REPEATABLE READ; INSERT INTO legal_unit VALUES (1, 12, 18); }
+step s3_commit	{ COMMIT; }
+
+# An overlapping row waits for the other writer of the key, then sees its row
+permutation s1_insert s2_insert_overlap s1_commit s2_commit
+
+# Even when its snapshot is older than that row
+permutation s1_insert s3_insert_overlap s1_commit s3_commit
+
+# It goes ahead when the other writer rolls back
+permutation s1_insert s2_insert_overlap s1_rollback s2_commit
+
+# Rows that do not overlap still wait, but go ahead
+permutation s1_insert s2_insert_after s1_commit s2_commit
+
+# Other keys are not blocked
+permutation s1_insert s2_insert_other s1_commit s2_commit
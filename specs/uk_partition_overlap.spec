@@ -0,0 +1,53 @@
+# The EXCLUDE constraint of each partition only sees its own rows, so the
+# trigger checking the other partitions locks the key first.  A writer of the
+# same key in another partition waits for the others, then sees their rows.
+
+setup
+{
+  CREATE EXTENSION btree_gist;
+  CREATE EXTENSION sql_saga;
+
+  CREATE TABLE legal_unit (id integer, valid_from integer, valid_to integer) PARTITION BY RANGE (valid_from);
+  CREATE TABLE legal_unit_0 PARTITION OF legal_unit FOR VALUES FROM (0) TO (100);
+  CREATE TABLE legal_unit_100 PARTITION OF legal_unit FOR VALUES FROM (100) TO (200);
+  SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+  SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id']);
+
+  INSERT INTO legal_unit VALUES (1, 0, 10), (2, 0, 10);
+}
+
+teardown
+{
+  SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+  SELECT sql_saga.drop_era('legal_unit');
+  DROP TABLE legal_unit;
+  DROP EXTENSION sql_saga;
+  DROP EXTENSION btree_gist;
+}
+
+session s1
+step s1_insert	{ BEGIN; INSERT INTO legal_unit VALUES (1, 50, 150); }
+step s1_commit	{ COMMIT; }
+step s1_rollback	{ ROLLBACK; }
+
+session s2
+step s2_insert_overlap	{ BEGIN; INSERT INTO legal_unit VALUES (1, 120, 130); }
+step s2_insert_other	{ BEGIN; INSERT INTO legal_unit VALUES (2, 120, 130); }
+step s2_commit	{ COMMIT; }
+
+session s3
+step s3_insert_overlap	{ BEGIN ISOLATION LEVEL REPEATABLE READ; INSERT INTO legal_unit VALUES (1, 140, 160); }
+step s3_commit	{ COMMIT; }
+
+# An overlapping row in a sibling partition waits for the other writer of the
+# key, then sees its row
+permutation s1_insert s2_insert_overlap s1_commit s2_commit
+
+# Even when its snapshot is older than that row
+permutation s1_insert s3_insert_overlap s1_commit s3_commit
+
+# It goes ahead when the other writer rolls back
+permutation s1_insert s2_insert_overlap s1_rollback s2_commit
+
+# Other keys are not blocked
+permutation s1_insert s2_insert_other s1_commit s2_commit
@@ -0,0 +1,177 @@
+/* Run tests as unprivileged user */
+SET ROLE TO sql_saga_unprivileged_user;
+
+/* Basic SYSTEM VERSIONING */
+
+CREATE TABLE sysver (val text, flap boolean);
+SELECT sql_saga.add_system_time_era('sysver', excluded_column_names => ARRAY['flap']);
+TABLE sql_saga.system_time_era;
+TABLE sql_saga.system_versioning;
+SELECT sql_saga.add_system_versioning('sysver',
+    history_table_name => 'custom_history_name',
+    view_name => 'custom_view_name',
+    function_as_of_name => 'custom_as_of',
+    function_between_name => 'custom_between',
+    function_between_symmetric_name => 'custom_between_symmetric',
+    function_from_to_name => 'custom_from_to');
+TABLE sql_saga.system_versioning;
+SELECT sql_saga.drop_system_versioning('sysver', drop_behavior => 'CASCADE');
+DROP TABLE custom_history_name;
+SELECT sql_saga.add_system_versioning('sysver');
+TABLE sql_saga.system_versioning;
+
+/* The history table gets an index on its period */
+SELECT indexrelid::regclass AS index_name, pg_get_indexdef(indexrelid) AS definition
+FROM pg_index
+WHERE indrelid = 'sysver_history'::regclass;
+
+INSERT INTO sysver (val, flap) VALUES ('hello', false);
+SELECT val FROM sysver;
+SELECT val FROM sysver_history ORDER BY system_time_start;
+
+SELECT transaction_timestamp() AS ts1 \gset
+
+UPDATE sysver SET val = 'world';
+SELECT val FROM sysver;
+SELECT val FROM sysver_history ORDER BY system_time_start;
+
+UPDATE sysver SET flap = not flap;
+UPDATE sysver SET flap = not flap;
+UPDATE sysver SET flap = not flap;
+UPDATE sysver SET flap = not flap;
+UPDATE sysver SET flap = not flap;
+SELECT val FROM sysver;
+SELECT val FROM sysver_history ORDER BY system_time_start;
+
+SELECT transaction_timestamp() AS ts2 \gset
+
+DELETE FROM sysver;
+SELECT val FROM sysver;
+SELECT val FROM sysver_history ORDER BY system_time_start;
+
+/* temporal queries */
+
+SELECT val FROM sysver__as_of(:'ts1') ORDER BY system_time_start;
+SELECT val FROM sysver__as_of(:'ts2') ORDER BY system_time_start;
+
+SELECT val FROM sysver__from_to(:'ts1', :'ts2') ORDER BY system_time_start;
+SELECT val FROM sysver__from_to(:'ts2', :'ts1') ORDER BY system_time_start;
+
+SELECT val FROM sysver__between(:'ts1', :'ts2') ORDER BY system_time_start;
+SELECT val FROM sysver__between(:'ts2', :'ts1') ORDER BY system_time_start;
+
+SELECT val FROM sysver__between_symmetric(:'ts1', :'ts2') ORDER BY system_time_start;
+SELECT val FROM sysver__between_symmetric(:'ts2', :'ts1') ORDER BY system_time_start;
+
+/* Ensure functions are inlined and use the index on the history */
+
+SET TimeZone = 'UTC';
+SET DateStyle = 'ISO';
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT * FROM sysver__as_of('2000-01-01');
+EXPLAIN (COSTS OFF) SELECT * FROM sysver__from_to('1000-01-01', '3000-01-01');
+EXPLAIN (COSTS OFF) SELECT * FROM sysver__between('1000-01-01', '3000-01-01');
+EXPLAIN (COSTS OFF) SELECT * FROM sysver__between_symmetric('3000-01-01', '1000-01-01');
+RESET enable_bitmapscan;
+RESET enable_seqscan;
+RESET DateStyle;
+RESET TimeZone;
+
+/* TRUNCATE should delete the history, too */
+SELECT val FROM sysver_with_history;
+TRUNCATE sysver;
+SELECT val FROM sysver_with_history; --empty
+
+/* Try modifying several times in a transaction */
+BEGIN;
+INSERT INTO sysver (val) VALUES ('hello');
+INSERT INTO sysver (val) VALUES ('world');
+ROLLBACK;
+SELECT val FROM sysver_with_history; --empty
+
+BEGIN;
+INSERT INTO sysver (val) VALUES ('hello');
+UPDATE sysver SET val = 'world';
+UPDATE sysver SET val = 'world2';
+UPDATE sysver SET val = 'world3';
+DELETE FROM sysver;
+COMMIT;
+SELECT val FROM sysver_with_history; --empty
+
+/* A statement changing several rows writes the history of all of them */
+INSERT INTO sysver (val) VALUES ('a'), ('b'), ('c');
+UPDATE sysver SET val = val || '2';
+DELETE FROM sysver WHERE val <> 'c2';
+SELECT val FROM sysver ORDER BY val;
+SELECT val FROM sysver_history ORDER BY val;
+
+/* The history of a rolled back savepoint goes with it, a released one keeps it */
+BEGIN;
+SAVEPOINT s1;
+UPDATE sysver SET val = 'd';
+ROLLBACK TO SAVEPOINT s1;
+SAVEPOINT s2;
+UPDATE sysver SET val = 'e';
+RELEASE SAVEPOINT s2;
+COMMIT;
+SELECT val FROM sysver ORDER BY val;
+SELECT val FROM sysver_history ORDER BY val;
+
+/* The same for rows still queued by a trigger while its statement runs */
+CREATE TABLE sysver_feed (val text);
+CREATE FUNCTION sysver_feed_apply() RETURNS trigger LANGUAGE plpgsql AS
+$$
+BEGIN
+    BEGIN
+        UPDATE sysver SET val = NEW.val;
+        IF NEW.val = 'bad' THEN
+            RAISE EXCEPTION 'bad value';
+        END IF;
+    EXCEPTION WHEN raise_exception THEN
+        NULL;
+    END;
+    RETURN NULL;
+END;
+$$;
+CREATE TRIGGER sysver_feed_apply AFTER INSERT ON sysver_feed
+    FOR EACH ROW EXECUTE PROCEDURE sysver_feed_apply();
+INSERT INTO sysver_feed VALUES ('bad'), ('f');
+SELECT val FROM sysver ORDER BY val;
+SELECT val FROM sysver_history ORDER BY val;
+
+/* COPY does not end in the executor, and its history is there at commit */
+BEGIN;
+COPY sysver_feed FROM STDIN;
+g
+\.
+COMMIT;
+SELECT val FROM sysver ORDER BY val;
+SELECT val FROM sysver_history ORDER BY val;
+
+/* AFTER triggers of the table see the history of their own statement */
+CREATE FUNCTION sysver_count_history() RETURNS trigger LANGUAGE plpgsql AS
+$$
+BEGIN
+    RAISE NOTICE '% rows in the history', (SELECT count(*) FROM sysver_history);
+    RETURN NULL;
+END;
+$$;
+CREATE TRIGGER sysver_count_history AFTER UPDATE OR DELETE ON sysver
+    FOR EACH STATEMENT EXECUTE PROCEDURE sysver_count_history();
+UPDATE sysver SET val = 'h';
+DELETE FROM sysver;
+DROP TRIGGER sysver_count_history ON sysver;
+DROP FUNCTION sysver_count_history();
+DROP TABLE sysver_feed;
+DROP FUNCTION sysver_feed_apply();
+
+-- We can't drop the the table without first dropping SYSTEM VERSIONING because
+-- Postgres will complain about dependant objects (our view functions) before
+-- we get a chance to clean them up.
+DROP TABLE sysver;
+SELECT sql_saga.drop_system_versioning('sysver', drop_behavior => 'CASCADE', cleanup => true);
+TABLE sql_saga.system_versioning;
+DROP TABLE sysver;
+TABLE sql_saga.era;
+TABLE sql_saga.system_time_era;
@@ -0,0 +1,55 @@
+/* Run tests as unprivileged user */
+SET ROLE TO sql_saga_unprivileged_user;
+
+CREATE TABLE excl (
+    value text NOT NULL,
+    null_value integer,
+    flap text NOT NULL
+);
+SELECT sql_saga.add_system_time_era('excl', excluded_column_names => ARRAY['xmin']); -- fails
+SELECT sql_saga.add_system_time_era('excl', excluded_column_names => ARRAY['none']); -- fails
+SELECT sql_saga.add_system_time_era('excl', excluded_column_names => ARRAY['flap']); -- passes
+SELECT sql_saga.add_system_versioning('excl');
+
+TABLE sql_saga.era;
+TABLE sql_saga.system_time_era;
+TABLE sql_saga.system_versioning;
+
+BEGIN;
+SELECT CURRENT_TIMESTAMP AS now \gset
+INSERT INTO excl (value, flap) VALUES ('hello world', 'off');
+COMMIT;
+SELECT value, null_value, flap, system_time_start <> :'now' AS changed FROM excl;
+
+UPDATE excl SET flap = 'off';
+UPDATE excl SET flap = 'on';
+UPDATE excl SET flap = 'off';
+UPDATE excl SET flap = 'on';
+SELECT value, null_value, flap, system_time_start <> :'now' AS changed FROM excl;
+
+BEGIN;
+SELECT CURRENT_TIMESTAMP AS now2 \gset
+UPDATE excl SET value = 'howdy folks!';
+COMMIT;
+SELECT value, null_value, flap, system_time_start <> :'now' AS changed FROM excl;
+
+UPDATE excl SET null_value = 0;
+SELECT value, null_value, flap, system_time_start <> :'now2' AS changed FROM excl;
+
+/* Test directly setting the excluded columns */
+SELECT sql_saga.drop_system_versioning('excl');
+ALTER TABLE excl ADD COLUMN flop text;
+ALTER TABLE excl_history ADD COLUMN flop text;
+SELECT sql_saga.add_system_versioning('excl');
+SELECT sql_saga.set_system_time_era_excluded_columns('excl', ARRAY['flap', 'flop']);
+TABLE sql_saga.system_time_era;
+UPDATE excl SET flop = 'flop';
+SELECT value, null_value, flap, flop FROM excl;
+SELECT value, null_value, flap, flop FROM excl_history ORDER BY system_time_start;
+
+/* Excluded columns cannot be renamed or dropped */
+ALTER TABLE excl RENAME COLUMN flop TO flip; -- fails
+ALTER TABLE excl DROP COLUMN flop; -- fails
+
+SELECT sql_saga.drop_system_versioning('excl', drop_behavior => 'CASCADE', cleanup => true);
+DROP TABLE excl;
@@ -104,6 +104,22 @@ SELECT 'legal_unit' AS type, COUNT(*) AS count FROM legal_unit
 UNION ALL
 SELECT 'establishment' AS type, COUNT(*) AS count FROM establishment;
 
+-- Many referencing rows checked in one statement, reusing the kept plan of
+-- the foreign key for every row
+INSERT INTO benchmark (event, row_count) VALUES ('INSERT SELECT referencing start', 0);
+INSERT INTO establishment (id, valid_from, valid_to, legal_unit_id, postal_place)
+  SELECT i, '2015-01-01', 'infinity', i - 20000, 'Shop ' || i
+  FROM generate_series(20001, 30000) AS i;
+INSERT INTO benchmark (event, row_count) VALUES ('INSERT SELECT referencing end', 10000);
+
+INSERT INTO benchmark (event, row_count) VALUES ('Update referencing start', 0);
+UPDATE establishment SET legal_unit_id = legal_unit_id + 10000 WHERE id > 20000;
+INSERT INTO benchmark (event, row_count) VALUES ('Update referencing end', 10000);
+
+SELECT 'legal_unit' AS type, COUNT(*) AS count FROM legal_unit
+UNION ALL
+SELECT 'establishment' AS type, COUNT(*) AS count FROM establishment;
+
 -- Teardown sql_saga constraints
 SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
 SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
@@ -0,0 +1,89 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  name text NOT NULL
+);
+
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  legal_unit_id integer NOT NULL,
+  name text NOT NULL
+);
+
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+SELECT sql_saga.add_unique_key('establishment', ARRAY['id'], 'valid');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+
+-- Row by row checking is the default
+SHOW sql_saga.foreign_key_check_mode;
+INSERT INTO legal_unit VALUES (1, '2015-01-01', 'infinity', 'Company 1');
+INSERT INTO establishment VALUES (1, '2015-01-01', 'infinity', 1, 'Shop 1');
+
+SET sql_saga.foreign_key_check_mode = 'batch';
+SHOW sql_saga.foreign_key_check_mode;
+
+-- Immediate constraints are checked at the end of each statement
+INSERT INTO legal_unit
+  SELECT i, '2015-01-01', 'infinity', 'Company ' || i FROM generate_series(2, 1000) AS i;
+INSERT INTO establishment
+  SELECT i, '2015-01-01', 'infinity', i, 'Shop ' || i FROM generate_series(2, 1000) AS i;
+INSERT INTO establishment
+  SELECT i, '2014-01-01', 'infinity', i - 1000, 'Shop ' || i FROM generate_series(1001, 1001) AS i; -- fail
+UPDATE establishment SET valid_from = '2010-01-01' WHERE id = 5; -- fail
+UPDATE establishment SET valid_from = '2016-01-01' WHERE id <= 10; -- success
+SELECT count(*) FROM establishment;
+
+-- Deferred constraints are checked at commit
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+INSERT INTO establishment VALUES (2001, '2015-01-01', 'infinity', 2001, 'Shop 2001');
+INSERT INTO legal_unit VALUES (2001, '2015-01-01', 'infinity', 'Company 2001');
+COMMIT;
+
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+INSERT INTO establishment VALUES (2002, '2015-01-01', 'infinity', 2002, 'Shop 2002');
+COMMIT; -- fail
+
+-- ...or when they are made immediate
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+INSERT INTO establishment
+  SELECT i, '2015-01-01', 'infinity', i, 'Shop ' || i FROM generate_series(3001, 3010) AS i;
+INSERT INTO legal_unit
+  SELECT i, '2015-01-01', CASE WHEN i = 3005 THEN date '2016-01-01' ELSE 'infinity' END, 'Company ' || i
+  FROM generate_series(3001, 3010) AS i;
+SET CONSTRAINTS ALL IMMEDIATE; -- fail
+ROLLBACK;
+
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+INSERT INTO establishment
+  SELECT i, '2015-01-01', 'infinity', i, 'Shop ' || i FROM generate_series(3001, 3010) AS i;
+INSERT INTO legal_unit
+  SELECT i, '2015-01-01', 'infinity', 'Company ' || i FROM generate_series(3001, 3010) AS i;
+SET CONSTRAINTS ALL IMMEDIATE; -- success
+COMMIT;
+
+SELECT count(*) FROM establishment;
+
+RESET sql_saga.foreign_key_check_mode;
+
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_unique_key('establishment', 'establishment_id_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
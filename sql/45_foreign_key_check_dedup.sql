@@ -0,0 +1,75 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  name text NOT NULL
+);
+
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  legal_unit_id integer NOT NULL,
+  name text NOT NULL
+);
+
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+
+INSERT INTO legal_unit VALUES (1, '2015-01-01', 'infinity', 'Company 1');
+
+-- The rows of a statement that share a key are checked once
+SELECT sql_saga.foreign_key_checks_skipped() AS skipped \gset
+INSERT INTO establishment
+  SELECT i, '2015-01-01', 'infinity', 1, 'Shop ' || i FROM generate_series(1, 10) AS i;
+SELECT sql_saga.foreign_key_checks_skipped() - :skipped AS skipped_checks;
+
+-- A later statement checks the key again
+DELETE FROM legal_unit WHERE id = 1; -- fail
+
+-- Deferred checks of the same key are only run once at commit
+SELECT sql_saga.foreign_key_checks_skipped() AS skipped \gset
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+DELETE FROM legal_unit WHERE id = 1;
+INSERT INTO legal_unit VALUES (1, '2015-01-01', 'infinity', 'Company 1');
+INSERT INTO establishment VALUES (11, '2015-01-01', 'infinity', 1, 'Shop 11');
+INSERT INTO establishment VALUES (12, '2016-01-01', 'infinity', 1, 'Shop 12');
+INSERT INTO establishment VALUES (13, '2017-01-01', 'infinity', 1, 'Shop 13');
+COMMIT;
+SELECT sql_saga.foreign_key_checks_skipped() - :skipped AS skipped_checks;
+
+-- The referenced side is deduplicated too
+INSERT INTO legal_unit VALUES
+  (3, '2015-01-01', '2016-01-01', 'Company 3'),
+  (3, '2016-01-01', '2017-01-01', 'Company 3'),
+  (3, '2017-01-01', 'infinity', 'Company 3');
+INSERT INTO establishment VALUES (100, '2015-06-01', 'infinity', 3, 'Shop 100');
+SELECT sql_saga.foreign_key_checks_skipped() AS skipped \gset
+UPDATE legal_unit SET valid_to = valid_to WHERE id = 3;
+SELECT sql_saga.foreign_key_checks_skipped() - :skipped AS skipped_checks;
+
+-- Batches only queue each key once
+SET sql_saga.foreign_key_check_mode = 'batch';
+SELECT sql_saga.foreign_key_checks_skipped() AS skipped \gset
+INSERT INTO establishment
+  SELECT i, '2015-01-01', 'infinity', 3, 'Shop ' || i FROM generate_series(101, 110) AS i;
+SELECT sql_saga.foreign_key_checks_skipped() - :skipped AS skipped_checks;
+RESET sql_saga.foreign_key_check_mode;
+
+SELECT count(*) FROM establishment;
+
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,49 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE uk(id integer, s integer, e integer);
+SELECT sql_saga.add_era('uk', 's', 'e', 'p');
+SELECT sql_saga.add_unique_key('uk', ARRAY['id'], 'p');
+
+CREATE TABLE fk(id integer, uk_id integer, s integer, e integer);
+SELECT sql_saga.add_era('fk', 's', 'e', 'q');
+SELECT sql_saga.add_foreign_key('fk', ARRAY['uk_id'], 'q', 'uk_id_p');
+
+INSERT INTO uk(id, s, e)        VALUES    (1, 1, 3),    (1, 3, 5),    (1, 5, 10);
+INSERT INTO fk(id, uk_id, s, e) VALUES (1, 1, 2, 4);
+
+-- A referencing period may not end in a hole
+DELETE FROM uk WHERE (id, s, e) = (1, 3, 5); -- fail
+DELETE FROM uk WHERE (id, s, e) = (1, 5, 10); -- success
+
+-- ...nor start in one
+INSERT INTO fk(id, uk_id, s, e) VALUES (2, 1, 3, 5);
+DELETE FROM uk WHERE (id, s, e) = (1, 1, 3); -- fail
+UPDATE uk SET e = 2 WHERE (id, s, e) = (1, 1, 3); -- fail
+UPDATE uk SET s = 0 WHERE (id, s, e) = (1, 1, 3); -- success
+
+-- Moving the key away is the same as deleting it
+UPDATE uk SET id = 2 WHERE (id, s, e) = (1, 3, 5); -- fail
+
+SELECT * FROM uk ORDER BY id, s;
+SELECT * FROM fk ORDER BY id;
+
+-- The check can also be called directly with the old row as jsonb
+SELECT sql_saga.validate_foreign_key_old_row('fk_uk_id_q', '{"id": 1, "s": 0, "e": 3}', false);
+SELECT sql_saga.validate_foreign_key_old_row('fk_uk_id_q', '{"id": null}', false);
+SELECT sql_saga.validate_foreign_key_old_row('no_such_key', '{"id": 1}', false); -- fail
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+INSERT INTO fk(id, uk_id, s, e) VALUES (3, 2, 1, 2);
+SELECT sql_saga.validate_foreign_key_old_row('fk_uk_id_q', '{"id": 2}', false); -- fail
+ROLLBACK;
+
+SELECT sql_saga.drop_foreign_key('fk', 'fk_uk_id_q');
+SELECT sql_saga.drop_unique_key('uk', 'uk_id_p');
+SELECT sql_saga.drop_era('fk', 'q');
+SELECT sql_saga.drop_era('uk', 'p');
+
+DROP TABLE fk;
+DROP TABLE uk;
+
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
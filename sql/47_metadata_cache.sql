@@ -0,0 +1,53 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  ident text NOT NULL,
+  valid_from date,
+  valid_to date
+);
+
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  legal_unit_id integer NOT NULL
+);
+
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+
+INSERT INTO legal_unit VALUES (1, 'A', '2015-01-01', 'infinity');
+INSERT INTO establishment VALUES (1, '2015-01-01', 'infinity', 1);
+INSERT INTO establishment VALUES (2, '2014-01-01', 'infinity', 1); -- fail
+
+-- Renaming the era columns of the referenced table reloads the cached key
+ALTER TABLE legal_unit RENAME COLUMN valid_from TO valid_since;
+ALTER TABLE legal_unit RENAME COLUMN valid_to TO valid_until;
+SELECT start_column_name, end_column_name FROM sql_saga.era WHERE table_name = 'legal_unit'::regclass;
+INSERT INTO establishment VALUES (2, '2016-01-01', 'infinity', 1);
+INSERT INTO establishment VALUES (3, '2014-01-01', 'infinity', 1); -- fail
+UPDATE legal_unit SET valid_since = '2016-01-01' WHERE id = 1; -- fail
+
+-- A foreign key added again under the same name is reloaded too
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['ident'], 'valid');
+ALTER TABLE establishment ADD COLUMN legal_unit_ident text;
+UPDATE establishment SET legal_unit_ident = 'A';
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_ident'], 'valid', 'legal_unit_ident_valid',
+                                key_name => 'establishment_legal_unit_id_valid');
+INSERT INTO establishment VALUES (4, '2015-01-01', 'infinity', 99, 'A');
+INSERT INTO establishment VALUES (5, '2015-01-01', 'infinity', 1, 'B'); -- fail
+
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_ident_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
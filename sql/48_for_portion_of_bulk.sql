@@ -0,0 +1,33 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE price (
+  row_id integer GENERATED BY DEFAULT AS IDENTITY PRIMARY KEY,
+  id integer NOT NULL,
+  valid_from integer NOT NULL,
+  valid_to integer NOT NULL,
+  amount integer,
+  note text
+);
+SELECT sql_saga.add_era('price', 'valid_from', 'valid_to');
+SELECT sql_saga.add_api('price');
+
+INSERT INTO price (id, valid_from, valid_to, amount)
+  SELECT i, 0, 100, i FROM generate_series(1, 5000) AS i;
+
+-- Change the middle of every row in a single statement
+UPDATE price__for_portion_of_valid SET valid_from = 10, valid_to = 20, amount = amount * 2;
+SELECT valid_from, valid_to, count(*), sum(amount) FROM price GROUP BY 1, 2 ORDER BY 1;
+
+-- Another set of changed columns gets a plan of its own
+UPDATE price__for_portion_of_valid SET valid_from = 12, valid_to = 14, note = 'x' WHERE id <= 2;
+SELECT id, valid_from, valid_to, amount, note FROM price WHERE id <= 2 ORDER BY id, valid_from;
+
+-- Changing only the period does nothing
+UPDATE price__for_portion_of_valid SET valid_from = 50 WHERE id = 3;
+SELECT count(*) FROM price WHERE id = 3;
+
+SELECT sql_saga.drop_api('price', 'valid');
+SELECT sql_saga.drop_era('price');
+DROP TABLE price;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,108 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from integer NOT NULL,
+  valid_to integer NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from integer NOT NULL,
+  valid_to integer NOT NULL,
+  legal_unit_id integer NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id']);
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+
+INSERT INTO legal_unit VALUES
+  (1, 0, 100, 'A'),
+  (2, 0, 50, 'B'),
+  (2, 50, 100, 'C');
+INSERT INTO establishment VALUES (10, 0, 100, 1);
+
+-- Split, trim and add slices
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], $$
+  SELECT * FROM (VALUES
+    (1, 20, 30, 'A2'),
+    (1, 40, 50, 'A3'),
+    (2, 40, 60, 'D'),
+    (3, 0, 10, 'E')) AS v (id, valid_from, valid_to, name)
+$$);
+TABLE legal_unit ORDER BY id, valid_from;
+
+-- Replaced slices are deleted and identical neighbours coalesced
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], $$
+  SELECT 1 AS id, 20 AS valid_from, 50 AS valid_to, 'A' AS name
+  UNION ALL
+  SELECT 2, 100, 120, 'C'
+$$);
+TABLE legal_unit ORDER BY id, valid_from;
+
+-- Merging needs a unique key on the key columns
+SELECT * FROM sql_saga.temporal_merge('establishment', ARRAY['id'], $$
+  SELECT 10 AS id, 50 AS valid_from, 120 AS valid_to, 2 AS legal_unit_id
+$$); -- fail
+SELECT sql_saga.add_unique_key('establishment', ARRAY['id']);
+SELECT * FROM sql_saga.temporal_merge('establishment', ARRAY['id'], $$
+  SELECT 10 AS id, 50 AS valid_from, 120 AS valid_to, 2 AS legal_unit_id
+$$);
+TABLE establishment ORDER BY id, valid_from;
+
+-- The foreign keys are checked at the end
+SELECT * FROM sql_saga.temporal_merge('establishment', ARRAY['id'], $$
+  SELECT 10 AS id, 0 AS valid_from, 130 AS valid_to, 1 AS legal_unit_id
+$$); -- fail
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], $$
+  SELECT 1 AS id, 0 AS valid_from, 10 AS valid_to, 'A' AS name
+  UNION ALL
+  SELECT 1, 5, 20, 'A'
+$$); -- fail
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], 'SELECT 1 AS id', 'nope'); -- fail
+TABLE establishment ORDER BY id, valid_from;
+
+-- The merge leaves the mode of the constraints as it is
+CREATE TABLE note (name text UNIQUE DEFERRABLE);
+BEGIN;
+SET CONSTRAINTS note_name_key DEFERRED;
+INSERT INTO note VALUES ('x'), ('x');
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], $$
+  SELECT 3 AS id, 10 AS valid_from, 20 AS valid_to, 'E' AS name
+$$);
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], $$
+  SELECT 3 AS id, 20 AS valid_from, 30 AS valid_to, 'F' AS name
+$$);
+DELETE FROM note;
+COMMIT; -- success
+TABLE legal_unit ORDER BY id, valid_from;
+DROP TABLE note;
+
+-- When the caller defers the constraints, the referenced rows can come later
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+SELECT * FROM sql_saga.temporal_merge('establishment', ARRAY['id'], $$
+  SELECT 11 AS id, 0 AS valid_from, 50 AS valid_to, 4 AS legal_unit_id
+$$);
+SELECT * FROM sql_saga.temporal_merge('legal_unit', ARRAY['id'], $$
+  SELECT 4 AS id, 0 AS valid_from, 50 AS valid_to, 'G' AS name
+$$);
+COMMIT; -- success
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+SELECT * FROM sql_saga.temporal_merge('establishment', ARRAY['id'], $$
+  SELECT 12 AS id, 0 AS valid_from, 50 AS valid_to, 5 AS legal_unit_id
+$$);
+COMMIT; -- fail
+TABLE establishment ORDER BY id, valid_from;
+
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_unique_key('establishment', 'establishment_id_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,60 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  row_id integer GENERATED BY DEFAULT AS IDENTITY PRIMARY KEY,
+  id integer NOT NULL,
+  valid_from integer NOT NULL,
+  valid_to integer NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from integer NOT NULL,
+  valid_to integer NOT NULL,
+  legal_unit_id integer NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id']);
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+
+INSERT INTO legal_unit (id, valid_from, valid_to, name) VALUES
+  (1, 0, 10, 'a'),
+  (1, 10, 20, 'a'),
+  (1, 20, 30, 'b'),
+  (1, 30, 40, 'a'),
+  (2, 0, 10, 'x'),
+  (2, 10, 20, 'x'),
+  (2, 20, 30, 'x');
+INSERT INTO establishment VALUES
+  (10, 5, 15, 1),
+  (11, 0, 30, 2);
+
+SELECT sql_saga.coalesce_era('legal_unit');
+SELECT id, valid_from, valid_to, name FROM legal_unit ORDER BY id, valid_from;
+SELECT sql_saga.coalesce_era('legal_unit');
+SELECT sql_saga.coalesce_era('legal_unit', 'nope'); -- fail
+
+-- Coalesce what is changed through the view
+SELECT sql_saga.add_api('legal_unit');
+SET sql_saga.coalesce_on_write = on;
+UPDATE legal_unit__for_portion_of_valid SET valid_from = 20, valid_to = 30, name = 'a' WHERE id = 1;
+UPDATE legal_unit__for_portion_of_valid SET valid_from = 10, valid_to = 20, name = 'y' WHERE id = 2;
+SELECT id, valid_from, valid_to, name FROM legal_unit ORDER BY id, valid_from;
+UPDATE legal_unit__for_portion_of_valid SET valid_from = 10, valid_to = 20, name = 'x' WHERE id = 2;
+SELECT id, valid_from, valid_to, name FROM legal_unit ORDER BY id, valid_from;
+RESET sql_saga.coalesce_on_write;
+UPDATE legal_unit__for_portion_of_valid SET valid_from = 10, valid_to = 20, name = 'x' WHERE id = 1;
+UPDATE legal_unit__for_portion_of_valid SET valid_from = 10, valid_to = 20, name = 'a' WHERE id = 1;
+SELECT id, valid_from, valid_to, name FROM legal_unit ORDER BY id, valid_from;
+TABLE establishment ORDER BY id;
+
+SELECT sql_saga.drop_api('legal_unit', 'valid');
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,60 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+-- The input does not need to be sorted
+SELECT sql_saga.no_gaps_unordered(r, int4range(1, 12))
+FROM (VALUES (int4range(6, 12)), (int4range(1, 6))) AS v (r);
+SELECT sql_saga.no_gaps_unordered(r, int4range(1, 12))
+FROM (VALUES (int4range(6, 12)), (int4range(1, 5))) AS v (r);
+SELECT sql_saga.no_gaps_unordered(r, int4range(2, 11))
+FROM (VALUES (int4range(7, 20)), (int4range(3, 5)), (int4range(0, 8))) AS v (r);
+SELECT sql_saga.no_gaps_unordered(r, int4range(NULL, NULL))
+FROM (VALUES (int4range(5, NULL)), (NULL), (int4range(NULL, 5))) AS v (r);
+SELECT sql_saga.no_gaps_unordered(r, numrange(0, 3))
+FROM (VALUES (numrange(1.5, 3)), (numrange(0, 1.5))) AS v (r);
+SELECT sql_saga.no_gaps_unordered(r, numrange(0, 3))
+FROM (VALUES (numrange(1.5, 3, '()')), (numrange(0, 1.5))) AS v (r);
+SELECT sql_saga.no_gaps_unordered(r, NULL::int4range)
+FROM (VALUES (int4range(1, 5))) AS v (r);
+SELECT sql_saga.no_gaps_unordered(r, int4range(1, 5))
+FROM (VALUES (int4range(1, 5))) AS v (r)
+WHERE false;
+
+-- Many groups, each in random order
+CREATE TABLE shifts (job_id integer, valid_from integer, valid_to integer);
+INSERT INTO shifts
+  SELECT j, 10 * i, 10 * i + 10
+  FROM generate_series(1, 1000) AS j, generate_series(0, 9) AS i
+  WHERE i <> 5 OR j % 7 <> 0
+  ORDER BY random();
+ANALYZE shifts;
+
+SELECT count(*) FILTER (WHERE covered) AS covered, count(*) FILTER (WHERE NOT covered) AS gaps
+FROM (SELECT sql_saga.no_gaps_unordered(int4range(valid_from, valid_to), int4range(0, 100)) AS covered
+      FROM shifts
+      GROUP BY job_id) AS s;
+
+-- The same, with parallel workers
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+EXPLAIN (COSTS OFF)
+SELECT sql_saga.no_gaps_unordered(int4range(valid_from, valid_to), int4range(0, 100))
+FROM shifts
+WHERE job_id = 7;
+SELECT sql_saga.no_gaps_unordered(int4range(valid_from, valid_to), int4range(0, 100))
+FROM shifts
+WHERE job_id = 7;
+SELECT sql_saga.no_gaps_unordered(int4range(valid_from, valid_to), int4range(0, 100))
+FROM shifts
+WHERE job_id = 8;
+SELECT sql_saga.no_gaps_unordered(int4range(valid_from, valid_to), int4range(0, 100))
+FROM shifts;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+
+DROP TABLE shifts;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,67 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  name text NOT NULL
+);
+
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  legal_unit_id integer,
+  name text NOT NULL
+);
+
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+
+INSERT INTO legal_unit VALUES
+  (1, '2015-01-01', '2016-01-01', 'Company 1'),
+  (1, '2016-01-01', 'infinity', 'Company 1 renamed'),
+  (2, '2015-01-01', '2016-01-01', 'Company 2'),
+  (2, '2017-01-01', 'infinity', 'Company 2 again');
+
+-- Existing rows are checked when the foreign key is added
+INSERT INTO establishment VALUES
+  (1, '2015-06-01', '2017-01-01', 1, 'Shop 1'),
+  (2, '2015-01-01', '2016-01-01', 2, 'Shop 2'),
+  (3, '2017-01-01', 'infinity', 2, 'Shop 3'),
+  (4, '2015-01-01', 'infinity', NULL, 'Shop 4');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+SELECT rows_checked FROM sql_saga.validate_foreign_key('establishment_legal_unit_id_valid');
+
+-- Rows loaded with the triggers disabled are caught by validating again
+ALTER TABLE establishment DISABLE TRIGGER USER;
+INSERT INTO establishment VALUES
+  (5, '2015-06-01', '2017-06-01', 2, 'Shop 5'), -- spans a gap
+  (6, '2014-01-01', '2015-06-01', 1, 'Shop 6'), -- starts too early
+  (7, '2015-01-01', '2016-01-01', 3, 'Shop 7'); -- no such legal unit
+ALTER TABLE establishment ENABLE TRIGGER USER;
+SELECT sql_saga.validate_foreign_key('establishment_legal_unit_id_valid'); -- fail
+SELECT v->>'id' AS id, v->>'legal_unit_id' AS legal_unit_id
+FROM sql_saga.foreign_key_violations('establishment_legal_unit_id_valid') AS v
+ORDER BY 1;
+
+DELETE FROM establishment WHERE id >= 5;
+SELECT count(*) FROM sql_saga.foreign_key_violations('establishment_legal_unit_id_valid');
+SELECT rows_checked FROM sql_saga.validate_foreign_key('establishment_legal_unit_id_valid');
+
+-- Adding a foreign key over violating rows reports them the same way
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+INSERT INTO establishment VALUES (8, '2016-06-01', '2017-06-01', 2, 'Shop 8');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid'); -- fail
+SELECT count(*) FROM sql_saga.foreign_keys;
+
+SELECT sql_saga.validate_foreign_key('no_such_key'); -- fail
+
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
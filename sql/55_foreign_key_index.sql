@@ -0,0 +1,59 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  name text NOT NULL
+);
+
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from date,
+  valid_to date,
+  legal_unit_id integer NOT NULL,
+  name text NOT NULL
+);
+
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+
+-- Nothing finds the establishments of a legal unit yet
+SELECT * FROM sql_saga.foreign_keys_without_index();
+
+-- An index leading with the key columns does
+CREATE INDEX establishment_legal_unit_id_idx ON establishment (legal_unit_id);
+SELECT * FROM sql_saga.foreign_keys_without_index();
+DROP INDEX establishment_legal_unit_id_idx;
+
+-- A partial index does not
+CREATE INDEX establishment_legal_unit_id_idx ON establishment (legal_unit_id) WHERE legal_unit_id > 0;
+SELECT count(*) FROM sql_saga.foreign_keys_without_index();
+DROP INDEX establishment_legal_unit_id_idx;
+
+-- The index can be created with the foreign key, and is dropped with it
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid', create_index => true);
+SELECT key_name, fk_index FROM sql_saga.foreign_keys;
+SELECT indexdef FROM pg_indexes WHERE tablename = 'establishment' ORDER BY indexname;
+SELECT count(*) FROM sql_saga.foreign_keys_without_index();
+DROP INDEX establishment_legal_unit_id_valid_idx; -- fail
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT indexname FROM pg_indexes WHERE tablename = 'establishment' ORDER BY indexname;
+
+-- An index that is already there is used, and kept
+CREATE INDEX establishment_legal_unit_id_idx ON establishment USING gist (legal_unit_id, daterange(valid_from, valid_to));
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid', create_index => true);
+SELECT key_name, fk_index FROM sql_saga.foreign_keys;
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT indexname FROM pg_indexes WHERE tablename = 'establishment' ORDER BY indexname;
+
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
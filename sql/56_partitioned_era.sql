@@ -0,0 +1,73 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+-- Both tables are partitioned by the start of their era, and one partition of
+-- each has its columns in another order than the parent
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+) PARTITION BY RANGE (valid_from);
+CREATE TABLE legal_unit_2022 PARTITION OF legal_unit FOR VALUES FROM ('2022-01-01') TO ('2023-01-01');
+CREATE TABLE legal_unit_2023 (name text NOT NULL, valid_to date NOT NULL, id integer NOT NULL, valid_from date NOT NULL);
+ALTER TABLE legal_unit ATTACH PARTITION legal_unit_2023 FOR VALUES FROM ('2023-01-01') TO ('2024-01-01');
+
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  legal_unit_id integer NOT NULL,
+  name text NOT NULL
+) PARTITION BY RANGE (valid_from);
+CREATE TABLE establishment_2022 PARTITION OF establishment FOR VALUES FROM ('2022-01-01') TO ('2023-01-01');
+CREATE TABLE establishment_2023 (legal_unit_id integer NOT NULL, name text NOT NULL, valid_to date NOT NULL, id integer NOT NULL, valid_from date NOT NULL);
+ALTER TABLE establishment ATTACH PARTITION establishment_2023 FOR VALUES FROM ('2023-01-01') TO ('2024-01-01');
+
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+
+-- The EXCLUDE constraints are on the partitions, and a trigger looks across them
+SELECT key_name, table_name, exclude_constraint, overlap_trigger FROM sql_saga.unique_keys;
+SELECT conrelid::regclass AS table_name, conname
+FROM pg_constraint
+WHERE contype = 'x' AND conrelid::regclass::text LIKE 'legal_unit%'
+ORDER BY conrelid::regclass::text, conname;
+
+INSERT INTO legal_unit VALUES
+  (1, '2022-01-01', '2022-07-01', 'A'),
+  (1, '2022-07-01', '2023-07-01', 'B'),
+  (1, '2023-07-01', 'infinity', 'C'); -- success
+INSERT INTO legal_unit VALUES (1, '2023-01-01', '2023-02-01', 'D'); -- fail
+UPDATE legal_unit SET valid_from = '2023-03-01', valid_to = '2023-05-01' WHERE name = 'A'; -- fail
+INSERT INTO legal_unit VALUES (2, '2022-01-01', '2023-03-01', 'E'), (2, '2023-03-01', '2023-06-01', 'E'); -- success
+
+-- New partitions get the EXCLUDE constraint as well, and must keep it
+CREATE TABLE legal_unit_2024 PARTITION OF legal_unit FOR VALUES FROM ('2024-01-01') TO ('2025-01-01');
+SELECT conrelid::regclass AS table_name, conname
+FROM pg_constraint
+WHERE contype = 'x' AND conrelid::regclass::text LIKE 'legal_unit%'
+ORDER BY conrelid::regclass::text, conname;
+ALTER TABLE legal_unit_2024 DROP CONSTRAINT legal_unit_2024_id_valid_excl; -- fail
+
+-- Foreign keys check the rows of every partition
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+INSERT INTO establishment VALUES (1, '2022-03-01', '2023-03-01', 1, 'F'); -- success
+INSERT INTO establishment VALUES (2, '2023-03-01', 'infinity', 1, 'G'); -- success
+INSERT INTO establishment VALUES (3, '2023-03-01', '2023-04-01', 3, 'H'); -- fail
+DELETE FROM legal_unit WHERE name = 'C'; -- fail
+
+-- Rows are merged across partitions
+SELECT sql_saga.coalesce_era('legal_unit');
+SELECT tableoid::regclass AS partition, * FROM legal_unit WHERE id = 2;
+
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT count(*) FROM pg_constraint WHERE contype = 'x' AND conrelid::regclass::text LIKE 'legal_unit%';
+SELECT count(*) FROM pg_trigger WHERE tgname = 'legal_unit_id_valid_overlap_check';
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
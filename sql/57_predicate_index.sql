@@ -0,0 +1,68 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+
+INSERT INTO legal_unit VALUES
+  (1, '2020-01-01', '2021-01-01', 'A'),
+  (1, '2021-01-01', 'infinity', 'B'),
+  (2, '2020-06-01', '2020-09-01', 'C');
+ANALYZE legal_unit;
+
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+
+-- The predicates on the era become range operators on the EXCLUDE index
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.contains(valid_from, valid_to, '2020-07-01');
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.contains(valid_from, valid_to, '2020-06-01', '2020-09-01');
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.equals(valid_from, valid_to, '2020-06-01', '2020-09-01');
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.overlaps(valid_from, valid_to, '2020-12-01', '2021-02-01');
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.precedes(valid_from, valid_to, '2021-01-01', '2022-01-01');
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.succeeds(valid_from, valid_to, '2020-01-01', '2021-01-01');
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.immediately_precedes(valid_from, valid_to, '2021-01-01', '2022-01-01');
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.immediately_succeeds(valid_from, valid_to, '2020-01-01', '2021-01-01');
+
+SELECT name FROM legal_unit WHERE sql_saga.contains(valid_from, valid_to, '2020-07-01') ORDER BY name;
+SELECT name FROM legal_unit WHERE sql_saga.contains(valid_from, valid_to, '2020-06-01', '2020-09-01') ORDER BY name;
+SELECT name FROM legal_unit WHERE sql_saga.equals(valid_from, valid_to, '2020-06-01', '2020-09-01') ORDER BY name;
+SELECT name FROM legal_unit WHERE sql_saga.overlaps(valid_from, valid_to, '2020-12-01', '2021-02-01') ORDER BY name;
+SELECT name FROM legal_unit WHERE sql_saga.precedes(valid_from, valid_to, '2021-01-01', '2022-01-01') ORDER BY name;
+SELECT name FROM legal_unit WHERE sql_saga.succeeds(valid_from, valid_to, '2020-01-01', '2021-01-01') ORDER BY name;
+SELECT name FROM legal_unit WHERE sql_saga.immediately_precedes(valid_from, valid_to, '2021-01-01', '2022-01-01') ORDER BY name;
+SELECT name FROM legal_unit WHERE sql_saga.immediately_succeeds(valid_from, valid_to, '2020-01-01', '2021-01-01') ORDER BY name;
+
+-- An empty period is inlined
+EXPLAIN (COSTS OFF) SELECT name FROM legal_unit WHERE sql_saga.overlaps(valid_from, valid_to, '2020-07-01', '2020-07-01');
+SELECT name FROM legal_unit WHERE sql_saga.overlaps(valid_from, valid_to, '2020-07-01', '2020-07-01') ORDER BY name;
+
+-- The parameters of a generic plan are used too, and a period they leave
+-- empty is filtered with the comparisons instead
+SET plan_cache_mode = force_generic_plan;
+PREPARE overlapping (date, date) AS
+  SELECT name FROM legal_unit WHERE sql_saga.overlaps(valid_from, valid_to, $1, $2) ORDER BY name;
+EXPLAIN (COSTS OFF) EXECUTE overlapping('2020-12-01', '2021-02-01');
+EXECUTE overlapping('2020-12-01', '2021-02-01');
+EXECUTE overlapping('2020-08-01', '2020-07-01');
+EXECUTE overlapping(NULL, '2021-02-01');
+DEALLOCATE overlapping;
+PREPARE preceding (date) AS
+  SELECT name FROM legal_unit WHERE sql_saga.precedes(valid_from, valid_to, $1, NULL) ORDER BY name;
+EXPLAIN (COSTS OFF) EXECUTE preceding('2021-01-01');
+EXECUTE preceding('2021-01-01');
+DEALLOCATE preceding;
+RESET plan_cache_mode;
+
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
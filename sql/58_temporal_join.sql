@@ -0,0 +1,67 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  legal_unit_id integer,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+
+INSERT INTO legal_unit VALUES
+  (1, '2020-01-01', '2021-01-01', 'LU 1a'),
+  (1, '2021-01-01', '2022-01-01', 'LU 1b'),
+  (2, '2020-01-01', 'infinity', 'LU 2'),
+  (3, '2020-01-01', '2021-01-01', 'LU 3');
+INSERT INTO establishment VALUES
+  (10, 1, '2020-06-01', '2021-06-01', 'ES 10'),
+  (11, 1, '2020-01-01', '2020-03-01', 'ES 11'),
+  (12, 1, '2021-06-01', '2023-01-01', 'ES 12'),
+  (20, 2, '2019-01-01', '2020-02-01', 'ES 20'),
+  (40, 4, '2020-01-01', '2021-01-01', 'ES 40'),
+  (50, NULL, '2020-01-01', '2021-01-01', 'ES 50');
+
+-- Each pair of overlapping rows with the same key, with the time they share
+SELECT j.valid_from, j.valid_to, (j.legal_unit).name AS legal_unit, (j.establishment).name AS establishment
+FROM sql_saga.temporal_join('legal_unit', ARRAY['id'], 'valid', 'establishment', ARRAY['legal_unit_id'], 'valid')
+  AS j (valid_from date, valid_to date, legal_unit legal_unit, establishment establishment);
+
+-- The same as joining on the key and && of the periods
+WITH
+sweep AS (
+  SELECT j.valid_from, j.valid_to, (j.legal_unit).name AS legal_unit, (j.establishment).name AS establishment
+  FROM sql_saga.temporal_join('legal_unit', ARRAY['id'], 'valid', 'establishment', ARRAY['legal_unit_id'], 'valid')
+    AS j (valid_from date, valid_to date, legal_unit legal_unit, establishment establishment)
+),
+overlap AS (
+  SELECT greatest(lu.valid_from, es.valid_from) AS valid_from,
+         least(lu.valid_to, es.valid_to) AS valid_to,
+         lu.name AS legal_unit,
+         es.name AS establishment
+  FROM legal_unit AS lu
+  JOIN establishment AS es
+    ON es.legal_unit_id = lu.id
+   AND daterange(lu.valid_from, lu.valid_to) && daterange(es.valid_from, es.valid_to)
+)
+SELECT count(*) AS differences
+FROM ((TABLE sweep EXCEPT ALL TABLE overlap) UNION ALL (TABLE overlap EXCEPT ALL TABLE sweep)) AS d;
+
+SELECT * FROM sql_saga.temporal_join('legal_unit', ARRAY['id'], 'valid', 'establishment', ARRAY['name'], 'valid')
+  AS j (valid_from date, valid_to date, legal_unit legal_unit, establishment establishment); -- fail
+SELECT * FROM sql_saga.temporal_join('legal_unit', ARRAY['id'], 'valid', 'establishment', ARRAY['legal_unit_id'], 'valid')
+  AS j (valid_from date, valid_to date); -- fail
+
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,90 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  legal_unit_id integer,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE stat_for_unit (
+  legal_unit_id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  employees integer NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('stat_for_unit', 'valid_from', 'valid_to');
+
+INSERT INTO legal_unit VALUES
+  (1, '2020-01-01', '2021-01-01', 'LU 1a'),
+  (1, '2021-01-01', '2022-01-01', 'LU 1b'),
+  (2, '2020-01-01', 'infinity', 'LU 2'),
+  (3, '2020-01-01', '2020-06-01', 'LU 3a'),
+  (3, '2021-01-01', '2021-06-01', 'LU 3b');
+INSERT INTO establishment VALUES
+  (10, 1, '2020-06-01', '2021-06-01', 'ES 10'),
+  (11, 1, '2020-01-01', '2020-03-01', 'ES 11'),
+  (20, 2, '2019-01-01', '2020-02-01', 'ES 20'),
+  (40, 4, '2020-01-01', '2021-01-01', 'ES 40'),
+  (50, NULL, '2020-01-01', '2021-01-01', 'ES 50');
+INSERT INTO stat_for_unit VALUES
+  (1, '2020-03-01', '2020-09-01', 10),
+  (2, '2020-01-01', '2020-02-01', 20);
+
+-- The timeline of each key is cut wherever a row of any table starts or ends
+SELECT *
+FROM sql_saga.timeline_segments(ARRAY['legal_unit', 'establishment', 'stat_for_unit']::regclass[],
+                                ARRAY['id', 'legal_unit_id', 'legal_unit_id'],
+                                ARRAY['valid', 'valid', 'valid'])
+  AS s (legal_unit_id integer, valid_from date, valid_to date);
+
+-- The same as taking the change points and the next one after each
+WITH
+merged AS (
+  SELECT *
+  FROM sql_saga.timeline_segments(ARRAY['legal_unit', 'establishment', 'stat_for_unit']::regclass[],
+                                  ARRAY['id', 'legal_unit_id', 'legal_unit_id'],
+                                  ARRAY['valid', 'valid', 'valid'])
+    AS s (legal_unit_id integer, valid_from date, valid_to date)
+),
+points AS (
+  SELECT id AS legal_unit_id, valid_from AS point FROM legal_unit
+  UNION SELECT id, valid_to FROM legal_unit
+  UNION SELECT legal_unit_id, valid_from FROM establishment WHERE legal_unit_id IS NOT NULL
+  UNION SELECT legal_unit_id, valid_to FROM establishment WHERE legal_unit_id IS NOT NULL
+  UNION SELECT legal_unit_id, valid_from FROM stat_for_unit
+  UNION SELECT legal_unit_id, valid_to FROM stat_for_unit
+),
+windowed AS (
+  SELECT legal_unit_id, point AS valid_from, lead(point) OVER (PARTITION BY legal_unit_id ORDER BY point) AS valid_to
+  FROM points
+),
+segments AS (
+  SELECT * FROM windowed WHERE valid_to IS NOT NULL
+)
+SELECT count(*) AS differences
+FROM ((TABLE merged EXCEPT ALL TABLE segments) UNION ALL (TABLE segments EXCEPT ALL TABLE merged)) AS d;
+
+SELECT *
+FROM sql_saga.timeline_segments(ARRAY['legal_unit']::regclass[], ARRAY['id'], ARRAY['valid'])
+  AS s (legal_unit_id text, valid_from date, valid_to date); -- fail
+SELECT *
+FROM sql_saga.timeline_segments(ARRAY['legal_unit', 'establishment']::regclass[], ARRAY['id', 'legal_unit_id'], ARRAY['valid'])
+  AS s (legal_unit_id integer, valid_from date, valid_to date); -- fail
+
+SELECT sql_saga.drop_era('stat_for_unit');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE stat_for_unit;
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
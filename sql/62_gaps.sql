@@ -0,0 +1,86 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+-- The parts of the target that are not covered, with sorted input
+SELECT sql_saga.gaps(r, int4range(1, 20) ORDER BY r)
+FROM (VALUES (int4range(1, 3)), (int4range(5, 8)), (int4range(7, 10)), (int4range(12, 15))) AS v (r);
+SELECT sql_saga.gaps(r, int4range(1, 10) ORDER BY r)
+FROM (VALUES (int4range(0, 5)), (int4range(5, 12))) AS v (r);
+SELECT sql_saga.gaps(r, int4range(NULL, NULL) ORDER BY r)
+FROM (VALUES (int4range(5, 10)), (NULL), ('empty'::int4range)) AS v (r);
+SELECT sql_saga.gaps(r, int4range(1, 10) ORDER BY r)
+FROM (VALUES (int4range(NULL, 3)), (int4range(6, NULL)), (int4range(20, 30))) AS v (r);
+SELECT sql_saga.gaps(r, numrange(0, 3, '[]') ORDER BY r)
+FROM (VALUES (numrange(0, 1, '[]')), (numrange(1, 2, '()')), (numrange(2, 3, '[]'))) AS v (r);
+SELECT sql_saga.gaps(r, numrange(0, 3, '[]') ORDER BY r)
+FROM (VALUES (numrange(0, 1, '[)')), (numrange(1, 3, '(]'))) AS v (r);
+SELECT sql_saga.gaps(r, NULL::int4range ORDER BY r)
+FROM (VALUES (int4range(1, 5))) AS v (r);
+SELECT sql_saga.gaps(r, int4range(1, 5) ORDER BY r)
+FROM (VALUES (int4range(1, 5))) AS v (r)
+WHERE false;
+SELECT sql_saga.gaps(r, t ORDER BY r)
+FROM (VALUES (int4range(1, 3), int4range(1, 10)), (int4range(3, 5), int4range(1, 11))) AS v (r, t); -- fail
+SELECT sql_saga.gaps(r, int4range(1, 20))
+FROM (VALUES (int4range(5, 8)), (int4range(1, 3))) AS v (r); -- fail
+
+-- The same with input in any order
+SELECT sql_saga.gaps_unordered(r, int4range(1, 20))
+FROM (VALUES (int4range(12, 15)), (int4range(7, 10)), (int4range(1, 3)), (int4range(5, 8))) AS v (r);
+SELECT sql_saga.gaps_unordered(r, int4range(NULL, NULL))
+FROM (VALUES (int4range(5, 10)), (NULL), ('empty'::int4range)) AS v (r);
+SELECT sql_saga.gaps_unordered(r, numrange(0, 3, '[]'))
+FROM (VALUES (numrange(1, 3, '(]')), (numrange(0, 1, '[)'))) AS v (r);
+
+-- Everything that is covered, in any order
+SELECT sql_saga.covered(r)
+FROM (VALUES (int4range(12, 15)), (int4range(7, 10)), (NULL), (int4range(1, 3)), (int4range(5, 8)), ('empty'::int4range)) AS v (r);
+SELECT sql_saga.covered(r)
+FROM (VALUES (daterange('2021-01-01', NULL)), (daterange('2020-01-01', '2021-01-01'))) AS v (r);
+SELECT sql_saga.covered(r)
+FROM (VALUES (int4range(1, 5))) AS v (r)
+WHERE false;
+
+-- Where the legal unit of each establishment is missing
+CREATE TABLE legal_unit (id integer, valid_from date, valid_to date);
+CREATE TABLE establishment (id integer, legal_unit_id integer, valid_from date, valid_to date);
+INSERT INTO legal_unit VALUES
+  (1, '2020-01-01', '2020-06-01'),
+  (1, '2020-09-01', '2021-01-01'),
+  (2, '2020-01-01', 'infinity');
+INSERT INTO establishment VALUES
+  (10, 1, '2020-01-01', '2021-06-01'),
+  (20, 2, '2019-01-01', '2020-06-01');
+
+SELECT es.id, sql_saga.gaps(daterange(lu.valid_from, lu.valid_to), daterange(es.valid_from, es.valid_to)
+                            ORDER BY daterange(lu.valid_from, lu.valid_to)) AS gaps
+FROM establishment AS es
+JOIN legal_unit AS lu ON lu.id = es.legal_unit_id
+GROUP BY es.id, es.valid_from, es.valid_to
+ORDER BY es.id;
+
+-- Many groups in random order, compared with the built-in range_agg
+CREATE TABLE shifts (job_id integer, valid_from integer, valid_to integer);
+INSERT INTO shifts
+  SELECT j, 10 * i, 10 * i + 10 - (i % 3)
+  FROM generate_series(1, 1000) AS j, generate_series(0, 9) AS i
+  WHERE i <> 5 OR j % 7 <> 0
+  ORDER BY random();
+ANALYZE shifts;
+
+SELECT count(*) AS jobs,
+       count(*) FILTER (WHERE gaps = gaps_unordered) AS same_gaps,
+       count(*) FILTER (WHERE covered = range_agg) AS same_covered,
+       count(*) FILTER (WHERE covered = range_agg AND gaps = int4multirange(int4range(0, 100)) - range_agg) AS complements
+FROM (SELECT job_id,
+             sql_saga.gaps(int4range(valid_from, valid_to), int4range(0, 100) ORDER BY int4range(valid_from, valid_to)) AS gaps,
+             sql_saga.gaps_unordered(int4range(valid_from, valid_to), int4range(0, 100)) AS gaps_unordered,
+             sql_saga.covered(int4range(valid_from, valid_to)) AS covered,
+             range_agg(int4range(valid_from, valid_to)) AS range_agg
+      FROM shifts
+      GROUP BY job_id) AS s;
+
+DROP TABLE shifts;
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,76 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+-- Multiranges can come in any order
+SELECT sql_saga.no_gaps(m, int4range(1, 20))
+FROM (VALUES ('{[10,20)}'::int4multirange), ('{[1,3),[3,5),[5,11)}')) AS v (m);
+SELECT sql_saga.no_gaps(m, int4range(1, 20))
+FROM (VALUES ('{[12,20)}'::int4multirange), ('{[1,5),[7,11)}'), (NULL), ('{}')) AS v (m);
+SELECT sql_saga.gaps(m, int4range(1, 20))
+FROM (VALUES ('{[12,20)}'::int4multirange), ('{[1,5),[7,11)}'), (NULL), ('{}')) AS v (m);
+SELECT sql_saga.covered(m)
+FROM (VALUES ('{[12,20)}'::int4multirange), ('{[1,5),[7,11)}'), (NULL), ('{}')) AS v (m);
+SELECT sql_saga.no_gaps(m, NULL::int4range)
+FROM (VALUES ('{[1,5)}'::int4multirange)) AS v (m);
+
+CREATE TABLE license (unit_id integer, valid datemultirange);
+INSERT INTO license VALUES
+  (1, '{[2020-01-01,2020-06-01),[2021-01-01,2022-01-01)}'),
+  (1, '{[2020-06-01,2021-01-01)}'),
+  (2, '{[2020-01-01,2020-03-01)}'),
+  (2, '{[2020-04-01,2021-01-01)}');
+SELECT unit_id,
+       sql_saga.no_gaps(valid, daterange('2020-01-01', '2022-01-01')),
+       sql_saga.gaps(valid, daterange('2020-01-01', '2022-01-01')),
+       sql_saga.covered(valid)
+FROM license
+GROUP BY unit_id
+ORDER BY unit_id;
+DROP TABLE license;
+
+-- Foreign keys check that the aggregated referenced timeline contains each period
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  legal_unit_id integer,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], 'valid');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+
+INSERT INTO legal_unit VALUES
+  (1, '2020-01-01', '2020-04-01', 'LU 1a'),
+  (1, '2020-04-01', '2020-08-01', 'LU 1b'),
+  (1, '2020-08-01', '2021-01-01', 'LU 1c'),
+  (2, '2020-01-01', '2020-04-01', 'LU 2a'),
+  (2, '2020-06-01', '2021-01-01', 'LU 2b');
+
+INSERT INTO establishment VALUES (10, 1, '2020-02-01', '2020-12-01', 'ES 10');
+INSERT INTO establishment VALUES (20, 2, '2020-06-01', '2021-01-01', 'ES 20');
+INSERT INTO establishment VALUES (21, 2, '2020-02-01', '2020-07-01', 'ES 21'); -- fail
+INSERT INTO establishment VALUES (11, 1, '2020-02-01', '2021-02-01', 'ES 11'); -- fail
+UPDATE establishment SET valid_from = '2020-03-01' WHERE id = 20; -- fail
+
+SELECT sql_saga.validate_foreign_key_new_row('establishment_legal_unit_id_valid', '{"legal_unit_id": 1}');
+ALTER TABLE establishment DISABLE TRIGGER USER;
+INSERT INTO establishment VALUES (22, 2, '2020-03-01', '2020-07-01', 'ES 22');
+ALTER TABLE establishment ENABLE TRIGGER USER;
+SELECT sql_saga.validate_foreign_key_new_row('establishment_legal_unit_id_valid', '{"legal_unit_id": 2}'); -- fail
+DELETE FROM establishment WHERE id = 22;
+
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE establishment;
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,79 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE uk(id integer, s integer, e integer);
+SELECT sql_saga.add_era('uk', 's', 'e', 'p');
+SELECT sql_saga.add_unique_key('uk', ARRAY['id'], 'p');
+
+CREATE TABLE fk(id integer, uk_id integer, s integer, e integer);
+SELECT sql_saga.add_era('fk', 's', 'e', 'q');
+SELECT sql_saga.add_foreign_key('fk', ARRAY['uk_id'], 'q', 'uk_id_p');
+
+-- The unique key of a partitioned table is checked across partitions by a trigger
+CREATE TABLE part(id integer NOT NULL, s integer NOT NULL, e integer NOT NULL) PARTITION BY RANGE (s);
+CREATE TABLE part_1 PARTITION OF part FOR VALUES FROM (0) TO (10);
+CREATE TABLE part_2 PARTITION OF part FOR VALUES FROM (10) TO (20);
+SELECT sql_saga.add_era('part', 's', 'e', 'p');
+SELECT sql_saga.add_unique_key('part', ARRAY['id'], 'p');
+
+SELECT sql_saga.stat_constraints_reset();
+SELECT count(*) FROM sql_saga.stat_constraints;
+
+INSERT INTO uk(id, s, e) VALUES (1, 1, 5), (2, 1, 5), (3, 1, 10);
+
+-- Immediate checks, one per key
+INSERT INTO fk(id, uk_id, s, e) VALUES (1, 1, 1, 3), (2, 2, 2, 4);
+INSERT INTO fk(id, uk_id, s, e) VALUES (3, 1, 4, 6); -- fail
+
+-- A deferred check
+BEGIN;
+SET CONSTRAINTS ALL DEFERRED;
+INSERT INTO fk(id, uk_id, s, e) VALUES (4, 2, 1, 2);
+COMMIT;
+
+-- The referenced side counts for the foreign key too
+DELETE FROM uk WHERE id = 1; -- fail
+
+-- A batch checks all the keys of the statement at once
+SET sql_saga.foreign_key_check_mode = 'batch';
+INSERT INTO fk(id, uk_id, s, e) VALUES (5, 3, 1, 2), (6, 3, 2, 3), (7, 1, 1, 2);
+RESET sql_saga.foreign_key_check_mode;
+
+INSERT INTO part(id, s, e) VALUES (1, 1, 5), (1, 5, 12);
+INSERT INTO part(id, s, e) VALUES (1, 11, 15); -- fail
+
+SELECT key_name, table_name, key_type, calls, rows_checked,
+       deferred_checks, immediate_checks, violations,
+       total_time >= max_time AND max_time >= 0 AS timed
+FROM sql_saga.stat_constraints
+ORDER BY key_name;
+
+-- Reset one constraint
+SELECT sql_saga.stat_constraints_reset('fk_uk_id_q');
+SELECT key_name, calls FROM sql_saga.stat_constraints ORDER BY key_name;
+
+-- Nothing is recorded when tracking is off
+SET sql_saga.track_constraints = off;
+INSERT INTO fk(id, uk_id, s, e) VALUES (8, 2, 1, 2);
+RESET sql_saga.track_constraints;
+SELECT key_name, calls FROM sql_saga.stat_constraints ORDER BY key_name;
+
+-- Reset them all
+SELECT sql_saga.stat_constraints_reset();
+SELECT count(*) FROM sql_saga.stat_constraints;
+
+-- No check went without statistics
+SELECT sql_saga.stat_constraints_untracked();
+
+SELECT sql_saga.drop_foreign_key('fk', 'fk_uk_id_q');
+SELECT sql_saga.drop_unique_key('uk', 'uk_id_p');
+SELECT sql_saga.drop_unique_key('part', 'part_id_p');
+SELECT sql_saga.drop_era('fk', 'q');
+SELECT sql_saga.drop_era('uk', 'p');
+SELECT sql_saga.drop_era('part', 'p');
+
+DROP TABLE fk;
+DROP TABLE uk;
+DROP TABLE part;
+
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -0,0 +1,43 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE uk(id integer, s integer, e integer);
+SELECT sql_saga.add_era('uk', 's', 'e', 'p');
+SELECT sql_saga.add_unique_key('uk', ARRAY['id'], 'p');
+
+CREATE TABLE fk(id integer, uk_id integer, s integer, e integer);
+SELECT sql_saga.add_era('fk', 's', 'e', 'q');
+SELECT sql_saga.add_foreign_key('fk', ARRAY['uk_id'], 'q', 'uk_id_p');
+
+-- Break a foreign key behind the back of the event triggers
+ALTER EVENT TRIGGER sql_saga_rename_following DISABLE;
+ALTER TRIGGER fk_uk_id_q_fk_insert ON fk RENAME TO hidden;
+ALTER EVENT TRIGGER sql_saga_rename_following ENABLE;
+
+-- DDL that does not touch the tables of sql_saga is left alone
+CREATE TABLE staging(id integer, s integer, e integer);
+ALTER TABLE staging ADD COLUMN note text;
+CREATE INDEX ON staging (id);
+ALTER TABLE staging RENAME COLUMN note TO remark;
+DROP TABLE staging;
+CREATE TEMPORARY TABLE scratch(id integer);
+DROP TABLE scratch;
+
+-- DDL on the tables of sql_saga still checks them
+ALTER TABLE fk ADD COLUMN note text; -- fail
+CREATE INDEX ON uk (id); -- fail
+
+-- Repair the foreign key
+ALTER EVENT TRIGGER sql_saga_rename_following DISABLE;
+ALTER TRIGGER hidden ON fk RENAME TO fk_uk_id_q_fk_insert;
+ALTER EVENT TRIGGER sql_saga_rename_following ENABLE;
+ALTER TABLE fk ADD COLUMN note text;
+
+SELECT sql_saga.drop_foreign_key('fk', 'fk_uk_id_q');
+SELECT sql_saga.drop_unique_key('uk', 'uk_id_p');
+SELECT sql_saga.drop_era('fk', 'q');
+SELECT sql_saga.drop_era('uk', 'p');
+DROP TABLE fk;
+DROP TABLE uk;
+
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
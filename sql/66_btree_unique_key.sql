@@ -0,0 +1,98 @@
+CREATE EXTENSION sql_saga CASCADE;
+
+CREATE TABLE legal_unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL,
+  name text NOT NULL
+);
+SELECT sql_saga.add_era('legal_unit', 'valid_from', 'valid_to');
+
+-- The rows already there are checked when the key is added
+INSERT INTO legal_unit VALUES
+  (1, '2022-01-01', '2023-01-01', 'A'),
+  (1, '2022-06-01', '2023-06-01', 'B');
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], enforcement => 'BTREE'); -- fail
+DELETE FROM legal_unit WHERE name = 'B';
+
+-- There is no EXCLUDE constraint to give it
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], exclude_constraint => 'legal_unit_excl', enforcement => 'BTREE'); -- fail
+
+SELECT sql_saga.add_unique_key('legal_unit', ARRAY['id'], enforcement => 'BTREE');
+
+-- Only the btree of the unique constraint is built, and a trigger checks it
+SELECT key_name, unique_constraint, exclude_constraint, overlap_trigger, enforcement FROM sql_saga.unique_keys;
+SELECT c.relname AS index_name, am.amname
+FROM pg_index AS i
+JOIN pg_class AS c ON c.oid = i.indexrelid
+JOIN pg_am AS am ON am.oid = c.relam
+WHERE i.indrelid = 'legal_unit'::regclass;
+
+INSERT INTO legal_unit VALUES
+  (1, '2023-02-01', '2023-07-01', 'B'),
+  (1, '2023-07-01', 'infinity', 'C'),
+  (2, '2022-01-01', '2022-12-01', 'D'); -- success
+INSERT INTO legal_unit VALUES (1, '2022-12-01', '2023-01-15', 'E'); -- fail, the previous row ends after its start
+INSERT INTO legal_unit VALUES (1, '2021-01-01', '2022-02-01', 'E'); -- fail, the next row starts before its end
+INSERT INTO legal_unit VALUES (1, '2022-03-01', '2022-04-01', 'E'); -- fail, within the previous row
+INSERT INTO legal_unit VALUES (1, '2022-01-01', '2022-02-01', 'E'); -- fail, with the same start
+INSERT INTO legal_unit VALUES (1, '2023-01-01', '2023-02-01', 'E'); -- success, in the gap
+UPDATE legal_unit SET valid_to = '2023-03-01' WHERE name = 'A'; -- fail
+UPDATE legal_unit SET id = 1 WHERE name = 'D'; -- fail
+
+-- The check is deferrable, like an EXCLUDE constraint
+BEGIN;
+SET CONSTRAINTS legal_unit_id_valid_overlap_check DEFERRED;
+UPDATE legal_unit SET valid_to = '2023-01-15' WHERE name = 'A';
+UPDATE legal_unit SET valid_from = '2023-01-15' WHERE name = 'E';
+COMMIT; -- success
+BEGIN;
+SET CONSTRAINTS legal_unit_id_valid_overlap_check DEFERRED;
+INSERT INTO legal_unit VALUES (2, '2022-06-01', '2023-06-01', 'F');
+COMMIT; -- fail
+TABLE legal_unit ORDER BY id, valid_from;
+
+-- Foreign keys work the same
+CREATE TABLE establishment (
+  id integer NOT NULL,
+  legal_unit_id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL
+);
+SELECT sql_saga.add_era('establishment', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('establishment', ARRAY['legal_unit_id'], 'valid', 'legal_unit_id_valid');
+INSERT INTO establishment VALUES (1, 1, '2022-06-01', '2024-01-01'); -- success
+INSERT INTO establishment VALUES (2, 2, '2022-06-01', '2024-01-01'); -- fail
+SELECT sql_saga.drop_foreign_key('establishment', 'establishment_legal_unit_id_valid');
+SELECT sql_saga.drop_era('establishment');
+DROP TABLE establishment;
+
+SELECT sql_saga.drop_unique_key('legal_unit', 'legal_unit_id_valid');
+SELECT count(*) FROM pg_constraint WHERE conrelid = 'legal_unit'::regclass AND contype IN ('u', 'x');
+SELECT count(*) FROM pg_trigger WHERE tgname = 'legal_unit_id_valid_overlap_check';
+
+-- Partitioned tables need no EXCLUDE constraint on their partitions either
+CREATE TABLE unit (
+  id integer NOT NULL,
+  valid_from date NOT NULL,
+  valid_to date NOT NULL
+) PARTITION BY RANGE (valid_from);
+CREATE TABLE unit_2022 PARTITION OF unit FOR VALUES FROM ('2022-01-01') TO ('2023-01-01');
+CREATE TABLE unit_2023 PARTITION OF unit FOR VALUES FROM ('2023-01-01') TO ('2024-01-01');
+SELECT sql_saga.add_era('unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('unit', ARRAY['id'], enforcement => 'BTREE');
+CREATE TABLE unit_2024 PARTITION OF unit FOR VALUES FROM ('2024-01-01') TO ('2025-01-01');
+SELECT count(*) FROM pg_constraint WHERE contype = 'x' AND conrelid::regclass::text LIKE 'unit%';
+
+INSERT INTO unit VALUES (1, '2022-01-01', '2023-03-01'), (1, '2023-03-01', '2024-06-01'); -- success
+INSERT INTO unit VALUES (1, '2023-01-01', '2023-02-01'); -- fail
+INSERT INTO unit VALUES (1, '2024-06-01', '2024-07-01'), (2, '2023-01-01', '2023-02-01'); -- success
+
+SELECT sql_saga.drop_unique_key('unit', 'unit_id_valid');
+SELECT sql_saga.drop_era('unit');
+DROP TABLE unit;
+
+SELECT sql_saga.drop_era('legal_unit');
+DROP TABLE legal_unit;
+DROP EXTENSION sql_saga;
+DROP EXTENSION btree_gist;
@@ -8,6 +8,8 @@ GRANT USAGE ON SCHEMA sql_saga TO PUBLIC;
 CREATE TYPE sql_saga.drop_behavior AS ENUM ('CASCADE', 'RESTRICT');
 CREATE TYPE sql_saga.fk_actions AS ENUM ('CASCADE', 'SET NULL', 'SET DEFAULT', 'RESTRICT', 'NO ACTION');
 CREATE TYPE sql_saga.fk_match_types AS ENUM ('FULL', 'PARTIAL', 'SIMPLE');
+CREATE TYPE sql_saga.fk_lock_modes AS ENUM ('ROW', 'KEY');
+CREATE TYPE sql_saga.uk_enforcements AS ENUM ('GIST', 'BTREE');
 
 /*
  * All referencing columns must be either name or regsomething in order for
@@ -38,8 +40,7 @@ CREATE TABLE sql_saga.era (
 
     PRIMARY KEY (table_name, era_name),
 
-    CHECK (start_column_name <> end_column_name),
-    CHECK (era_name <> 'system_time')
+    CHECK (start_column_name <> end_column_name)
 );
 COMMENT ON TABLE sql_saga.era IS 'The main catalog for sql_saga.  All "DDL" operations for periods must first take an exclusive lock on this table.';
 GRANT SELECT ON TABLE sql_saga.era TO PUBLIC;
@@ -51,10 +52,20 @@ CREATE TABLE sql_saga.unique_keys (
     column_names name[] NOT NULL,
     era_name name NOT NULL,
     unique_constraint name NOT NULL,
-    exclude_constraint name NOT NULL,
+    exclude_constraint name,
+    overlap_trigger name,
+    enforcement sql_saga.uk_enforcements NOT NULL DEFAULT 'GIST',
 
     PRIMARY KEY (key_name),
 
+    /*
+     * A partitioned table cannot have an EXCLUDE constraint, so each of its
+     * partitions gets one and a trigger checks across partitions instead.
+     * With the BTREE enforcement, the trigger does all the checking.
+     */
+    CHECK ((exclude_constraint IS NULL) <> (overlap_trigger IS NULL)),
+    CHECK (enforcement = 'GIST' OR exclude_constraint IS NULL),
+
     FOREIGN KEY (table_name, era_name) REFERENCES sql_saga.era
 );
 GRANT SELECT ON TABLE sql_saga.unique_keys TO PUBLIC;
@@ -75,6 +86,8 @@ CREATE TABLE sql_saga.foreign_keys (
     fk_update_trigger name NOT NULL,
     uk_update_trigger name NOT NULL,
     uk_delete_trigger name NOT NULL,
+    fk_index regclass,
+    lock_mode sql_saga.fk_lock_modes NOT NULL DEFAULT 'ROW',
 
     PRIMARY KEY (key_name),
 
@@ -119,6 +132,78 @@ CREATE TABLE sql_saga.api_view (
 GRANT SELECT ON TABLE sql_saga.api_view TO PUBLIC;
 SELECT pg_catalog.pg_extension_config_dump('sql_saga.api_view', '');
 
+CREATE TABLE sql_saga.system_time_era (
+    table_name regclass NOT NULL,
+    era_name name NOT NULL DEFAULT 'system_time',
+    infinity_check_constraint name NOT NULL,
+    generated_always_trigger name NOT NULL,
+    write_history_trigger name NOT NULL,
+    truncate_trigger name NOT NULL,
+    excluded_column_names name[] NOT NULL DEFAULT '{}',
+
+    PRIMARY KEY (table_name),
+    FOREIGN KEY (table_name, era_name) REFERENCES sql_saga.era,
+
+    CHECK (era_name = 'system_time')
+);
+GRANT SELECT ON TABLE sql_saga.system_time_era TO PUBLIC;
+SELECT pg_catalog.pg_extension_config_dump('sql_saga.system_time_era', '');
+
+COMMENT ON TABLE sql_saga.system_time_era IS 'The SYSTEM_TIME eras, whose bounds are maintained by triggers';
+
+CREATE TABLE sql_saga.system_versioning (
+    table_name regclass NOT NULL,
+    era_name name NOT NULL DEFAULT 'system_time',
+    history_table_name regclass NOT NULL,
+    view_name regclass NOT NULL,
+
+    -- These functions should be of type regprocedure, but that blocks pg_upgrade.
+    func_as_of text NOT NULL,
+    func_between text NOT NULL,
+    func_between_symmetric text NOT NULL,
+    func_from_to text NOT NULL,
+
+    PRIMARY KEY (table_name),
+
+    FOREIGN KEY (table_name, era_name) REFERENCES sql_saga.era,
+
+    CHECK (era_name = 'system_time'),
+
+    UNIQUE (history_table_name),
+    UNIQUE (view_name),
+    UNIQUE (func_as_of),
+    UNIQUE (func_between),
+    UNIQUE (func_between_symmetric),
+    UNIQUE (func_from_to)
+);
+GRANT SELECT ON TABLE sql_saga.system_versioning TO PUBLIC;
+SELECT pg_catalog.pg_extension_config_dump('sql_saga.system_versioning', '');
+
+COMMENT ON TABLE sql_saga.system_versioning IS 'The history tables of the tables with SYSTEM VERSIONING';
+
+/*
+ * The trigger functions cache what these tables say in every backend.  Any
+ * change to them sends an invalidation for the table concerned, so that the
+ * caches reload it.
+ */
+CREATE FUNCTION sql_saga.invalidate_cached_metadata()
+ RETURNS trigger
+ LANGUAGE c
+AS 'sql_saga', 'invalidate_cached_metadata';
+
+CREATE TRIGGER invalidate_cached_metadata AFTER INSERT OR UPDATE OR DELETE ON sql_saga.era
+    FOR EACH ROW EXECUTE PROCEDURE sql_saga.invalidate_cached_metadata();
+CREATE TRIGGER invalidate_cached_metadata AFTER INSERT OR UPDATE OR DELETE ON sql_saga.unique_keys
+    FOR EACH ROW EXECUTE PROCEDURE sql_saga.invalidate_cached_metadata();
+CREATE TRIGGER invalidate_cached_metadata AFTER INSERT OR UPDATE OR DELETE ON sql_saga.foreign_keys
+    FOR EACH ROW EXECUTE PROCEDURE sql_saga.invalidate_cached_metadata();
+CREATE TRIGGER invalidate_cached_metadata AFTER INSERT OR UPDATE OR DELETE ON sql_saga.api_view
+    FOR EACH ROW EXECUTE PROCEDURE sql_saga.invalidate_cached_metadata();
+CREATE TRIGGER invalidate_cached_metadata AFTER INSERT OR UPDATE OR DELETE ON sql_saga.system_time_era
+    FOR EACH ROW EXECUTE PROCEDURE sql_saga.invalidate_cached_metadata();
+CREATE TRIGGER invalidate_cached_metadata AFTER INSERT OR UPDATE OR DELETE ON sql_saga.system_versioning
+    FOR EACH ROW EXECUTE PROCEDURE sql_saga.invalidate_cached_metadata();
+
 /*
  * C Helper functions
  */
@@ -144,6 +229,271 @@ CREATE AGGREGATE sql_saga.no_gaps(anyrange, anyrange) (
   finalfunc_extra
 );
 
+CREATE FUNCTION sql_saga.no_gaps_unordered_transfn(internal, anyrange, anyrange)
+RETURNS internal
+AS 'sql_saga', 'no_gaps_unordered_transfn'
+LANGUAGE c
+PARALLEL SAFE;
+
+CREATE FUNCTION sql_saga.no_gaps_unordered_combinefn(internal, internal)
+RETURNS internal
+AS 'sql_saga', 'no_gaps_unordered_combinefn'
+LANGUAGE c
+PARALLEL SAFE;
+
+CREATE FUNCTION sql_saga.no_gaps_unordered_serialfn(internal)
+RETURNS bytea
+AS 'sql_saga', 'no_gaps_unordered_serialfn'
+LANGUAGE c
+STRICT
+PARALLEL SAFE;
+
+CREATE FUNCTION sql_saga.no_gaps_unordered_deserialfn(bytea, internal)
+RETURNS internal
+AS 'sql_saga', 'no_gaps_unordered_deserialfn'
+LANGUAGE c
+STRICT
+PARALLEL SAFE;
+
+CREATE FUNCTION sql_saga.no_gaps_unordered_finalfn(internal, anyrange, anyrange)
+RETURNS boolean
+AS 'sql_saga', 'no_gaps_unordered_finalfn'
+LANGUAGE c
+PARALLEL SAFE;
+
+/*
+ * no_gaps_unordered(period anyrange, target anyrange) -
+ * Like no_gaps, but the `period` values can come in any order, so no sort is
+ * needed and the aggregate can run in parallel.  It reads all the rows of the
+ * group instead of stopping at the first gap.
+ */
+CREATE AGGREGATE sql_saga.no_gaps_unordered(anyrange, anyrange) (
+  sfunc = sql_saga.no_gaps_unordered_transfn,
+  stype = internal,
+  finalfunc = sql_saga.no_gaps_unordered_finalfn,
+  finalfunc_extra,
+  combinefunc = sql_saga.no_gaps_unordered_combinefn,
+  serialfunc = sql_saga.no_gaps_unordered_serialfn,
+  deserialfunc = sql_saga.no_gaps_unordered_deserialfn,
+  parallel = safe
+);
+
+/*
+ * gaps(period anyrange, target anyrange) -
+ * Returns the parts of the fixed arg `target` that none of the `period`
+ * values cover, as a multirange.  Like no_gaps, it needs the `period` values
+ * sorted.
+ *
+ * gaps_unordered(period anyrange, target anyrange) -
+ * The same, for `period` values in any order.
+ *
+ * covered(period anyrange) -
+ * Returns the union of the `period` values, in any order, as a multirange.
+ *
+ * no_gaps, gaps and covered also take `period` values that are multiranges,
+ * in any order.
+ *
+ * These need PostgreSQL 14 or later, which has multiranges.
+ */
+DO
+$block$
+BEGIN
+    IF current_setting('server_version_num')::integer >= 140000 THEN
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.gaps_transfn(internal, anyrange, anyrange)
+            RETURNS internal
+            AS 'sql_saga', 'gaps_transfn'
+            LANGUAGE c
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.gaps_finalfn(internal, anyrange, anyrange)
+            RETURNS anymultirange
+            AS 'sql_saga', 'gaps_finalfn'
+            LANGUAGE c
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE AGGREGATE sql_saga.gaps(anyrange, anyrange) (
+              sfunc = sql_saga.gaps_transfn,
+              stype = internal,
+              finalfunc = sql_saga.gaps_finalfn,
+              finalfunc_extra
+            )
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.gaps_unordered_finalfn(internal, anyrange, anyrange)
+            RETURNS anymultirange
+            AS 'sql_saga', 'gaps_unordered_finalfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE AGGREGATE sql_saga.gaps_unordered(anyrange, anyrange) (
+              sfunc = sql_saga.no_gaps_unordered_transfn,
+              stype = internal,
+              finalfunc = sql_saga.gaps_unordered_finalfn,
+              finalfunc_extra,
+              combinefunc = sql_saga.no_gaps_unordered_combinefn,
+              serialfunc = sql_saga.no_gaps_unordered_serialfn,
+              deserialfunc = sql_saga.no_gaps_unordered_deserialfn,
+              parallel = safe
+            )
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.covered_transfn(internal, anyrange)
+            RETURNS internal
+            AS 'sql_saga', 'covered_transfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.covered_finalfn(internal, anyrange)
+            RETURNS anymultirange
+            AS 'sql_saga', 'covered_finalfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE AGGREGATE sql_saga.covered(anyrange) (
+              sfunc = sql_saga.covered_transfn,
+              stype = internal,
+              finalfunc = sql_saga.covered_finalfn,
+              finalfunc_extra,
+              combinefunc = sql_saga.no_gaps_unordered_combinefn,
+              serialfunc = sql_saga.no_gaps_unordered_serialfn,
+              deserialfunc = sql_saga.no_gaps_unordered_deserialfn,
+              parallel = safe
+            )
+        $sql$;
+
+        -- The same for multiranges, in any order
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.no_gaps_multirange_transfn(internal, anymultirange, anyrange)
+            RETURNS internal
+            AS 'sql_saga', 'no_gaps_multirange_transfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.no_gaps_multirange_finalfn(internal, anymultirange, anyrange)
+            RETURNS boolean
+            AS 'sql_saga', 'no_gaps_unordered_finalfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE AGGREGATE sql_saga.no_gaps(anymultirange, anyrange) (
+              sfunc = sql_saga.no_gaps_multirange_transfn,
+              stype = internal,
+              finalfunc = sql_saga.no_gaps_multirange_finalfn,
+              finalfunc_extra,
+              combinefunc = sql_saga.no_gaps_unordered_combinefn,
+              serialfunc = sql_saga.no_gaps_unordered_serialfn,
+              deserialfunc = sql_saga.no_gaps_unordered_deserialfn,
+              parallel = safe
+            )
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.gaps_multirange_finalfn(internal, anymultirange, anyrange)
+            RETURNS anymultirange
+            AS 'sql_saga', 'gaps_unordered_finalfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE AGGREGATE sql_saga.gaps(anymultirange, anyrange) (
+              sfunc = sql_saga.no_gaps_multirange_transfn,
+              stype = internal,
+              finalfunc = sql_saga.gaps_multirange_finalfn,
+              finalfunc_extra,
+              combinefunc = sql_saga.no_gaps_unordered_combinefn,
+              serialfunc = sql_saga.no_gaps_unordered_serialfn,
+              deserialfunc = sql_saga.no_gaps_unordered_deserialfn,
+              parallel = safe
+            )
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.covered_multirange_transfn(internal, anymultirange)
+            RETURNS internal
+            AS 'sql_saga', 'covered_multirange_transfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga.covered_multirange_finalfn(internal, anymultirange)
+            RETURNS anymultirange
+            AS 'sql_saga', 'covered_finalfn'
+            LANGUAGE c
+            PARALLEL SAFE
+        $sql$;
+
+        EXECUTE $sql$
+            CREATE AGGREGATE sql_saga.covered(anymultirange) (
+              sfunc = sql_saga.covered_multirange_transfn,
+              stype = internal,
+              finalfunc = sql_saga.covered_multirange_finalfn,
+              finalfunc_extra,
+              combinefunc = sql_saga.no_gaps_unordered_combinefn,
+              serialfunc = sql_saga.no_gaps_unordered_serialfn,
+              deserialfunc = sql_saga.no_gaps_unordered_deserialfn,
+              parallel = safe
+            )
+        $sql$;
+    END IF;
+END;
+$block$;
+
+/*
+ * temporal_join(left_table, left_column_names, left_era_name,
+ *               right_table, right_column_names, right_era_name) -
+ * Returns a row for each pair of rows of the two tables with the same key
+ * whose eras overlap, with the start and end of the time they have in common
+ * and both rows, ordered by key and start.  The caller names the columns:
+ *
+ *   SELECT * FROM sql_saga.temporal_join('legal_unit', '{id}', 'valid',
+ *                                        'establishment', '{legal_unit_id}', 'valid')
+ *     AS j (valid_from date, valid_to date, legal_unit legal_unit, establishment establishment);
+ */
+CREATE FUNCTION sql_saga.temporal_join(
+    left_table regclass, left_column_names name[], left_era_name name,
+    right_table regclass, right_column_names name[], right_era_name name)
+RETURNS SETOF record
+AS 'sql_saga', 'temporal_join'
+LANGUAGE c
+STABLE
+STRICT;
+
+/*
+ * timeline_segments(table_names, key_column_names, era_names) -
+ * Cuts the timeline of each key at every start and end of its rows in any of
+ * the tables, and returns the key with the start and end of each segment,
+ * ordered by key and start.  key_column_names has a row of key columns for
+ * each table, or one column per table.  The caller names the columns:
+ *
+ *   SELECT * FROM sql_saga.timeline_segments(ARRAY['legal_unit', 'establishment']::regclass[],
+ *                                            ARRAY['id', 'legal_unit_id'],
+ *                                            ARRAY['valid', 'valid'])
+ *     AS s (legal_unit_id integer, valid_from date, valid_to date);
+ */
+CREATE FUNCTION sql_saga.timeline_segments(table_names regclass[], key_column_names name[], era_names name[])
+RETURNS SETOF record
+AS 'sql_saga', 'timeline_segments'
+LANGUAGE c
+STABLE
+STRICT;
+
 
 
 /*
@@ -280,6 +630,11 @@ BEGIN
         RAISE EXCEPTION 'only alphanumeric characters are currently allowed';
     END IF;
 
+    /* The bounds of SYSTEM_TIME are maintained by the database */
+    IF era_name = 'system_time' THEN
+        RETURN sql_saga.add_system_time_era(table_name, start_column_name, end_column_name, bounds_check_constraint);
+    END IF;
+
     /* Must be a regular persistent base table. SQL:2016 11.27 SR 2 */
 
     SELECT c.relpersistence, c.relkind
@@ -287,16 +642,11 @@ BEGIN
     FROM pg_catalog.pg_class AS c
     WHERE c.oid = table_name;
 
-    IF kind <> 'r' THEN
-        /*
-         * The main reason partitioned tables aren't supported yet is simply
-         * because I haven't put any thought into it.
-         * Maybe it's trivial, maybe not.
-         */
-        IF kind = 'p' THEN
-            RAISE EXCEPTION 'partitioned tables are not supported yet';
-        END IF;
-
+    /*
+     * Partitioned tables are fine too; whatever cannot be put on the parent
+     * is put on each partition by the unique keys.
+     */
+    IF kind NOT IN ('r', 'p') THEN
         RAISE EXCEPTION 'relation % is not a table', $1;
     END IF;
 
@@ -520,44 +870,6 @@ BEGIN
     INSERT INTO sql_saga.era (table_name, era_name, start_column_name, end_column_name, range_type, bounds_check_constraint)
     VALUES (table_name, era_name, start_column_name, end_column_name, range_type, bounds_check_constraint);
 
-    -- Code for creation of triggers, when extending the era api
-    --        /* Make sure all the excluded columns exist */
-    --    FOR excluded_column_name IN
-    --        SELECT u.name
-    --        FROM unnest(excluded_column_names) AS u (name)
-    --        WHERE NOT EXISTS (
-    --            SELECT FROM pg_catalog.pg_attribute AS a
-    --            WHERE (a.attrelid, a.attname) = (table_class, u.name))
-    --    LOOP
-    --        RAISE EXCEPTION 'column "%" does not exist', excluded_column_name;
-    --    END LOOP;
-    --
-    --    /* Don't allow system columns to be excluded either */
-    --    FOR excluded_column_name IN
-    --        SELECT u.name
-    --        FROM unnest(excluded_column_names) AS u (name)
-    --        JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attname) = (table_class, u.name)
-    --        WHERE a.attnum < 0
-    --    LOOP
-    --        RAISE EXCEPTION 'cannot exclude system column "%"', excluded_column_name;
-    --    END LOOP;
-    --
-    --    generated_always_trigger := coalesce(
-    --        generated_always_trigger,
-    --        sql_saga._make_name(ARRAY[table_name], 'system_time_generated_always'));
-    --    EXECUTE format('CREATE TRIGGER %I BEFORE INSERT OR UPDATE ON %s FOR EACH ROW EXECUTE PROCEDURE sql_saga.generated_always_as_row_start_end()', generated_always_trigger, table_class);
-    --
-    --    write_history_trigger := coalesce(
-    --        write_history_trigger,
-    --        sql_saga._make_name(ARRAY[table_name], 'system_time_write_history'));
-    --    EXECUTE format('CREATE TRIGGER %I AFTER INSERT OR UPDATE OR DELETE ON %s FOR EACH ROW EXECUTE PROCEDURE sql_saga.write_history()', write_history_trigger, table_class);
-    --
-    --    truncate_trigger := coalesce(
-    --        truncate_trigger,
-    --        sql_saga._make_name(ARRAY[table_name], 'truncate'));
-    --    EXECUTE format('CREATE TRIGGER %I AFTER TRUNCATE ON %s FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga.truncate_era()', truncate_trigger, table_class);
-
-
     RETURN true;
 END;
 $function$;
@@ -571,6 +883,7 @@ $function$
 #variable_conflict use_variable
 DECLARE
     era_row sql_saga.era;
+    system_time_era_row sql_saga.system_time_era;
     portion_view regclass;
     is_dropped boolean;
 BEGIN
@@ -605,17 +918,18 @@ BEGIN
     /* Drop the "for portion" view if it hasn't been dropped already */
     PERFORM sql_saga.drop_api(table_name, era_name, drop_behavior, cleanup);
 
-    /* If this is a system_time period, get rid of the triggers */
-    --    DELETE FROM sql_saga.system_time_periods AS stp
-    --    WHERE stp.table_name = table_name
-    --    RETURNING stp.* INTO system_time_era_row;
-    --
-    --    IF FOUND AND NOT is_dropped THEN
-    --        EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I', table_name, system_time_era_row.infinity_check_constraint);
-    --        EXECUTE format('DROP TRIGGER %I ON %s', system_time_era_row.generated_always_trigger, table_name);
-    --        EXECUTE format('DROP TRIGGER %I ON %s', system_time_era_row.write_history_trigger, table_name);
-    --        EXECUTE format('DROP TRIGGER %I ON %s', system_time_era_row.truncate_trigger, table_name);
-    --    END IF;
+    /* If this is a system_time era, get rid of the triggers */
+    DELETE FROM sql_saga.system_time_era AS ste
+    WHERE ste.table_name = table_name
+      AND era_name = 'system_time'
+    RETURNING ste.* INTO system_time_era_row;
+
+    IF FOUND AND NOT is_dropped THEN
+        EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I', table_name, system_time_era_row.infinity_check_constraint);
+        EXECUTE format('DROP TRIGGER %I ON %s', system_time_era_row.generated_always_trigger, table_name);
+        EXECUTE format('DROP TRIGGER %I ON %s', system_time_era_row.write_history_trigger, table_name);
+        EXECUTE format('DROP TRIGGER %I ON %s', system_time_era_row.truncate_trigger, table_name);
+    END IF;
 
     IF drop_behavior = 'RESTRICT' THEN
         /* Check for UNIQUE or PRIMARY KEYs */
@@ -634,13 +948,13 @@ BEGIN
             RAISE EXCEPTION 'era % is part of a FOREIGN KEY', era_name;
         END IF;
 
---        /* Check for SYSTEM VERSIONING */
---        IF EXISTS (
---            SELECT FROM sql_saga.system_versioning AS sv
---            WHERE (sv.table_name, sv.era_name) = (table_name, era_name))
---        THEN
---            RAISE EXCEPTION 'table % has SYSTEM VERSIONING', table_name;
---        END IF;
+        /* Check for SYSTEM VERSIONING */
+        IF EXISTS (
+            SELECT FROM sql_saga.system_versioning AS sv
+            WHERE (sv.table_name, sv.era_name) = (table_name, era_name))
+        THEN
+            RAISE EXCEPTION 'table % has SYSTEM VERSIONING', table_name;
+        END IF;
 
         /* Delete bounds check constraint if purging */
         IF NOT is_dropped AND cleanup THEN
@@ -657,6 +971,11 @@ BEGIN
 
     /* We must be in CASCADE mode now */
 
+    /* The history table is kept, only cleanup of the versioning drops it */
+    PERFORM sql_saga.drop_system_versioning(table_name, drop_behavior, false)
+    FROM sql_saga.system_versioning AS sv
+    WHERE (sv.table_name, sv.era_name) = (table_name, era_name);
+
     PERFORM sql_saga.drop_foreign_key(table_name, fk.key_name)
     FROM sql_saga.foreign_keys AS fk
     WHERE (fk.table_name, fk.era_name) = (table_name, era_name);
@@ -680,408 +999,1015 @@ END;
 $function$;
 
 
---CREATE FUNCTION sql_saga.set_era_excluded_columns(
---    table_name regclass,
---    excluded_column_names name[])
--- RETURNS void
--- LANGUAGE plpgsql
--- SECURITY DEFINER
---AS
---$function$
---#variable_conflict use_variable
---DECLARE
---    excluded_column_name name;
---BEGIN
---    /* Always serialize operations on our catalogs */
---    PERFORM sql_saga._serialize(table_name);
---
---    /* Make sure all the excluded columns exist */
---    FOR excluded_column_name IN
---        SELECT u.name
---        FROM unnest(excluded_column_names) AS u (name)
---        WHERE NOT EXISTS (
---            SELECT FROM pg_catalog.pg_attribute AS a
---            WHERE (a.attrelid, a.attname) = (table_name, u.name))
---    LOOP
---        RAISE EXCEPTION 'column "%" does not exist', excluded_column_name;
---    END LOOP;
---
---    /* Don't allow system columns to be excluded either */
---    FOR excluded_column_name IN
---        SELECT u.name
---        FROM unnest(excluded_column_names) AS u (name)
---        JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attname) = (table_name, u.name)
---        WHERE a.attnum < 0
---    LOOP
---        RAISE EXCEPTION 'cannot exclude system column "%"', excluded_column_name;
---    END LOOP;
---
---    /* Do it. */
---    UPDATE sql_saga.era AS stp SET
---        excluded_column_names = excluded_column_names
---    WHERE stp.table_name = table_name;
---END;
---$function$;
-
-
-CREATE FUNCTION sql_saga.truncate_era()
- RETURNS trigger
+/*
+ * The SYSTEM_TIME era is a period whose bounds are set by the database: its
+ * start is the start of the transaction that wrote the row and its end is
+ * always infinity.  Its columns are created if they don't exist.
+ */
+CREATE FUNCTION sql_saga.add_system_time_era(
+    table_class regclass,
+    start_column_name name DEFAULT 'system_time_start',
+    end_column_name name DEFAULT 'system_time_end',
+    bounds_check_constraint name DEFAULT NULL,
+    infinity_check_constraint name DEFAULT NULL,
+    generated_always_trigger name DEFAULT NULL,
+    write_history_trigger name DEFAULT NULL,
+    truncate_trigger name DEFAULT NULL,
+    excluded_column_names name[] DEFAULT '{}')
+ RETURNS boolean
  LANGUAGE plpgsql
- STRICT
  SECURITY DEFINER
 AS
 $function$
 #variable_conflict use_variable
 DECLARE
-    audit_table_name name;
-BEGIN
-    SELECT sv.audit_table_name
-    INTO audit_table_name
-    FROM sql_saga.era AS sv
-    WHERE sv.table_name = TG_RELID;
+    era_name CONSTANT name := 'system_time';
 
-    IF FOUND THEN
-        EXECUTE format('TRUNCATE %s', audit_table_name);
-    END IF;
+    schema_name name;
+    table_name name;
+    kind "char";
+    persistence "char";
+    alter_commands text[] DEFAULT '{}';
 
-    RETURN NULL;
-END;
-$function$;
+    start_attnum smallint;
+    start_type oid;
+    start_notnull boolean;
 
-CREATE FUNCTION sql_saga.add_api(table_name regclass DEFAULT NULL, era_name name DEFAULT 'valid')
- RETURNS boolean
- LANGUAGE plpgsql
- SECURITY DEFINER
-AS
-$function$
-#variable_conflict use_variable
-DECLARE
-    r record;
-    view_name name;
-    trigger_name name;
+    end_attnum smallint;
+    end_type oid;
+    end_notnull boolean;
+
+    excluded_column_name name;
+
+    DATE_OID CONSTANT integer := 1082;
+    TIMESTAMP_OID CONSTANT integer := 1114;
+    TIMESTAMPTZ_OID CONSTANT integer := 1184;
+    range_type regtype;
 BEGIN
-    /*
-     * If table_name and era_name are specified, then just add the views for that.
-     *
-     * If no period is specified, add the views for all periods of the table.
-     *
-     * If no table is specified, add the views everywhere.
-     *
-     * If no table is specified but a period is, that doesn't make any sense.
-     */
-    IF table_name IS NULL AND era_name IS NOT NULL THEN
-        RAISE EXCEPTION 'cannot specify era name without table name';
+    IF table_class IS NULL THEN
+        RAISE EXCEPTION 'no table name specified';
     END IF;
 
     /* Always serialize operations on our catalogs */
-    PERFORM sql_saga._serialize(table_name);
+    PERFORM sql_saga._serialize(table_class);
 
     /*
-     * We require the table to have a primary key, so check to see if there is
-     * one.  This requires a lock on the table so no one removes it after we
-     * check and before we commit.
+     * REFERENCES:
+     *     SQL:2016 4.15.2.2
+     *     SQL:2016 11.7
+     *     SQL:2016 11.27
      */
-    EXECUTE format('LOCK TABLE %s IN ACCESS SHARE MODE', table_name);
 
-    /* Now check for the primary key */
-    IF NOT EXISTS (
-        SELECT FROM pg_catalog.pg_constraint AS c
-        WHERE (c.conrelid, c.contype) = (table_name, 'p'))
+    /* The columns must not be part of UNIQUE keys. SQL:2016 11.7 SR 5)b) */
+    IF EXISTS (
+        SELECT FROM sql_saga.unique_keys AS uk
+        WHERE uk.table_name = table_class
+          AND uk.column_names && ARRAY[start_column_name, end_column_name])
     THEN
-        RAISE EXCEPTION 'table "%" must have a primary key', table_name;
+        RAISE EXCEPTION 'columns in era for SYSTEM_TIME are not allowed in UNIQUE keys';
     END IF;
 
-    FOR r IN
-        SELECT n.nspname AS schema_name, c.relname AS table_name, c.relowner AS table_owner, p.era_name
-        FROM sql_saga.era AS p
-        JOIN pg_catalog.pg_class AS c ON c.oid = p.table_name
-        JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
-        WHERE (table_name IS NULL OR p.table_name = table_name)
-          AND (era_name IS NULL OR p.era_name = era_name)
-          AND p.era_name <> 'system_time'
-          AND NOT EXISTS (
-                SELECT FROM sql_saga.api_view AS _fpv
-                WHERE (_fpv.table_name, _fpv.era_name) = (p.table_name, p.era_name))
-    LOOP
-        view_name := sql_saga._make_api_view_name(r.table_name, r.era_name);
-        trigger_name := 'for_portion_of_' || r.era_name;
-        EXECUTE format('CREATE VIEW %1$I.%2$I AS TABLE %1$I.%3$I', r.schema_name, view_name, r.table_name);
-        EXECUTE format('ALTER VIEW %1$I.%2$I OWNER TO %s', r.schema_name, view_name, r.table_owner::regrole);
-        EXECUTE format('CREATE TRIGGER %I INSTEAD OF UPDATE ON %I.%I FOR EACH ROW EXECUTE PROCEDURE sql_saga.update_portion_of()',
-            trigger_name, r.schema_name, view_name);
-        INSERT INTO sql_saga.api_view (table_name, era_name, view_name, trigger_name)
-            VALUES (format('%I.%I', r.schema_name, r.table_name), r.era_name, format('%I.%I', r.schema_name, view_name), trigger_name);
-    END LOOP;
+    /* Must be a regular persistent base table. SQL:2016 11.27 SR 2 */
 
-    RETURN true;
-END;
-$function$;
+    SELECT n.nspname, c.relname, c.relpersistence, c.relkind
+    INTO schema_name, table_name, persistence, kind
+    FROM pg_catalog.pg_class AS c
+    JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
+    WHERE c.oid = table_class;
+
+    IF kind <> 'r' THEN
+        /*
+         * The history rows of a partitioned table would be written by each
+         * partition, which has no SYSTEM VERSIONING of its own.
+         */
+        IF kind = 'p' THEN
+            RAISE EXCEPTION 'partitioned tables are not supported yet';
+        END IF;
+
+        RAISE EXCEPTION 'relation % is not a table', $1;
+    END IF;
+
+    IF persistence <> 'p' THEN
+        /* We could probably accept unlogged tables but what's the point? */
+        RAISE EXCEPTION 'table "%" must be persistent', table_class;
+    END IF;
 
-CREATE FUNCTION sql_saga.drop_api(table_name regclass, era_name name, drop_behavior sql_saga.drop_behavior DEFAULT 'RESTRICT', cleanup boolean DEFAULT false)
- RETURNS boolean
- LANGUAGE plpgsql
- SECURITY DEFINER
-AS
-$function$
-#variable_conflict use_variable
-DECLARE
-    view_name regclass;
-    trigger_name name;
-BEGIN
     /*
-     * If table_name and era_name are specified, then just drop the views for that.
-     *
-     * If no period is specified, drop the views for all periods of the table.
+     * Check if era already exists.
      *
-     * If no table is specified, drop the views everywhere.
+     * SQL:2016 11.27 SR 4.a
+     */
+    IF EXISTS (SELECT FROM sql_saga.era AS p WHERE (p.table_name, p.era_name) = (table_class, era_name)) THEN
+        RAISE EXCEPTION 'era for SYSTEM_TIME already exists on table "%"', table_class;
+    END IF;
+
+    /*
+     * Although we are not creating a new object, the SQL standard says that
+     * periods are in the same namespace as columns, so prevent that.
      *
-     * If no table is specified but a period is, that doesn't make any sense.
+     * SQL:2016 11.27 SR 4.b
      */
-    IF table_name IS NULL AND era_name IS NOT NULL THEN
-        RAISE EXCEPTION 'cannot specify era name without table name';
+    IF EXISTS (SELECT FROM pg_catalog.pg_attribute AS a WHERE (a.attrelid, a.attname) = (table_class, era_name)) THEN
+        RAISE EXCEPTION 'a column named system_time already exists for table "%"', table_class;
     END IF;
 
-    /* Always serialize operations on our catalogs */
-    PERFORM sql_saga._serialize(table_name);
+    /* The standard says that the columns must not exist already, but we don't obey that rule for now. */
 
-    FOR view_name, trigger_name IN
-        DELETE FROM sql_saga.api_view AS fp
-        WHERE (table_name IS NULL OR fp.table_name = table_name)
-          AND (era_name IS NULL OR fp.era_name = era_name)
-        RETURNING fp.view_name, fp.trigger_name
-    LOOP
-        EXECUTE format('DROP TRIGGER %I on %s', trigger_name, view_name);
-        EXECUTE format('DROP VIEW %s %s', view_name, drop_behavior);
-    END LOOP;
+    /* Get start column information */
+    SELECT a.attnum, a.atttypid, a.attnotnull
+    INTO start_attnum, start_type, start_notnull
+    FROM pg_catalog.pg_attribute AS a
+    WHERE (a.attrelid, a.attname) = (table_class, start_column_name);
 
-    RETURN true;
-END;
-$function$;
+    IF NOT FOUND THEN
+       /*
+        * First add the column with DEFAULT of -infinity to fill the
+        * current rows, then replace the DEFAULT with transaction_timestamp() for future
+        * rows.
+        *
+        * The default value is just for self-documentation anyway because
+        * the trigger will enforce the value.
+        */
+        alter_commands := alter_commands || format('ADD COLUMN %I timestamp with time zone NOT NULL DEFAULT ''-infinity''', start_column_name);
+
+        start_attnum := 0;
+        start_type := 'timestamp with time zone'::regtype;
+        start_notnull := true;
+    END IF;
+    alter_commands := alter_commands || format('ALTER COLUMN %I SET DEFAULT transaction_timestamp()', start_column_name);
 
-CREATE FUNCTION sql_saga.update_portion_of()
- RETURNS trigger
- LANGUAGE plpgsql
-AS
-$function$
-#variable_conflict use_variable
-DECLARE
-    info record;
-    test boolean;
-    generated_columns_sql text;
-    generated_columns text[];
+    IF start_attnum < 0 THEN
+        RAISE EXCEPTION 'system columns cannot be used in an era';
+    END IF;
 
-    jnew jsonb;
-    fromval jsonb;
-    toval jsonb;
+    /* Get end column information */
+    SELECT a.attnum, a.atttypid, a.attnotnull
+    INTO end_attnum, end_type, end_notnull
+    FROM pg_catalog.pg_attribute AS a
+    WHERE (a.attrelid, a.attname) = (table_class, end_column_name);
 
-    jold jsonb;
-    bstartval jsonb;
-    bendval jsonb;
+    IF NOT FOUND THEN
+        alter_commands := alter_commands || format('ADD COLUMN %I timestamp with time zone NOT NULL DEFAULT ''infinity''', end_column_name);
 
-    pre_row jsonb;
-    new_row jsonb;
-    post_row jsonb;
-    pre_assigned boolean;
-    post_assigned boolean;
+        end_attnum := 0;
+        end_type := 'timestamp with time zone'::regtype;
+        end_notnull := true;
+    ELSE
+        alter_commands := alter_commands || format('ALTER COLUMN %I SET DEFAULT ''infinity''', end_column_name);
+    END IF;
 
-    SERVER_VERSION CONSTANT integer := current_setting('server_version_num')::integer;
+    IF end_attnum < 0 THEN
+        RAISE EXCEPTION 'system columns cannot be used in an era';
+    END IF;
 
-    TEST_SQL CONSTANT text :=
-        'VALUES (CAST(%2$L AS %1$s) < CAST(%3$L AS %1$s) AND '
-        '        CAST(%3$L AS %1$s) < CAST(%4$L AS %1$s))';
+    /* Verify compatibility of start/end columns */
+    IF start_type::regtype NOT IN ('date', 'timestamp without time zone', 'timestamp with time zone') THEN
+        RAISE EXCEPTION 'SYSTEM_TIME eras must be of type "date", "timestamp without time zone", or "timestamp with time zone"';
+    END IF;
+    IF start_type <> end_type THEN
+        RAISE EXCEPTION 'start and end columns must be of same type';
+    END IF;
 
-    GENERATED_COLUMNS_SQL_PRE_10 CONSTANT text :=
-        'SELECT array_agg(a.attname) '
-        'FROM pg_catalog.pg_attribute AS a '
-        'WHERE a.attrelid = $1 '
-        '  AND a.attnum > 0 '
-        '  AND NOT a.attisdropped '
-        '  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL '
-        '    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c '
-        '               WHERE _c.conrelid = a.attrelid '
-        '                 AND _c.contype = ''p'' '
-        '                 AND _c.conkey @> ARRAY[a.attnum]) '
-        '    OR EXISTS (SELECT FROM sql_saga.era AS _p '
-        '               WHERE (_p.table_name, _p.era_name) = (a.attrelid, ''system_time'') '
-        '                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))';
-
-    GENERATED_COLUMNS_SQL_PRE_12 CONSTANT text :=
-        'SELECT array_agg(a.attname) '
-        'FROM pg_catalog.pg_attribute AS a '
-        'WHERE a.attrelid = $1 '
-        '  AND a.attnum > 0 '
-        '  AND NOT a.attisdropped '
-        '  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL '
-        '    OR a.attidentity <> '''' '
-        '    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c '
-        '               WHERE _c.conrelid = a.attrelid '
-        '                 AND _c.contype = ''p'' '
-        '                 AND _c.conkey @> ARRAY[a.attnum]) '
-        '    OR EXISTS (SELECT FROM sql_saga.era AS _p '
-        '               WHERE (_p.table_name, _p.era_name) = (a.attrelid, ''system_time'') '
-        '                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))';
-
-    GENERATED_COLUMNS_SQL_CURRENT CONSTANT text :=
-        'SELECT array_agg(a.attname) '
-        'FROM pg_catalog.pg_attribute AS a '
-        'WHERE a.attrelid = $1 '
-        '  AND a.attnum > 0 '
-        '  AND NOT a.attisdropped '
-        '  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL '
-        '    OR a.attidentity <> '''' '
-        '    OR a.attgenerated <> '''' '
-        '    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c '
-        '               WHERE _c.conrelid = a.attrelid '
-        '                 AND _c.contype = ''p'' '
-        '                 AND _c.conkey @> ARRAY[a.attnum]) '
-        '    OR EXISTS (SELECT FROM sql_saga.era AS _p '
-        '               WHERE (_p.table_name, _p.era_name) = (a.attrelid, ''system_time'') '
-        '                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))';
+    /* Get appropriate range type */
+    CASE start_type
+        WHEN DATE_OID THEN range_type := 'daterange';
+        WHEN TIMESTAMP_OID THEN range_type := 'tsrange';
+        WHEN TIMESTAMPTZ_OID THEN range_type := 'tstzrange';
+    ELSE
+        RAISE EXCEPTION 'unexpected data type: "%"', start_type::regtype;
+    END CASE;
+
+    /* can't be part of a foreign key */
+    IF EXISTS (
+        SELECT FROM sql_saga.foreign_keys AS fk
+        WHERE fk.table_name = table_class
+          AND fk.column_names && ARRAY[start_column_name, end_column_name])
+    THEN
+        RAISE EXCEPTION 'columns for SYSTEM_TIME must not be part of foreign keys';
+    END IF;
 
-BEGIN
     /*
-     * REFERENCES:
-     *     SQL:2016 15.13 GR 10
+     * Era columns must not be nullable.
+     */
+    IF NOT start_notnull THEN
+        alter_commands := alter_commands || format('ALTER COLUMN %I SET NOT NULL', start_column_name);
+    END IF;
+    IF NOT end_notnull THEN
+        alter_commands := alter_commands || format('ALTER COLUMN %I SET NOT NULL', end_column_name);
+    END IF;
+
+    /*
+     * Find and appropriate a CHECK constraint to make sure that start < end.
+     * Create one if necessary.
+     *
+     * SQL:2016 11.27 GR 2.b
+     */
+    DECLARE
+        condef CONSTANT text := format('CHECK ((%I < %I))', start_column_name, end_column_name);
+        context text;
+    BEGIN
+        IF bounds_check_constraint IS NOT NULL THEN
+            /* We were given a name, does it exist? */
+            SELECT pg_catalog.pg_get_constraintdef(c.oid)
+            INTO context
+            FROM pg_catalog.pg_constraint AS c
+            WHERE (c.conrelid, c.conname) = (table_class, bounds_check_constraint)
+              AND c.contype = 'c';
+
+            IF FOUND THEN
+                /* Does it match? */
+                IF context <> condef THEN
+                    RAISE EXCEPTION 'constraint "%" on table "%" does not match', bounds_check_constraint, table_class;
+                END IF;
+            ELSE
+                /* If it doesn't exist, we'll use the name for the one we create. */
+                alter_commands := alter_commands || format('ADD CONSTRAINT %I %s', bounds_check_constraint, condef);
+            END IF;
+        ELSE
+            /* No name given, can we appropriate one? */
+            SELECT c.conname
+            INTO bounds_check_constraint
+            FROM pg_catalog.pg_constraint AS c
+            WHERE c.conrelid = table_class
+              AND c.contype = 'c'
+              AND pg_catalog.pg_get_constraintdef(c.oid) = condef;
+
+            /* Make our own then */
+            IF NOT FOUND THEN
+                bounds_check_constraint := sql_saga._make_name(ARRAY[table_name, era_name], 'check');
+                alter_commands := alter_commands || format('ADD CONSTRAINT %I %s', bounds_check_constraint, condef);
+            END IF;
+        END IF;
+    END;
+
+    /*
+     * Find and appropriate a CHECK constraint to make sure that end = 'infinity'.
+     * Create one if necessary.
+     *
+     * SQL:2016 4.15.2.2
      */
+    DECLARE
+        condef CONSTANT text := format('CHECK ((%I = ''infinity''::%s))', end_column_name, end_type::regtype);
+        context text;
+    BEGIN
+        IF infinity_check_constraint IS NOT NULL THEN
+            /* We were given a name, does it exist? */
+            SELECT pg_catalog.pg_get_constraintdef(c.oid)
+            INTO context
+            FROM pg_catalog.pg_constraint AS c
+            WHERE (c.conrelid, c.conname) = (table_class, infinity_check_constraint)
+              AND c.contype = 'c';
+
+            IF FOUND THEN
+                /* Does it match? */
+                IF context <> condef THEN
+                    RAISE EXCEPTION 'constraint "%" on table "%" does not match', infinity_check_constraint, table_class;
+                END IF;
+            ELSE
+                /* If it doesn't exist, we'll use the name for the one we create. */
+                alter_commands := alter_commands || format('ADD CONSTRAINT %I %s', infinity_check_constraint, condef);
+            END IF;
+        ELSE
+            /* No name given, can we appropriate one? */
+            SELECT c.conname
+            INTO infinity_check_constraint
+            FROM pg_catalog.pg_constraint AS c
+            WHERE c.conrelid = table_class
+              AND c.contype = 'c'
+              AND pg_catalog.pg_get_constraintdef(c.oid) = condef;
+
+            /* Make our own then */
+            IF NOT FOUND THEN
+                infinity_check_constraint := sql_saga._make_name(ARRAY[table_name, end_column_name], 'infinity_check');
+                alter_commands := alter_commands || format('ADD CONSTRAINT %I %s', infinity_check_constraint, condef);
+            END IF;
+        END IF;
+    END;
 
-    /* Get the table information from this view */
-    SELECT p.table_name, p.era_name,
-           p.start_column_name, p.end_column_name,
-           format_type(a.atttypid, a.atttypmod) AS datatype
-    INTO info
-    FROM sql_saga.api_view AS fpv
-    JOIN sql_saga.era AS p ON (p.table_name, p.era_name) = (fpv.table_name, fpv.era_name)
-    JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attname) = (p.table_name, p.start_column_name)
-    WHERE fpv.view_name = TG_RELID;
+    /* If we've created any work for ourselves, do it now */
+    IF alter_commands <> '{}' THEN
+        EXECUTE format('ALTER TABLE %I.%I %s', schema_name, table_name, array_to_string(alter_commands, ', '));
+    END IF;
+
+    /* Make sure all the excluded columns exist */
+    FOR excluded_column_name IN
+        SELECT u.name
+        FROM unnest(excluded_column_names) AS u (name)
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_attribute AS a
+            WHERE (a.attrelid, a.attname) = (table_class, u.name))
+    LOOP
+        RAISE EXCEPTION 'column "%" does not exist', excluded_column_name;
+    END LOOP;
+
+    /* Don't allow system columns to be excluded either */
+    FOR excluded_column_name IN
+        SELECT u.name
+        FROM unnest(excluded_column_names) AS u (name)
+        JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attname) = (table_class, u.name)
+        WHERE a.attnum < 0
+    LOOP
+        RAISE EXCEPTION 'cannot exclude system column "%"', excluded_column_name;
+    END LOOP;
+
+    generated_always_trigger := coalesce(
+        generated_always_trigger,
+        sql_saga._make_name(ARRAY[table_name], 'system_time_generated_always'));
+    EXECUTE format('CREATE TRIGGER %I BEFORE INSERT OR UPDATE ON %s FOR EACH ROW EXECUTE PROCEDURE sql_saga.generated_always_as_row_start_end()', generated_always_trigger, table_class);
+
+    write_history_trigger := coalesce(
+        write_history_trigger,
+        sql_saga._make_name(ARRAY[table_name], 'system_time_write_history'));
+    EXECUTE format('CREATE TRIGGER %I AFTER INSERT OR UPDATE OR DELETE ON %s FOR EACH ROW EXECUTE PROCEDURE sql_saga.write_history()', write_history_trigger, table_class);
+
+    truncate_trigger := coalesce(
+        truncate_trigger,
+        sql_saga._make_name(ARRAY[table_name], 'truncate'));
+    EXECUTE format('CREATE TRIGGER %I AFTER TRUNCATE ON %s FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga.truncate_era()', truncate_trigger, table_class);
+
+    INSERT INTO sql_saga.era (table_name, era_name, start_column_name, end_column_name, range_type, bounds_check_constraint)
+    VALUES (table_class, era_name, start_column_name, end_column_name, range_type, bounds_check_constraint);
+
+    INSERT INTO sql_saga.system_time_era (
+        table_name, era_name, infinity_check_constraint,
+        generated_always_trigger, write_history_trigger, truncate_trigger,
+        excluded_column_names)
+    VALUES (
+        table_class, era_name, infinity_check_constraint,
+        generated_always_trigger, write_history_trigger, truncate_trigger,
+        excluded_column_names);
+
+    RETURN true;
+END;
+$function$;
+
+CREATE FUNCTION sql_saga.set_system_time_era_excluded_columns(
+    table_name regclass,
+    excluded_column_names name[])
+ RETURNS void
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    excluded_column_name name;
+BEGIN
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(table_name);
+
+    /* Make sure all the excluded columns exist */
+    FOR excluded_column_name IN
+        SELECT u.name
+        FROM unnest(excluded_column_names) AS u (name)
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_attribute AS a
+            WHERE (a.attrelid, a.attname) = (table_name, u.name))
+    LOOP
+        RAISE EXCEPTION 'column "%" does not exist', excluded_column_name;
+    END LOOP;
+
+    /* Don't allow system columns to be excluded either */
+    FOR excluded_column_name IN
+        SELECT u.name
+        FROM unnest(excluded_column_names) AS u (name)
+        JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attname) = (table_name, u.name)
+        WHERE a.attnum < 0
+    LOOP
+        RAISE EXCEPTION 'cannot exclude system column "%"', excluded_column_name;
+    END LOOP;
+
+    /* Do it. */
+    UPDATE sql_saga.system_time_era AS ste SET
+        excluded_column_names = excluded_column_names
+    WHERE ste.table_name = table_name;
+END;
+$function$;
+
+CREATE FUNCTION sql_saga.drop_system_time_era(table_name regclass, drop_behavior sql_saga.drop_behavior DEFAULT 'RESTRICT', cleanup boolean DEFAULT true)
+ RETURNS boolean
+ LANGUAGE sql
+ SECURITY DEFINER
+AS
+$function$
+SELECT sql_saga.drop_era(table_name, 'system_time', drop_behavior, cleanup);
+$function$;
+
+CREATE FUNCTION sql_saga.generated_always_as_row_start_end()
+ RETURNS trigger
+ LANGUAGE c
+ STRICT
+ SECURITY DEFINER
+AS 'sql_saga', 'generated_always_as_row_start_end';
+
+CREATE FUNCTION sql_saga.write_history()
+ RETURNS trigger
+ LANGUAGE c
+ STRICT
+ SECURITY DEFINER
+AS 'sql_saga', 'write_history';
+
+CREATE FUNCTION sql_saga.truncate_era()
+ RETURNS trigger
+ LANGUAGE plpgsql
+ STRICT
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    history_table_name regclass;
+BEGIN
+    SELECT sv.history_table_name
+    INTO history_table_name
+    FROM sql_saga.system_versioning AS sv
+    WHERE sv.table_name = TG_RELID;
+
+    IF FOUND THEN
+        EXECUTE format('TRUNCATE %s', history_table_name);
+    END IF;
+
+    RETURN NULL;
+END;
+$function$;
+
+CREATE FUNCTION sql_saga.add_api(table_name regclass DEFAULT NULL, era_name name DEFAULT 'valid')
+ RETURNS boolean
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    r record;
+    view_name name;
+    trigger_name name;
+BEGIN
+    /*
+     * If table_name and era_name are specified, then just add the views for that.
+     *
+     * If no period is specified, add the views for all periods of the table.
+     *
+     * If no table is specified, add the views everywhere.
+     *
+     * If no table is specified but a period is, that doesn't make any sense.
+     */
+    IF table_name IS NULL AND era_name IS NOT NULL THEN
+        RAISE EXCEPTION 'cannot specify era name without table name';
+    END IF;
+
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(table_name);
+
+    /*
+     * We require the table to have a primary key, so check to see if there is
+     * one.  This requires a lock on the table so no one removes it after we
+     * check and before we commit.
+     */
+    EXECUTE format('LOCK TABLE %s IN ACCESS SHARE MODE', table_name);
+
+    /* Now check for the primary key */
+    IF NOT EXISTS (
+        SELECT FROM pg_catalog.pg_constraint AS c
+        WHERE (c.conrelid, c.contype) = (table_name, 'p'))
+    THEN
+        RAISE EXCEPTION 'table "%" must have a primary key', table_name;
+    END IF;
+
+    FOR r IN
+        SELECT n.nspname AS schema_name, c.relname AS table_name, c.relowner AS table_owner, p.era_name
+        FROM sql_saga.era AS p
+        JOIN pg_catalog.pg_class AS c ON c.oid = p.table_name
+        JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
+        WHERE (table_name IS NULL OR p.table_name = table_name)
+          AND (era_name IS NULL OR p.era_name = era_name)
+          AND p.era_name <> 'system_time'
+          AND NOT EXISTS (
+                SELECT FROM sql_saga.api_view AS _fpv
+                WHERE (_fpv.table_name, _fpv.era_name) = (p.table_name, p.era_name))
+    LOOP
+        view_name := sql_saga._make_api_view_name(r.table_name, r.era_name);
+        trigger_name := 'for_portion_of_' || r.era_name;
+        EXECUTE format('CREATE VIEW %1$I.%2$I AS TABLE %1$I.%3$I', r.schema_name, view_name, r.table_name);
+        EXECUTE format('ALTER VIEW %1$I.%2$I OWNER TO %s', r.schema_name, view_name, r.table_owner::regrole);
+        EXECUTE format('CREATE TRIGGER %I INSTEAD OF UPDATE ON %I.%I FOR EACH ROW EXECUTE PROCEDURE sql_saga.update_portion_of()',
+            trigger_name, r.schema_name, view_name);
+        INSERT INTO sql_saga.api_view (table_name, era_name, view_name, trigger_name)
+            VALUES (format('%I.%I', r.schema_name, r.table_name), r.era_name, format('%I.%I', r.schema_name, view_name), trigger_name);
+    END LOOP;
+
+    RETURN true;
+END;
+$function$;
+
+CREATE FUNCTION sql_saga.drop_api(table_name regclass, era_name name, drop_behavior sql_saga.drop_behavior DEFAULT 'RESTRICT', cleanup boolean DEFAULT false)
+ RETURNS boolean
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    view_name regclass;
+    trigger_name name;
+BEGIN
+    /*
+     * If table_name and era_name are specified, then just drop the views for that.
+     *
+     * If no period is specified, drop the views for all periods of the table.
+     *
+     * If no table is specified, drop the views everywhere.
+     *
+     * If no table is specified but a period is, that doesn't make any sense.
+     */
+    IF table_name IS NULL AND era_name IS NOT NULL THEN
+        RAISE EXCEPTION 'cannot specify era name without table name';
+    END IF;
+
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(table_name);
+
+    FOR view_name, trigger_name IN
+        DELETE FROM sql_saga.api_view AS fp
+        WHERE (table_name IS NULL OR fp.table_name = table_name)
+          AND (era_name IS NULL OR fp.era_name = era_name)
+        RETURNING fp.view_name, fp.trigger_name
+    LOOP
+        EXECUTE format('DROP TRIGGER %I on %s', trigger_name, view_name);
+        EXECUTE format('DROP VIEW %s %s', view_name, drop_behavior);
+    END LOOP;
+
+    RETURN true;
+END;
+$function$;
+
+/*
+ * The INSTEAD OF UPDATE trigger of the FOR PORTION OF views.  The bounds of
+ * the era set by the UPDATE are the portion of the row to change; the parts
+ * of the row outside of it are inserted back unchanged.
+ */
+CREATE FUNCTION sql_saga.update_portion_of()
+ RETURNS trigger
+ LANGUAGE c
+AS 'sql_saga', 'update_portion_of';
+
+/*
+ * The columns of a table that an INSERT or UPDATE can set.  Generated
+ * columns, and columns owning a sequence, are left out.
+ */
+CREATE FUNCTION sql_saga._writable_columns(table_name regclass)
+ RETURNS name[]
+ STABLE
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    sql text;
+    result name[];
+BEGIN
+    sql :=
+        'SELECT array_agg(a.attname ORDER BY a.attnum) '
+        'FROM pg_catalog.pg_attribute AS a '
+        'WHERE a.attrelid = $1 '
+        '  AND a.attnum > 0 '
+        '  AND NOT a.attisdropped '
+        '  AND a.attidentity = '''' '
+        '  AND pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NULL';
+    IF current_setting('server_version_num')::integer >= 120000 THEN
+        sql := sql || ' AND a.attgenerated = ''''';
+    END IF;
+
+    EXECUTE sql INTO result USING table_name;
+    RETURN result;
+END;
+$function$;
+
+/*
+ * _coalesce_era_sql(table_name, era_name, restriction) -
+ * Returns a statement merging the adjacent rows of the table that have the
+ * same values in all the writable columns outside of the era, and returning
+ * how many rows it updated and deleted.  The first row of each run gets the
+ * end of the last one and the others are deleted, all in one statement so
+ * that the constraints are only checked once it is done.  Rows are told apart
+ * by their ctid, along with their tableoid for partitioned tables.  The
+ * restriction, if any, is a condition on the rows of the table aliased as "t".
+ */
+CREATE FUNCTION sql_saga._coalesce_era_sql(table_name regclass, era_name name, restriction text DEFAULT NULL)
+ RETURNS text
+ STABLE
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    era_row sql_saga.era;
+    slice_values text;
+BEGIN
+    SELECT p.*
+    INTO era_row
+    FROM sql_saga.era AS p
+    WHERE (p.table_name, p.era_name) = (table_name, era_name);
 
     IF NOT FOUND THEN
-        RAISE EXCEPTION 'table and era information not found for view "%"', TG_RELID::regclass;
+        RAISE EXCEPTION 'era "%" does not exist', era_name;
+    END IF;
+
+    SELECT string_agg('t.' || quote_ident(c.name), ', ')
+    INTO slice_values
+    FROM unnest(sql_saga._writable_columns(table_name)) AS c (name)
+    WHERE c.name NOT IN (era_row.start_column_name, era_row.end_column_name);
+
+    RETURN format(
+        'WITH slices AS ( '
+        '    SELECT t.tableoid AS slice_table, t.ctid AS slice, t.%2$I AS slice_start, t.%3$I AS slice_end, '
+        '           CAST(ROW(%4$s) AS text) AS slice_values, '
+        '           CASE WHEN lag(t.%3$I) OVER w = t.%2$I THEN 0 ELSE 1 END AS starts_run '
+        '    FROM %1$s AS t '
+        '    WHERE %5$s '
+        '    WINDOW w AS (PARTITION BY CAST(ROW(%4$s) AS text) ORDER BY t.%2$I) '
+        '), runs AS ( '
+        '    SELECT s.*, sum(s.starts_run) OVER (PARTITION BY s.slice_values ORDER BY s.slice_start) AS run '
+        '    FROM slices AS s '
+        '), merged AS ( '
+        '    SELECT r.slice_table, r.slice, r.slice_end, '
+        '           first_value(r.slice_table) OVER g AS run_first_table, '
+        '           first_value(r.slice) OVER g AS run_first, '
+        '           last_value(r.slice_end) OVER g AS run_end '
+        '    FROM runs AS r '
+        '    WINDOW g AS (PARTITION BY r.slice_values, r.run ORDER BY r.slice_start '
+        '                 ROWS BETWEEN UNBOUNDED PRECEDING AND UNBOUNDED FOLLOWING) '
+        '), deleted AS ( '
+        '    DELETE FROM %1$s AS t '
+        '    USING merged AS m '
+        '    WHERE (t.tableoid, t.ctid) = (m.slice_table, m.slice) '
+        '      AND (m.slice_table, m.slice) <> (m.run_first_table, m.run_first) '
+        '    RETURNING 1 '
+        '), updated AS ( '
+        '    UPDATE %1$s AS t '
+        '    SET %3$I = m.run_end '
+        '    FROM merged AS m '
+        '    WHERE (t.tableoid, t.ctid) = (m.slice_table, m.slice) '
+        '      AND (m.slice_table, m.slice) = (m.run_first_table, m.run_first) '
+        '      AND m.run_end <> m.slice_end '
+        '    RETURNING 1 '
+        ') '
+        'SELECT (SELECT count(*) FROM updated) AS updated, (SELECT count(*) FROM deleted) AS deleted',
+        table_name, era_row.start_column_name, era_row.end_column_name,
+        coalesce(slice_values, ''), coalesce(restriction, 'true'));
+END;
+$function$;
+
+/*
+ * temporal_merge(table_name, key_columns, source, era_name) -
+ * Applies the timelines returned by the query `source` to the table.  The
+ * source returns the key columns, the columns of the era and any other
+ * columns of the table to set.  For each key, the source rows replace what the
+ * table says for their periods: the rows they overlap are trimmed, split or
+ * deleted, and the source rows are inserted.  Adjacent rows of the keys
+ * involved that end up with the same data are then coalesced.
+ *
+ * This is done with a fixed number of set-based statements whatever the
+ * number of rows.  The source is applied by a single one of them, so that the
+ * keys are only checked once it is done, and the mode the caller set for the
+ * constraints is left alone: deferred ones are checked at commit.
+ */
+CREATE FUNCTION sql_saga.temporal_merge(
+    table_name regclass,
+    key_columns name[],
+    source text,
+    era_name name DEFAULT 'valid',
+    OUT inserted bigint,
+    OUT updated bigint,
+    OUT deleted bigint)
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    era_row sql_saga.era;
+    writable_columns name[];
+    source_columns name[];
+    col name;
+    typ text;
+    has_overlaps boolean;
+    coalesced_updates bigint;
+    coalesced_deletes bigint;
+    merge_number integer;
+    source_table text;
+    hits_table text;
+    pieces_table text;
+
+    key_eq text;        -- the key columns of %1$s and %2$s are equal
+    key_list text;      -- the key columns of %1$s
+    s text;
+    e text;
+BEGIN
+    inserted := 0;
+    updated := 0;
+    deleted := 0;
+
+    SELECT p.*
+    INTO era_row
+    FROM sql_saga.era AS p
+    WHERE (p.table_name, p.era_name) = (table_name, era_name);
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'era "%" does not exist', era_name;
     END IF;
 
-    jnew := to_jsonb(NEW);
-    fromval := jnew->info.start_column_name;
-    toval := jnew->info.end_column_name;
+    IF NOT EXISTS (
+        SELECT FROM sql_saga.unique_keys AS uk
+        WHERE (uk.table_name, uk.era_name, uk.column_names) = (table_name, era_name, key_columns))
+    THEN
+        RAISE EXCEPTION 'table "%" has no unique key on (%) for era "%"',
+            table_name, array_to_string(key_columns, ', '), era_name;
+    END IF;
 
-    jold := to_jsonb(OLD);
-    bstartval := jold->info.start_column_name;
-    bendval := jold->info.end_column_name;
+    s := quote_ident(era_row.start_column_name);
+    e := quote_ident(era_row.end_column_name);
 
-    pre_row := jold;
-    new_row := jnew;
-    post_row := jold;
+    SELECT string_agg(format('%%1$s.%1$I = %%2$s.%1$I', c.name), ' AND '),
+           string_agg(format('%%1$s.%1$I', c.name), ', ')
+    INTO key_eq, key_list
+    FROM unnest(key_columns) AS c (name);
 
-    /* Reset the period columns */
-    new_row := jsonb_set(new_row, ARRAY[info.start_column_name], bstartval);
-    new_row := jsonb_set(new_row, ARRAY[info.end_column_name], bendval);
+    writable_columns := sql_saga._writable_columns(table_name);
 
-    /* If the period is the only thing changed, do nothing */
-    IF new_row = jold THEN
-        RETURN NULL;
+    IF NOT writable_columns @> ARRAY[era_row.start_column_name, era_row.end_column_name] THEN
+        RAISE EXCEPTION 'the columns of era "%" on table "%" must be writable', era_name, table_name;
     END IF;
 
-    pre_assigned := false;
-    EXECUTE format(TEST_SQL, info.datatype, bstartval, fromval, bendval) INTO test;
-    IF test THEN
-        pre_assigned := true;
-        pre_row := jsonb_set(pre_row, ARRAY[info.end_column_name], fromval);
-        new_row := jsonb_set(new_row, ARRAY[info.start_column_name], fromval);
-    END IF;
+    /*
+     * The work tables of a merge still running in this session, from a
+     * trigger of the table for instance, must be left alone.
+     */
+    merge_number := 1;
+    WHILE to_regclass(format('pg_temp.temporal_merge_source_%s', merge_number)) IS NOT NULL LOOP
+        merge_number := merge_number + 1;
+    END LOOP;
+    source_table := format('pg_temp.temporal_merge_source_%s', merge_number);
+    hits_table := format('pg_temp.temporal_merge_hits_%s', merge_number);
+    pieces_table := format('pg_temp.temporal_merge_pieces_%s', merge_number);
 
-    post_assigned := false;
-    EXECUTE format(TEST_SQL, info.datatype, bstartval, toval, bendval) INTO test;
-    IF test THEN
-        post_assigned := true;
-        new_row := jsonb_set(new_row, ARRAY[info.end_column_name], toval::jsonb);
-        post_row := jsonb_set(post_row, ARRAY[info.start_column_name], toval::jsonb);
-    END IF;
+    /* Run the source query once */
+    EXECUTE format('CREATE TEMPORARY TABLE %s ON COMMIT DROP AS SELECT * FROM (%s) AS s', source_table, source);
 
-    IF pre_assigned OR post_assigned THEN
-        /* Don't validate foreign keys until all this is done */
-        SET CONSTRAINTS ALL DEFERRED;
+    SELECT array_agg(a.attname ORDER BY a.attnum)
+    INTO source_columns
+    FROM pg_catalog.pg_attribute AS a
+    WHERE a.attrelid = to_regclass(source_table)
+      AND a.attnum > 0
+      AND NOT a.attisdropped;
 
-        /*
-         * Find and remove all generated columns from pre_row and post_row.
-         * SQL:2016 15.13 GR 10)b)i)
-         *
-         * We also remove columns that own a sequence as those are a form of
-         * generated column.  We do not, however, remove columns that default
-         * to nextval() without owning the underlying sequence.
-         *
-         * Columns belonging to a SYSTEM_TIME period are also removed.
-         *
-         * In addition to what the standard calls for, we also remove any
-         * columns belonging to primary keys.
-         */
-        IF SERVER_VERSION < 100000 THEN
-            generated_columns_sql := GENERATED_COLUMNS_SQL_PRE_10;
-        ELSIF SERVER_VERSION < 120000 THEN
-            generated_columns_sql := GENERATED_COLUMNS_SQL_PRE_12;
-        ELSE
-            generated_columns_sql := GENERATED_COLUMNS_SQL_CURRENT;
-        END IF;
+    IF NOT source_columns @> (key_columns || ARRAY[era_row.start_column_name, era_row.end_column_name]) THEN
+        RAISE EXCEPTION 'the source must return the columns %',
+            array_to_string(key_columns || ARRAY[era_row.start_column_name, era_row.end_column_name], ', ');
+    END IF;
 
-        EXECUTE generated_columns_sql
-        INTO generated_columns
-        USING info.table_name;
-
-        /* There may not be any generated columns. */
-        IF generated_columns IS NOT NULL THEN
-            IF SERVER_VERSION < 100000 THEN
-                SELECT jsonb_object_agg(e.key, e.value)
-                INTO pre_row
-                FROM jsonb_each(pre_row) AS e (key, value)
-                WHERE e.key <> ALL (generated_columns);
-
-                SELECT jsonb_object_agg(e.key, e.value)
-                INTO post_row
-                FROM jsonb_each(post_row) AS e (key, value)
-                WHERE e.key <> ALL (generated_columns);
-            ELSE
-                pre_row := pre_row - generated_columns;
-                post_row := post_row - generated_columns;
-            END IF;
-        END IF;
+    SELECT u.name
+    INTO col
+    FROM unnest(source_columns) AS u (name)
+    WHERE u.name <> ALL (writable_columns)
+    LIMIT 1;
+
+    IF FOUND THEN
+        RAISE EXCEPTION 'column "%" of the source cannot be written to table "%"', col, table_name;
     END IF;
 
-    IF pre_assigned THEN
-        EXECUTE format('INSERT INTO %s (%s) VALUES (%s)',
-            info.table_name,
-            (SELECT string_agg(quote_ident(key), ', ' ORDER BY key) FROM jsonb_each_text(pre_row)),
-            (SELECT string_agg(quote_nullable(value), ', ' ORDER BY key) FROM jsonb_each_text(pre_row)));
-    END IF;
-
-    EXECUTE format('UPDATE %s SET %s WHERE %s AND %I > %L AND %I < %L',
-                   info.table_name,
-                   (SELECT string_agg(format('%I = %L', j.key, j.value), ', ')
-                    FROM (SELECT key, value FROM jsonb_each_text(new_row)
-                          EXCEPT ALL
-                          SELECT key, value FROM jsonb_each_text(jold)
-                         ) AS j
-                   ),
-                   (SELECT string_agg(format('%I = %L', key, value), ' AND ')
-                    FROM pg_catalog.jsonb_each_text(jold) AS j
-                    JOIN pg_catalog.pg_attribute AS a ON a.attname = j.key
-                    JOIN pg_catalog.pg_constraint AS c ON c.conkey @> ARRAY[a.attnum]
-                    WHERE a.attrelid = info.table_name
-                      AND c.conrelid = info.table_name
-                   ),
-                   info.end_column_name,
-                   fromval,
-                   info.start_column_name,
-                   toval
-                  );
-
-    IF post_assigned THEN
-        EXECUTE format('INSERT INTO %s (%s) VALUES (%s)',
-            info.table_name,
-            (SELECT string_agg(quote_ident(key), ', ' ORDER BY key) FROM jsonb_each_text(post_row)),
-            (SELECT string_agg(quote_nullable(value), ', ' ORDER BY key) FROM jsonb_each_text(post_row)));
+    /* Compare the source in the types of the table */
+    FOR col, typ IN
+        SELECT sa.attname, pg_catalog.format_type(ta.atttypid, ta.atttypmod)
+        FROM pg_catalog.pg_attribute AS sa
+        JOIN pg_catalog.pg_attribute AS ta ON (ta.attrelid, ta.attname) = (table_name, sa.attname)
+        WHERE sa.attrelid = to_regclass(source_table)
+          AND sa.attnum > 0
+          AND NOT sa.attisdropped
+          AND sa.atttypid <> ta.atttypid
+    LOOP
+        EXECUTE format('ALTER TABLE %1$s ALTER COLUMN %2$I TYPE %3$s USING %2$I::%3$s', source_table, col, typ);
+    END LOOP;
+
+    /* Which rows of the source win would be ambiguous if they overlapped */
+    EXECUTE format(
+        'SELECT EXISTS ( '
+        '    SELECT FROM (SELECT %3$s, lag(%2$s) OVER (PARTITION BY %1$s ORDER BY %3$s) AS prev_end '
+        '                 FROM %4$s AS ms) AS s '
+        '    WHERE s.prev_end > s.%3$s)',
+        format(key_list, 'ms'), e, s, source_table)
+    INTO has_overlaps;
+
+    IF has_overlaps THEN
+        RAISE EXCEPTION 'the source has overlapping rows for the same key';
     END IF;
 
-    RETURN NEW;
+    /*
+     * The rows of the table overlapped by the source, and what is left of them
+     * outside of it, one row per remaining piece in start order.
+     */
+    EXECUTE format(
+        'CREATE TEMPORARY TABLE %6$s ON COMMIT DROP AS '
+        'SELECT %1$s, t.%3$s AS t_start, t.%4$s AS t_end, s.%3$s AS s_start, s.%4$s AS s_end '
+        'FROM %2$s AS t '
+        'JOIN %7$s AS s ON %5$s AND t.%3$s < s.%4$s AND t.%4$s > s.%3$s',
+        format(key_list, 't'), table_name, s, e, format(key_eq, 't', 's'), hits_table, source_table);
+
+    EXECUTE format(
+        'CREATE TEMPORARY TABLE %3$s ON COMMIT DROP AS '
+        'SELECT g.*, row_number() OVER (PARTITION BY %1$s, g.t_start ORDER BY g.p_start) AS n '
+        'FROM (SELECT %2$s, h.t_start, h.t_end, '
+        '             coalesce(lag(h.s_end) OVER (PARTITION BY %2$s, h.t_start ORDER BY h.s_start), h.t_start) AS p_start, '
+        '             h.s_start AS p_end '
+        '      FROM %4$s AS h '
+        '      UNION ALL '
+        '      SELECT %2$s, h.t_start, h.t_end, max(h.s_end), h.t_end '
+        '      FROM %4$s AS h '
+        '      GROUP BY %2$s, h.t_start, h.t_end '
+        '     ) AS g '
+        'WHERE g.p_start < g.p_end',
+        format(key_list, 'g'), format(key_list, 'h'), pieces_table, hits_table);
+
+    /*
+     * Apply the source in a single statement.  Its parts all see the table as
+     * it was before, so the split rows still give their values to the pieces
+     * inserted after the first one, and the keys of the table are checked
+     * once the rows are in place: at the end of the statement, or later if
+     * the caller deferred them.
+     */
+    EXECUTE format(
+        'WITH replaced AS ( '
+        '    DELETE FROM %1$s AS t '
+        '    USING (SELECT DISTINCT %2$s, h.t_start, h.t_end '
+        '           FROM %7$s AS h '
+        '           WHERE NOT EXISTS (SELECT FROM %8$s AS p '
+        '                             WHERE %3$s AND p.t_start = h.t_start)) AS h '
+        '    WHERE %4$s AND t.%5$s = h.t_start AND t.%6$s = h.t_end '
+        '    RETURNING 1 '
+        '), split AS ( '
+        '    INSERT INTO %1$s (%9$s) '
+        '    SELECT %10$s '
+        '    FROM %8$s AS p '
+        '    JOIN %1$s AS t ON %11$s AND t.%5$s = p.t_start AND t.%6$s = p.t_end '
+        '    WHERE p.n > 1 '
+        '    RETURNING 1 '
+        '), trimmed AS ( '
+        '    UPDATE %1$s AS t '
+        '    SET %5$s = p.p_start, %6$s = p.p_end '
+        '    FROM %8$s AS p '
+        '    WHERE %11$s AND t.%5$s = p.t_start AND t.%6$s = p.t_end AND p.n = 1 '
+        '    RETURNING 1 '
+        '), added AS ( '
+        '    INSERT INTO %1$s (%12$s) SELECT %12$s FROM %13$s '
+        '    RETURNING 1 '
+        ') '
+        'SELECT (SELECT count(*) FROM split) + (SELECT count(*) FROM added), '
+        '       (SELECT count(*) FROM trimmed), '
+        '       (SELECT count(*) FROM replaced)',
+        table_name, format(key_list, 'h'), format(key_eq, 'p', 'h'), format(key_eq, 't', 'h'), s, e,
+        hits_table, pieces_table,
+        (SELECT string_agg(quote_ident(c.name), ', ') FROM unnest(writable_columns) AS c (name)),
+        (SELECT string_agg(CASE c.name
+                               WHEN era_row.start_column_name THEN 'p.p_start'
+                               WHEN era_row.end_column_name THEN 'p.p_end'
+                               ELSE 't.' || quote_ident(c.name)
+                           END, ', ')
+         FROM unnest(writable_columns) AS c (name)),
+        format(key_eq, 't', 'p'),
+        (SELECT string_agg(quote_ident(c.name), ', ') FROM unnest(source_columns) AS c (name)),
+        source_table)
+    INTO inserted, updated, deleted;
+
+    /* Coalesce the adjacent rows of the keys involved that ended up equal */
+    EXECUTE sql_saga._coalesce_era_sql(table_name, era_name,
+        format('(%s) IN (SELECT %s FROM %s AS ms)',
+               format(key_list, 't'), format(key_list, 'ms'), source_table))
+    INTO coalesced_updates, coalesced_deletes;
+    updated := updated + coalesced_updates;
+    deleted := deleted + coalesced_deletes;
+
+    EXECUTE format('DROP TABLE %s, %s, %s', pieces_table, hits_table, source_table);
 END;
 $function$;
 
+/*
+ * coalesce_era(table_name, era_name) -
+ * Merges the adjacent rows of the table that only differ by their period, and
+ * returns how many rows were removed.
+ */
+CREATE FUNCTION sql_saga.coalesce_era(table_name regclass, era_name name DEFAULT 'valid')
+ RETURNS bigint
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    updated bigint;
+    deleted bigint;
+BEGIN
+    EXECUTE sql_saga._coalesce_era_sql(table_name, era_name)
+    INTO updated, deleted;
+
+    RETURN deleted;
+END;
+$function$;
+
+
+/*
+ * The partitions holding the rows of a table: its leaf partitions if it is
+ * partitioned, or the table itself.
+ */
+CREATE FUNCTION sql_saga._leaf_partitions(table_name regclass)
+ RETURNS SETOF regclass
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    WITH RECURSIVE tree (relid, relkind) AS (
+        SELECT c.oid, c.relkind
+        FROM pg_catalog.pg_class AS c
+        WHERE c.oid = table_name
+
+        UNION ALL
+
+        SELECT c.oid, c.relkind
+        FROM tree AS t
+        JOIN pg_catalog.pg_inherits AS i ON i.inhparent = t.relid
+        JOIN pg_catalog.pg_class AS c ON c.oid = i.inhrelid
+        WHERE t.relkind = 'p'
+    )
+    SELECT t.relid::regclass
+    FROM tree AS t
+    WHERE t.relkind = 'r'
+    ORDER BY t.relid;
+$function$;
+
+/*
+ * The definition of the EXCLUDE constraint behind a unique key, as
+ * pg_get_constraintdef() shows it.
+ */
+CREATE FUNCTION sql_saga._exclude_constraint_def(table_name regclass, column_names name[], era_name name)
+ RETURNS text
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    SELECT format('EXCLUDE USING gist (%s, %I(%I, %I, ''[)''::text) WITH &&) DEFERRABLE',
+                  string_agg(quote_ident(u.column_name) || ' WITH =', ', ' ORDER BY u.ordinality),
+                  p.range_type,
+                  p.start_column_name,
+                  p.end_column_name)
+    FROM sql_saga.era AS p
+    CROSS JOIN LATERAL unnest(column_names) WITH ORDINALITY AS u (column_name, ordinality)
+    WHERE (p.table_name, p.era_name) = (table_name, era_name)
+    GROUP BY p.range_type, p.start_column_name, p.end_column_name;
+$function$;
+
+/*
+ * Add the EXCLUDE constraint of a unique key on a partitioned table to the
+ * partitions that don't have it yet.  This is called when the key is added,
+ * and again by health_checks() whenever partitions are created or attached.
+ */
+CREATE FUNCTION sql_saga._add_partition_exclude_constraints(key_name name)
+ RETURNS void
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    partition_oid regclass;
+    constraint_name name;
+    exclude_sql text;
+BEGIN
+    SELECT sql_saga._exclude_constraint_def(uk.table_name, uk.column_names, uk.era_name)
+    INTO exclude_sql
+    FROM sql_saga.unique_keys AS uk
+    WHERE uk.key_name = key_name;
+
+    FOR partition_oid, constraint_name IN
+        SELECT l.relid,
+               sql_saga._make_name(ARRAY[c.relname] || uk.column_names || ARRAY[uk.era_name], 'excl')
+        FROM sql_saga.unique_keys AS uk
+        CROSS JOIN LATERAL sql_saga._leaf_partitions(uk.table_name) AS l (relid)
+        JOIN pg_catalog.pg_class AS c ON c.oid = l.relid
+        WHERE uk.key_name = key_name
+          AND uk.overlap_trigger IS NOT NULL
+          AND uk.enforcement = 'GIST'
+    LOOP
+        /*
+         * Look again for every partition, since each ALTER TABLE runs
+         * health_checks(), which calls us for the partitions still missing it.
+         */
+        IF NOT EXISTS (
+            SELECT FROM pg_catalog.pg_constraint AS c
+            WHERE (c.conrelid, c.contype) = (partition_oid, 'x')
+              AND pg_catalog.pg_get_constraintdef(c.oid) = exclude_sql)
+        THEN
+            EXECUTE format('ALTER TABLE %s ADD CONSTRAINT %I %s', partition_oid, constraint_name, exclude_sql);
+        END IF;
+    END LOOP;
+END;
+$function$;
 
 CREATE FUNCTION sql_saga.add_unique_key(
         table_name regclass,
@@ -1089,7 +2015,8 @@ CREATE FUNCTION sql_saga.add_unique_key(
         era_name name DEFAULT 'valid',
         key_name name DEFAULT NULL,
         unique_constraint name DEFAULT NULL,
-        exclude_constraint name DEFAULT NULL)
+        exclude_constraint name DEFAULT NULL,
+        enforcement sql_saga.uk_enforcements DEFAULT 'GIST')
  RETURNS name
  LANGUAGE plpgsql
  SECURITY DEFINER
@@ -1109,14 +2036,34 @@ DECLARE
     exclude_index regclass;
     unique_sql text;
     exclude_sql text;
+    partitioned boolean;
+    overlapping boolean;
+    overlap_trigger name;
+    excluding boolean;
 BEGIN
     IF table_name IS NULL THEN
         RAISE EXCEPTION 'no table name specified';
     END IF;
 
+    IF enforcement IS NULL THEN
+        RAISE EXCEPTION 'no enforcement specified';
+    END IF;
+
+    IF enforcement = 'BTREE' AND exclude_constraint IS NOT NULL THEN
+        RAISE EXCEPTION 'a unique key with the BTREE enforcement cannot use an EXCLUDE constraint';
+    END IF;
+
     /* Always serialize operations on our catalogs */
     PERFORM sql_saga._serialize(table_name);
 
+    SELECT c.relkind = 'p'
+    INTO partitioned
+    FROM pg_catalog.pg_class AS c
+    WHERE c.oid = table_name;
+
+    /* Only a plain table enforced with GIST has an EXCLUDE constraint of its own */
+    excluding := enforcement = 'GIST' AND NOT partitioned;
+
     SELECT p.*
     INTO era_row
     FROM sql_saga.era AS p
@@ -1291,7 +2238,7 @@ BEGIN
         alter_cmds := alter_cmds || ('ADD ' || unique_sql);
     END IF;
 
-    IF exclude_constraint IS NULL THEN
+    IF exclude_constraint IS NULL AND excluding THEN
         alter_cmds := alter_cmds || ('ADD ' || exclude_sql);
     END IF;
 
@@ -1316,7 +2263,7 @@ BEGIN
     END IF;
 
     /* If we don't already have an exclude_constraint, it must be the one with the highest oid */
-    IF exclude_constraint IS NULL THEN
+    IF exclude_constraint IS NULL AND excluding THEN
         SELECT c.conname, c.conindid
         INTO exclude_constraint, exclude_index
         FROM pg_catalog.pg_constraint AS c
@@ -1325,8 +2272,47 @@ BEGIN
         LIMIT 1;
     END IF;
 
-    INSERT INTO sql_saga.unique_keys (key_name, table_name, column_names, era_name, unique_constraint, exclude_constraint)
-    VALUES (key_name, table_name, column_names, era_name, unique_constraint, exclude_constraint);
+    /*
+     * A partitioned table cannot have an EXCLUDE constraint, so each of its
+     * partitions gets one, and a trigger looks for overlapping rows in the
+     * other partitions.  With the BTREE enforcement, the trigger looks for
+     * them in the unique constraint's index instead, on any table.  The rows
+     * already there are checked once here.
+     */
+    IF NOT excluding THEN
+        EXECUTE format(
+            'SELECT EXISTS ('
+            '  SELECT FROM %1$s AS a'
+            '  JOIN %1$s AS b ON (%2$s) = (%3$s)'
+            '   AND a.%4$I < b.%5$I AND b.%4$I < a.%5$I'
+            '   AND (a.tableoid, a.ctid) <> (b.tableoid, b.ctid))',
+            table_name,
+            (SELECT string_agg(format('a.%I', n), ', ') FROM unnest(column_names) AS n),
+            (SELECT string_agg(format('b.%I', n), ', ') FROM unnest(column_names) AS n),
+            era_row.start_column_name,
+            era_row.end_column_name)
+        INTO overlapping;
+
+        IF overlapping THEN
+            RAISE EXCEPTION 'could not create unique key "%"', key_name
+            USING ERRCODE = 'exclusion_violation',
+                  DETAIL = format('Table "%s" has rows with overlapping periods for the same key.', table_name);
+        END IF;
+
+        overlap_trigger := sql_saga._make_name(ARRAY[key_name], 'overlap_check');
+        EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER INSERT OR UPDATE OF %s ON %s DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.uk_overlap_check(%L)',
+            overlap_trigger,
+            (SELECT string_agg(quote_ident(n), ', ') FROM unnest(column_names || era_row.start_column_name || era_row.end_column_name) AS n),
+            table_name,
+            key_name);
+    END IF;
+
+    INSERT INTO sql_saga.unique_keys (key_name, table_name, column_names, era_name, unique_constraint, exclude_constraint, overlap_trigger, enforcement)
+    VALUES (key_name, table_name, column_names, era_name, unique_constraint, exclude_constraint, overlap_trigger, enforcement);
+
+    IF partitioned AND enforcement = 'GIST' THEN
+        PERFORM sql_saga._add_partition_exclude_constraints(key_name);
+    END IF;
 
     RETURN key_name;
 END;
@@ -1347,6 +2333,7 @@ $function$
 DECLARE
     foreign_key_row sql_saga.foreign_keys;
     unique_key_row sql_saga.unique_keys;
+    sql text;
 BEGIN
     IF table_name IS NULL THEN
         RAISE EXCEPTION 'no table name specified';
@@ -1383,75 +2370,122 @@ BEGIN
             SELECT FROM pg_catalog.pg_class AS c
             WHERE c.oid = unique_key_row.table_name)
         THEN
-            EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I, DROP CONSTRAINT %I',
-                unique_key_row.table_name, unique_key_row.unique_constraint, unique_key_row.exclude_constraint);
+            IF unique_key_row.overlap_trigger IS NULL THEN
+                EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I, DROP CONSTRAINT %I',
+                    unique_key_row.table_name, unique_key_row.unique_constraint, unique_key_row.exclude_constraint);
+            ELSE
+                EXECUTE format('DROP TRIGGER %I ON %s', unique_key_row.overlap_trigger, unique_key_row.table_name);
+                EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I',
+                    unique_key_row.table_name, unique_key_row.unique_constraint);
+
+                /* The partitions each have their own EXCLUDE constraint */
+                FOR sql IN
+                    SELECT format('ALTER TABLE %s DROP CONSTRAINT %I', l.relid, c.conname)
+                    FROM sql_saga._leaf_partitions(unique_key_row.table_name) AS l (relid)
+                    JOIN pg_catalog.pg_constraint AS c ON (c.conrelid, c.contype) = (l.relid, 'x')
+                    WHERE unique_key_row.enforcement = 'GIST'
+                      AND pg_catalog.pg_get_constraintdef(c.oid) = sql_saga._exclude_constraint_def(
+                        unique_key_row.table_name, unique_key_row.column_names, unique_key_row.era_name)
+                LOOP
+                    EXECUTE sql;
+                END LOOP;
+            END IF;
         END IF;
     END LOOP;
 
 END;
 $function$;
 
+/*
+ * The unique key side checks are called when a table referenced by foreign
+ * keys with periods is updated or deleted from.  They check that the
+ * referenced table still contains the proper data to satisfy the foreign key
+ * constraint, like validate_foreign_key_old_row() does, once per key and
+ * transaction for as long as the data does not change.
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ *
+ * The only difference between NO ACTION and RESTRICT is when the check is
+ * done, so these functions are used for both.
+ */
 CREATE FUNCTION sql_saga.uk_update_check()
  RETURNS trigger
- LANGUAGE plpgsql
-AS $function$
-#variable_conflict use_variable
-DECLARE
-    jold jsonb;
-BEGIN
-    /*
-     * This function is called when a table referenced by foreign keys with
-     * periods is updated.  It checks to verify that the referenced table still
-     * contains the proper data to satisfy the foreign key constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     *
-     * If this is a NO ACTION constraint, we need to check if there is a new
-     * row that still satisfies the constraint, in which case there is no
-     * error.
-     */
-
-    /* Use jsonb to look up values by parameterized names */
-    jold := to_jsonb(OLD);
-
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_old_row(TG_ARGV[0], jold, true);
-
-    RETURN NULL;
-END;
-$function$;
+ LANGUAGE c
+AS 'sql_saga', 'uk_update_check';
 
 CREATE FUNCTION sql_saga.uk_delete_check()
  RETURNS trigger
- LANGUAGE plpgsql
-AS $function$
-#variable_conflict use_variable
-DECLARE
-    jold jsonb;
-BEGIN
-    /*
-     * This function is called when a table referenced by foreign keys with
-     * periods is deleted from.  It checks to verify that the referenced table
-     * still contains the proper data to satisfy the foreign key constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     *
-     * The only difference between NO ACTION and RESTRICT is when the check is
-     * done, so this function is used for both.
-     */
+ LANGUAGE c
+AS 'sql_saga', 'uk_delete_check';
 
-    /* Use jsonb to look up values by parameterized names */
-    jold := to_jsonb(OLD);
+/*
+ * The EXCLUDE constraint of a unique key on a partitioned table is put on
+ * each partition, and this trigger on the partitioned table looks for
+ * overlapping rows across partitions.  A unique key with the BTREE
+ * enforcement has no EXCLUDE constraint, and this trigger does all of its
+ * checking.  The argument is the name of the unique key.
+ */
+CREATE FUNCTION sql_saga.uk_overlap_check()
+ RETURNS trigger
+ LANGUAGE c
+AS 'sql_saga', 'uk_overlap_check';
 
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_old_row(TG_ARGV[0], jold, false);
 
-    RETURN NULL;
-END;
+/*
+ * Returns an index that can find the rows of a table by the given columns, that
+ * is a valid btree or GiST index without a predicate whose leading columns are
+ * those columns in any order, or NULL if there is none.
+ */
+CREATE FUNCTION sql_saga._foreign_key_index(table_name regclass, column_names name[])
+ RETURNS regclass
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    SELECT i.indexrelid::regclass
+    FROM pg_catalog.pg_index AS i
+    JOIN pg_catalog.pg_class AS ic ON ic.oid = i.indexrelid
+    JOIN pg_catalog.pg_am AS am ON am.oid = ic.relam
+    WHERE i.indrelid = table_name
+      AND i.indisvalid
+      AND i.indpred IS NULL
+      AND am.amname IN ('btree', 'gist')
+      AND i.indnkeyatts >= cardinality(column_names)
+      AND (SELECT array_agg(k.attnum ORDER BY k.attnum)
+           FROM unnest(i.indkey::smallint[]) WITH ORDINALITY AS k (attnum, ordinality)
+           WHERE k.ordinality <= cardinality(column_names))
+        = (SELECT array_agg(a.attnum ORDER BY a.attnum)
+           FROM pg_catalog.pg_attribute AS a
+           WHERE a.attrelid = table_name
+             AND a.attname = ANY (column_names))
+    ORDER BY am.amname = 'btree' DESC, i.indexrelid
+    LIMIT 1;
 $function$;
 
+/*
+ * Lists the foreign keys whose referencing table has no index to find rows by
+ * the key columns, with the statement that would create one.  Without it,
+ * every update or delete in the referenced table scans the referencing table.
+ */
+CREATE FUNCTION sql_saga.foreign_keys_without_index()
+ RETURNS TABLE (key_name name, table_name regclass, column_names name[], create_index_sql text)
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    SELECT fk.key_name,
+           fk.table_name,
+           fk.column_names,
+           format('CREATE INDEX ON %s (%s)',
+                  fk.table_name,
+                  (SELECT string_agg(quote_ident(u.column_name), ', ' ORDER BY u.ordinality)
+                   FROM unnest(fk.column_names || e.start_column_name || e.end_column_name)
+                        WITH ORDINALITY AS u (column_name, ordinality)))
+    FROM sql_saga.foreign_keys AS fk
+    JOIN sql_saga.era AS e ON (e.table_name, e.era_name) = (fk.table_name, fk.era_name)
+    WHERE sql_saga._foreign_key_index(fk.table_name, fk.column_names) IS NULL
+    ORDER BY fk.key_name;
+$function$;
 
 CREATE FUNCTION sql_saga.add_foreign_key(
         table_name regclass,
@@ -1468,7 +2502,9 @@ CREATE FUNCTION sql_saga.add_foreign_key(
         fk_insert_trigger name DEFAULT NULL,
         fk_update_trigger name DEFAULT NULL,
         uk_update_trigger name DEFAULT NULL,
-        uk_delete_trigger name DEFAULT NULL)
+        uk_delete_trigger name DEFAULT NULL,
+        create_index boolean DEFAULT false,
+        lock_mode sql_saga.fk_lock_modes DEFAULT 'ROW')
  RETURNS name
  LANGUAGE plpgsql
  SECURITY DEFINER
@@ -1490,6 +2526,10 @@ DECLARE
     del_action text DEFAULT '';
     foreign_columns text;
     unique_columns text;
+    fk_index_name name;
+    fk_index regclass;
+    rows_checked bigint;
+    duration interval;
 BEGIN
     IF table_name IS NULL THEN
         RAISE EXCEPTION 'no table name specified';
@@ -1631,14 +2671,33 @@ BEGIN
     EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER DELETE ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.uk_delete_check(%L)',
         uk_delete_trigger, unique_row_schema_name_str ,unique_row_table_name_str, schema_name_str, table_name_str, key_name);
 
+    /*
+     * The checks on the unique key side look up the referencing rows by key,
+     * which scans the whole referencing table unless an index leads with the
+     * key columns.  Only an index we create here is dropped with the key.
+     */
+    IF sql_saga._foreign_key_index(table_name, column_names) IS NULL THEN
+        IF create_index THEN
+            fk_index_name := sql_saga._make_name(ARRAY[key_name], 'idx');
+            EXECUTE format('CREATE INDEX %I ON %I.%I (' || foreign_columns || ')',
+                fk_index_name, schema_name_str, table_name_str);
+            fk_index := to_regclass(format('%I.%I', schema_name_str, fk_index_name));
+        ELSE
+            RAISE NOTICE 'table "%" has no index for foreign key "%"', table_name, key_name
+            USING HINT = 'Every update or delete in the referenced table scans it without one.  Pass create_index => true to create it.';
+        END IF;
+    END IF;
+
     INSERT INTO sql_saga.foreign_keys (key_name, table_name, column_names, era_name, unique_key, match_type, update_action, delete_action,
-                                      fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger)
+                                      fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger, fk_index, lock_mode)
     VALUES (key_name, table_name, column_names, era_name, unique_row.key_name, match_type, update_action, delete_action,
-            fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger);
+            fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger, fk_index, lock_mode);
 
-    /* Validate the constraint on existing data, iterating over each row. */
-    EXECUTE format('SELECT sql_saga.validate_foreign_key_new_row(%1$L, to_jsonb(%3$I.*)) FROM %2$I.%3$I;',
-        key_name, schema_name_str, table_name_str);
+    /* Validate the constraint on existing data, all rows at once. */
+    SELECT v.rows_checked, v.duration
+    INTO rows_checked, duration
+    FROM sql_saga.validate_foreign_key(key_name) AS v;
+    RAISE DEBUG 'foreign key % checked % rows in %', key_name, rows_checked, duration;
 
     RETURN key_name;
 END;
@@ -1694,6 +2753,14 @@ BEGIN
             EXECUTE format('DROP TRIGGER %I ON %s', foreign_key_row.fk_update_trigger, foreign_key_row.table_name);
         END IF;
 
+        /* Drop the supporting index if we made it and it is still there */
+        IF foreign_key_row.fk_index IS NOT NULL AND EXISTS (
+                SELECT FROM pg_catalog.pg_class AS c
+                WHERE c.oid = foreign_key_row.fk_index)
+        THEN
+            EXECUTE format('DROP INDEX %s', foreign_key_row.fk_index);
+        END IF;
+
         SELECT uk.table_name
         INTO unique_table_name
         FROM sql_saga.unique_keys AS uk
@@ -1718,269 +2785,108 @@ BEGIN
 END;
 $function$;
 
+/*
+ * The foreign key side checks are called for every row inserted or updated in
+ * a referencing table, so they are implemented in C.  They raise the same
+ * errors as validate_foreign_key_new_row().
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ */
 CREATE FUNCTION sql_saga.fk_insert_check()
  RETURNS trigger
- LANGUAGE plpgsql
-AS $function$
-#variable_conflict use_variable
-DECLARE
-    jnew jsonb;
-BEGIN
-    /*
-     * This function is called when a new row is inserted into a table
-     * containing foreign keys with sql_saga.  It checks to verify that the
-     * referenced table contains the proper data to satisfy the foreign key
-     * constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     */
-
-    /* Use jsonb to look up values by parameterized names */
-    jnew := to_jsonb(NEW);
-
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_new_row(TG_ARGV[0], jnew);
-
-    RETURN NULL;
-END;
-$function$;
+ LANGUAGE c
+AS 'sql_saga', 'fk_insert_check';
 
 CREATE FUNCTION sql_saga.fk_update_check()
  RETURNS trigger
- LANGUAGE plpgsql
-AS $function$
-#variable_conflict use_variable
-DECLARE
-    jnew jsonb;
-BEGIN
-    /*
-     * This function is called when a table containing foreign keys with
-     * periods is updated.  It checks to verify that the referenced table
-     * contains the proper data to satisfy the foreign key constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     */
-
-    /* Use jsonb to look up values by parameterized names */
-    jnew := to_jsonb(NEW);
-
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_new_row(TG_ARGV[0], jnew);
-
-    RETURN NULL;
-END;
-$function$;
+ LANGUAGE c
+AS 'sql_saga', 'fk_update_check';
 
 /*
- * This function either returns true or raises an exception.
+ * The number of foreign key checks that this session did not run because the
+ * same key had been checked, or queued, already.
  */
-CREATE FUNCTION sql_saga.validate_foreign_key_old_row(foreign_key_name name, row_data jsonb, is_update boolean)
- RETURNS boolean
- LANGUAGE plpgsql
-AS
-$function$
-#variable_conflict use_variable
-DECLARE
-    foreign_key_info record;
-    column_name name;
-    uk_column_names_arr text[];
-    uk_column_values_arr text[];
-    uk_column_names text;
-    uk_column_values text;
-    fk_column_names text;
-    min_uk_start_value text;
-    max_uk_end_value text;
-    violation boolean;
-
-    SQL_UK_MINMAX text;
-    QSQL_UK_MINMAX CONSTANT text :=
-        'SELECT MIN(%5$I), MAX(%6$I) '
-        '  FROM %1$I.%2$I as t '
-        ' WHERE ROW(%3$s) = ROW(%4$s)';
-
-    SQL_FK_EXISTS text;
-    QSQL_FK_EXISTS CONSTANT text :=
-        'SELECT EXISTS( '
-        '  SELECT FROM %1$I.%2$I as t '
-        '  WHERE ROW(%3$s) = ROW(%4$s)'
-        ')';
-
-    SQL_FK_OUT_OF_UK_MINMAX_RANGE text;
-    QSQL_FK_OUT_OF_UK_MINMAX_RANGE CONSTANT text :=
-        'SELECT EXISTS( '
-        '   SELECT '
-        '     FROM %1$I.%2$I as t '
-        '    WHERE ROW(%3$s) = ROW(%4$s) '
-        '      AND NOT sql_saga.contains(%5$L, %6$L, %7$I, %8$I) '
-        ')';
-
-    SQL_FK_CONTAINS_UK_HOLES text;
-    QSQL_FK_CONTAINS_UK_HOLES CONSTANT text :=
-        'SELECT EXISTS( '
-        '    WITH holes AS ( '
-        '        SELECT %6$I AS "s", next_s AS "e" '
-        '          FROM (SELECT %6$I, LEAD(%5$I, 1) OVER (ORDER BY %5$I) "next_s" '
-        '                  FROM %1$I.%2$I '
-        '                 WHERE ROW(%3$s) = ROW(%4$s)) t '
-        '         WHERE (t.next_s IS NOT NULL AND t.next_s <> %6$I) '
-        '    ) '
-        '    SELECT FROM %7$I.%8$I t'
-        '     WHERE ROW(%9$s) = ROW(%4$s)'
-        '       AND EXISTS(SELECT '
-        '                    FROM holes h '
-        '                   WHERE sql_saga.contains(%10$I, %11$I, h.s, h.e)) '
-        ')';
-BEGIN
-    -- gets metadata about the periods, foreign-keys and unique-keys
-    SELECT fc.oid AS fk_table_oid,
-           fn.nspname AS fk_schema_name,
-           fc.relname AS fk_table_name,
-           fk.column_names AS fk_column_names,
-           fp.era_name AS fk_era_name,
-           fp.start_column_name AS fk_start_column_name,
-           fp.end_column_name AS fk_end_column_name,
-           uc.oid AS uk_table_oid,
-           un.nspname AS uk_schema_name,
-           uc.relname AS uk_table_name,
-           uk.column_names AS uk_column_names,
-           up.era_name AS uk_era_name,
-           up.start_column_name AS uk_start_column_name,
-           up.end_column_name AS uk_end_column_name,
-           fk.match_type,
-           fk.update_action,
-           fk.delete_action
-    INTO foreign_key_info
-    FROM sql_saga.foreign_keys AS fk
-    JOIN sql_saga.era AS fp ON (fp.table_name, fp.era_name) = (fk.table_name, fk.era_name)
-    JOIN pg_catalog.pg_class AS fc ON fc.oid = fk.table_name
-    JOIN pg_catalog.pg_namespace AS fn ON fn.oid = fc.relnamespace
-    JOIN sql_saga.unique_keys AS uk ON uk.key_name = fk.unique_key
-    JOIN sql_saga.era AS up ON (up.table_name, up.era_name) = (uk.table_name, uk.era_name)
-    JOIN pg_catalog.pg_class AS uc ON uc.oid = uk.table_name
-    JOIN pg_catalog.pg_namespace AS un ON un.oid = uc.relnamespace
-    WHERE fk.key_name = foreign_key_name;
-
-    IF NOT FOUND THEN
-        RAISE EXCEPTION 'foreign key "%" not found', foreign_key_name;
-    END IF;
-
-    FOREACH column_name IN ARRAY foreign_key_info.uk_column_names LOOP
-        IF row_data->>column_name IS NULL THEN
-            /*
-             * If the deleted row had nulls in the referenced columns then
-             * there was no possible referencing row (until we implement
-             * PARTIAL) so we can just stop here.
-             */
-            RETURN true;
-        END IF;
-        uk_column_names_arr := uk_column_names_arr || ('t.' || quote_ident(column_name));
-        uk_column_values_arr := uk_column_values_arr || quote_literal(row_data->>column_name);
-    END LOOP;
+CREATE FUNCTION sql_saga.foreign_key_checks_skipped()
+ RETURNS bigint
+ LANGUAGE c
+ VOLATILE
+AS 'sql_saga', 'foreign_key_checks_skipped';
 
-    uk_column_names := array_to_string(uk_column_names_arr, ', ');
-    uk_column_values := array_to_string(uk_column_values_arr, ', ');
-
-    -- query the range that the uk currently spans:
-    -- time: 1 2 3 4 5 6 | in ranges
-    --   uk: *** ******* | [1,2), [3,6)
-    -- in this case would return [1,6).
-    SQL_UK_MINMAX := format(QSQL_UK_MINMAX,
-        foreign_key_info.uk_schema_name,
-        foreign_key_info.uk_table_name,
-        uk_column_names,
-        uk_column_values,
-        foreign_key_info.uk_start_column_name,
-        foreign_key_info.uk_end_column_name);
-    RAISE DEBUG 'SQL_UK_MINMAX=%', SQL_UK_MINMAX;
-    EXECUTE SQL_UK_MINMAX
-    INTO min_uk_start_value, max_uk_end_value;
-
-    SELECT string_agg('t.' || quote_ident(u.c), ', ' ORDER BY u.ordinality)
-    INTO fk_column_names
-    FROM unnest(foreign_key_info.fk_column_names) WITH ORDINALITY AS u (c, ordinality);
-
-    -- min|max can be null if `uk` has no record for the specified filter,
-    -- which means that should not exists any `fk` record for the same filter.
-    IF min_uk_start_value IS NULL OR max_uk_end_value IS NULL THEN
-        SQL_FK_EXISTS := format(QSQL_FK_EXISTS,
-                                       foreign_key_info.fk_schema_name,
-                                       foreign_key_info.fk_table_name,
-                                       fk_column_names,
-                                       uk_column_values);
-        RAISE DEBUG 'SQL_FK_EXISTS=%', SQL_FK_EXISTS;
-        EXECUTE SQL_FK_EXISTS
-        INTO violation;
-
-        IF violation THEN
-            RAISE DEBUG 'Violation detected for FK: %, Row Data: %', foreign_key_name, row_data;
-            RAISE EXCEPTION 'update or delete on table "%" violates foreign key constraint "%" on table "%"',
-                foreign_key_info.uk_table_oid::regclass,
-                foreign_key_name,
-                foreign_key_info.fk_table_oid::regclass;
-        END IF;
-    END IF;
+/*
+ * Cumulative statistics about the checks of the foreign keys, and of the
+ * unique keys of partitioned tables, of the current database.  A check is one
+ * query, of one row or of a batch of keys, and the times are in
+ * milliseconds.  The checks made by deferred triggers, at commit or by SET
+ * CONSTRAINTS, are counted apart from the immediate ones.
+ *
+ * With sql_saga in shared_preload_libraries the counters are shared by all
+ * sessions, otherwise each session only sees its own checks.
+ * sql_saga.track_constraints turns the tracking off.
+ */
+CREATE FUNCTION sql_saga.stat_constraints(
+    OUT key_name name,
+    OUT calls bigint,
+    OUT rows_checked bigint,
+    OUT total_time double precision,
+    OUT max_time double precision,
+    OUT deferred_checks bigint,
+    OUT immediate_checks bigint,
+    OUT violations bigint)
+ RETURNS SETOF record
+ LANGUAGE c
+ VOLATILE
+AS 'sql_saga', 'stat_constraints';
+
+CREATE VIEW sql_saga.stat_constraints AS
+SELECT s.key_name,
+       coalesce(fk.table_name, uk.table_name) AS table_name,
+       CASE WHEN fk.key_name IS NOT NULL THEN 'foreign key'
+            WHEN uk.key_name IS NOT NULL THEN 'unique key'
+       END AS key_type,
+       s.calls,
+       s.rows_checked,
+       s.total_time,
+       s.max_time,
+       s.deferred_checks,
+       s.immediate_checks,
+       s.violations
+FROM sql_saga.stat_constraints() AS s
+LEFT JOIN sql_saga.foreign_keys AS fk ON fk.key_name = s.key_name
+LEFT JOIN sql_saga.unique_keys AS uk ON uk.key_name = s.key_name;
+GRANT SELECT ON TABLE sql_saga.stat_constraints TO PUBLIC;
 
-    -- check if any fk record is not contained in the range `[min(uk.start), max(uk.end)).`
-    -- time: 1 2 3 4 5 6
-    --   uk:   *******
-    --   fk:   ^-----^
-    -- any fk record with start or end outside the ^ markers are considered a violation.
-    SQL_FK_OUT_OF_UK_MINMAX_RANGE := format(QSQL_FK_OUT_OF_UK_MINMAX_RANGE,
-                                                   foreign_key_info.fk_schema_name,
-                                                   foreign_key_info.fk_table_name,
-                                                   fk_column_names,
-                                                   uk_column_values,
-                                                   min_uk_start_value,
-                                                   max_uk_end_value,
-                                                   foreign_key_info.uk_start_column_name,
-                                                   foreign_key_info.uk_end_column_name);
-    RAISE DEBUG 'SQL_FK_OUT_OF_UK_MINMAX_RANGE=%', SQL_FK_OUT_OF_UK_MINMAX_RANGE;
-    EXECUTE SQL_FK_OUT_OF_UK_MINMAX_RANGE
-    INTO violation;
-
-    IF violation THEN
-        RAISE DEBUG 'Violation detected for FK: %, Row Data: %', foreign_key_name, row_data;
-        RAISE EXCEPTION 'update or delete on table "%" violates foreign key constraint "%" on table "%"',
-            foreign_key_info.uk_table_oid::regclass,
-            foreign_key_name,
-            foreign_key_info.fk_table_oid::regclass;
-    END IF;
-
-    -- check if any fk record contains any hole periods from uk
-    -- time: 1 2 3 4 5 6    | in ranges
-    --   uk: *** *** ***    | [1,2), [3,4), [5,6)
-    --   fk: ^-----^        | [1,4)
-    -- in this case, we have the following holes in `uk`: [2,3), [4,5)
-    -- if we have any `fk` record that contains such holes (such as [1,4)),
-    -- this mean that this record is referencing the `uk` for a period that it not existed.
-    SQL_FK_CONTAINS_UK_HOLES := format(QSQL_FK_CONTAINS_UK_HOLES,
-                                              foreign_key_info.uk_schema_name,
-                                              foreign_key_info.uk_table_name,
-                                              replace(uk_column_names, 't.', ''),
-                                              uk_column_values,
-                                              foreign_key_info.uk_start_column_name,
-                                              foreign_key_info.uk_end_column_name,
-                                              foreign_key_info.fk_schema_name,
-                                              foreign_key_info.fk_table_name,
-                                              fk_column_names,
-                                              foreign_key_info.fk_start_column_name,
-                                              foreign_key_info.fk_end_column_name);
-    RAISE DEBUG 'SQL_FK_CONTAINS_UK_HOLES=%', SQL_FK_CONTAINS_UK_HOLES;
-    EXECUTE SQL_FK_CONTAINS_UK_HOLES
-    INTO violation;
-
-    IF violation THEN
-        RAISE EXCEPTION 'update or delete on table "%" violates foreign key constraint "%" on table "%"',
-            foreign_key_info.uk_table_oid::regclass,
-            foreign_key_name,
-            foreign_key_info.fk_table_oid::regclass;
-    END IF;
+/*
+ * Forget the statistics of the given constraint, or of all of them, which
+ * makes room for others in shared memory.  Like pg_stat_reset(), only
+ * superusers may call it unless granted otherwise.
+ */
+CREATE FUNCTION sql_saga.stat_constraints_reset(key_name name DEFAULT NULL)
+ RETURNS void
+ LANGUAGE c
+ VOLATILE
+AS 'sql_saga', 'stat_constraints_reset';
+REVOKE EXECUTE ON FUNCTION sql_saga.stat_constraints_reset(name) FROM PUBLIC;
 
-    RETURN true;
-END;
-$function$;
+/*
+ * The number of checks that were not recorded since the server started,
+ * because sql_saga.stat_max_constraints constraints had statistics already.
+ */
+CREATE FUNCTION sql_saga.stat_constraints_untracked()
+ RETURNS bigint
+ LANGUAGE c
+ VOLATILE
+AS 'sql_saga', 'stat_constraints_untracked';
+
+/*
+ * This function either returns true or raises an exception.
+ *
+ * Only the unique key columns of row_data are used: the referencing periods
+ * of that key must all fit in what the referenced table still covers.
+ */
+CREATE FUNCTION sql_saga.validate_foreign_key_old_row(foreign_key_name name, row_data jsonb, is_update boolean)
+ RETURNS boolean
+ LANGUAGE c
+AS 'sql_saga', 'validate_foreign_key_old_row';
 
 /*
  * This function either returns true or raises an exception.
@@ -1995,6 +2901,7 @@ DECLARE
     foreign_key_info record;
     row_clause text DEFAULT 'true';
     violation boolean;
+    check_sql text;
 
 	QSQL CONSTANT text :=
         'SELECT EXISTS ( '
@@ -2020,6 +2927,26 @@ DECLARE
         '    ) AND %10$s '
         ')';
 
+    /*
+     * From PostgreSQL 14 on, the referenced periods are aggregated into one
+     * multirange that must contain the referencing period.
+     */
+    QSQL_RANGE_AGG CONSTANT text :=
+        'SELECT EXISTS ( '
+        '    SELECT FROM %5$I.%6$I AS fk '
+        '    WHERE NOT EXISTS ( '
+        '        SELECT FROM (SELECT uk.%3$I AS uk_start_value, '
+        '                            uk.%4$I AS uk_end_value '
+        '                     FROM %1$I.%2$I AS uk '
+        '                     WHERE %9$s '
+        '                       AND uk.%3$I <= fk.%8$I '
+        '                       AND uk.%4$I >= fk.%7$I '
+        '                     FOR KEY SHARE '
+        '                    ) AS uk '
+        '        HAVING range_agg(%11$s(uk.uk_start_value, uk.uk_end_value)) @> %11$s(fk.%7$I, fk.%8$I) '
+        '    ) AND %10$s '
+        ')';
+
 BEGIN
     SELECT fc.oid AS fk_table_oid,
            fn.nspname AS fk_schema_name,
@@ -2035,6 +2962,7 @@ BEGIN
            up.era_name AS uk_era_name,
            up.start_column_name AS uk_start_column_name,
            up.end_column_name AS uk_end_column_name,
+           up.range_type AS uk_range_type,
 
            fk.match_type,
            fk.update_action,
@@ -2087,437 +3015,729 @@ BEGIN
             RETURN true;
         END IF;
 
-        IF has_nulls THEN
-            CASE foreign_key_info.match_type
-                WHEN 'SIMPLE' THEN
-                    RETURN true;
-                WHEN 'PARTIAL' THEN
-                    RAISE EXCEPTION 'partial not implemented';
-                WHEN 'FULL' THEN
-                    RAISE EXCEPTION 'foreign key violated (nulls in FULL)';
-            END CASE;
-        END IF;
+        IF has_nulls THEN
+            CASE foreign_key_info.match_type
+                WHEN 'SIMPLE' THEN
+                    RETURN true;
+                WHEN 'PARTIAL' THEN
+                    RAISE EXCEPTION 'partial not implemented';
+                WHEN 'FULL' THEN
+                    RAISE EXCEPTION 'foreign key violated (nulls in FULL)';
+            END CASE;
+        END IF;
+
+        row_clause := format(' (%s) = (%s)', array_to_string(cols, ', '), array_to_string(vals, ', '));
+    END;
+
+    IF current_setting('server_version_num')::integer >= 140000 THEN
+        check_sql := QSQL_RANGE_AGG;
+    ELSE
+        check_sql := QSQL;
+    END IF;
+
+    BEGIN
+        EXECUTE format(check_sql, foreign_key_info.uk_schema_name,
+                             foreign_key_info.uk_table_name,
+                             foreign_key_info.uk_start_column_name,
+                             foreign_key_info.uk_end_column_name,
+                             foreign_key_info.fk_schema_name,
+                             foreign_key_info.fk_table_name,
+                             foreign_key_info.fk_start_column_name,
+                             foreign_key_info.fk_end_column_name,
+                             (SELECT string_agg(format('%I IS NOT DISTINCT FROM %I', ukc, fkc), ' AND ')
+                              FROM unnest(foreign_key_info.uk_column_names,
+                                          foreign_key_info.fk_column_names) AS u (ukc, fkc)
+                             ),
+                             row_clause,
+                             foreign_key_info.uk_range_type)
+        INTO violation;
+
+        IF violation THEN
+            IF row_data IS NULL THEN
+                RAISE EXCEPTION 'foreign key violated by some row';
+            ELSE
+                RAISE EXCEPTION 'insert or update on table "%" violates foreign key constraint "%"',
+                    foreign_key_info.fk_table_oid::regclass,
+                    foreign_key_name;
+            END IF;
+        END IF;
+    END;
+
+    RETURN true;
+END;
+$function$;
+
+/*
+ * Builds the query that checks all the rows of the referencing table of a
+ * foreign key at once.  The referenced table is first coalesced into one row
+ * per key and contiguous run of periods, so that every referencing row only
+ * needs an equijoin on the key and a containment check on the period.  That
+ * lets the planner use a hash join and parallel workers instead of running a
+ * query per row.
+ *
+ * With violations_only, the query returns the violating rows as jsonb.
+ * Otherwise it returns the number of rows checked, the number of violating
+ * rows, one of them as text, and the number of rows with only some of the key
+ * columns null.
+ */
+CREATE FUNCTION sql_saga._foreign_key_check_sql(foreign_key_name name, violations_only boolean)
+ RETURNS text
+ LANGUAGE plpgsql
+ STABLE
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    foreign_key_info record;
+    uk_keys text;
+    uk_columns text;
+    run_keys text;
+    join_clause text;
+    fk_columns text;
+    needs_check text;
+    timeline text;
+BEGIN
+    SELECT fk.table_name AS fk_table_name,
+           fk.column_names AS fk_column_names,
+           fp.start_column_name AS fk_start_column_name,
+           fp.end_column_name AS fk_end_column_name,
+           uk.table_name AS uk_table_name,
+           uk.column_names AS uk_column_names,
+           up.start_column_name AS uk_start_column_name,
+           up.end_column_name AS uk_end_column_name,
+           fk.match_type
+    INTO foreign_key_info
+    FROM sql_saga.foreign_keys AS fk
+    JOIN sql_saga.era AS fp ON (fp.table_name, fp.era_name) = (fk.table_name, fk.era_name)
+    JOIN sql_saga.unique_keys AS uk ON uk.key_name = fk.unique_key
+    JOIN sql_saga.era AS up ON (up.table_name, up.era_name) = (uk.table_name, uk.era_name)
+    WHERE fk.key_name = foreign_key_name;
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'foreign key "%" not found', foreign_key_name;
+    END IF;
+
+    SELECT string_agg(format('uk.%I AS k%s', u.ukc, u.n), ', ' ORDER BY u.n),
+           string_agg(format('uk.%I', u.ukc), ', ' ORDER BY u.n),
+           string_agg(format('k%s', u.n), ', ' ORDER BY u.n),
+           string_agg(format('t.k%s = fk.%I', u.n, u.fkc), ' AND ' ORDER BY u.n),
+           string_agg(format('fk.%I', u.fkc), ', ' ORDER BY u.n)
+    INTO uk_keys, uk_columns, run_keys, join_clause, fk_columns
+    FROM unnest(foreign_key_info.uk_column_names,
+                foreign_key_info.fk_column_names) WITH ORDINALITY AS u (ukc, fkc, n);
+
+    /*
+     * Rows with nulls in the key are not checked, except that the FULL match
+     * type only lets them through when all of the key is null.
+     */
+    IF foreign_key_info.match_type = 'FULL' THEN
+        needs_check := format('num_nulls(%s) < %s', fk_columns, cardinality(foreign_key_info.fk_column_names));
+    ELSE
+        needs_check := format('num_nulls(%s) = 0', fk_columns);
+    END IF;
+
+    timeline := format(
+        'SELECT %1$s, min(uk.s) AS s, max(uk.e) AS e '
+        'FROM (SELECT %1$s, uk.s, uk.e, sum(uk.gap) OVER (PARTITION BY %1$s ORDER BY uk.s) AS run '
+        '      FROM (SELECT %2$s, uk.%4$I AS s, uk.%5$I AS e, '
+        '                   CASE WHEN lag(uk.%5$I) OVER (PARTITION BY %3$s ORDER BY uk.%4$I) = uk.%4$I THEN 0 ELSE 1 END AS gap '
+        '            FROM %6$s AS uk '
+        '           ) AS uk '
+        '     ) AS uk '
+        'GROUP BY %1$s, uk.run',
+        run_keys, uk_keys, uk_columns,
+        foreign_key_info.uk_start_column_name,
+        foreign_key_info.uk_end_column_name,
+        foreign_key_info.uk_table_name);
+
+    IF violations_only THEN
+        RETURN format(
+            'SELECT to_jsonb(fk.*) '
+            'FROM %1$s AS fk '
+            'WHERE %2$s '
+            '  AND NOT EXISTS ( '
+            '    SELECT FROM (%3$s) AS t '
+            '    WHERE %4$s AND t.s <= fk.%5$I AND t.e >= fk.%6$I)',
+            foreign_key_info.fk_table_name, needs_check, timeline, join_clause,
+            foreign_key_info.fk_start_column_name,
+            foreign_key_info.fk_end_column_name);
+    END IF;
+
+    /* The runs of a key never touch, so at most one of them can match */
+    RETURN format(
+        'SELECT count(*), '
+        '       count(*) FILTER (WHERE %2$s AND t.s IS NULL), '
+        '       min(to_jsonb(fk.*)::text) FILTER (WHERE %2$s AND t.s IS NULL), '
+        '       count(*) FILTER (WHERE num_nulls(%7$s) BETWEEN 1 AND %8$s - 1) '
+        'FROM %1$s AS fk '
+        'LEFT JOIN (%3$s) AS t ON %4$s AND t.s <= fk.%5$I AND t.e >= fk.%6$I',
+        foreign_key_info.fk_table_name, needs_check, timeline, join_clause,
+        foreign_key_info.fk_start_column_name,
+        foreign_key_info.fk_end_column_name,
+        fk_columns, cardinality(foreign_key_info.fk_column_names));
+END;
+$function$;
+
+/*
+ * Checks all the existing rows of the referencing table of a foreign key, for
+ * example after a bulk load with the triggers disabled.  It raises the usual
+ * error if any row is not covered by the referenced table, and otherwise
+ * returns how many rows were checked and how long it took.
+ */
+CREATE FUNCTION sql_saga.validate_foreign_key(key_name name, OUT rows_checked bigint, OUT duration interval)
+ RETURNS record
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    foreign_key_row sql_saga.foreign_keys;
+    unique_table_name regclass;
+    started timestamptz := clock_timestamp();
+    violations bigint;
+    example text;
+    partial_nulls bigint;
+BEGIN
+    SELECT fk.*
+    INTO foreign_key_row
+    FROM sql_saga.foreign_keys AS fk
+    WHERE fk.key_name = key_name;
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'foreign key "%" not found', key_name;
+    END IF;
+
+    SELECT uk.table_name
+    INTO unique_table_name
+    FROM sql_saga.unique_keys AS uk
+    WHERE uk.key_name = foreign_key_row.unique_key;
+
+    /* Keep writers out of both tables while we look at them */
+    EXECUTE format('LOCK TABLE %s, %s IN SHARE MODE', foreign_key_row.table_name, unique_table_name);
+
+    EXECUTE sql_saga._foreign_key_check_sql(key_name, false)
+    INTO rows_checked, violations, example, partial_nulls;
+
+    IF foreign_key_row.match_type = 'PARTIAL' AND partial_nulls > 0 THEN
+        RAISE EXCEPTION 'partial not implemented';
+    END IF;
+
+    IF violations > 0 THEN
+        RAISE EXCEPTION 'insert or update on table "%" violates foreign key constraint "%"',
+            foreign_key_row.table_name, key_name
+        USING DETAIL = format('%s of %s rows are not covered by table "%s", for example %s.',
+                              violations, rows_checked, unique_table_name, example),
+              HINT = format('Use sql_saga.foreign_key_violations(%L) to list them.', key_name);
+    END IF;
+
+    duration := clock_timestamp() - started;
+END;
+$function$;
+
+/*
+ * Lists the rows of the referencing table that violate a foreign key.
+ */
+CREATE FUNCTION sql_saga.foreign_key_violations(key_name name)
+ RETURNS SETOF jsonb
+ LANGUAGE plpgsql
+ STABLE
+AS
+$function$
+BEGIN
+    RETURN QUERY EXECUTE sql_saga._foreign_key_check_sql(key_name, true);
+END;
+$function$;
+
+CREATE FUNCTION sql_saga.add_system_versioning(
+    table_class regclass,
+    history_table_name name DEFAULT NULL,
+    view_name name DEFAULT NULL,
+    function_as_of_name name DEFAULT NULL,
+    function_between_name name DEFAULT NULL,
+    function_between_symmetric_name name DEFAULT NULL,
+    function_from_to_name name DEFAULT NULL)
+ RETURNS void
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    schema_name name;
+    table_name name;
+    table_owner regrole;
+    persistence "char";
+    kind "char";
+    era_row sql_saga.era;
+    bound_type text;
+    history_table_id oid;
+    history_index_name name;
+    history_index_def text;
+    sql text;
+    grantees text;
+BEGIN
+    IF table_class IS NULL THEN
+        RAISE EXCEPTION 'no table name specified';
+    END IF;
+
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(table_class);
+
+    /*
+     * REFERENCES:
+     *     SQL:2016 4.15.2.2
+     *     SQL:2016 11.3 SR 2.3
+     *     SQL:2016 11.3 GR 1.c
+     *     SQL:2016 11.29
+     */
+
+    /* Already registered? SQL:2016 11.29 SR 5 */
+    IF EXISTS (SELECT FROM sql_saga.system_versioning AS r WHERE r.table_name = table_class) THEN
+        RAISE EXCEPTION 'table already has SYSTEM VERSIONING';
+    END IF;
+
+    /* Must be a regular persistent base table. SQL:2016 11.29 SR 2 */
+
+    SELECT n.nspname, c.relname, c.relowner, c.relpersistence, c.relkind
+    INTO schema_name, table_name, table_owner, persistence, kind
+    FROM pg_catalog.pg_class AS c
+    JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
+    WHERE c.oid = table_class;
+
+    IF kind <> 'r' THEN
+        IF kind = 'p' THEN
+            RAISE EXCEPTION 'partitioned tables are not supported yet';
+        END IF;
+
+        RAISE EXCEPTION 'relation % is not a table', $1;
+    END IF;
+
+    IF persistence <> 'p' THEN
+        /*
+         * We could probably accept unlogged tables if the history table is
+         * also unlogged, but what's the point?
+         */
+        RAISE EXCEPTION 'table "%" must be persistent', table_class;
+    END IF;
+
+    /* We need a SYSTEM_TIME era. SQL:2016 11.29 SR 4 */
+    SELECT p.*
+    INTO era_row
+    FROM sql_saga.era AS p
+    WHERE (p.table_name, p.era_name) = (table_class, 'system_time');
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'no era for SYSTEM_TIME found for table %', table_class;
+    END IF;
+
+    /* The functions take arguments of the type of the bounds */
+    SELECT pg_catalog.format_type(a.atttypid, NULL)
+    INTO bound_type
+    FROM pg_catalog.pg_attribute AS a
+    WHERE (a.attrelid, a.attname) = (table_class, era_row.start_column_name);
+
+    /* Get all of our "fake" infrastructure ready */
+    history_table_name := coalesce(history_table_name, sql_saga._make_name(ARRAY[table_name], 'history'));
+    view_name := coalesce(view_name, sql_saga._make_name(ARRAY[table_name], 'with_history'));
+    function_as_of_name := coalesce(function_as_of_name, sql_saga._make_name(ARRAY[table_name], '_as_of'));
+    function_between_name := coalesce(function_between_name, sql_saga._make_name(ARRAY[table_name], '_between'));
+    function_between_symmetric_name := coalesce(function_between_symmetric_name, sql_saga._make_name(ARRAY[table_name], '_between_symmetric'));
+    function_from_to_name := coalesce(function_from_to_name, sql_saga._make_name(ARRAY[table_name], '_from_to'));
+
+    /*
+     * Create the history table.  If it already exists we check that all the
+     * columns match but otherwise we trust the user.  Perhaps the history
+     * table was disconnected in order to change the schema (a case which is
+     * not defined by the SQL standard).  Or perhaps the user wanted to
+     * partition the history table.
+     *
+     * There shouldn't be any concurrency issues here because our main catalog
+     * is locked.
+     */
+    SELECT c.oid
+    INTO history_table_id
+    FROM pg_catalog.pg_class AS c
+    JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
+    WHERE (n.nspname, c.relname) = (schema_name, history_table_name);
+
+    IF FOUND THEN
+        /* Don't allow any eras on the history table (this might be relaxed later) */
+        IF EXISTS (SELECT FROM sql_saga.era AS p WHERE p.table_name = history_table_id) THEN
+            RAISE EXCEPTION 'history tables for SYSTEM VERSIONING cannot have eras';
+        END IF;
+
+        /*
+         * The query to the attributes is harder than one would think because
+         * we need to account for dropped columns.  Basically what we're
+         * looking for is that all columns have the same name, type, and
+         * collation.
+         */
+        IF EXISTS (
+            WITH
+            L (attname, atttypid, atttypmod, attcollation) AS (
+                SELECT a.attname, a.atttypid, a.atttypmod, a.attcollation
+                FROM pg_catalog.pg_attribute AS a
+                WHERE a.attrelid = table_class
+                  AND NOT a.attisdropped
+            ),
+            R (attname, atttypid, atttypmod, attcollation) AS (
+                SELECT a.attname, a.atttypid, a.atttypmod, a.attcollation
+                FROM pg_catalog.pg_attribute AS a
+                WHERE a.attrelid = history_table_id
+                  AND NOT a.attisdropped
+            )
+            SELECT FROM L NATURAL FULL JOIN R
+            WHERE L.attname IS NULL OR R.attname IS NULL)
+        THEN
+            RAISE EXCEPTION 'base table "%" and history table "%" are not compatible',
+                table_class, history_table_id::regclass;
+        END IF;
+
+        /* Make sure the owner is correct */
+        EXECUTE format('ALTER TABLE %s OWNER TO %I', history_table_id::regclass, table_owner);
+    ELSE
+        EXECUTE format('CREATE TABLE %1$I.%2$I (LIKE %1$I.%3$I)', schema_name, history_table_name, table_name);
+        history_table_id := format('%I.%I', schema_name, history_table_name)::regclass;
+
+        EXECUTE format('ALTER TABLE %1$I.%2$I OWNER TO %3$I', schema_name, history_table_name, table_owner);
+    END IF;
+
+    /*
+     * The history only grows, and the start of its rows has nothing to do
+     * with where they are stored, so it gets a GiST index on the period for
+     * the functions below, unless it has one already.
+     */
+    history_index_def := format(' USING gist (%s(%I, %I))',
+        era_row.range_type, era_row.start_column_name, era_row.end_column_name);
+    IF NOT EXISTS (
+        SELECT FROM pg_catalog.pg_index AS i
+        WHERE i.indrelid = history_table_id
+          AND substring(pg_catalog.pg_get_indexdef(i.indexrelid) FROM ' USING .*$') = history_index_def)
+    THEN
+        history_index_name := sql_saga._make_name(ARRAY[history_table_name, 'system_time'], 'idx');
+        EXECUTE format('CREATE INDEX %I ON %s%s', history_index_name, history_table_id::regclass, history_index_def);
+    END IF;
+
+    /* Create the "with history" view.  This one we do want to error out on if it exists. */
+    EXECUTE format(
+        /*
+         * The query we really want here is
+         *
+         *     CREATE VIEW view_name AS
+         *         TABLE table_name
+         *         UNION ALL CORRESPONDING
+         *         TABLE history_table_name
+         *
+         * but PostgreSQL doesn't support that syntax (yet), so we have to do
+         * it manually.
+         */
+        'CREATE VIEW %1$I.%2$I AS SELECT %5$s FROM %1$I.%3$I UNION ALL SELECT %5$s FROM %1$I.%4$I',
+        schema_name, view_name, table_name, history_table_name,
+        (SELECT string_agg(quote_ident(a.attname), ', ' ORDER BY a.attnum)
+         FROM pg_attribute AS a
+         WHERE a.attrelid = table_class
+           AND a.attnum > 0
+           AND NOT a.attisdropped
+        ));
+    EXECUTE format('ALTER VIEW %1$I.%2$I OWNER TO %3$I', schema_name, view_name, table_owner);
+
+    /*
+     * Create functions to simulate the system versioned grammar.  They must
+     * be inlinable for any kind of performance, and their conditions are
+     * written with the range operators so that they can use the index on the
+     * history table.  The greatest() only keeps the range valid when the
+     * bounds are reversed, in which case the first condition fails anyway.
+     */
+    EXECUTE format(
+        $$
+        CREATE FUNCTION %1$I.%2$I(%6$s)
+         RETURNS SETOF %1$I.%3$I
+         LANGUAGE sql
+         STABLE
+        AS 'SELECT * FROM %1$I.%3$I WHERE %7$s(%4$I, %5$I) @> $1'
+        $$, schema_name, function_as_of_name, view_name, era_row.start_column_name, era_row.end_column_name,
+        bound_type, era_row.range_type);
+    EXECUTE format('ALTER FUNCTION %1$I.%2$I(%4$s) OWNER TO %3$I',
+        schema_name, function_as_of_name, table_owner, bound_type);
+
+    EXECUTE format(
+        $$
+        CREATE FUNCTION %1$I.%2$I(%6$s, %6$s)
+         RETURNS SETOF %1$I.%3$I
+         LANGUAGE sql
+         STABLE
+        AS 'SELECT * FROM %1$I.%3$I WHERE $1 <= $2 AND %7$s(%4$I, %5$I) && %7$s($1, greatest($1, $2), ''[]'')'
+        $$, schema_name, function_between_name, view_name, era_row.start_column_name, era_row.end_column_name,
+        bound_type, era_row.range_type);
+    EXECUTE format('ALTER FUNCTION %1$I.%2$I(%4$s, %4$s) OWNER TO %3$I',
+        schema_name, function_between_name, table_owner, bound_type);
+
+    EXECUTE format(
+        $$
+        CREATE FUNCTION %1$I.%2$I(%6$s, %6$s)
+         RETURNS SETOF %1$I.%3$I
+         LANGUAGE sql
+         STABLE
+        AS 'SELECT * FROM %1$I.%3$I WHERE %7$s(%4$I, %5$I) && %7$s(least($1, $2), greatest($1, $2), ''[]'')'
+        $$, schema_name, function_between_symmetric_name, view_name, era_row.start_column_name, era_row.end_column_name,
+        bound_type, era_row.range_type);
+    EXECUTE format('ALTER FUNCTION %1$I.%2$I(%4$s, %4$s) OWNER TO %3$I',
+        schema_name, function_between_symmetric_name, table_owner, bound_type);
+
+    EXECUTE format(
+        $$
+        CREATE FUNCTION %1$I.%2$I(%6$s, %6$s)
+         RETURNS SETOF %1$I.%3$I
+         LANGUAGE sql
+         STABLE
+        AS 'SELECT * FROM %1$I.%3$I WHERE $1 < $2 AND %7$s(%4$I, %5$I) && %7$s($1, greatest($1, $2), ''[)'')'
+        $$, schema_name, function_from_to_name, view_name, era_row.start_column_name, era_row.end_column_name,
+        bound_type, era_row.range_type);
+    EXECUTE format('ALTER FUNCTION %1$I.%2$I(%4$s, %4$s) OWNER TO %3$I',
+        schema_name, function_from_to_name, table_owner, bound_type);
+
+    /* Set privileges on history objects */
+    FOR sql IN
+        SELECT format('REVOKE ALL ON %s %s FROM %s',
+                      CASE object_type
+                          WHEN 'r' THEN 'TABLE'
+                          WHEN 'p' THEN 'TABLE'
+                          WHEN 'v' THEN 'TABLE'
+                          WHEN 'f' THEN 'FUNCTION'
+                      ELSE 'ERROR'
+                      END,
+                      string_agg(DISTINCT object_name, ', '),
+                      string_agg(DISTINCT quote_ident(COALESCE(a.rolname, 'public')), ', '))
+        FROM (
+            SELECT c.relkind AS object_type,
+                   c.oid::regclass::text AS object_name,
+                   acl.grantee AS grantee
+            FROM pg_class AS c
+            JOIN pg_namespace AS n ON n.oid = c.relnamespace
+            CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
+            WHERE n.nspname = schema_name
+              AND c.relname IN (history_table_name, view_name)
+
+            UNION ALL
+
+            SELECT 'f',
+                   p.oid::regprocedure::text,
+                   acl.grantee
+            FROM pg_proc AS p
+            CROSS JOIN LATERAL aclexplode(COALESCE(p.proacl, acldefault('f', p.proowner))) AS acl
+            WHERE p.oid = ANY (ARRAY[
+                    format('%I.%I(%s)', schema_name, function_as_of_name, bound_type)::regprocedure,
+                    format('%I.%I(%s,%s)', schema_name, function_between_name, bound_type, bound_type)::regprocedure,
+                    format('%I.%I(%s,%s)', schema_name, function_between_symmetric_name, bound_type, bound_type)::regprocedure,
+                    format('%I.%I(%s,%s)', schema_name, function_from_to_name, bound_type, bound_type)::regprocedure
+                ])
+        ) AS objects
+        LEFT JOIN pg_authid AS a ON a.oid = objects.grantee
+        GROUP BY objects.object_type
+    LOOP
+        EXECUTE sql;
+    END LOOP;
+
+    FOR grantees IN
+        SELECT string_agg(acl.grantee::regrole::text, ', ')
+        FROM pg_class AS c
+        CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
+        WHERE c.oid = table_class
+          AND acl.privilege_type = 'SELECT'
+    LOOP
+        EXECUTE format('GRANT SELECT ON TABLE %1$I.%2$I, %1$I.%3$I TO %4$s',
+                       schema_name, history_table_name, view_name, grantees);
+        EXECUTE format('GRANT EXECUTE ON FUNCTION %s, %s, %s, %s TO %s',
+                       format('%I.%I(%s)', schema_name, function_as_of_name, bound_type)::regprocedure,
+                       format('%I.%I(%s,%s)', schema_name, function_between_name, bound_type, bound_type)::regprocedure,
+                       format('%I.%I(%s,%s)', schema_name, function_between_symmetric_name, bound_type, bound_type)::regprocedure,
+                       format('%I.%I(%s,%s)', schema_name, function_from_to_name, bound_type, bound_type)::regprocedure,
+                       grantees);
+    END LOOP;
+
+    /* Register it */
+    INSERT INTO sql_saga.system_versioning (table_name, era_name, history_table_name, view_name,
+                                            func_as_of, func_between, func_between_symmetric, func_from_to)
+    VALUES (
+        table_class,
+        'system_time',
+        format('%I.%I', schema_name, history_table_name),
+        format('%I.%I', schema_name, view_name),
+        format('%I.%I(%s)', schema_name, function_as_of_name, bound_type),
+        format('%I.%I(%s,%s)', schema_name, function_between_name, bound_type, bound_type),
+        format('%I.%I(%s,%s)', schema_name, function_between_symmetric_name, bound_type, bound_type),
+        format('%I.%I(%s,%s)', schema_name, function_from_to_name, bound_type, bound_type)
+    );
+END;
+$function$;
+
+CREATE FUNCTION sql_saga.drop_system_versioning(table_name regclass, drop_behavior sql_saga.drop_behavior DEFAULT 'RESTRICT', cleanup boolean DEFAULT false)
+ RETURNS boolean
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS $function$
+#variable_conflict use_variable
+DECLARE
+    system_versioning_row sql_saga.system_versioning;
+    is_dropped boolean;
+BEGIN
+    IF table_name IS NULL THEN
+        RAISE EXCEPTION 'no table name specified';
+    END IF;
+
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(table_name);
+
+    /*
+     * REFERENCES:
+     *     SQL:2016 4.15.2.2
+     *     SQL:2016 11.3 SR 2.3
+     *     SQL:2016 11.3 GR 1.c
+     *     SQL:2016 11.30
+     */
+
+    /*
+     * We need to delete our row first so that the DROP protection doesn't
+     * block us.
+     */
+    DELETE FROM sql_saga.system_versioning AS sv
+    WHERE sv.table_name = table_name
+    RETURNING * INTO system_versioning_row;
 
-        row_clause := format(' (%s) = (%s)', array_to_string(cols, ', '), array_to_string(vals, ', '));
-    END;
+    IF NOT FOUND THEN
+        RAISE DEBUG 'table % does not have SYSTEM VERSIONING', table_name;
+        RETURN false;
+    END IF;
 
-    BEGIN
-        EXECUTE format(QSQL, foreign_key_info.uk_schema_name,
-                             foreign_key_info.uk_table_name,
-                             foreign_key_info.uk_start_column_name,
-                             foreign_key_info.uk_end_column_name,
-                             foreign_key_info.fk_schema_name,
-                             foreign_key_info.fk_table_name,
-                             foreign_key_info.fk_start_column_name,
-                             foreign_key_info.fk_end_column_name,
-                             (SELECT string_agg(format('%I IS NOT DISTINCT FROM %I', ukc, fkc), ' AND ')
-                              FROM unnest(foreign_key_info.uk_column_names,
-                                          foreign_key_info.fk_column_names) AS u (ukc, fkc)
-                             ),
-                             row_clause)
-        INTO violation;
+    /*
+     * Has the table been dropped?  If so, everything else is also dropped
+     * except for the history table.
+     */
+    is_dropped := NOT EXISTS (SELECT FROM pg_catalog.pg_class AS c WHERE c.oid = table_name);
 
-        IF violation THEN
-            IF row_data IS NULL THEN
-                RAISE EXCEPTION 'foreign key violated by some row';
-            ELSE
-                RAISE EXCEPTION 'insert or update on table "%" violates foreign key constraint "%"',
-                    foreign_key_info.fk_table_oid::regclass,
-                    foreign_key_name;
-            END IF;
-        END IF;
-    END;
+    IF NOT is_dropped THEN
+        /* Drop the functions. */
+        EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_as_of::regprocedure, drop_behavior);
+        EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_between::regprocedure, drop_behavior);
+        EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_between_symmetric::regprocedure, drop_behavior);
+        EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_from_to::regprocedure, drop_behavior);
+
+        /* Drop the "with_history" view. */
+        EXECUTE format('DROP VIEW %s %s', system_versioning_row.view_name, drop_behavior);
+    END IF;
+
+    /*
+     * SQL:2016 11.30 GR 2 says "Every row of T that corresponds to a
+     * historical system row is effectively deleted at the end of the SQL-
+     * statement." but we leave the history table intact in case the user
+     * merely wants to make some DDL changes and hook things back up again.
+     *
+     * The cleanup parameter tells us that the user really wants to get rid of it
+     * all.
+     */
+    IF NOT is_dropped AND cleanup THEN
+        PERFORM sql_saga.drop_era(table_name, 'system_time', drop_behavior, cleanup);
+        EXECUTE format('DROP TABLE %s %s', system_versioning_row.history_table_name, drop_behavior);
+    END IF;
 
     RETURN true;
 END;
 $function$;
 
---TODO: Pick relevant parts of creating functions for views
--- to make the API for the `era` table.
---
--- CREATE FUNCTION sql_saga.add_system_versioning(
---     table_class regclass,
---     audit_table_name name DEFAULT NULL,
---     view_name name DEFAULT NULL,
---     function_as_of_name name DEFAULT NULL,
---     function_between_name name DEFAULT NULL,
---     function_between_symmetric_name name DEFAULT NULL,
---     function_from_to_name name DEFAULT NULL)
---  RETURNS void
---  LANGUAGE plpgsql
---  SECURITY DEFINER
--- AS
--- $function$
--- #variable_conflict use_variable
--- DECLARE
---     schema_name name;
---     table_name name;
---     table_owner regrole;
---     persistence "char";
---     kind "char";
---     era_row sql_saga.era;
---     history_table_id oid;
---     sql text;
---     grantees text;
--- BEGIN
---     IF table_class IS NULL THEN
---         RAISE EXCEPTION 'no table name specified';
---     END IF;
--- 
---     /* Always serialize operations on our catalogs */
---     PERFORM sql_saga._serialize(table_class);
--- 
---     /*
---      * REFERENCES:
---      *     SQL:2016 4.15.2.2
---      *     SQL:2016 11.3 SR 2.3
---      *     SQL:2016 11.3 GR 1.c
---      *     SQL:2016 11.29
---      */
--- 
---     /* Already registered? SQL:2016 11.29 SR 5 */
---     IF EXISTS (SELECT FROM sql_saga.system_versioning AS r WHERE r.table_name = table_class) THEN
---         RAISE EXCEPTION 'table already has SYSTEM VERSIONING';
---     END IF;
--- 
---     /* Must be a regular persistent base table. SQL:2016 11.29 SR 2 */
--- 
---     SELECT n.nspname, c.relname, c.relowner, c.relpersistence, c.relkind
---     INTO schema_name, table_name, table_owner, persistence, kind
---     FROM pg_catalog.pg_class AS c
---     JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
---     WHERE c.oid = table_class;
--- 
---     IF kind <> 'r' THEN
---         /*
---          * The main reason partitioned tables aren't supported yet is simply
---          * because I haven't put any thought into it.
---          * Maybe it's trivial, maybe not.
---          */
---         IF kind = 'p' THEN
---             RAISE EXCEPTION 'partitioned tables are not supported yet';
---         END IF;
--- 
---         RAISE EXCEPTION 'relation % is not a table', $1;
---     END IF;
--- 
---     IF persistence <> 'p' THEN
---         /*
---          * We could probably accept unlogged tables if the history table is
---          * also unlogged, but what's the point?
---          */
---         RAISE EXCEPTION 'table "%" must be persistent', table_class;
---     END IF;
--- 
---     /* We need a SYSTEM_TIME period. SQL:2016 11.29 SR 4 */
---     SELECT p.*
---     INTO era_row
---     FROM sql_saga.era AS p
---     WHERE (p.table_name, p.era_name) = (table_class, 'system_time');
--- 
---     IF NOT FOUND THEN
---         RAISE EXCEPTION 'no period for SYSTEM_TIME found for table %', table_class;
---     END IF;
--- 
---     /* Get all of our "fake" infrastructure ready */
---     audit_table_name := coalesce(audit_table_name, sql_saga._make_name(ARRAY[table_name], 'history'));
---     view_name := coalesce(view_name, sql_saga._make_name(ARRAY[table_name], 'with_history'));
---     function_as_of_name := coalesce(function_as_of_name, sql_saga._make_name(ARRAY[table_name], '_as_of'));
---     function_between_name := coalesce(function_between_name, sql_saga._make_name(ARRAY[table_name], '_between'));
---     function_between_symmetric_name := coalesce(function_between_symmetric_name, sql_saga._make_name(ARRAY[table_name], '_between_symmetric'));
---     function_from_to_name := coalesce(function_from_to_name, sql_saga._make_name(ARRAY[table_name], '_from_to'));
--- 
---     /*
---      * Create the history table.  If it already exists we check that all the
---      * columns match but otherwise we trust the user.  Perhaps the history
---      * table was disconnected in order to change the schema (a case which is
---      * not defined by the SQL standard).  Or perhaps the user wanted to
---      * partition the history table.
---      *
---      * There shouldn't be any concurrency issues here because our main catalog
---      * is locked.
---      */
---     SELECT c.oid
---     INTO history_table_id
---     FROM pg_catalog.pg_class AS c
---     JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
---     WHERE (n.nspname, c.relname) = (schema_name, audit_table_name);
--- 
---     IF FOUND THEN
---         /* Don't allow any periods on the history table (this might be relaxed later) */
---         IF EXISTS (SELECT FROM sql_saga.era AS p WHERE p.table_name = history_table_id) THEN
---             RAISE EXCEPTION 'history tables for SYSTEM VERSIONING cannot have periods';
---         END IF;
--- 
---         /*
---          * The query to the attributes is harder than one would think because
---          * we need to account for dropped columns.  Basically what we're
---          * looking for is that all columns have the same name, type, and
---          * collation.
---          */
---         IF EXISTS (
---             WITH
---             L (attname, atttypid, atttypmod, attcollation) AS (
---                 SELECT a.attname, a.atttypid, a.atttypmod, a.attcollation
---                 FROM pg_catalog.pg_attribute AS a
---                 WHERE a.attrelid = table_class
---                   AND NOT a.attisdropped
---             ),
---             R (attname, atttypid, atttypmod, attcollation) AS (
---                 SELECT a.attname, a.atttypid, a.atttypmod, a.attcollation
---                 FROM pg_catalog.pg_attribute AS a
---                 WHERE a.attrelid = history_table_id
---                   AND NOT a.attisdropped
---             )
---             SELECT FROM L NATURAL FULL JOIN R
---             WHERE L.attname IS NULL OR R.attname IS NULL)
---         THEN
---             RAISE EXCEPTION 'base table "%" and history table "%" are not compatible',
---                 table_class, history_table_id::regclass;
---         END IF;
--- 
---         /* Make sure the owner is correct */
---         EXECUTE format('ALTER TABLE %s OWNER TO %I', history_table_id::regclass, table_owner);
--- 
---         /*
---          * Remove all privileges other than SELECT from everyone on the history
---          * table.  We do this without error because some privileges may have
---          * been added in order to do maintenance while we were disconnected.
---          *
---          * We start by doing the table owner because that will make sure we
---          * don't have NULL in pg_class.relacl.
---          */
---         --EXECUTE format('REVOKE INSERT, UPDATE, DELETE, TRUNCATE, REFERENCES, TRIGGER ON TABLE %s FROM %I',
---             --history_table_id::regclass, table_owner);
---     ELSE
---         EXECUTE format('CREATE TABLE %1$I.%2$I (LIKE %1$I.%3$I)', schema_name, audit_table_name, table_name);
---         history_table_id := format('%I.%I', schema_name, audit_table_name)::regclass;
--- 
---         EXECUTE format('ALTER TABLE %1$I.%2$I OWNER TO %3$I', schema_name, audit_table_name, table_owner);
--- 
---         RAISE DEBUG 'history table "%" created for "%", be sure to index it properly',
---             history_table_id::regclass, table_class;
---     END IF;
--- 
---     /* Create the "with history" view.  This one we do want to error out on if it exists. */
---     EXECUTE format(
---         /*
---          * The query we really want here is
---          *
---          *     CREATE VIEW view_name AS
---          *         TABLE table_name
---          *         UNION ALL CORRESPONDING
---          *         TABLE audit_table_name
---          *
---          * but PostgreSQL doesn't support that syntax (yet), so we have to do
---          * it manually.
---          */
---         'CREATE VIEW %1$I.%2$I AS SELECT %5$s FROM %1$I.%3$I UNION ALL SELECT %5$s FROM %1$I.%4$I',
---         schema_name, view_name, table_name, audit_table_name,
---         (SELECT string_agg(quote_ident(a.attname), ', ' ORDER BY a.attnum)
---          FROM pg_attribute AS a
---          WHERE a.attrelid = table_class
---            AND a.attnum > 0
---            AND NOT a.attisdropped
---         ));
---     EXECUTE format('ALTER VIEW %1$I.%2$I OWNER TO %3$I', schema_name, view_name, table_owner);
--- 
---     /*
---      * Create functions to simulate the system versioned grammar.  These must
---      * be inlinable for any kind of performance.
---      */
---     EXECUTE format(
---         $$
---         CREATE FUNCTION %1$I.%2$I(timestamp with time zone)
---          RETURNS SETOF %1$I.%3$I
---          LANGUAGE sql
---          STABLE
---         AS 'SELECT * FROM %1$I.%3$I WHERE %4$I <= $1 AND %5$I > $1'
---         $$, schema_name, function_as_of_name, view_name, era_row.start_column_name, era_row.end_column_name);
---     EXECUTE format('ALTER FUNCTION %1$I.%2$I(timestamp with time zone) OWNER TO %3$I',
---         schema_name, function_as_of_name, table_owner);
--- 
---     EXECUTE format(
---         $$
---         CREATE FUNCTION %1$I.%2$I(timestamp with time zone, timestamp with time zone)
---          RETURNS SETOF %1$I.%3$I
---          LANGUAGE sql
---          STABLE
---         AS 'SELECT * FROM %1$I.%3$I WHERE $1 <= $2 AND %5$I > $1 AND %4$I <= $2'
---         $$, schema_name, function_between_name, view_name, era_row.start_column_name, era_row.end_column_name);
---     EXECUTE format('ALTER FUNCTION %1$I.%2$I(timestamp with time zone, timestamp with time zone) OWNER TO %3$I',
---         schema_name, function_between_name, table_owner);
--- 
---     EXECUTE format(
---         $$
---         CREATE FUNCTION %1$I.%2$I(timestamp with time zone, timestamp with time zone)
---          RETURNS SETOF %1$I.%3$I
---          LANGUAGE sql
---          STABLE
---         AS 'SELECT * FROM %1$I.%3$I WHERE %5$I > least($1, $2) AND %4$I <= greatest($1, $2)'
---         $$, schema_name, function_between_symmetric_name, view_name, era_row.start_column_name, era_row.end_column_name);
---     EXECUTE format('ALTER FUNCTION %1$I.%2$I(timestamp with time zone, timestamp with time zone) OWNER TO %3$I',
---         schema_name, function_between_symmetric_name, table_owner);
--- 
---     EXECUTE format(
---         $$
---         CREATE FUNCTION %1$I.%2$I(timestamp with time zone, timestamp with time zone)
---          RETURNS SETOF %1$I.%3$I
---          LANGUAGE sql
---          STABLE
---         AS 'SELECT * FROM %1$I.%3$I WHERE $1 < $2 AND %5$I > $1 AND %4$I < $2'
---         $$, schema_name, function_from_to_name, view_name, era_row.start_column_name, era_row.end_column_name);
---     EXECUTE format('ALTER FUNCTION %1$I.%2$I(timestamp with time zone, timestamp with time zone) OWNER TO %3$I',
---         schema_name, function_from_to_name, table_owner);
--- 
---     /* Set privileges on history objects */
---     FOR sql IN
---         SELECT format('REVOKE ALL ON %s %s FROM %s',
---                       CASE object_type
---                           WHEN 'r' THEN 'TABLE'
---                           WHEN 'p' THEN 'TABLE'
---                           WHEN 'v' THEN 'TABLE'
---                           WHEN 'f' THEN 'FUNCTION'
---                       ELSE 'ERROR'
---                       END,
---                       string_agg(DISTINCT object_name, ', '),
---                       string_agg(DISTINCT quote_ident(COALESCE(a.rolname, 'public')), ', '))
---         FROM (
---             SELECT c.relkind AS object_type,
---                    c.oid::regclass::text AS object_name,
---                    acl.grantee AS grantee
---             FROM pg_class AS c
---             JOIN pg_namespace AS n ON n.oid = c.relnamespace
---             CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
---             WHERE n.nspname = schema_name
---               AND c.relname IN (audit_table_name, view_name)
--- 
---             UNION ALL
--- 
---             SELECT 'f',
---                    p.oid::regprocedure::text,
---                    acl.grantee
---             FROM pg_proc AS p
---             CROSS JOIN LATERAL aclexplode(COALESCE(p.proacl, acldefault('f', p.proowner))) AS acl
---             WHERE p.oid = ANY (ARRAY[
---                     format('%I.%I(timestamp with time zone)', schema_name, function_as_of_name)::regprocedure,
---                     format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_between_name)::regprocedure,
---                     format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_between_symmetric_name)::regprocedure,
---                     format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_from_to_name)::regprocedure
---                 ])
---         ) AS objects
---         LEFT JOIN pg_authid AS a ON a.oid = objects.grantee
---         GROUP BY objects.object_type
---     LOOP
---         EXECUTE sql;
---     END LOOP;
--- 
---     FOR grantees IN
---         SELECT string_agg(acl.grantee::regrole::text, ', ')
---         FROM pg_class AS c
---         CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
---         WHERE c.oid = table_class
---           AND acl.privilege_type = 'SELECT'
---     LOOP
---         EXECUTE format('GRANT SELECT ON TABLE %1$I.%2$I, %1$I.%3$I TO %4$s',
---                        schema_name, audit_table_name, view_name, grantees);
---         EXECUTE format('GRANT EXECUTE ON FUNCTION %s, %s, %s, %s TO %s',
---                        format('%I.%I(timestamp with time zone)', schema_name, function_as_of_name)::regprocedure,
---                        format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_between_name)::regprocedure,
---                        format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_between_symmetric_name)::regprocedure,
---                        format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_from_to_name)::regprocedure,
---                        grantees);
---     END LOOP;
--- 
---     /* Register it */
---     INSERT INTO sql_saga.system_versioning (table_name, era_name, audit_table_name, view_name,
---                                            func_as_of, func_between, func_between_symmetric, func_from_to)
---     VALUES (
---         table_class,
---         'system_time',
---         format('%I.%I', schema_name, audit_table_name),
---         format('%I.%I', schema_name, view_name),
---         format('%I.%I(timestamp with time zone)', schema_name, function_as_of_name),
---         format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_between_name),
---         format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_between_symmetric_name),
---         format('%I.%I(timestamp with time zone,timestamp with time zone)', schema_name, function_from_to_name)
---     );
--- END;
--- $function$;
--- 
--- CREATE FUNCTION sql_saga.drop_system_versioning(table_name regclass, drop_behavior sql_saga.drop_behavior DEFAULT 'RESTRICT', cleanup boolean DEFAULT false)
---  RETURNS boolean
---  LANGUAGE plpgsql
---  SECURITY DEFINER
--- AS $function$
--- #variable_conflict use_variable
--- DECLARE
---     system_versioning_row sql_saga.system_versioning;
---     is_dropped boolean;
--- BEGIN
---     IF table_name IS NULL THEN
---         RAISE EXCEPTION 'no table name specified';
---     END IF;
--- 
---     /* Always serialize operations on our catalogs */
---     PERFORM sql_saga._serialize(table_name);
--- 
---     /*
---      * REFERENCES:
---      *     SQL:2016 4.15.2.2
---      *     SQL:2016 11.3 SR 2.3
---      *     SQL:2016 11.3 GR 1.c
---      *     SQL:2016 11.30
---      */
--- 
---     /*
---      * We need to delete our row first so that the DROP protection doesn't
---      * block us.
---      */
---     DELETE FROM sql_saga.system_versioning AS sv
---     WHERE sv.table_name = table_name
---     RETURNING * INTO system_versioning_row;
--- 
---     IF NOT FOUND THEN
---         RAISE DEBUG 'table % does not have SYSTEM VERSIONING', table_name;
---         RETURN false;
---     END IF;
--- 
---     /*
---      * Has the table been dropped?  If so, everything else is also dropped
---      * except for the history table.
---      */
---     is_dropped := NOT EXISTS (SELECT FROM pg_catalog.pg_class AS c WHERE c.oid = table_name);
--- 
---     IF NOT is_dropped THEN
---         /* Drop the functions. */
---         EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_as_of::regprocedure, drop_behavior);
---         EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_between::regprocedure, drop_behavior);
---         EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_between_symmetric::regprocedure, drop_behavior);
---         EXECUTE format('DROP FUNCTION %s %s', system_versioning_row.func_from_to::regprocedure, drop_behavior);
--- 
---         /* Drop the "with_history" view. */
---         EXECUTE format('DROP VIEW %s %s', system_versioning_row.view_name, drop_behavior);
---     END IF;
--- 
---     /*
---      * SQL:2016 11.30 GR 2 says "Every row of T that corresponds to a
---      * historical system row is effectively deleted at the end of the SQL-
---      * statement." but we leave the history table intact in case the user
---      * merely wants to make some DDL changes and hook things back up again.
---      *
---      * The cleanup parameter tells us that the user really wants to get rid of it
---      * all.
---      */
---     IF NOT is_dropped AND cleanup THEN
---         PERFORM sql_saga.drop_era(table_name, 'system_time', drop_behavior, cleanup);
---         EXECUTE format('DROP TABLE %s %s', system_versioning_row.audit_table_name, drop_behavior);
---     END IF;
--- 
---     RETURN true;
--- END;
--- $function$;
+/*
+ * The relations that sql_saga keeps track of: the tables with eras and their
+ * partitions, the history tables and views of system versioning, and the
+ * FOR PORTION OF views.
+ */
+CREATE FUNCTION sql_saga._saga_relations()
+ RETURNS SETOF oid
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    WITH RECURSIVE relations (relid) AS (
+        SELECT r.relid
+        FROM (
+            SELECT p.table_name::oid FROM sql_saga.era AS p
+            UNION ALL
+            SELECT sv.history_table_name::oid FROM sql_saga.system_versioning AS sv
+            UNION ALL
+            SELECT sv.view_name::oid FROM sql_saga.system_versioning AS sv
+            UNION ALL
+            SELECT fpv.view_name::oid FROM sql_saga.api_view AS fpv
+        ) AS r (relid)
+        UNION
+        SELECT i.inhrelid
+        FROM pg_catalog.pg_inherits AS i
+        JOIN relations AS r ON r.relid = i.inhparent
+    )
+    SELECT relid FROM relations;
+$function$;
+
+/*
+ * The event triggers below check our whole catalogs, so they first make sure
+ * that the event is about something we keep track of.  The DDL on anything
+ * else, like the staging tables of a migration, then costs a lookup of the
+ * objects it touched instead of a scan of every era.
+ *
+ * GRANT and REVOKE do not tell what they are about, and system versioning
+ * keeps its functions by name, so any of those counts when there is
+ * something they could be about.
+ */
+CREATE FUNCTION sql_saga._ddl_commands_touch_saga()
+ RETURNS boolean
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    SELECT EXISTS (
+        SELECT
+        FROM pg_catalog.pg_event_trigger_ddl_commands() AS ev_ddl
+        WHERE CASE
+            WHEN ev_ddl.command_tag IN ('GRANT', 'REVOKE') THEN
+                EXISTS (SELECT FROM sql_saga.system_versioning) OR EXISTS (SELECT FROM sql_saga.api_view)
+            WHEN ev_ddl.classid IN ('pg_catalog.pg_proc'::regclass, 'pg_catalog.pg_namespace'::regclass) THEN
+                EXISTS (SELECT FROM sql_saga.system_versioning)
+            WHEN ev_ddl.classid = 'pg_catalog.pg_constraint'::regclass THEN
+                (SELECT c.conrelid FROM pg_catalog.pg_constraint AS c WHERE c.oid = ev_ddl.objid)
+                    IN (SELECT sql_saga._saga_relations())
+            WHEN ev_ddl.classid = 'pg_catalog.pg_trigger'::regclass THEN
+                (SELECT t.tgrelid FROM pg_catalog.pg_trigger AS t WHERE t.oid = ev_ddl.objid)
+                    IN (SELECT sql_saga._saga_relations())
+            WHEN ev_ddl.classid = 'pg_catalog.pg_class'::regclass THEN
+                coalesce((SELECT i.indrelid FROM pg_catalog.pg_index AS i WHERE i.indexrelid = ev_ddl.objid),
+                         ev_ddl.objid)
+                    IN (SELECT sql_saga._saga_relations())
+            ELSE false
+        END);
+$function$;
 
+/*
+ * The same for sql_drop.  The constraints and triggers are gone by then, but
+ * the names of their table are still there.
+ */
+CREATE FUNCTION sql_saga._dropped_objects_touch_saga()
+ RETURNS boolean
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    SELECT EXISTS (
+        SELECT
+        FROM pg_catalog.pg_event_trigger_dropped_objects() AS dobj
+        WHERE CASE
+            WHEN dobj.object_type = 'function' THEN
+                EXISTS (SELECT FROM sql_saga.system_versioning)
+            WHEN dobj.object_type = 'index' THEN
+                dobj.objid IN (SELECT fk.fk_index FROM sql_saga.foreign_keys AS fk)
+            WHEN dobj.object_type IN ('table constraint', 'trigger') THEN
+                pg_catalog.to_regclass(pg_catalog.format('%I.%I', dobj.address_names[1], dobj.address_names[2]))::oid
+                    IN (SELECT sql_saga._saga_relations())
+            ELSE
+                dobj.objid IN (SELECT sql_saga._saga_relations())
+                OR dobj.objid IN (SELECT p.range_type FROM sql_saga.era AS p)
+        END);
+$function$;
 
 CREATE FUNCTION sql_saga.drop_protection()
  RETURNS event_trigger
@@ -2531,6 +3751,11 @@ DECLARE
     table_name regclass;
     era_name name;
 BEGIN
+    /* Leave the DDL on objects that are not ours alone */
+    IF NOT sql_saga._dropped_objects_touch_saga() THEN
+        RETURN;
+    END IF;
+
     /*
      * This function is called after the fact, so we have to just look to see
      * if anything is missing in the catalogs if we just store the name and not
@@ -2583,69 +3808,73 @@ BEGIN
             r.object_identity, r.era_name, r.table_name;
     END LOOP;
 
-    --/* Complain if the infinity CHECK constraint is missing. */
-    --FOR r IN
-    --    SELECT p.table_name, p.infinity_check_constraint
-    --    FROM sql_saga.system_time_periods AS p
-    --    WHERE NOT EXISTS (
-    --        SELECT FROM pg_catalog.pg_constraint AS c
-    --        WHERE (c.conrelid, c.conname) = (p.table_name, p.infinity_check_constraint))
-    --LOOP
-    --    RAISE EXCEPTION 'cannot drop constraint "%" on table "%" because it is used in SYSTEM_TIME period',
-    --        r.infinity_check_constraint, r.table_name;
-    --END LOOP;
+    ---
+    --- system_time_era
+    ---
+
+    /* Complain if the infinity CHECK constraint is missing. */
+    FOR r IN
+        SELECT p.table_name, p.infinity_check_constraint
+        FROM sql_saga.system_time_era AS p
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_constraint AS c
+            WHERE (c.conrelid, c.conname) = (p.table_name, p.infinity_check_constraint))
+    LOOP
+        RAISE EXCEPTION 'cannot drop constraint "%" on table "%" because it is used in SYSTEM_TIME era',
+            r.infinity_check_constraint, r.table_name;
+    END LOOP;
 
     /* Complain if the GENERATED ALWAYS AS ROW START/END trigger is missing. */
-    --FOR r IN
-    --    SELECT p.table_name, p.generated_always_trigger
-    --    FROM sql_saga.system_time_periods AS p
-    --    WHERE NOT EXISTS (
-    --        SELECT FROM pg_catalog.pg_trigger AS t
-    --        WHERE (t.tgrelid, t.tgname) = (p.table_name, p.generated_always_trigger))
-    --LOOP
-    --    RAISE EXCEPTION 'cannot drop trigger "%" on table "%" because it is used in SYSTEM_TIME period',
-    --        r.generated_always_trigger, r.table_name;
-    --END LOOP;
+    FOR r IN
+        SELECT p.table_name, p.generated_always_trigger
+        FROM sql_saga.system_time_era AS p
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_trigger AS t
+            WHERE (t.tgrelid, t.tgname) = (p.table_name, p.generated_always_trigger))
+    LOOP
+        RAISE EXCEPTION 'cannot drop trigger "%" on table "%" because it is used in SYSTEM_TIME era',
+            r.generated_always_trigger, r.table_name;
+    END LOOP;
 
     /* Complain if the write_history trigger is missing. */
-    -- FOR r IN
-    --     SELECT p.table_name, p.write_history_trigger
-    --     FROM sql_saga.system_time_periods AS p
-    --     WHERE NOT EXISTS (
-    --         SELECT FROM pg_catalog.pg_trigger AS t
-    --         WHERE (t.tgrelid, t.tgname) = (p.table_name, p.write_history_trigger))
-    -- LOOP
-    --     RAISE EXCEPTION 'cannot drop trigger "%" on table "%" because it is used in SYSTEM_TIME period',
-    --         r.write_history_trigger, r.table_name;
-    -- END LOOP;
+    FOR r IN
+        SELECT p.table_name, p.write_history_trigger
+        FROM sql_saga.system_time_era AS p
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_trigger AS t
+            WHERE (t.tgrelid, t.tgname) = (p.table_name, p.write_history_trigger))
+    LOOP
+        RAISE EXCEPTION 'cannot drop trigger "%" on table "%" because it is used in SYSTEM_TIME era',
+            r.write_history_trigger, r.table_name;
+    END LOOP;
 
     /* Complain if the TRUNCATE trigger is missing. */
-    --FOR r IN
-    --    SELECT p.table_name, p.truncate_trigger
-    --    FROM sql_saga.system_time_periods AS p
-    --    WHERE NOT EXISTS (
-    --        SELECT FROM pg_catalog.pg_trigger AS t
-    --        WHERE (t.tgrelid, t.tgname) = (p.table_name, p.truncate_trigger))
-    --LOOP
-    --    RAISE EXCEPTION 'cannot drop trigger "%" on table "%" because it is used in SYSTEM_TIME period',
-    --        r.truncate_trigger, r.table_name;
-    --END LOOP;
+    FOR r IN
+        SELECT p.table_name, p.truncate_trigger
+        FROM sql_saga.system_time_era AS p
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_trigger AS t
+            WHERE (t.tgrelid, t.tgname) = (p.table_name, p.truncate_trigger))
+    LOOP
+        RAISE EXCEPTION 'cannot drop trigger "%" on table "%" because it is used in SYSTEM_TIME era',
+            r.truncate_trigger, r.table_name;
+    END LOOP;
 
     /*
      * We can't reliably find out what a column was renamed to, so just error
      * out in this case.
      */
---    FOR r IN
---        SELECT stp.table_name, u.column_name
---        FROM sql_saga.era AS stp
---        CROSS JOIN LATERAL unnest(stp.excluded_column_names) AS u (column_name)
---        WHERE NOT EXISTS (
---            SELECT FROM pg_catalog.pg_attribute AS a
---            WHERE (a.attrelid, a.attname) = (stp.table_name, u.column_name))
---    LOOP
---        RAISE EXCEPTION 'cannot drop or rename column "%" on table "%" because it is excluded from an era',
---            r.column_name, r.table_name;
---    END LOOP;
+    FOR r IN
+        SELECT ste.table_name, u.column_name
+        FROM sql_saga.system_time_era AS ste
+        CROSS JOIN LATERAL unnest(ste.excluded_column_names) AS u (column_name)
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_attribute AS a
+            WHERE (a.attrelid, a.attname) = (ste.table_name, u.column_name))
+    LOOP
+        RAISE EXCEPTION 'cannot drop or rename column "%" on table "%" because it is excluded from SYSTEM VERSIONING',
+            r.column_name, r.table_name;
+    END LOOP;
 
     ---
     --- api_view
@@ -2712,7 +3941,7 @@ BEGIN
     FOR r IN
         SELECT uk.key_name, uk.table_name, uk.exclude_constraint
         FROM sql_saga.unique_keys AS uk
-        WHERE NOT EXISTS (
+        WHERE uk.exclude_constraint IS NOT NULL AND NOT EXISTS (
             SELECT FROM pg_catalog.pg_constraint AS c
             WHERE (c.conrelid, c.conname) = (uk.table_name, uk.exclude_constraint))
     LOOP
@@ -2720,6 +3949,33 @@ BEGIN
             r.exclude_constraint, r.table_name, r.key_name;
     END LOOP;
 
+    /* On partitioned tables, the partitions have the EXCLUDE constraints */
+    FOR r IN
+        SELECT uk.key_name, l.relid AS table_name
+        FROM sql_saga.unique_keys AS uk
+        CROSS JOIN LATERAL sql_saga._leaf_partitions(uk.table_name) AS l (relid)
+        WHERE uk.overlap_trigger IS NOT NULL
+          AND uk.enforcement = 'GIST'
+          AND NOT EXISTS (
+            SELECT FROM pg_catalog.pg_constraint AS c
+            WHERE (c.conrelid, c.contype) = (l.relid, 'x')
+              AND pg_catalog.pg_get_constraintdef(c.oid) = sql_saga._exclude_constraint_def(uk.table_name, uk.column_names, uk.era_name))
+    LOOP
+        RAISE EXCEPTION 'cannot drop EXCLUDE constraint on partition "%" because it is used in era unique key "%"',
+            r.table_name, r.key_name;
+    END LOOP;
+
+    FOR r IN
+        SELECT uk.key_name, uk.table_name, uk.overlap_trigger
+        FROM sql_saga.unique_keys AS uk
+        WHERE uk.overlap_trigger IS NOT NULL AND NOT EXISTS (
+            SELECT FROM pg_catalog.pg_trigger AS t
+            WHERE (t.tgrelid, t.tgname) = (uk.table_name, uk.overlap_trigger))
+    LOOP
+        RAISE EXCEPTION 'cannot drop trigger "%" on table "%" because it is used in era unique key "%"',
+            r.overlap_trigger, r.table_name, r.key_name;
+    END LOOP;
+
     ---
     --- foreign_keys
     ---
@@ -2771,45 +4027,58 @@ BEGIN
             r.uk_delete_trigger, r.table_name, r.key_name;
     END LOOP;
 
+    /* Reject dropping the index we made for the foreign key */
+    FOR r IN
+        SELECT dobj.object_identity, fk.key_name
+        FROM sql_saga.foreign_keys AS fk
+        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
+                ON dobj.objid = fk.fk_index
+        WHERE dobj.object_type = 'index'
+        ORDER BY dobj.ordinality
+    LOOP
+        RAISE EXCEPTION 'cannot drop index "%" because it is used in era foreign key "%"',
+            r.object_identity, r.key_name;
+    END LOOP;
+
     ---
     --- system_versioning
     ---
 
---    FOR r IN
---        SELECT dobj.object_identity, sv.table_name
---        FROM sql_saga.system_versioning AS sv
---        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
---                ON dobj.objid = sv.audit_table_name
---        WHERE dobj.object_type = 'table'
---        ORDER BY dobj.ordinality
---    LOOP
---        RAISE EXCEPTION 'cannot drop table "%" because it is used in SYSTEM VERSIONING for table "%"',
---            r.object_identity, r.table_name;
---    END LOOP;
---
---    FOR r IN
---        SELECT dobj.object_identity, sv.table_name
---        FROM sql_saga.system_versioning AS sv
---        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
---                ON dobj.objid = sv.view_name
---        WHERE dobj.object_type = 'view'
---        ORDER BY dobj.ordinality
---    LOOP
---        RAISE EXCEPTION 'cannot drop view "%" because it is used in SYSTEM VERSIONING for table "%"',
---            r.object_identity, r.table_name;
---    END LOOP;
---
---    FOR r IN
---        SELECT dobj.object_identity, sv.table_name
---        FROM sql_saga.system_versioning AS sv
---        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
---                ON dobj.object_identity = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to])
---        WHERE dobj.object_type = 'function'
---        ORDER BY dobj.ordinality
---    LOOP
---        RAISE EXCEPTION 'cannot drop function "%" because it is used in SYSTEM VERSIONING for table "%"',
---            r.object_identity, r.table_name;
---    END LOOP;
+    FOR r IN
+        SELECT dobj.object_identity, sv.table_name
+        FROM sql_saga.system_versioning AS sv
+        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
+                ON dobj.objid = sv.history_table_name
+        WHERE dobj.object_type = 'table'
+        ORDER BY dobj.ordinality
+    LOOP
+        RAISE EXCEPTION 'cannot drop table "%" because it is used in SYSTEM VERSIONING for table "%"',
+            r.object_identity, r.table_name;
+    END LOOP;
+
+    FOR r IN
+        SELECT dobj.object_identity, sv.table_name
+        FROM sql_saga.system_versioning AS sv
+        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
+                ON dobj.objid = sv.view_name
+        WHERE dobj.object_type = 'view'
+        ORDER BY dobj.ordinality
+    LOOP
+        RAISE EXCEPTION 'cannot drop view "%" because it is used in SYSTEM VERSIONING for table "%"',
+            r.object_identity, r.table_name;
+    END LOOP;
+
+    FOR r IN
+        SELECT dobj.object_identity, sv.table_name
+        FROM sql_saga.system_versioning AS sv
+        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
+                ON dobj.object_identity = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to])
+        WHERE dobj.object_type = 'function'
+        ORDER BY dobj.ordinality
+    LOOP
+        RAISE EXCEPTION 'cannot drop function "%" because it is used in SYSTEM VERSIONING for table "%"',
+            r.object_identity, r.table_name;
+    END LOOP;
 END;
 $function$;
 
@@ -2826,6 +4095,11 @@ DECLARE
     r record;
     sql text;
 BEGIN
+    /* Leave the DDL on objects that are not ours alone */
+    IF NOT sql_saga._ddl_commands_touch_saga() THEN
+        RETURN;
+    END IF;
+
     /*
      * Anything that is stored by reg* type will auto-adjust, but anything we
      * store by name will need to be updated after a rename. One way to do this
@@ -2873,72 +4147,76 @@ BEGIN
         EXECUTE sql;
     END LOOP;
 
-    --    FOR sql IN
-    --        SELECT pg_catalog.format('UPDATE sql_saga.system_time_periods SET infinity_check_constraint = %L WHERE table_name = %L::regclass',
-    --            c.conname, p.table_name)
-    --        FROM sql_saga.era AS p
-    --        JOIN sql_saga.system_time_periods AS stp ON (stp.table_name, stp.era_name) = (p.table_name, p.era_name)
-    --        JOIN pg_catalog.pg_constraint AS c ON c.conrelid = p.table_name
-    --        JOIN pg_catalog.pg_attribute AS ea ON ea.attrelid = p.table_name
-    --        WHERE stp.infinity_check_constraint <> c.conname
-    --          AND pg_catalog.pg_get_constraintdef(c.oid) = format('CHECK ((%I = ''infinity''::%s))', ea.attname, format_type(ea.atttypid, ea.atttypmod))
-    --          AND p.end_column_name = ea.attname
-    --          AND NOT EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c WHERE (_c.conrelid, _c.conname) = (stp.table_name, stp.infinity_check_constraint))
-    --    LOOP
-    --        EXECUTE sql;
-    --    END LOOP;
-    --
-    --    FOR sql IN
-    --        SELECT pg_catalog.format('UPDATE sql_saga.system_time_periods SET generated_always_trigger = %L WHERE table_name = %L::regclass',
-    --            t.tgname, stp.table_name)
-    --        FROM sql_saga.system_time_periods AS stp
-    --        JOIN pg_catalog.pg_trigger AS t ON t.tgrelid = stp.table_name
-    --        WHERE t.tgname <> stp.generated_always_trigger
-    --          AND t.tgfoid = 'sql_saga.generated_always_as_row_start_end()'::regprocedure
-    --          AND NOT EXISTS (SELECT FROM pg_catalog.pg_trigger AS _t WHERE (_t.tgrelid, _t.tgname) = (stp.table_name, stp.generated_always_trigger))
-    --    LOOP
-    --        EXECUTE sql;
-    --    END LOOP;
-    --
-    --    FOR sql IN
-    --        SELECT pg_catalog.format('UPDATE sql_saga.system_time_periods SET write_history_trigger = %L WHERE table_name = %L::regclass',
-    --            t.tgname, stp.table_name)
-    --        FROM sql_saga.system_time_periods AS stp
-    --        JOIN pg_catalog.pg_trigger AS t ON t.tgrelid = stp.table_name
-    --        WHERE t.tgname <> stp.write_history_trigger
-    --          AND t.tgfoid = 'sql_saga.write_history()'::regprocedure
-    --          AND NOT EXISTS (SELECT FROM pg_catalog.pg_trigger AS _t WHERE (_t.tgrelid, _t.tgname) = (stp.table_name, stp.write_history_trigger))
-    --    LOOP
-    --        EXECUTE sql;
-    --    END LOOP;
-    --
-    --    FOR sql IN
-    --        SELECT pg_catalog.format('UPDATE sql_saga.system_time_periods SET truncate_trigger = %L WHERE table_name = %L::regclass',
-    --            t.tgname, stp.table_name)
-    --        FROM sql_saga.system_time_periods AS stp
-    --        JOIN pg_catalog.pg_trigger AS t ON t.tgrelid = stp.table_name
-    --        WHERE t.tgname <> stp.truncate_trigger
-    --          AND t.tgfoid = 'sql_saga.truncate_era()'::regprocedure
-    --          AND NOT EXISTS (SELECT FROM pg_catalog.pg_trigger AS _t WHERE (_t.tgrelid, _t.tgname) = (stp.table_name, stp.truncate_trigger))
-    --    LOOP
-    --        EXECUTE sql;
-    --    END LOOP;
+    ---
+    --- system_time_era
+    ---
+
+    FOR sql IN
+        SELECT pg_catalog.format('UPDATE sql_saga.system_time_era SET infinity_check_constraint = %L WHERE table_name = %L::regclass',
+            c.conname, p.table_name)
+        FROM sql_saga.era AS p
+        JOIN sql_saga.system_time_era AS ste ON (ste.table_name, ste.era_name) = (p.table_name, p.era_name)
+        JOIN pg_catalog.pg_constraint AS c ON c.conrelid = p.table_name
+        JOIN pg_catalog.pg_attribute AS ea ON ea.attrelid = p.table_name
+        WHERE ste.infinity_check_constraint <> c.conname
+          AND pg_catalog.pg_get_constraintdef(c.oid) = format('CHECK ((%I = ''infinity''::%s))', ea.attname, format_type(ea.atttypid, ea.atttypmod))
+          AND p.end_column_name = ea.attname
+          AND NOT EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c WHERE (_c.conrelid, _c.conname) = (ste.table_name, ste.infinity_check_constraint))
+    LOOP
+        EXECUTE sql;
+    END LOOP;
+
+    FOR sql IN
+        SELECT pg_catalog.format('UPDATE sql_saga.system_time_era SET generated_always_trigger = %L WHERE table_name = %L::regclass',
+            t.tgname, ste.table_name)
+        FROM sql_saga.system_time_era AS ste
+        JOIN pg_catalog.pg_trigger AS t ON t.tgrelid = ste.table_name
+        WHERE t.tgname <> ste.generated_always_trigger
+          AND t.tgfoid = 'sql_saga.generated_always_as_row_start_end()'::regprocedure
+          AND NOT EXISTS (SELECT FROM pg_catalog.pg_trigger AS _t WHERE (_t.tgrelid, _t.tgname) = (ste.table_name, ste.generated_always_trigger))
+    LOOP
+        EXECUTE sql;
+    END LOOP;
+
+    FOR sql IN
+        SELECT pg_catalog.format('UPDATE sql_saga.system_time_era SET write_history_trigger = %L WHERE table_name = %L::regclass',
+            t.tgname, ste.table_name)
+        FROM sql_saga.system_time_era AS ste
+        JOIN pg_catalog.pg_trigger AS t ON t.tgrelid = ste.table_name
+        WHERE t.tgname <> ste.write_history_trigger
+          AND t.tgfoid = 'sql_saga.write_history()'::regprocedure
+          AND NOT EXISTS (SELECT FROM pg_catalog.pg_trigger AS _t WHERE (_t.tgrelid, _t.tgname) = (ste.table_name, ste.write_history_trigger))
+    LOOP
+        EXECUTE sql;
+    END LOOP;
+
+    FOR sql IN
+        SELECT pg_catalog.format('UPDATE sql_saga.system_time_era SET truncate_trigger = %L WHERE table_name = %L::regclass',
+            t.tgname, ste.table_name)
+        FROM sql_saga.system_time_era AS ste
+        JOIN pg_catalog.pg_trigger AS t ON t.tgrelid = ste.table_name
+        WHERE t.tgname <> ste.truncate_trigger
+          AND t.tgfoid = 'sql_saga.truncate_era()'::regprocedure
+          AND NOT EXISTS (SELECT FROM pg_catalog.pg_trigger AS _t WHERE (_t.tgrelid, _t.tgname) = (ste.table_name, ste.truncate_trigger))
+    LOOP
+        EXECUTE sql;
+    END LOOP;
 
     /*
      * We can't reliably find out what a column was renamed to, so just error
      * out in this case.
      */
---    FOR r IN
---        SELECT stp.table_name, u.column_name
---        FROM sql_saga.system_time_periods AS stp
---        CROSS JOIN LATERAL unnest(stp.excluded_column_names) AS u (column_name)
---        WHERE NOT EXISTS (
---            SELECT FROM pg_catalog.pg_attribute AS a
---            WHERE (a.attrelid, a.attname) = (stp.table_name, u.column_name))
---    LOOP
---        RAISE EXCEPTION 'cannot drop or rename column "%" on table "%" because it is excluded from era',
---            r.column_name, r.table_name;
---    END LOOP;
+    FOR r IN
+        SELECT ste.table_name, u.column_name
+        FROM sql_saga.system_time_era AS ste
+        CROSS JOIN LATERAL unnest(ste.excluded_column_names) AS u (column_name)
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_attribute AS a
+            WHERE (a.attrelid, a.attname) = (ste.table_name, u.column_name))
+    LOOP
+        RAISE EXCEPTION 'cannot drop or rename column "%" on table "%" because it is excluded from SYSTEM VERSIONING',
+            r.column_name, r.table_name;
+    END LOOP;
 
     ---
     --- api_view
@@ -3000,7 +4278,7 @@ BEGIN
         JOIN sql_saga.era AS p ON (p.table_name, p.era_name) = (uk.table_name, uk.era_name)
         CROSS JOIN LATERAL unnest(uk.column_names) WITH ORDINALITY AS u (column_name, ordinality)
         JOIN pg_catalog.pg_constraint AS c ON c.conrelid = uk.table_name
-        WHERE NOT EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c WHERE (_c.conrelid, _c.conname) = (uk.table_name, uk.exclude_constraint))
+        WHERE uk.exclude_constraint IS NOT NULL AND NOT EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c WHERE (_c.conrelid, _c.conname) = (uk.table_name, uk.exclude_constraint))
         GROUP BY uk.key_name, c.oid, c.conname, p.range_type, p.start_column_name, p.end_column_name
         HAVING format('EXCLUDE USING gist (%s, %I(%I, %I, ''[)''::text) WITH &&) DEFERRABLE',
                       string_agg(quote_ident(u.column_name) || ' WITH =', ', ' ORDER BY u.ordinality),
@@ -3012,6 +4290,18 @@ BEGIN
         EXECUTE sql;
     END LOOP;
 
+    /* The trigger checking across partitions can't be told apart from other triggers either */
+    FOR r IN
+        SELECT uk.key_name, uk.table_name, uk.overlap_trigger
+        FROM sql_saga.unique_keys AS uk
+        WHERE uk.overlap_trigger IS NOT NULL AND NOT EXISTS (
+            SELECT FROM pg_catalog.pg_trigger AS t
+            WHERE (t.tgrelid, t.tgname) = (uk.table_name, uk.overlap_trigger))
+    LOOP
+        RAISE EXCEPTION 'cannot drop or rename trigger "%" on table "%" because it is used in era unique key "%"',
+            r.overlap_trigger, r.table_name, r.key_name;
+    END LOOP;
+
     ---
     --- foreign_keys
     ---
@@ -3084,6 +4374,11 @@ DECLARE
     r record;
     save_search_path text;
 BEGIN
+    /* Leave the DDL on objects that are not ours alone */
+    IF NOT sql_saga._ddl_commands_touch_saga() THEN
+        RETURN;
+    END IF;
+
     /* Make sure that all of our tables are still persistent */
     FOR r IN
         SELECT p.table_name
@@ -3098,46 +4393,52 @@ BEGIN
     /* And the history tables, too */
     FOR r IN
         SELECT sv.table_name
-        FROM sql_saga.era AS sv
-        JOIN pg_catalog.pg_class AS c ON c.oid = sv.audit_table_name
+        FROM sql_saga.system_versioning AS sv
+        JOIN pg_catalog.pg_class AS c ON c.oid = sv.history_table_name
         WHERE c.relpersistence <> 'p'
     LOOP
-        RAISE EXCEPTION 'history table "%" must remain persistent because it has an era',
+        RAISE EXCEPTION 'history table "%" must remain persistent because it has SYSTEM VERSIONING',
             r.table_name;
     END LOOP;
 
+    /* New partitions need the EXCLUDE constraints of the unique keys */
+    PERFORM sql_saga._add_partition_exclude_constraints(uk.key_name)
+    FROM sql_saga.unique_keys AS uk
+    WHERE uk.overlap_trigger IS NOT NULL
+      AND uk.enforcement = 'GIST';
+
     /* Check that our system versioning functions are still here */
-    --    save_search_path := pg_catalog.current_setting('search_path');
-    --    PERFORM pg_catalog.set_config('search_path', 'pg_catalog, pg_temp', true);
-    --    FOR r IN
-    --        SELECT *
-    --        FROM sql_saga.era AS sv
-    --        CROSS JOIN LATERAL UNNEST(ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]) AS u (fn)
-    --        WHERE NOT EXISTS (
-    --            SELECT FROM pg_catalog.pg_proc AS p
-    --            WHERE p.oid::regprocedure::text = u.fn
-    --        )
-    --    LOOP
-    --        RAISE EXCEPTION 'cannot drop or rename function "%" because it is used in SYSTEM VERSIONING for table "%"',
-    --            r.fn, r.table_name;
-    --    END LOOP;
-    --    PERFORM pg_catalog.set_config('search_path', save_search_path, true);
+    save_search_path := pg_catalog.current_setting('search_path');
+    PERFORM pg_catalog.set_config('search_path', 'pg_catalog, pg_temp', true);
+    FOR r IN
+        SELECT *
+        FROM sql_saga.system_versioning AS sv
+        CROSS JOIN LATERAL UNNEST(ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]) AS u (fn)
+        WHERE NOT EXISTS (
+            SELECT FROM pg_catalog.pg_proc AS p
+            WHERE p.oid::regprocedure::text = u.fn
+        )
+    LOOP
+        RAISE EXCEPTION 'cannot drop or rename function "%" because it is used in SYSTEM VERSIONING for table "%"',
+            r.fn, r.table_name;
+    END LOOP;
+    PERFORM pg_catalog.set_config('search_path', save_search_path, true);
 
     /* Fix up history and for-portion objects ownership */
     FOR cmd IN
-        --        SELECT format('ALTER %s %s OWNER TO %I',
-        --            CASE ht.relkind
-        --                WHEN 'p' THEN 'TABLE'
-        --                WHEN 'r' THEN 'TABLE'
-        --                WHEN 'v' THEN 'VIEW'
-        --            END,
-        --            ht.oid::regclass, t.relowner::regrole)
-        --        FROM sql_saga.system_versioning AS sv
-        --        JOIN pg_class AS t ON t.oid = sv.table_name
-        --        JOIN pg_class AS ht ON ht.oid IN (sv.audit_table_name, sv.view_name)
-        --        WHERE t.relowner <> ht.relowner
-        --
-        --        UNION ALL
+        SELECT format('ALTER %s %s OWNER TO %I',
+            CASE ht.relkind
+                WHEN 'p' THEN 'TABLE'
+                WHEN 'r' THEN 'TABLE'
+                WHEN 'v' THEN 'VIEW'
+            END,
+            ht.oid::regclass, t.relowner::regrole)
+        FROM sql_saga.system_versioning AS sv
+        JOIN pg_class AS t ON t.oid = sv.table_name
+        JOIN pg_class AS ht ON ht.oid IN (sv.history_table_name, sv.view_name)
+        WHERE t.relowner <> ht.relowner
+
+        UNION ALL
 
         SELECT format('ALTER VIEW %s OWNER TO %I', fpt.oid::regclass, t.relowner::regrole)
         FROM sql_saga.api_view AS fpv
@@ -3145,13 +4446,13 @@ BEGIN
         JOIN pg_class AS fpt ON fpt.oid = fpv.view_name
         WHERE t.relowner <> fpt.relowner
 
-        --        UNION ALL
-        --
-        --        SELECT format('ALTER FUNCTION %s OWNER TO %I', p.oid::regprocedure, t.relowner::regrole)
-        --        FROM sql_saga.system_versioning AS sv
-        --        JOIN pg_class AS t ON t.oid = sv.table_name
-        --        JOIN pg_proc AS p ON p.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
-        --        WHERE t.relowner <> p.proowner
+        UNION ALL
+
+        SELECT format('ALTER FUNCTION %s OWNER TO %I', p.oid::regprocedure, t.relowner::regrole)
+        FROM sql_saga.system_versioning AS sv
+        JOIN pg_class AS t ON t.oid = sv.table_name
+        JOIN pg_proc AS p ON p.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
+        WHERE t.relowner <> p.proowner
     LOOP
         EXECUTE cmd;
     END LOOP;
@@ -3172,19 +4473,19 @@ BEGIN
                          AND _acl.privilege_type = 'SELECT'
                    ) AS on_base_table
             FROM (
---                SELECT sv.table_name,
---                       c.oid::regclass::text AS object_name,
---                       c.relkind AS object_type,
---                       acl.privilege_type,
---                       acl.privilege_type AS base_privilege_type,
---                       acl.grantee,
---                       'h' AS history_or_portion
---                FROM sql_saga.system_versioning AS sv
---                JOIN pg_class AS c ON c.oid IN (sv.audit_table_name, sv.view_name)
---                CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
---
---                UNION ALL
---
+                SELECT sv.table_name,
+                       c.oid::regclass::text AS object_name,
+                       c.relkind AS object_type,
+                       acl.privilege_type,
+                       acl.privilege_type AS base_privilege_type,
+                       acl.grantee,
+                       'h' AS history_or_portion
+                FROM sql_saga.system_versioning AS sv
+                JOIN pg_class AS c ON c.oid IN (sv.history_table_name, sv.view_name)
+                CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
+
+                UNION ALL
+
                 SELECT fpv.table_name,
                        c.oid::regclass::text AS object_name,
                        c.relkind AS object_type,
@@ -3196,18 +4497,18 @@ BEGIN
                 JOIN pg_class AS c ON c.oid = fpv.view_name
                 CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
 
---                UNION ALL
---
---                SELECT sv.table_name,
---                       p.oid::regprocedure::text,
---                       'f',
---                       acl.privilege_type,
---                       'SELECT',
---                       acl.grantee,
---                       'h'
---                FROM sql_saga.system_versioning AS sv
---                JOIN pg_proc AS p ON p.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
---                CROSS JOIN LATERAL aclexplode(COALESCE(p.proacl, acldefault('f', p.proowner))) AS acl
+                UNION ALL
+
+                SELECT sv.table_name,
+                       p.oid::regprocedure::text,
+                       'f',
+                       acl.privilege_type,
+                       'SELECT',
+                       acl.grantee,
+                       'h'
+                FROM sql_saga.system_versioning AS sv
+                JOIN pg_proc AS p ON p.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
+                CROSS JOIN LATERAL aclexplode(COALESCE(p.proacl, acldefault('f', p.proowner))) AS acl
             ) AS objects
             ORDER BY object_name, object_type, privilege_type
         LOOP
@@ -3233,19 +4534,19 @@ BEGIN
                           string_agg(DISTINCT object_name, ', '),
                           string_agg(DISTINCT COALESCE(a.rolname, 'public'), ', '))
             FROM (
---                SELECT 'TABLE' AS object_type,
---                       hc.oid::regclass::text AS object_name,
---                       'SELECT' AS privilege_type,
---                       acl.grantee
---                FROM sql_saga.system_versioning AS sv
---                JOIN pg_class AS c ON c.oid = sv.table_name
---                CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
---                JOIN pg_class AS hc ON hc.oid IN (sv.audit_table_name, sv.view_name)
---                WHERE acl.privilege_type = 'SELECT'
---                  AND NOT has_table_privilege(acl.grantee, hc.oid, 'SELECT')
---
---                UNION ALL
---
+                SELECT 'TABLE' AS object_type,
+                       hc.oid::regclass::text AS object_name,
+                       'SELECT' AS privilege_type,
+                       acl.grantee
+                FROM sql_saga.system_versioning AS sv
+                JOIN pg_class AS c ON c.oid = sv.table_name
+                CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
+                JOIN pg_class AS hc ON hc.oid IN (sv.history_table_name, sv.view_name)
+                WHERE acl.privilege_type = 'SELECT'
+                  AND NOT has_table_privilege(acl.grantee, hc.oid, 'SELECT')
+
+                UNION ALL
+
                 SELECT 'TABLE' AS object_type,
                        fpc.oid::regclass::text AS object_name,
                        acl.privilege_type AS privilege_type,
@@ -3256,18 +4557,18 @@ BEGIN
                 JOIN pg_class AS fpc ON fpc.oid = fpv.view_name
                 WHERE NOT has_table_privilege(acl.grantee, fpc.oid, acl.privilege_type)
 
---                UNION ALL
---
---                SELECT 'FUNCTION',
---                       hp.oid::regprocedure::text,
---                       'EXECUTE',
---                       acl.grantee
---                FROM sql_saga.system_versioning AS sv
---                JOIN pg_class AS c ON c.oid = sv.table_name
---                CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
---                JOIN pg_proc AS hp ON hp.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
---                WHERE acl.privilege_type = 'SELECT'
---                  AND NOT has_function_privilege(acl.grantee, hp.oid, 'EXECUTE')
+                UNION ALL
+
+                SELECT 'FUNCTION',
+                       hp.oid::regprocedure::text,
+                       'EXECUTE',
+                       acl.grantee
+                FROM sql_saga.system_versioning AS sv
+                JOIN pg_class AS c ON c.oid = sv.table_name
+                CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
+                JOIN pg_proc AS hp ON hp.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
+                WHERE acl.privilege_type = 'SELECT'
+                  AND NOT has_function_privilege(acl.grantee, hp.oid, 'EXECUTE')
             ) AS objects
             LEFT JOIN pg_authid AS a ON a.oid = objects.grantee
             GROUP BY object_type
@@ -3282,22 +4583,22 @@ BEGIN
         WHERE ev_ddl.command_tag = 'REVOKE')
     THEN
         FOR r IN
---            SELECT sv.table_name,
---                   hc.oid::regclass::text AS object_name,
---                   acl.privilege_type,
---                   acl.privilege_type AS base_privilege_type
---            FROM sql_saga.system_versioning AS sv
---            JOIN pg_class AS c ON c.oid = sv.table_name
---            CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
---            JOIN pg_class AS hc ON hc.oid IN (sv.audit_table_name, sv.view_name)
---            WHERE acl.privilege_type = 'SELECT'
---              AND NOT EXISTS (
---                SELECT
---                FROM aclexplode(COALESCE(hc.relacl, acldefault('r', hc.relowner))) AS _acl
---                WHERE _acl.privilege_type = 'SELECT'
---                  AND _acl.grantee = acl.grantee)
---
---            UNION ALL
+            SELECT sv.table_name,
+                   hc.oid::regclass::text AS object_name,
+                   acl.privilege_type,
+                   acl.privilege_type AS base_privilege_type
+            FROM sql_saga.system_versioning AS sv
+            JOIN pg_class AS c ON c.oid = sv.table_name
+            CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
+            JOIN pg_class AS hc ON hc.oid IN (sv.history_table_name, sv.view_name)
+            WHERE acl.privilege_type = 'SELECT'
+              AND NOT EXISTS (
+                SELECT
+                FROM aclexplode(COALESCE(hc.relacl, acldefault('r', hc.relowner))) AS _acl
+                WHERE _acl.privilege_type = 'SELECT'
+                  AND _acl.grantee = acl.grantee)
+
+            UNION ALL
 
             SELECT fpv.table_name,
                    hc.oid::regclass::text AS object_name,
@@ -3313,23 +4614,23 @@ BEGIN
                 WHERE _acl.privilege_type = acl.privilege_type
                   AND _acl.grantee = acl.grantee)
 
---            UNION ALL
---
---            SELECT sv.table_name,
---                   hp.oid::regprocedure::text,
---                   'EXECUTE',
---                   'SELECT'
---            FROM sql_saga.system_versioning AS sv
---            JOIN pg_class AS c ON c.oid = sv.table_name
---            CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
---            JOIN pg_proc AS hp ON hp.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
---            WHERE acl.privilege_type = 'SELECT'
---              AND NOT EXISTS (
---                SELECT
---                FROM aclexplode(COALESCE(hp.proacl, acldefault('f', hp.proowner))) AS _acl
---                WHERE _acl.privilege_type = 'EXECUTE'
---                  AND _acl.grantee = acl.grantee)
---
+            UNION ALL
+
+            SELECT sv.table_name,
+                   hp.oid::regprocedure::text,
+                   'EXECUTE',
+                   'SELECT'
+            FROM sql_saga.system_versioning AS sv
+            JOIN pg_class AS c ON c.oid = sv.table_name
+            CROSS JOIN LATERAL aclexplode(COALESCE(c.relacl, acldefault('r', c.relowner))) AS acl
+            JOIN pg_proc AS hp ON hp.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
+            WHERE acl.privilege_type = 'SELECT'
+              AND NOT EXISTS (
+                SELECT
+                FROM aclexplode(COALESCE(hp.proacl, acldefault('f', hp.proowner))) AS _acl
+                WHERE _acl.privilege_type = 'EXECUTE'
+                  AND _acl.grantee = acl.grantee)
+
             ORDER BY table_name, object_name
         LOOP
             RAISE EXCEPTION 'cannot revoke % directly from "%", revoke % from "%" instead',
@@ -3344,17 +4645,17 @@ BEGIN
                           string_agg(DISTINCT object_name, ', '),
                           string_agg(DISTINCT COALESCE(a.rolname, 'public'), ', '))
             FROM (
---                SELECT 'TABLE' AS object_type,
---                       hc.oid::regclass::text AS object_name,
---                       'SELECT' AS privilege_type,
---                       hacl.grantee
---                FROM sql_saga.system_versioning AS sv
---                JOIN pg_class AS hc ON hc.oid IN (sv.audit_table_name, sv.view_name)
---                CROSS JOIN LATERAL aclexplode(COALESCE(hc.relacl, acldefault('r', hc.relowner))) AS hacl
---                WHERE hacl.privilege_type = 'SELECT'
---                  AND NOT has_table_privilege(hacl.grantee, sv.table_name, 'SELECT')
---
---                UNION ALL
+                SELECT 'TABLE' AS object_type,
+                       hc.oid::regclass::text AS object_name,
+                       'SELECT' AS privilege_type,
+                       hacl.grantee
+                FROM sql_saga.system_versioning AS sv
+                JOIN pg_class AS hc ON hc.oid IN (sv.history_table_name, sv.view_name)
+                CROSS JOIN LATERAL aclexplode(COALESCE(hc.relacl, acldefault('r', hc.relowner))) AS hacl
+                WHERE hacl.privilege_type = 'SELECT'
+                  AND NOT has_table_privilege(hacl.grantee, sv.table_name, 'SELECT')
+
+                UNION ALL
 
                 SELECT 'TABLE' AS object_type,
                        hc.oid::regclass::text AS object_name,
@@ -3365,17 +4666,17 @@ BEGIN
                 CROSS JOIN LATERAL aclexplode(COALESCE(hc.relacl, acldefault('r', hc.relowner))) AS hacl
                 WHERE NOT has_table_privilege(hacl.grantee, fpv.table_name, hacl.privilege_type)
 
---                UNION ALL
---
---                SELECT 'FUNCTION' AS object_type,
---                       hp.oid::regprocedure::text AS object_name,
---                       'EXECUTE' AS privilege_type,
---                       hacl.grantee
---                FROM sql_saga.system_versioning AS sv
---                JOIN pg_proc AS hp ON hp.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
---                CROSS JOIN LATERAL aclexplode(COALESCE(hp.proacl, acldefault('f', hp.proowner))) AS hacl
---                WHERE hacl.privilege_type = 'EXECUTE'
---                  AND NOT has_table_privilege(hacl.grantee, sv.table_name, 'SELECT')
+                UNION ALL
+
+                SELECT 'FUNCTION' AS object_type,
+                       hp.oid::regprocedure::text AS object_name,
+                       'EXECUTE' AS privilege_type,
+                       hacl.grantee
+                FROM sql_saga.system_versioning AS sv
+                JOIN pg_proc AS hp ON hp.oid = ANY (ARRAY[sv.func_as_of, sv.func_between, sv.func_between_symmetric, sv.func_from_to]::regprocedure[])
+                CROSS JOIN LATERAL aclexplode(COALESCE(hp.proacl, acldefault('f', hp.proowner))) AS hacl
+                WHERE hacl.privilege_type = 'EXECUTE'
+                  AND NOT has_table_privilege(hacl.grantee, sv.table_name, 'SELECT')
             ) AS objects
             LEFT JOIN pg_authid AS a ON a.oid = objects.grantee
             GROUP BY object_type
@@ -3462,6 +4763,36 @@ $function$
     SELECT sv1 = ev2;
 $function$;
 
+/*
+ * On a table with a GiST index on the range of an era, as made by
+ * add_unique_key, the planner support function turns the predicates on the
+ * columns of the era into range operators that can use that index.  Other
+ * calls are inlined as before.  Support functions are new in PostgreSQL 12.
+ */
+DO
+$block$
+BEGIN
+    IF current_setting('server_version_num')::integer >= 120000 THEN
+        EXECUTE $sql$
+            CREATE FUNCTION sql_saga._predicate_support(internal)
+             RETURNS internal
+             LANGUAGE c
+             IMMUTABLE STRICT
+            AS 'sql_saga', 'predicate_support'
+        $sql$;
+
+        EXECUTE 'ALTER FUNCTION sql_saga.contains(anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+        EXECUTE 'ALTER FUNCTION sql_saga.contains(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+        EXECUTE 'ALTER FUNCTION sql_saga.equals(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+        EXECUTE 'ALTER FUNCTION sql_saga.overlaps(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+        EXECUTE 'ALTER FUNCTION sql_saga.precedes(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+        EXECUTE 'ALTER FUNCTION sql_saga.succeeds(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+        EXECUTE 'ALTER FUNCTION sql_saga.immediately_precedes(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+        EXECUTE 'ALTER FUNCTION sql_saga.immediately_succeeds(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support';
+    END IF;
+END;
+$block$;
+
 
 -- TODO: Use a more "private" prefix for all our helper functions:
 
@@ -10,6 +10,12 @@
 #include <catalog/dependency.h>
 #include <catalog/objectaccess.h>
 #include <catalog/pg_class.h>
+#include <utils/guc.h>
+
+#include "foreign_keys.h"
+#include "metadata.h"
+#include "periods.h"
+#include "stats.h"
 
 /*
 #include <pg_config.h>
@@ -34,6 +40,16 @@ void _PG_init(void);
 void _PG_fini(void);
 
 void _PG_init(void) {
+  metadata_init();
+  periods_init();
+  foreign_keys_init();
+  stats_init();
+
+#if PG_VERSION_NUM >= 150000
+  MarkGUCPrefixReserved("sql_saga");
+#else
+  EmitWarningsOnPlaceholders("sql_saga");
+#endif
 }
 
 void _PG_fini(void) {
@@ -0,0 +1,530 @@
+/**
+ * stats.c -
+ * Cumulative statistics about the checks of the temporal foreign and unique
+ * keys, per constraint, like pg_stat_user_functions does for functions.
+ *
+ * The counters live in a hash table in shared memory, keyed by database and
+ * constraint name, when sql_saga is in shared_preload_libraries.  Otherwise
+ * there is no shared memory to reserve, and each backend only sees the
+ * counters of its own checks.
+ *
+ * Each entry has a spinlock of its own, so that recording a check only holds
+ * the lock of that constraint for a few additions, along with the LWLock of
+ * the table in shared mode.  The entries are remembered in a local hash table
+ * once found.  Resetting the statistics evicts the entries under the LWLock
+ * in exclusive mode and bumps the generation of the table, which tells the
+ * backends to look their entries up again.  When the table is full, the
+ * checks of the constraints that did not get an entry are not recorded, but
+ * counted, and a WARNING says so.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include <limits.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/tuplestore.h"
+
+#include "stats.h"
+
+PGDLLEXPORT Datum stat_constraints(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum stat_constraints_reset(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum stat_constraints_untracked(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(stat_constraints);
+PG_FUNCTION_INFO_V1(stat_constraints_reset);
+PG_FUNCTION_INFO_V1(stat_constraints_untracked);
+
+#define STAT_CONSTRAINTS_COLS	8
+
+typedef struct SagaStatKey
+{
+	Oid			dbid;
+	NameData	key_name;
+} SagaStatKey;
+
+typedef struct SagaStatCounters
+{
+	int64		calls;
+	int64		rows_checked;
+	double		total_time;		/* in milliseconds */
+	double		max_time;		/* in milliseconds */
+	int64		deferred_checks;
+	int64		immediate_checks;
+	int64		violations;
+} SagaStatCounters;
+
+typedef struct SagaStatEntry
+{
+	SagaStatKey	key;			/* the hash key; must be first */
+	slock_t		mutex;			/* protects the counters only */
+	SagaStatCounters counters;
+} SagaStatEntry;
+
+typedef struct SagaStatSharedState
+{
+	LWLock	   *lock;			/* protects the hash table and generation */
+	uint64		generation;		/* bumped whenever entries are evicted */
+	slock_t		mutex;			/* protects untracked */
+	int64		untracked;		/* checks not recorded for want of an entry */
+} SagaStatSharedState;
+
+/*
+ * What a backend knows about a constraint.  Without shared memory the
+ * counters are kept here instead.
+ */
+typedef struct SagaStatLocalEntry
+{
+	SagaStatKey	key;			/* the hash key; must be first */
+	SagaStatEntry *shared;		/* NULL if the shared table was full */
+	uint64		generation;		/* of the table when shared was looked up */
+	SagaStatCounters counters;
+} SagaStatLocalEntry;
+
+static bool track_constraints = true;
+static int	stat_max_constraints = 1000;
+
+static SagaStatSharedState *SagaStats = NULL;
+static HTAB *SagaStatsHash = NULL;
+static HTAB *LocalStatsHash = NULL;
+
+#if (PG_VERSION_NUM >= 150000)
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size
+StatsShmemSize(void)
+{
+	return add_size(MAXALIGN(sizeof(SagaStatSharedState)),
+					hash_estimate_size(stat_max_constraints, sizeof(SagaStatEntry)));
+}
+
+static void
+stats_shmem_request(void)
+{
+#if (PG_VERSION_NUM >= 150000)
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(StatsShmemSize());
+	RequestNamedLWLockTranche("sql_saga", 1);
+}
+
+static void
+stats_shmem_startup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	SagaStats = NULL;
+	SagaStatsHash = NULL;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SagaStats = ShmemInitStruct("sql_saga constraint statistics",
+								sizeof(SagaStatSharedState), &found);
+	if (!found)
+	{
+		SagaStats->lock = &(GetNamedLWLockTranche("sql_saga"))->lock;
+		SagaStats->generation = 1;
+		SpinLockInit(&SagaStats->mutex);
+		SagaStats->untracked = 0;
+	}
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(SagaStatKey);
+	info.entrysize = sizeof(SagaStatEntry);
+	SagaStatsHash = ShmemInitHash("sql_saga constraint statistics hash",
+								  stat_max_constraints, stat_max_constraints,
+								  &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Find or create the shared entry of a constraint, and return it with the
+ * LWLock of the table held, so that it cannot be evicted while the check is
+ * recorded.  The entry remembered by the backend is used as long as the
+ * generation of the table has not changed.  Returns NULL if the table is
+ * full, which is also remembered until entries are evicted, since only that
+ * makes room.
+ */
+static SagaStatEntry *
+LockSharedStatEntry(SagaStatLocalEntry *local)
+{
+	SagaStatEntry *entry;
+	bool		found;
+
+	LWLockAcquire(SagaStats->lock, LW_SHARED);
+
+	if (local->generation == SagaStats->generation)
+		return local->shared;
+
+	/* Most of the time the entry is there already */
+	entry = (SagaStatEntry *) hash_search(SagaStatsHash, &local->key, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		LWLockRelease(SagaStats->lock);
+		LWLockAcquire(SagaStats->lock, LW_EXCLUSIVE);
+
+		entry = (SagaStatEntry *) hash_search(SagaStatsHash, &local->key,
+											  HASH_ENTER_NULL, &found);
+		if (entry != NULL && !found)
+		{
+			SpinLockInit(&entry->mutex);
+			MemSet(&entry->counters, 0, sizeof(entry->counters));
+		}
+	}
+
+	local->shared = entry;
+	local->generation = SagaStats->generation;
+
+	return entry;
+}
+
+static SagaStatLocalEntry *
+GetStatEntry(const char *key_name)
+{
+	SagaStatLocalEntry *local;
+	SagaStatKey	key;
+	bool		found;
+
+	if (LocalStatsHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(SagaStatKey);
+		ctl.entrysize = sizeof(SagaStatLocalEntry);
+
+		LocalStatsHash = hash_create("sql_saga local constraint statistics",
+									 64, &ctl, HASH_ELEM | HASH_BLOBS);
+	}
+
+	/* The padding of the name is part of the key */
+	MemSet(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	namestrcpy(&key.key_name, key_name);
+
+	local = (SagaStatLocalEntry *) hash_search(LocalStatsHash, &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		/* The shared entry is looked up on the first check */
+		local->shared = NULL;
+		local->generation = 0;
+		MemSet(&local->counters, 0, sizeof(local->counters));
+	}
+
+	return local;
+}
+
+static inline void
+AccumulateCheck(SagaStatCounters *counters, double time, int64 rows,
+				bool deferred, bool violated)
+{
+	counters->calls++;
+	counters->rows_checked += rows;
+	counters->total_time += time;
+	if (time > counters->max_time)
+		counters->max_time = time;
+	if (deferred)
+		counters->deferred_checks++;
+	else
+		counters->immediate_checks++;
+	if (violated)
+		counters->violations++;
+}
+
+/*
+ * Start timing a check.  The start time stays zero when the checks are not
+ * tracked, which tells StatsCheckEnd() to do nothing.
+ */
+void
+StatsCheckStart(instr_time *start)
+{
+	if (track_constraints)
+		INSTR_TIME_SET_CURRENT(*start);
+	else
+		INSTR_TIME_SET_ZERO(*start);
+}
+
+/*
+ * Record a check of the given constraint, of the given number of rows or
+ * keys.  A violation must be recorded before it is reported, since reporting
+ * it does not return.
+ */
+void
+StatsCheckEnd(const char *key_name, instr_time *start, int64 rows,
+			  bool deferred, bool violated)
+{
+	SagaStatLocalEntry *local;
+	instr_time	duration;
+	double		time;
+
+	if (INSTR_TIME_IS_ZERO(*start))
+		return;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, *start);
+	time = INSTR_TIME_GET_MILLISEC(duration);
+
+	local = GetStatEntry(key_name);
+
+	if (SagaStatsHash != NULL)
+	{
+		uint64		generation = local->generation;
+		SagaStatEntry *entry = LockSharedStatEntry(local);
+
+		if (entry != NULL)
+		{
+			SpinLockAcquire(&entry->mutex);
+			AccumulateCheck(&entry->counters, time, rows, deferred, violated);
+			SpinLockRelease(&entry->mutex);
+		}
+		else
+		{
+			SpinLockAcquire(&SagaStats->mutex);
+			SagaStats->untracked++;
+			SpinLockRelease(&SagaStats->mutex);
+		}
+
+		LWLockRelease(SagaStats->lock);
+
+		/* Say so once per constraint until entries are evicted */
+		if (entry == NULL && local->generation != generation)
+			ereport(WARNING,
+					(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+					 errmsg("checks of constraint \"%s\" are not tracked", key_name),
+					 errdetail("The statistics of %d constraints are kept already.",
+							   stat_max_constraints),
+					 errhint("Reset them with sql_saga.stat_constraints_reset(), or increase sql_saga.stat_max_constraints.")));
+	}
+	else
+		AccumulateCheck(&local->counters, time, rows, deferred, violated);
+}
+
+static void
+PutStatTuple(Tuplestorestate *tupstore, TupleDesc tupdesc, SagaStatKey *key,
+			 SagaStatCounters *counters)
+{
+	Datum		values[STAT_CONSTRAINTS_COLS];
+	bool		nulls[STAT_CONSTRAINTS_COLS];
+
+	MemSet(nulls, 0, sizeof(nulls));
+	values[0] = NameGetDatum(&key->key_name);
+	values[1] = Int64GetDatum(counters->calls);
+	values[2] = Int64GetDatum(counters->rows_checked);
+	values[3] = Float8GetDatum(counters->total_time);
+	values[4] = Float8GetDatum(counters->max_time);
+	values[5] = Int64GetDatum(counters->deferred_checks);
+	values[6] = Int64GetDatum(counters->immediate_checks);
+	values[7] = Int64GetDatum(counters->violations);
+
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
+
+/*
+ * stat_constraints -
+ *
+ * The statistics of the constraints of the current database that have been
+ * checked since they were last reset.
+ */
+Datum
+stat_constraints(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS status;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (SagaStatsHash != NULL)
+	{
+		SagaStatEntry *entry;
+
+		LWLockAcquire(SagaStats->lock, LW_SHARED);
+
+		hash_seq_init(&status, SagaStatsHash);
+		while ((entry = (SagaStatEntry *) hash_seq_search(&status)) != NULL)
+		{
+			SagaStatCounters counters;
+
+			if (entry->key.dbid != MyDatabaseId)
+				continue;
+
+			SpinLockAcquire(&entry->mutex);
+			counters = entry->counters;
+			SpinLockRelease(&entry->mutex);
+
+			PutStatTuple(tupstore, tupdesc, &entry->key, &counters);
+		}
+
+		LWLockRelease(SagaStats->lock);
+	}
+	else if (LocalStatsHash != NULL)
+	{
+		SagaStatLocalEntry *local;
+
+		hash_seq_init(&status, LocalStatsHash);
+		while ((local = (SagaStatLocalEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (local->key.dbid == MyDatabaseId)
+				PutStatTuple(tupstore, tupdesc, &local->key, &local->counters);
+		}
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * stat_constraints_reset -
+ *
+ * Forget the statistics of the given constraint of the current database, or
+ * of all of them if it is NULL.
+ */
+Datum
+stat_constraints_reset(PG_FUNCTION_ARGS)
+{
+	Name		key_name = PG_ARGISNULL(0) ? NULL : PG_GETARG_NAME(0);
+	HASH_SEQ_STATUS status;
+
+	if (SagaStatsHash != NULL)
+	{
+		SagaStatEntry *entry;
+
+		LWLockAcquire(SagaStats->lock, LW_EXCLUSIVE);
+
+		hash_seq_init(&status, SagaStatsHash);
+		while ((entry = (SagaStatEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (entry->key.dbid != MyDatabaseId ||
+				(key_name != NULL &&
+				 strcmp(NameStr(entry->key.key_name), NameStr(*key_name)) != 0))
+				continue;
+
+			hash_search(SagaStatsHash, &entry->key, HASH_REMOVE, NULL);
+		}
+
+		/* The backends may remember the evicted entries */
+		SagaStats->generation++;
+
+		LWLockRelease(SagaStats->lock);
+	}
+	else if (LocalStatsHash != NULL)
+	{
+		SagaStatLocalEntry *local;
+
+		hash_seq_init(&status, LocalStatsHash);
+		while ((local = (SagaStatLocalEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (local->key.dbid != MyDatabaseId ||
+				(key_name != NULL &&
+				 strcmp(NameStr(local->key.key_name), NameStr(*key_name)) != 0))
+				continue;
+
+			hash_search(LocalStatsHash, &local->key, HASH_REMOVE, NULL);
+		}
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * stat_constraints_untracked -
+ *
+ * The number of checks not recorded since the server started because the
+ * shared table had no room for their constraint.
+ */
+Datum
+stat_constraints_untracked(PG_FUNCTION_ARGS)
+{
+	int64		untracked = 0;
+
+	if (SagaStats != NULL)
+	{
+		SpinLockAcquire(&SagaStats->mutex);
+		untracked = SagaStats->untracked;
+		SpinLockRelease(&SagaStats->mutex);
+	}
+
+	PG_RETURN_INT64(untracked);
+}
+
+void
+stats_init(void)
+{
+	DefineCustomBoolVariable("sql_saga.track_constraints",
+							 "Collects statistics about the checks of temporal foreign and unique keys.",
+							 NULL,
+							 &track_constraints,
+							 true,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("sql_saga.stat_max_constraints",
+							"Sets the maximum number of constraints tracked by sql_saga.stat_constraints.",
+							"Only used when sql_saga is in shared_preload_libraries.",
+							&stat_max_constraints,
+							1000,
+							100,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	/* Shared memory can only be reserved when loaded at server start */
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if (PG_VERSION_NUM >= 150000)
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = stats_shmem_request;
+#else
+	stats_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = stats_shmem_startup;
+}
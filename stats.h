@@ -0,0 +1,17 @@
+/**
+ * stats.h -
+ * Cumulative statistics about the checks of the temporal foreign and unique
+ * keys, per constraint.
+ */
+#ifndef SQL_SAGA_STATS_H
+#define SQL_SAGA_STATS_H
+
+#include "portability/instr_time.h"
+
+extern void stats_init(void);
+
+extern void StatsCheckStart(instr_time *start);
+extern void StatsCheckEnd(const char *key_name, instr_time *start, int64 rows,
+						  bool deferred, bool violated);
+
+#endif							/* SQL_SAGA_STATS_H */
@@ -0,0 +1,893 @@
+/**
+ * temporal_join.c -
+ * Set returning functions that merge the timelines of tables with eras,
+ * reading each table once in (key, start) order.
+ *
+ * temporal_join() joins two tables on a key and returns the slices of time in
+ * which a row of each side is valid together.  Joining on the key and && of
+ * the periods compares every row of a key with every row of that key on the
+ * other side.  Here each key is swept once: a row arriving at its start is
+ * paired with the rows of the other side that are still valid then, and rows
+ * are forgotten as soon as they end, so the work is proportional to the rows
+ * read and the slices returned, and the memory to the rows of a key that are
+ * valid at the same time.
+ *
+ * timeline_segments() merges any number of tables in the same way and cuts
+ * the timeline of each key at every start and end of its rows in any of
+ * them.  The ends of the rows that have started are kept in a heap, so the
+ * change points come out in order without sorting them.
+ *
+ * The tables are read through cursors a batch at a time, and the results are
+ * returned in a tuplestore, which spills to disk beyond work_mem.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "access/tupdesc.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+#include "utils/typcache.h"
+
+#include "metadata.h"
+
+PGDLLEXPORT Datum temporal_join(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum timeline_segments(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(temporal_join);
+PG_FUNCTION_INFO_V1(timeline_segments);
+
+#define TIMELINE_FETCH_SIZE 1000
+
+/* The two sides of temporal_join, in the order of the arguments */
+#define JOIN_LEFT	0
+#define JOIN_RIGHT	1
+
+/*
+ * A table being read in (key, start) order.  Its query returns the key
+ * columns, the start and end of the era and, if asked for, the whole row.
+ */
+typedef struct TimelineInput
+{
+	Portal		portal;
+	SPITupleTable *tuptable;
+	uint64		ntuples;
+	uint64		next;
+	bool		done;
+} TimelineInput;
+
+/*
+ * How the keys and eras of the tables compare, which is the same for all of
+ * them, and the key being merged.
+ */
+typedef struct TimelineKeys
+{
+	int			nkeys;
+	Oid			key_types[INDEX_MAX_KEYS];
+	FmgrInfo	key_cmp[INDEX_MAX_KEYS];
+	Oid			key_collations[INDEX_MAX_KEYS];
+	int16		key_typlen[INDEX_MAX_KEYS];
+	bool		key_typbyval[INDEX_MAX_KEYS];
+	Oid			bounds_type;
+	FmgrInfo	bounds_cmp;
+	Oid			bounds_collation;
+	int16		bounds_typlen;
+	bool		bounds_typbyval;
+
+	/* The key being merged, and what is kept for it, in key_context */
+	MemoryContext key_context;
+	Datum		key[INDEX_MAX_KEYS];
+
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+} TimelineKeys;
+
+/* A row of the key being swept that may still overlap rows to come */
+typedef struct JoinRow
+{
+	Datum		start;
+	Datum		end;
+	Datum		row;
+} JoinRow;
+
+typedef struct JoinRows
+{
+	JoinRow    *rows;
+	int			nrows;
+	int			maxrows;
+} JoinRows;
+
+/* A min-heap of the ends of the rows of the key that have started */
+typedef struct EndHeap
+{
+	Datum	   *ends;
+	int			nends;
+	int			maxends;
+} EndHeap;
+
+/*
+ * Returns the next row of the input without consuming it, or NULL at the
+ * end.  The row stays valid until the input is advanced past its batch.
+ */
+static HeapTuple
+InputPeek(TimelineInput *input)
+{
+	if (input->done)
+		return NULL;
+
+	if (input->next >= input->ntuples)
+	{
+		if (input->tuptable != NULL)
+			SPI_freetuptable(input->tuptable);
+
+		SPI_cursor_fetch(input->portal, true, TIMELINE_FETCH_SIZE);
+		input->tuptable = SPI_tuptable;
+		input->ntuples = SPI_processed;
+		input->next = 0;
+
+		if (input->ntuples == 0)
+		{
+			input->done = true;
+			return NULL;
+		}
+	}
+
+	return input->tuptable->vals[input->next];
+}
+
+static Datum
+InputGetDatum(TimelineInput *input, HeapTuple tuple, int attnum)
+{
+	bool		is_null;
+
+	return SPI_getbinval(tuple, input->tuptable->tupdesc, attnum, &is_null);
+}
+
+static int
+CompareBounds(TimelineKeys *keys, Datum a, Datum b)
+{
+	return DatumGetInt32(FunctionCall2Coll(&keys->bounds_cmp,
+										   keys->bounds_collation,
+										   a, b));
+}
+
+static int
+CompareKeyColumn(TimelineKeys *keys, int i, Datum a, Datum b)
+{
+	return DatumGetInt32(FunctionCall2Coll(&keys->key_cmp[i],
+										   keys->key_collations[i],
+										   a, b));
+}
+
+/* Compare the keys of the next rows of two inputs */
+static int
+CompareInputKeys(TimelineKeys *keys, TimelineInput *a, HeapTuple a_tuple,
+				 TimelineInput *b, HeapTuple b_tuple)
+{
+	int			i;
+
+	for (i = 0; i < keys->nkeys; i++)
+	{
+		int			cmp = CompareKeyColumn(keys, i,
+										   InputGetDatum(a, a_tuple, i + 1),
+										   InputGetDatum(b, b_tuple, i + 1));
+
+		if (cmp != 0)
+			return cmp;
+	}
+
+	return 0;
+}
+
+/* Is the key of this row the one being merged? */
+static bool
+IsMergedKey(TimelineKeys *keys, TimelineInput *input, HeapTuple tuple)
+{
+	int			i;
+
+	for (i = 0; i < keys->nkeys; i++)
+	{
+		if (CompareKeyColumn(keys, i, keys->key[i], InputGetDatum(input, tuple, i + 1)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/* Start merging the key of this row, forgetting everything about the last */
+static void
+StartKey(TimelineKeys *keys, TimelineInput *input, HeapTuple tuple)
+{
+	MemoryContext oldcontext;
+	int			i;
+
+	MemoryContextReset(keys->key_context);
+
+	oldcontext = MemoryContextSwitchTo(keys->key_context);
+	for (i = 0; i < keys->nkeys; i++)
+		keys->key[i] = datumCopy(InputGetDatum(input, tuple, i + 1),
+								 keys->key_typbyval[i], keys->key_typlen[i]);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+static void
+FreeBound(TimelineKeys *keys, Datum bound)
+{
+	if (!keys->bounds_typbyval)
+		pfree(DatumGetPointer(bound));
+}
+
+/*
+ * Find the eras and key columns of the tables, and check that they all
+ * compare the same way.
+ */
+static void
+SetupKeys(TimelineKeys *keys, int ntables, Oid *relids, char ***column_names,
+		  int nkeys, char **era_names)
+{
+	SagaEra    *eras = (SagaEra *) palloc(ntables * sizeof(SagaEra));
+	int			t;
+	int			i;
+
+	/* Copy the eras, the next lookup may reload the cache */
+	for (t = 0; t < ntables; t++)
+		memcpy(&eras[t], GetSagaEra(relids[t], era_names[t], false), sizeof(SagaEra));
+
+	for (t = 1; t < ntables; t++)
+	{
+		if (eras[t].bounds_type != eras[0].bounds_type ||
+			eras[t].bounds_collation != eras[0].bounds_collation)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("era \"%s\" of \"%s\" and era \"%s\" of \"%s\" must have the same type",
+							era_names[0], get_rel_name(relids[0]),
+							era_names[t], get_rel_name(relids[t]))));
+	}
+
+	keys->nkeys = nkeys;
+	for (i = 0; i < nkeys; i++)
+	{
+		Oid			first_collation = InvalidOid;
+		TypeCacheEntry *typentry;
+
+		for (t = 0; t < ntables; t++)
+		{
+			AttrNumber	attnum = get_attnum(relids[t], column_names[t][i]);
+			Oid			type;
+			int32		typmod;
+			Oid			collation;
+
+			if (attnum == InvalidAttrNumber)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNDEFINED_COLUMN),
+						 errmsg("column \"%s\" of relation \"%s\" does not exist",
+								column_names[t][i], get_rel_name(relids[t]))));
+
+			get_atttypetypmodcoll(relids[t], attnum, &type, &typmod, &collation);
+
+			if (t == 0)
+			{
+				keys->key_types[i] = type;
+				first_collation = collation;
+			}
+			else if (type != keys->key_types[i] || collation != first_collation)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATATYPE_MISMATCH),
+						 errmsg("column \"%s\" of \"%s\" and column \"%s\" of \"%s\" must have the same type",
+								column_names[0][i], get_rel_name(relids[0]),
+								column_names[t][i], get_rel_name(relids[t]))));
+		}
+
+		typentry = lookup_type_cache(keys->key_types[i], TYPECACHE_CMP_PROC_FINFO);
+		if (!OidIsValid(typentry->cmp_proc))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify a comparison function for type %s",
+							format_type_be(keys->key_types[i]))));
+
+		fmgr_info_copy(&keys->key_cmp[i], &typentry->cmp_proc_finfo, CurrentMemoryContext);
+		keys->key_collations[i] = first_collation;
+		get_typlenbyval(keys->key_types[i], &keys->key_typlen[i], &keys->key_typbyval[i]);
+	}
+
+	keys->bounds_type = eras[0].bounds_type;
+	fmgr_info_copy(&keys->bounds_cmp, &eras[0].bounds_cmp, CurrentMemoryContext);
+	keys->bounds_collation = eras[0].bounds_collation;
+	keys->bounds_typlen = eras[0].bounds_typlen;
+	keys->bounds_typbyval = eras[0].bounds_typbyval;
+}
+
+/*
+ * Check the call of a set returning function and set it up to return the
+ * tuplestore.
+ */
+static void
+CheckMaterializeMode(ReturnSetInfo *rsinfo)
+{
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+}
+
+static void
+StartResult(TimelineKeys *keys, ReturnSetInfo *rsinfo, TupleDesc tupdesc)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	keys->tupdesc = CreateTupleDescCopy(tupdesc);
+	keys->tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+										   false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = keys->tupstore;
+	rsinfo->setDesc = keys->tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Open a cursor over the rows of the table with a key without nulls, in
+ * (key, start) order.
+ */
+static void
+OpenInput(TimelineInput *input, Oid relid, int nkeys, char **column_names,
+		  const char *era_name, bool with_row)
+{
+	SagaEra    *era = GetSagaEra(relid, era_name, false);
+	StringInfoData buf;
+	SPIPlanPtr	qplan;
+	int			i;
+
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, "SELECT ");
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&buf, "t.%s, ", quote_identifier(column_names[i]));
+	appendStringInfo(&buf, "t.%s, t.%s%s FROM %s AS t WHERE ",
+					 quote_identifier(pstrdup(NameStr(era->start_name))),
+					 quote_identifier(pstrdup(NameStr(era->end_name))),
+					 (with_row ? ", t" : ""),
+					 quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+												get_rel_name(relid)));
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&buf, "%st.%s IS NOT NULL",
+						 (i > 0 ? " AND " : ""), quote_identifier(column_names[i]));
+	appendStringInfoString(&buf, " ORDER BY ");
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&buf, "%d, ", i + 1);
+	appendStringInfo(&buf, "%d", nkeys + 1);
+
+	qplan = SPI_prepare(buf.data, 0, NULL);
+	if (qplan == NULL)
+		elog(ERROR, "SPI_prepare returned %s for %s",
+			 SPI_result_code_string(SPI_result), buf.data);
+
+	memset(input, 0, sizeof(TimelineInput));
+	input->portal = SPI_cursor_open(NULL, qplan, NULL, NULL, true);
+}
+
+/*
+ * Forget the rows that end by the given point in time.  Every row still to
+ * come starts at that point or later, so they cannot overlap any of them.
+ */
+static void
+PruneRows(TimelineKeys *keys, JoinRows *rows, Datum start)
+{
+	int			i;
+	int			n = 0;
+
+	for (i = 0; i < rows->nrows; i++)
+	{
+		JoinRow    *row = &rows->rows[i];
+
+		if (CompareBounds(keys, row->end, start) > 0)
+		{
+			rows->rows[n++] = *row;
+			continue;
+		}
+
+		FreeBound(keys, row->start);
+		FreeBound(keys, row->end);
+		pfree(DatumGetPointer(row->row));
+	}
+
+	rows->nrows = n;
+}
+
+/*
+ * Pair a row of one side with the rows of the other side that are still
+ * valid when it starts, and keep it for the rows that start later.
+ */
+static void
+AddJoinRow(TimelineKeys *keys, JoinRows *active, TimelineInput *input, int side,
+		   HeapTuple tuple)
+{
+	JoinRows   *mine = &active[side];
+	JoinRows   *theirs = &active[1 - side];
+	Datum		start = InputGetDatum(input, tuple, keys->nkeys + 1);
+	Datum		end = InputGetDatum(input, tuple, keys->nkeys + 2);
+	Datum		row = InputGetDatum(input, tuple, keys->nkeys + 3);
+	Datum		values[4];
+	bool		nulls[4] = {false, false, false, false};
+	MemoryContext oldcontext;
+	JoinRow    *kept;
+	int			i;
+
+	PruneRows(keys, mine, start);
+	PruneRows(keys, theirs, start);
+
+	/* What is left started no later than this row and ends after its start */
+	for (i = 0; i < theirs->nrows; i++)
+	{
+		JoinRow    *other = &theirs->rows[i];
+
+		values[0] = start;
+		values[1] = (CompareBounds(keys, end, other->end) < 0) ? end : other->end;
+		values[2 + side] = row;
+		values[3 - side] = other->row;
+
+		tuplestore_putvalues(keys->tupstore, keys->tupdesc, values, nulls);
+	}
+
+	oldcontext = MemoryContextSwitchTo(keys->key_context);
+
+	if (mine->nrows == mine->maxrows)
+	{
+		mine->maxrows = (mine->maxrows == 0) ? 8 : mine->maxrows * 2;
+		if (mine->rows == NULL)
+			mine->rows = (JoinRow *) palloc(mine->maxrows * sizeof(JoinRow));
+		else
+			mine->rows = (JoinRow *) repalloc(mine->rows, mine->maxrows * sizeof(JoinRow));
+	}
+
+	kept = &mine->rows[mine->nrows++];
+	kept->start = datumCopy(start, keys->bounds_typbyval, keys->bounds_typlen);
+	kept->end = datumCopy(end, keys->bounds_typbyval, keys->bounds_typlen);
+	kept->row = datumCopy(row, false, -1);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Sweep the rows of the key of the next row of the left input, which the
+ * right input has rows for as well, in start order.
+ */
+static void
+SweepJoinKey(TimelineKeys *keys, TimelineInput *inputs)
+{
+	JoinRows	active[2];
+
+	StartKey(keys, &inputs[JOIN_LEFT], InputPeek(&inputs[JOIN_LEFT]));
+	memset(active, 0, sizeof(active));
+
+	for (;;)
+	{
+		HeapTuple	tuples[2];
+		int			side;
+
+		for (side = JOIN_LEFT; side <= JOIN_RIGHT; side++)
+		{
+			tuples[side] = InputPeek(&inputs[side]);
+			if (tuples[side] != NULL && !IsMergedKey(keys, &inputs[side], tuples[side]))
+				tuples[side] = NULL;
+		}
+
+		if (tuples[JOIN_LEFT] == NULL && tuples[JOIN_RIGHT] == NULL)
+			break;
+
+		if (tuples[JOIN_LEFT] == NULL)
+			side = JOIN_RIGHT;
+		else if (tuples[JOIN_RIGHT] == NULL)
+			side = JOIN_LEFT;
+		else if (CompareBounds(keys,
+							   InputGetDatum(&inputs[JOIN_LEFT], tuples[JOIN_LEFT], keys->nkeys + 1),
+							   InputGetDatum(&inputs[JOIN_RIGHT], tuples[JOIN_RIGHT], keys->nkeys + 1)) <= 0)
+			side = JOIN_LEFT;
+		else
+			side = JOIN_RIGHT;
+
+		AddJoinRow(keys, active, &inputs[side], side, tuples[side]);
+		inputs[side].next++;
+	}
+}
+
+/*
+ * temporal_join(left_table regclass, left_column_names name[], left_era_name name,
+ *               right_table regclass, right_column_names name[], right_era_name name) -
+ * Returns (start, end, left row, right row) for each pair of rows with the
+ * same key whose periods overlap, with the period they have in common,
+ * ordered by key and start.
+ */
+Datum
+temporal_join(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Oid			relids[2];
+	char	  **column_names[2];
+	int			ncolumns[2];
+	char	   *era_names[2];
+	Oid			row_types[2];
+	TimelineKeys keys;
+	TimelineInput inputs[2];
+	TupleDesc	tupdesc;
+	int			side;
+
+	CheckMaterializeMode(rsinfo);
+
+	for (side = JOIN_LEFT; side <= JOIN_RIGHT; side++)
+	{
+		relids[side] = PG_GETARG_OID(side * 3);
+		ncolumns[side] = GetNameArray(PG_GETARG_DATUM(side * 3 + 1), &column_names[side]);
+		era_names[side] = NameStr(*PG_GETARG_NAME(side * 3 + 2));
+		row_types[side] = get_rel_type_id(relids[side]);
+	}
+
+	if (ncolumns[JOIN_LEFT] != ncolumns[JOIN_RIGHT] ||
+		ncolumns[JOIN_LEFT] < 1 || ncolumns[JOIN_LEFT] > INDEX_MAX_KEYS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("the keys of both tables must have the same number of columns")));
+
+	memset(&keys, 0, sizeof(keys));
+	SetupKeys(&keys, 2, relids, column_names, ncolumns[JOIN_LEFT], era_names);
+
+	/* The column definition list gives the names, but we check the types */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != 4 ||
+		TupleDescAttr(tupdesc, 0)->atttypid != keys.bounds_type ||
+		TupleDescAttr(tupdesc, 1)->atttypid != keys.bounds_type ||
+		TupleDescAttr(tupdesc, 2)->atttypid != row_types[JOIN_LEFT] ||
+		TupleDescAttr(tupdesc, 3)->atttypid != row_types[JOIN_RIGHT])
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("the column definition list of temporal_join must have the types (%s, %s, %s, %s)",
+						format_type_be(keys.bounds_type),
+						format_type_be(keys.bounds_type),
+						format_type_be(row_types[JOIN_LEFT]),
+						format_type_be(row_types[JOIN_RIGHT]))));
+
+	StartResult(&keys, rsinfo, tupdesc);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	keys.key_context = AllocSetContextCreate(CurrentMemoryContext,
+											 "temporal_join key",
+											 ALLOCSET_DEFAULT_SIZES);
+
+	for (side = JOIN_LEFT; side <= JOIN_RIGHT; side++)
+		OpenInput(&inputs[side], relids[side], keys.nkeys, column_names[side],
+				  era_names[side], true);
+
+	/* Skip the keys only one side has, and sweep the others */
+	for (;;)
+	{
+		HeapTuple	left = InputPeek(&inputs[JOIN_LEFT]);
+		HeapTuple	right = InputPeek(&inputs[JOIN_RIGHT]);
+		int			cmp;
+
+		if (left == NULL || right == NULL)
+			break;
+
+		cmp = CompareInputKeys(&keys, &inputs[JOIN_LEFT], left, &inputs[JOIN_RIGHT], right);
+		if (cmp < 0)
+			inputs[JOIN_LEFT].next++;
+		else if (cmp > 0)
+			inputs[JOIN_RIGHT].next++;
+		else
+			SweepJoinKey(&keys, inputs);
+	}
+
+	for (side = JOIN_LEFT; side <= JOIN_RIGHT; side++)
+		SPI_cursor_close(inputs[side].portal);
+
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+static void
+EndHeapPush(TimelineKeys *keys, EndHeap *heap, Datum end)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(keys->key_context);
+	int			i;
+
+	if (heap->nends == heap->maxends)
+	{
+		heap->maxends = (heap->maxends == 0) ? 8 : heap->maxends * 2;
+		if (heap->ends == NULL)
+			heap->ends = (Datum *) palloc(heap->maxends * sizeof(Datum));
+		else
+			heap->ends = (Datum *) repalloc(heap->ends, heap->maxends * sizeof(Datum));
+	}
+
+	end = datumCopy(end, keys->bounds_typbyval, keys->bounds_typlen);
+	MemoryContextSwitchTo(oldcontext);
+
+	/* Sift up */
+	i = heap->nends++;
+	while (i > 0)
+	{
+		int			parent = (i - 1) / 2;
+
+		if (CompareBounds(keys, heap->ends[parent], end) <= 0)
+			break;
+		heap->ends[i] = heap->ends[parent];
+		i = parent;
+	}
+	heap->ends[i] = end;
+}
+
+/* Remove the earliest end and return it, which the caller must free */
+static Datum
+EndHeapPop(TimelineKeys *keys, EndHeap *heap)
+{
+	Datum		result = heap->ends[0];
+	Datum		last = heap->ends[--heap->nends];
+	int			i = 0;
+
+	/* Sift the last end down from the top */
+	for (;;)
+	{
+		int			child = 2 * i + 1;
+
+		if (child >= heap->nends)
+			break;
+		if (child + 1 < heap->nends &&
+			CompareBounds(keys, heap->ends[child + 1], heap->ends[child]) < 0)
+			child++;
+		if (CompareBounds(keys, last, heap->ends[child]) <= 0)
+			break;
+		heap->ends[i] = heap->ends[child];
+		i = child;
+	}
+	if (heap->nends > 0)
+		heap->ends[i] = last;
+
+	return result;
+}
+
+/*
+ * Cut the timeline of the key of the given input's next row at every start
+ * and end of its rows in any of the inputs, from the first start to the last
+ * end.
+ */
+static void
+SegmentKey(TimelineKeys *keys, TimelineInput *inputs, int ninputs, int first)
+{
+	EndHeap		heap;
+	Datum		last = (Datum) 0;
+	bool		have_last = false;
+	Datum	   *values = (Datum *) palloc((keys->nkeys + 2) * sizeof(Datum));
+	bool	   *nulls = (bool *) palloc0((keys->nkeys + 2) * sizeof(bool));
+	int			i;
+
+	StartKey(keys, &inputs[first], InputPeek(&inputs[first]));
+	memset(&heap, 0, sizeof(heap));
+
+	for (i = 0; i < keys->nkeys; i++)
+		values[i] = keys->key[i];
+
+	for (;;)
+	{
+		int			next = -1;
+		Datum		next_start = (Datum) 0;
+		Datum		point;
+		bool		popped;
+
+		/* The earliest start of the next rows of this key */
+		for (i = 0; i < ninputs; i++)
+		{
+			HeapTuple	tuple = InputPeek(&inputs[i]);
+			Datum		start;
+
+			if (tuple == NULL || !IsMergedKey(keys, &inputs[i], tuple))
+				continue;
+
+			start = InputGetDatum(&inputs[i], tuple, keys->nkeys + 1);
+			if (next < 0 || CompareBounds(keys, start, next_start) < 0)
+			{
+				next = i;
+				next_start = start;
+			}
+		}
+
+		if (next < 0 && heap.nends == 0)
+			break;
+
+		/* The start stays valid until the next InputPeek() of its input */
+		popped = (next < 0 || CompareBounds(keys, heap.ends[0], next_start) < 0);
+		if (popped)
+			point = EndHeapPop(keys, &heap);
+		else
+		{
+			HeapTuple	tuple = InputPeek(&inputs[next]);
+
+			point = next_start;
+			EndHeapPush(keys, &heap, InputGetDatum(&inputs[next], tuple, keys->nkeys + 2));
+			inputs[next].next++;
+		}
+
+		if (!have_last || CompareBounds(keys, last, point) < 0)
+		{
+			MemoryContext oldcontext;
+
+			if (have_last)
+			{
+				values[keys->nkeys] = last;
+				values[keys->nkeys + 1] = point;
+				tuplestore_putvalues(keys->tupstore, keys->tupdesc, values, nulls);
+				FreeBound(keys, last);
+			}
+
+			oldcontext = MemoryContextSwitchTo(keys->key_context);
+			last = datumCopy(point, keys->bounds_typbyval, keys->bounds_typlen);
+			MemoryContextSwitchTo(oldcontext);
+			have_last = true;
+		}
+
+		if (popped)
+			FreeBound(keys, point);
+	}
+
+	pfree(values);
+	pfree(nulls);
+}
+
+/*
+ * timeline_segments(table_names regclass[], key_column_names name[], era_names name[]) -
+ * Returns (key, start, end) for the segments between consecutive starts and
+ * ends of the rows of each key in all of the tables, ordered by key and
+ * start.  key_column_names has a row of key columns for each table, or one
+ * column per table.
+ */
+Datum
+timeline_segments(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	ArrayType  *table_array = PG_GETARG_ARRAYTYPE_P(0);
+	ArrayType  *column_array = PG_GETARG_ARRAYTYPE_P(1);
+	Datum	   *table_datums;
+	bool	   *table_nulls;
+	int			ntables;
+	Oid		   *relids;
+	char	  **all_column_names;
+	int			ncolumns;
+	char	  ***column_names;
+	int			nkeys;
+	char	  **era_names;
+	int			neras;
+	TimelineKeys keys;
+	TimelineInput *inputs;
+	TupleDesc	tupdesc;
+	int			t;
+	int			i;
+
+	CheckMaterializeMode(rsinfo);
+
+	deconstruct_array(table_array, REGCLASSOID, sizeof(Oid), true, 'i',
+					  &table_datums, &table_nulls, &ntables);
+	ncolumns = GetNameArray(PG_GETARG_DATUM(1), &all_column_names);
+	neras = GetNameArray(PG_GETARG_DATUM(2), &era_names);
+
+	if (ntables < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("at least one table is required")));
+
+	if (ARR_NDIM(column_array) == 1 && ncolumns == ntables)
+		nkeys = 1;
+	else if (ARR_NDIM(column_array) == 2 && ARR_DIMS(column_array)[0] == ntables)
+		nkeys = ARR_DIMS(column_array)[1];
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("key_column_names must have a row of key columns for each table")));
+
+	if (nkeys < 1 || nkeys > INDEX_MAX_KEYS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("the keys must have between 1 and %d columns", INDEX_MAX_KEYS)));
+
+	if (neras != ntables)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("era_names must have an era for each table")));
+
+	relids = (Oid *) palloc(ntables * sizeof(Oid));
+	column_names = (char ***) palloc(ntables * sizeof(char **));
+	for (t = 0; t < ntables; t++)
+	{
+		if (table_nulls[t])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("table_names must not contain nulls")));
+
+		relids[t] = DatumGetObjectId(table_datums[t]);
+		column_names[t] = &all_column_names[t * nkeys];
+	}
+
+	memset(&keys, 0, sizeof(keys));
+	SetupKeys(&keys, ntables, relids, column_names, nkeys, era_names);
+
+	/* The column definition list gives the names, but we check the types */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != nkeys + 2 ||
+		TupleDescAttr(tupdesc, nkeys)->atttypid != keys.bounds_type ||
+		TupleDescAttr(tupdesc, nkeys + 1)->atttypid != keys.bounds_type)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("the column definition list of timeline_segments must have the key columns followed by two columns of type %s",
+						format_type_be(keys.bounds_type))));
+	for (i = 0; i < nkeys; i++)
+	{
+		if (TupleDescAttr(tupdesc, i)->atttypid != keys.key_types[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column %d of the column definition list of timeline_segments must have type %s",
+							i + 1, format_type_be(keys.key_types[i]))));
+	}
+
+	StartResult(&keys, rsinfo, tupdesc);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	keys.key_context = AllocSetContextCreate(CurrentMemoryContext,
+											 "timeline_segments key",
+											 ALLOCSET_DEFAULT_SIZES);
+
+	inputs = (TimelineInput *) palloc(ntables * sizeof(TimelineInput));
+	for (t = 0; t < ntables; t++)
+		OpenInput(&inputs[t], relids[t], nkeys, column_names[t], era_names[t], false);
+
+	/* Take the keys in order from all the inputs */
+	for (;;)
+	{
+		int			first = -1;
+		HeapTuple	first_tuple = NULL;
+
+		for (t = 0; t < ntables; t++)
+		{
+			HeapTuple	tuple = InputPeek(&inputs[t]);
+
+			if (tuple == NULL)
+				continue;
+			if (first < 0 ||
+				CompareInputKeys(&keys, &inputs[t], tuple, &inputs[first], first_tuple) < 0)
+			{
+				first = t;
+				first_tuple = tuple;
+			}
+		}
+
+		if (first < 0)
+			break;
+
+		SegmentKey(&keys, inputs, ntables, first);
+	}
+
+	for (t = 0; t < ntables; t++)
+		SPI_cursor_close(inputs[t].portal);
+
+	SPI_finish();
+
+	return (Datum) 0;
+}